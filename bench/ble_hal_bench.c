@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "ble_hal.h"
+#include "mock_bluez.h"
+
+/*
+ * Throughput and latency benchmark against a mock BlueZ.
+ *
+ * A private dbus-daemon (GTestDBus) stands in for the system bus, unless
+ * --bus-address names one. The mock owns org.bluez there and the HAL is
+ * pointed at it through DBUS_SYSTEM_BUS_ADDRESS. Phases:
+ *
+ *  - startup: ble_hal_init_async() until ready, with --devices objects in
+ *    GetManagedObjects
+ *  - InterfacesAdded: --signals new devices at --rate; latency is the
+ *    signal's send time to BLE_HAL_EVENT_DEVICE_ADDED
+ *  - PropertiesChanged: --signals RSSI/ManufacturerData changes at --rate;
+ *    latency is the send time carried in ManufacturerData to the
+ *    advertisement batch callback (coalesced updates count once)
+ *  - Properties.Set: --calls sequential ble_hal_set_adapter_power() calls
+ *
+ * Exits non-zero if a phase does not complete, so it can gate regressions.
+ */
+
+#define BENCH_STALL_TIMEOUT_MS  5000    // A phase fails after this long without progress
+
+typedef struct {
+    guint n_devices;
+    guint n_signals;
+    guint rate;
+    guint n_calls;
+    guint reply_latency_ms;
+    guint batch_interval_ms;
+    gboolean event_thread;
+    gboolean adapter_threads;
+    const gchar* bus_address;
+} BenchOptions;
+
+typedef struct {
+    GArray* samples_us;             // gint64 latencies of the running phase
+    guint received;
+    gint64 last_received_us;
+    gboolean ready;
+    BleHalStatus ready_status;
+    guint set_issued;
+    guint set_done;
+    gint64 set_started_us;
+} BenchState;
+
+static MockBluez* mock = NULL;
+static BenchState state;
+
+// --- Measurements ---
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64*)a, y = *(const gint64*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const gchar* label, GArray* samples) {
+    if (samples->len == 0) {
+        printf("  %-20s no samples\n", label);
+        return;
+    }
+    g_array_sort(samples, compare_gint64);
+    gint64* v = (gint64*)samples->data;
+    guint n = samples->len;
+    printf("  %-20s p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  max %.3f ms  (%u samples)\n", label,
+           v[n / 2] / 1000.0, v[(guint)(n * 0.90)] / 1000.0, v[MIN((guint)(n * 0.99), n - 1)] / 1000.0,
+           v[n - 1] / 1000.0, n);
+}
+
+/**
+ * @brief Resident set size and its peak in KiB, from /proc/self/status.
+ */
+static void read_rss(guint* rss_kib, guint* peak_kib) {
+    gchar* status = NULL;
+    *rss_kib = *peak_kib = 0;
+    if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL)) return;
+
+    const gchar* line;
+    if ((line = strstr(status, "VmRSS:"))) *rss_kib = (guint)strtoul(line + 6, NULL, 10);
+    if ((line = strstr(status, "VmHWM:"))) *peak_kib = (guint)strtoul(line + 6, NULL, 10);
+    g_free(status);
+}
+
+static void print_rss(const gchar* label) {
+    guint rss, peak;
+    read_rss(&rss, &peak);
+    printf("  %-20s RSS %.1f MiB (peak %.1f MiB)\n", label, rss / 1024.0, peak / 1024.0);
+}
+
+static void phase_begin(void) {
+    g_array_set_size(state.samples_us, 0);
+    state.received = 0;
+    state.last_received_us = 0;
+}
+
+// --- HAL Callbacks ---
+
+static void bench_global_event_cb(BleHalEvent event_type, BleHalEventData* data, void* user_data) {
+    if (event_type != BLE_HAL_EVENT_DEVICE_ADDED || !mock) return;
+
+    const BleHalDeviceInfo* info = (const BleHalDeviceInfo*)data->data;
+    gint index = mock_bluez_device_index(info->address.b);
+    gint64 sent_us = index >= 0 ? mock_bluez_added_sent_us(mock, (guint)index) : 0;
+    if (sent_us == 0) return; // Listed from the start
+
+    gint64 now = g_get_monotonic_time();
+    gint64 latency = now - sent_us;
+    g_array_append_val(state.samples_us, latency);
+    state.received++;
+    state.last_received_us = now;
+}
+
+/**
+ * @brief Send time the mock put into ManufacturerData, or 0.
+ */
+static gint64 adv_sent_us(const BleHalAdvUpdate* update) {
+    BleHalAdvData entry;
+    gint64 sent_us = 0;
+
+    if (ble_hal_adv_get_manufacturer_data(update, MOCK_BLUEZ_MANUFACTURER_ID, &entry) &&
+        entry.length == sizeof(sent_us)) {
+        memcpy(&sent_us, entry.data, sizeof(sent_us));
+    }
+    return sent_us;
+}
+
+static void bench_adv_batch_cb(const BleHalAdvUpdate* updates, guint n_updates, void* user_data) {
+    gint64 now = g_get_monotonic_time();
+
+    for (guint i = 0; i < n_updates; i++) {
+        gint64 sent_us = adv_sent_us(&updates[i]);
+        if (sent_us == 0) continue;
+
+        gint64 latency = now - sent_us;
+        g_array_append_val(state.samples_us, latency);
+        state.received++;
+        state.last_received_us = now;
+    }
+}
+
+static void bench_ready_cb(BleHalStatus status, void* user_data) {
+    state.ready = TRUE;
+    state.ready_status = status;
+}
+
+static void bench_set_power_cb(BleHalStatus status, void* user_data) {
+    gint64 now = g_get_monotonic_time();
+    gint64 latency = now - state.set_started_us;
+
+    g_array_append_val(state.samples_us, latency);
+    state.set_done++;
+    state.received += status == BLE_HAL_SUCCESS;
+    state.last_received_us = now;
+}
+
+// --- Driving the Loop ---
+
+static gboolean wake_cb(gpointer user_data) {
+    return G_SOURCE_CONTINUE; // Only makes the blocking iteration return
+}
+
+/**
+ * @brief Iterates the default context until 'done' holds. Fails once nothing
+ * has been received for BENCH_STALL_TIMEOUT_MS.
+ */
+static gboolean run_until(gboolean (*done)(void)) {
+    guint wake_id = g_timeout_add(10, wake_cb, NULL);
+    gint64 progress_us = g_get_monotonic_time();
+    guint seen = state.received;
+    gboolean ok = TRUE;
+
+    while (!done()) {
+        g_main_context_iteration(NULL, TRUE);
+        gint64 now = g_get_monotonic_time();
+        if (state.received != seen || (mock && mock_bluez_flood_running(mock))) {
+            seen = state.received;
+            progress_us = now;
+        } else if (now - progress_us > (gint64)BENCH_STALL_TIMEOUT_MS * 1000) {
+            ok = FALSE;
+            break;
+        }
+    }
+    g_source_remove(wake_id);
+    return ok;
+}
+
+static gboolean is_ready(void) {
+    return state.ready;
+}
+
+static guint expected = 0;
+
+static gboolean all_received(void) {
+    return state.received >= expected;
+}
+
+/**
+ * @brief PropertiesChanged updates of one device coalesce, so the flood is
+ * done once the mock is finished and batches have gone quiet.
+ */
+static gboolean flood_drained(void) {
+    if (mock_bluez_flood_running(mock) || state.last_received_us == 0) return FALSE;
+    return g_get_monotonic_time() - state.last_received_us > 200 * 1000;
+}
+
+// --- Phases ---
+
+static gboolean bench_startup(const BenchOptions* options) {
+    BleHalConfig config;
+
+    memset(&config, 0, sizeof(config));
+    config.global_event_cb = bench_global_event_cb;
+    config.adv_batch_cb = bench_adv_batch_cb;
+    config.adv_batch_interval_ms = options->batch_interval_ms;
+    config.use_event_thread = options->event_thread;
+    config.use_adapter_threads = options->adapter_threads;
+    config.log_level = BLE_HAL_LOG_WARN;
+
+    gint64 started_us = g_get_monotonic_time();
+    BleHalStatus status = ble_hal_init_async(&config, NULL, bench_ready_cb, NULL);
+    if (status != BLE_HAL_SUCCESS && status != BLE_HAL_PENDING) {
+        fprintf(stderr, "bench: ble_hal_init_async failed (%d)\n", status);
+        return FALSE;
+    }
+    if (!run_until(is_ready) || state.ready_status != BLE_HAL_SUCCESS) {
+        fprintf(stderr, "bench: HAL did not become ready (%d)\n", state.ready_status);
+        return FALSE;
+    }
+
+    gint64 elapsed_us = g_get_monotonic_time() - started_us;
+    printf("startup\n");
+    printf("  %-20s %.1f ms (%u of %u devices)\n", "ready after", elapsed_us / 1000.0,
+           ble_hal_get_device_count(), options->n_devices);
+    print_rss("after startup");
+    return ble_hal_get_device_count() == options->n_devices;
+}
+
+static void print_throughput(guint count, const gchar* unit) {
+    gint64 elapsed_us = state.last_received_us - mock_bluez_flood_started_us(mock);
+    printf("  %-20s %u %s in %.1f ms, %.0f signals/s\n", "delivered", count, unit, elapsed_us / 1000.0,
+           elapsed_us > 0 ? mock_bluez_flood_sent(mock) * 1e6 / elapsed_us : 0.0);
+}
+
+static gboolean bench_added_flood(const BenchOptions* options) {
+    printf("InterfacesAdded flood\n");
+    phase_begin();
+    expected = options->n_signals;
+    mock_bluez_flood(mock, MOCK_BLUEZ_FLOOD_ADDED, options->n_signals, options->rate);
+
+    gboolean ok = run_until(all_received);
+    print_throughput(state.received, "devices");
+    print_latency("signal to event", state.samples_us);
+    if (!ok) fprintf(stderr, "bench: only %u of %u devices arrived\n", state.received, expected);
+    return ok;
+}
+
+static gboolean bench_properties_flood(const BenchOptions* options) {
+    printf("PropertiesChanged flood\n");
+    phase_begin();
+    mock_bluez_flood(mock, MOCK_BLUEZ_FLOOD_PROPERTIES, options->n_signals, options->rate);
+
+    gboolean ok = run_until(flood_drained);
+    print_throughput(state.received, "coalesced updates");
+    print_latency("signal to batch", state.samples_us);
+    if (!ok) fprintf(stderr, "bench: PropertiesChanged flood stalled after %u updates\n", state.received);
+    return ok;
+}
+
+/**
+ * @brief Sends the next call once the previous one has been answered.
+ */
+static gboolean next_set_or_done(void) {
+    if (state.set_done >= expected) return TRUE;
+    if (state.set_issued == state.set_done) {
+        state.set_issued++;
+        state.set_started_us = g_get_monotonic_time();
+        ble_hal_set_adapter_power(MOCK_BLUEZ_ADAPTER_PATH, TRUE, bench_set_power_cb, NULL);
+    }
+    return FALSE;
+}
+
+static gboolean bench_set_calls(const BenchOptions* options) {
+    printf("Properties.Set calls (reply latency %u ms)\n", options->reply_latency_ms);
+    phase_begin();
+    state.set_issued = 0;
+    state.set_done = 0;
+    expected = options->n_calls;
+
+    gboolean ok = run_until(next_set_or_done);
+    printf("  %-20s %u of %u succeeded\n", "calls", state.received, state.set_done);
+    print_latency("call to result", state.samples_us);
+    return ok && state.received == options->n_calls;
+}
+
+static void print_hal_stats(void) {
+    BleHalStats stats;
+    ble_hal_get_stats(&stats);
+
+    printf("HAL counters\n");
+    printf("  %-20s %u commands, %u events, %u waiting / %u in-flight requests\n", "peak depth",
+           stats.commands.peak, stats.events.peak, stats.requests_waiting.peak, stats.requests_in_flight.peak);
+    printf("  %-20s %u\n", "events dropped", stats.events_dropped);
+    const BleHalLatencyStats* scan = &stats.methods[BLE_HAL_STATS_METHOD_GET_MANAGED_OBJECTS];
+    if (scan->count) {
+        printf("  %-20s %.1f ms\n", "GetManagedObjects", scan->max_us / 1000.0);
+    }
+    const gchar* signal_names[BLE_HAL_STATS_N_SIGNALS] = {
+        "InterfacesAdded", "InterfacesRemoved", "Adapter props", "Device props", "mgmt reports"
+    };
+    for (guint i = 0; i < BLE_HAL_STATS_N_SIGNALS; i++) {
+        const BleHalLatencyStats* s = &stats.signals[i];
+        if (s->count == 0) continue;
+        printf("  %-20s %llu handled, avg %.1f us, max %llu us\n", signal_names[i], (unsigned long long)s->count,
+               (double)s->total_us / s->count, (unsigned long long)s->max_us);
+    }
+}
+
+// --- Main ---
+
+static gboolean parse_options(int argc, char* argv[], BenchOptions* options) {
+    options->n_devices = 2000;
+    options->n_signals = 20000;
+    options->rate = 20000;
+    options->n_calls = 200;
+    options->reply_latency_ms = 0;
+    options->batch_interval_ms = 10;
+    options->event_thread = FALSE;
+    options->adapter_threads = FALSE;
+    options->bus_address = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const gchar* arg = argv[i];
+        const gchar* value = i + 1 < argc ? argv[i + 1] : NULL;
+        guint* number = NULL;
+
+        if (strcmp(arg, "--devices") == 0) number = &options->n_devices;
+        else if (strcmp(arg, "--signals") == 0) number = &options->n_signals;
+        else if (strcmp(arg, "--rate") == 0) number = &options->rate;           // 0: unthrottled
+        else if (strcmp(arg, "--calls") == 0) number = &options->n_calls;
+        else if (strcmp(arg, "--reply-latency-ms") == 0) number = &options->reply_latency_ms;
+        else if (strcmp(arg, "--batch-ms") == 0) number = &options->batch_interval_ms;
+        else if (strcmp(arg, "--event-thread") == 0) options->event_thread = TRUE;
+        else if (strcmp(arg, "--adapter-threads") == 0) options->adapter_threads = TRUE;
+        else if (strcmp(arg, "--bus-address") == 0 && value) options->bus_address = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--devices N] [--signals N] [--rate N] [--calls N] [--reply-latency-ms N]\n"
+                            "       [--batch-ms N] [--event-thread] [--adapter-threads] [--bus-address ADDR]\n",
+                    argv[0]);
+            return FALSE;
+        }
+
+        if (number) {
+            if (!value) return FALSE;
+            *number = (guint)strtoul(argv[++i], NULL, 10);
+        }
+    }
+    return TRUE;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    GTestDBus* test_bus = NULL;
+    GError* error = NULL;
+    gboolean ok = FALSE;
+
+    if (!parse_options(argc, argv, &options)) return 2;
+
+    const gchar* bus_address = options.bus_address;
+    if (!bus_address) {
+        test_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+        g_test_dbus_up(test_bus);
+        bus_address = g_test_dbus_get_bus_address(test_bus);
+    }
+    // The HAL talks to the system bus; make that the private one.
+    g_setenv("DBUS_SYSTEM_BUS_ADDRESS", bus_address, TRUE);
+
+    printf("ble_hal_bench: %u devices, %u signals per flood at %u/s, %u calls, reply latency %u ms, %s mode\n",
+           options.n_devices, options.n_signals, options.rate, options.n_calls, options.reply_latency_ms,
+           options.adapter_threads ? "adapter-thread" : options.event_thread ? "event-thread" : "inline");
+    print_rss("baseline");
+
+    MockBluezConfig mock_config = { options.n_devices, options.reply_latency_ms };
+    mock = mock_bluez_start(bus_address, &mock_config, &error);
+    if (!mock) {
+        fprintf(stderr, "bench: mock BlueZ failed to start: %s\n", error->message);
+        g_error_free(error);
+        goto out;
+    }
+
+    state.samples_us = g_array_new(FALSE, FALSE, sizeof(gint64));
+    ok = bench_startup(&options) &&
+         bench_added_flood(&options) &&
+         bench_properties_flood(&options) &&
+         bench_set_calls(&options);
+    print_hal_stats();
+    print_rss("at exit");
+
+    ble_hal_deinit();
+    mock_bluez_stop(mock);
+    mock = NULL;
+    g_array_free(state.samples_us, TRUE);
+
+out:
+    if (test_bus) {
+        g_test_dbus_down(test_bus);
+        g_object_unref(test_bus);
+    }
+    printf("ble_hal_bench: %s\n", ok ? "done" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <string.h>
+#include "mock_bluez.h"
+
+/*
+ * Fake org.bluez.
+ *
+ * Everything below runs on the mock's own GMainContext and thread, except
+ * the accessors, which only read fields written with atomic stores. "/" is a
+ * regular object carrying the ObjectManager; the adapter and its devices are
+ * served from two subtrees, so devices need no registration of their own.
+ * Properties.Set reaches method_call() because the vtables leave
+ * set_property NULL, which lets every reply go through the same delay.
+ */
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg type='a{oa{sa{sv}}}' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.Adapter1'>"
+    "    <method name='StartDiscovery'/>"
+    "    <method name='StopDiscovery'/>"
+    "    <method name='SetDiscoveryFilter'>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <property name='Powered' type='b' access='readwrite'/>"
+    "  </interface>"
+    "  <interface name='org.bluez.Device1'>"
+    "    <method name='Connect'/>"
+    "    <method name='Disconnect'/>"
+    "  </interface>"
+    "</node>";
+
+struct _MockBluez {
+    GThread* thread;
+    GMainContext* context;
+    GMainLoop* loop;
+    GDBusConnection* conn;
+    GDBusNodeInfo* node_info;
+    guint object_id;
+    guint adapter_subtree_id;
+    guint device_subtree_id;
+    gchar* bus_address;
+    guint reply_latency_ms;
+
+    volatile guint n_devices;       // Devices that exist (listed or announced)
+    gint64* added_sent_us;          // Per device index; grown by mock_bluez_flood() between floods
+    guint added_capacity;
+
+    // Current flood (mock thread, except the atomics)
+    MockBluezFlood flood_kind;
+    guint flood_total;
+    guint flood_rate;
+    volatile guint flood_sent;
+    volatile gint64 flood_started_us;
+    volatile gint flood_active;
+
+    // Startup hand-shake
+    GMutex mutex;
+    GCond cond;
+    gboolean started;
+    GError* start_error;
+};
+
+// --- Addresses ---
+
+void mock_bluez_device_address(guint index, gchar address[18]) {
+    g_snprintf(address, 18, "10:00:00:%02X:%02X:%02X", (index >> 16) & 0xff, (index >> 8) & 0xff, index & 0xff);
+}
+
+gint mock_bluez_device_index(const guint8* address) {
+    if (address[0] != 0x10 || address[1] != 0 || address[2] != 0) return -1;
+    return (address[3] << 16) | (address[4] << 8) | address[5];
+}
+
+static gchar* device_path(guint index) {
+    return g_strdup_printf(MOCK_BLUEZ_ADAPTER_PATH "/dev_10_00_00_%02X_%02X_%02X",
+                           (index >> 16) & 0xff, (index >> 8) & 0xff, index & 0xff);
+}
+
+// --- Objects ---
+
+static GVariant* adapter_properties(void) {
+    GVariantBuilder props;
+    g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&props, "{sv}", "Address", g_variant_new_string("00:AA:BB:CC:DD:EE"));
+    g_variant_builder_add(&props, "{sv}", "Name", g_variant_new_string("mock-hci0"));
+    g_variant_builder_add(&props, "{sv}", "Powered", g_variant_new_boolean(TRUE));
+    g_variant_builder_add(&props, "{sv}", "Discovering", g_variant_new_boolean(FALSE));
+    g_variant_builder_add(&props, "{sv}", "Discoverable", g_variant_new_boolean(FALSE));
+    g_variant_builder_add(&props, "{sv}", "Pairable", g_variant_new_boolean(TRUE));
+    return g_variant_builder_end(&props);
+}
+
+static GVariant* device_properties(guint index) {
+    gchar address[18];
+    gchar name[32];
+    GVariantBuilder props;
+
+    mock_bluez_device_address(index, address);
+    g_snprintf(name, sizeof(name), "bench-%u", index);
+    g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&props, "{sv}", "Address", g_variant_new_string(address));
+    g_variant_builder_add(&props, "{sv}", "AddressType", g_variant_new_string("public"));
+    g_variant_builder_add(&props, "{sv}", "Name", g_variant_new_string(name));
+    g_variant_builder_add(&props, "{sv}", "Adapter", g_variant_new_object_path(MOCK_BLUEZ_ADAPTER_PATH));
+    g_variant_builder_add(&props, "{sv}", "RSSI", g_variant_new_int16(-60));
+    g_variant_builder_add(&props, "{sv}", "Paired", g_variant_new_boolean(FALSE));
+    g_variant_builder_add(&props, "{sv}", "Connected", g_variant_new_boolean(FALSE));
+    return g_variant_builder_end(&props);
+}
+
+static GVariant* interfaces_entry(const gchar* interface, GVariant* properties) {
+    GVariantBuilder interfaces;
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(&interfaces, "{s@a{sv}}", interface, properties);
+    return g_variant_builder_end(&interfaces);
+}
+
+static GVariant* managed_objects(MockBluez* mock) {
+    GVariantBuilder objects;
+    guint n = g_atomic_int_get(&mock->n_devices);
+
+    g_variant_builder_init(&objects, G_VARIANT_TYPE("(a{oa{sa{sv}}})"));
+    g_variant_builder_open(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+    g_variant_builder_add(&objects, "{o@a{sa{sv}}}", MOCK_BLUEZ_ADAPTER_PATH,
+                          interfaces_entry("org.bluez.Adapter1", adapter_properties()));
+    for (guint i = 0; i < n; i++) {
+        gchar* path = device_path(i);
+        g_variant_builder_add(&objects, "{o@a{sa{sv}}}", path, interfaces_entry("org.bluez.Device1", device_properties(i)));
+        g_free(path);
+    }
+    g_variant_builder_close(&objects);
+    return g_variant_builder_end(&objects);
+}
+
+// --- Method Calls ---
+
+typedef struct {
+    GDBusMethodInvocation* invocation;
+    GVariant* reply;
+} DelayedReply;
+
+static gboolean delayed_reply_cb(gpointer user_data) {
+    DelayedReply* delayed = (DelayedReply*)user_data;
+    g_dbus_method_invocation_return_value(delayed->invocation, delayed->reply);
+    g_free(delayed);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Sends 'reply' (floating, may be NULL for "()") now or after the configured delay.
+ */
+static void reply_later(MockBluez* mock, GDBusMethodInvocation* invocation, GVariant* reply) {
+    if (mock->reply_latency_ms == 0) {
+        g_dbus_method_invocation_return_value(invocation, reply);
+        return;
+    }
+
+    DelayedReply* delayed = g_new0(DelayedReply, 1);
+    delayed->invocation = invocation;   // Kept alive until answered
+    delayed->reply = reply;
+    GSource* source = g_timeout_source_new(mock->reply_latency_ms);
+    g_source_set_callback(source, delayed_reply_cb, delayed, NULL);
+    g_source_attach(source, mock->context);
+    g_source_unref(source);
+}
+
+static void method_call(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                        const gchar* interface_name, const gchar* method_name, GVariant* parameters,
+                        GDBusMethodInvocation* invocation, gpointer user_data) {
+    MockBluez* mock = (MockBluez*)user_data;
+
+    if (strcmp(method_name, "GetManagedObjects") == 0) {
+        reply_later(mock, invocation, managed_objects(mock));
+    } else if (strcmp(interface_name, "org.freedesktop.DBus.Properties") == 0 && strcmp(method_name, "Set") != 0) {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotSupported",
+                                                   "Only Properties.Set is mocked");
+    } else {
+        // Properties.Set and every Adapter1/Device1 method succeed.
+        reply_later(mock, invocation, NULL);
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = { method_call, NULL, NULL, { 0 } };
+
+static gchar** subtree_enumerate(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                                 gpointer user_data) {
+    return g_new0(gchar*, 1); // Nodes are dispatched without being listed
+}
+
+static GDBusInterfaceInfo** subtree_introspect(GDBusConnection* connection, const gchar* sender,
+                                               const gchar* object_path, const gchar* node, gpointer user_data) {
+    MockBluez* mock = (MockBluez*)user_data;
+    const gchar* interface = NULL;
+
+    if (node && strcmp(object_path, "/org/bluez") == 0 && strcmp(node, "hci0") == 0) {
+        interface = "org.bluez.Adapter1";
+    } else if (node && strcmp(object_path, MOCK_BLUEZ_ADAPTER_PATH) == 0 && g_str_has_prefix(node, "dev_")) {
+        interface = "org.bluez.Device1";
+    }
+    if (!interface) return NULL;
+
+    GDBusInterfaceInfo** infos = g_new0(GDBusInterfaceInfo*, 2);
+    infos[0] = g_dbus_interface_info_ref(g_dbus_node_info_lookup_interface(mock->node_info, interface));
+    return infos;
+}
+
+static const GDBusInterfaceVTable* subtree_dispatch(GDBusConnection* connection, const gchar* sender,
+                                                    const gchar* object_path, const gchar* interface_name,
+                                                    const gchar* node, gpointer* out_user_data,
+                                                    gpointer user_data) {
+    *out_user_data = user_data;
+    return &interface_vtable;
+}
+
+static const GDBusSubtreeVTable subtree_vtable = { subtree_enumerate, subtree_introspect, subtree_dispatch, { 0 } };
+
+// --- Floods ---
+
+static void emit_added(MockBluez* mock, gint64 now) {
+    guint index = g_atomic_int_get(&mock->n_devices);
+    gchar* path = device_path(index);
+
+    __atomic_store_n(&mock->added_sent_us[index], now, __ATOMIC_RELAXED);
+    g_dbus_connection_emit_signal(mock->conn, NULL, "/", "org.freedesktop.DBus.ObjectManager", "InterfacesAdded",
+                                  g_variant_new("(o@a{sa{sv}})", path,
+                                                interfaces_entry("org.bluez.Device1", device_properties(index))),
+                                  NULL);
+    g_atomic_int_set(&mock->n_devices, index + 1);
+    g_free(path);
+}
+
+static void emit_properties(MockBluez* mock, guint sequence, gint64 now) {
+    guint n = g_atomic_int_get(&mock->n_devices);
+    gchar* path = device_path(sequence % n);
+    GVariantBuilder changed;
+    GVariantBuilder manufacturer;
+
+    g_variant_builder_init(&manufacturer, G_VARIANT_TYPE("a{qv}"));
+    g_variant_builder_add(&manufacturer, "{qv}", (guint16)MOCK_BLUEZ_MANUFACTURER_ID,
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &now, sizeof(now), 1));
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "RSSI", g_variant_new_int16((gint16)(-40 - (gint)(sequence % 50))));
+    g_variant_builder_add(&changed, "{sv}", "ManufacturerData", g_variant_builder_end(&manufacturer));
+
+    g_dbus_connection_emit_signal(mock->conn, NULL, path, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", "org.bluez.Device1", &changed, NULL), NULL);
+    g_free(path);
+}
+
+/**
+ * @brief Emits whatever the flood owes by now: the rate's share of the
+ * elapsed time, or a fixed slice per pass when unthrottled.
+ */
+static gboolean flood_tick_cb(gpointer user_data) {
+    MockBluez* mock = (MockBluez*)user_data;
+    gint64 now = g_get_monotonic_time();
+    guint sent = mock->flood_sent;
+    guint due = mock->flood_total;
+
+    if (mock->flood_rate) {
+        guint64 owed = (guint64)(now - mock->flood_started_us) * mock->flood_rate / G_USEC_PER_SEC + 1;
+        due = (guint)MIN(owed, (guint64)mock->flood_total);
+    } else {
+        due = MIN(sent + 256, mock->flood_total);
+    }
+
+    for (; sent < due; sent++) {
+        now = g_get_monotonic_time();
+        if (mock->flood_kind == MOCK_BLUEZ_FLOOD_ADDED) {
+            emit_added(mock, now);
+        } else {
+            emit_properties(mock, sent, now);
+        }
+        g_atomic_int_set(&mock->flood_sent, sent + 1);
+    }
+
+    if (sent < mock->flood_total) return G_SOURCE_CONTINUE;
+    g_dbus_connection_flush_sync(mock->conn, NULL, NULL);
+    g_atomic_int_set(&mock->flood_active, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean flood_start_cb(gpointer user_data) {
+    MockBluez* mock = (MockBluez*)user_data;
+    GSource* source = mock->flood_rate ? g_timeout_source_new(1) : g_idle_source_new();
+
+    __atomic_store_n(&mock->flood_started_us, g_get_monotonic_time(), __ATOMIC_RELAXED);
+    g_source_set_callback(source, flood_tick_cb, mock, NULL);
+    g_source_attach(source, mock->context);
+    g_source_unref(source);
+    return G_SOURCE_REMOVE;
+}
+
+void mock_bluez_flood(MockBluez* mock, MockBluezFlood kind, guint count, guint rate) {
+    g_return_if_fail(!g_atomic_int_get(&mock->flood_active));
+
+    if (kind == MOCK_BLUEZ_FLOOD_ADDED) {
+        // Nothing reads the array while no flood runs, so it can move now.
+        guint needed = g_atomic_int_get(&mock->n_devices) + count;
+        if (needed > mock->added_capacity) {
+            mock->added_sent_us = g_renew(gint64, mock->added_sent_us, needed);
+            memset(mock->added_sent_us + mock->added_capacity, 0,
+                   (needed - mock->added_capacity) * sizeof(gint64));
+            mock->added_capacity = needed;
+        }
+    } else if (g_atomic_int_get(&mock->n_devices) == 0) {
+        return; // No device to change
+    }
+
+    mock->flood_kind = kind;
+    mock->flood_total = count;
+    mock->flood_rate = rate;
+    g_atomic_int_set(&mock->flood_sent, 0);
+    g_atomic_int_set(&mock->flood_active, count > 0);
+    if (count > 0) {
+        g_main_context_invoke(mock->context, flood_start_cb, mock);
+    }
+}
+
+gboolean mock_bluez_flood_running(MockBluez* mock) {
+    return g_atomic_int_get(&mock->flood_active);
+}
+
+guint mock_bluez_flood_sent(MockBluez* mock) {
+    return g_atomic_int_get(&mock->flood_sent);
+}
+
+gint64 mock_bluez_flood_started_us(MockBluez* mock) {
+    return __atomic_load_n(&mock->flood_started_us, __ATOMIC_RELAXED);
+}
+
+gint64 mock_bluez_added_sent_us(MockBluez* mock, guint index) {
+    if (index >= mock->added_capacity) return 0;
+    return __atomic_load_n(&mock->added_sent_us[index], __ATOMIC_RELAXED);
+}
+
+// --- Thread ---
+
+static gboolean mock_setup(MockBluez* mock, GError** error) {
+    mock->conn = g_dbus_connection_new_for_address_sync(mock->bus_address,
+                                                        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                        NULL, NULL, error);
+    if (!mock->conn) return FALSE;
+
+    mock->node_info = g_dbus_node_info_new_for_xml(introspection_xml, error);
+    if (!mock->node_info) return FALSE;
+
+    mock->object_id = g_dbus_connection_register_object(
+        mock->conn, "/", g_dbus_node_info_lookup_interface(mock->node_info, "org.freedesktop.DBus.ObjectManager"),
+        &interface_vtable, mock, NULL, error);
+    if (!mock->object_id) return FALSE;
+    mock->adapter_subtree_id = g_dbus_connection_register_subtree(
+        mock->conn, "/org/bluez", &subtree_vtable, G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+        mock, NULL, error);
+    if (!mock->adapter_subtree_id) return FALSE;
+    mock->device_subtree_id = g_dbus_connection_register_subtree(
+        mock->conn, MOCK_BLUEZ_ADAPTER_PATH, &subtree_vtable, G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+        mock, NULL, error);
+    if (!mock->device_subtree_id) return FALSE;
+
+    // Owning the name last makes the HAL see a fully served org.bluez appear.
+    GVariant* result = g_dbus_connection_call_sync(mock->conn, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                                   "org.freedesktop.DBus", "RequestName",
+                                                   g_variant_new("(su)", "org.bluez", 0x4 /* DO_NOT_QUEUE */),
+                                                   G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+    if (!result) return FALSE;
+
+    guint32 reply;
+    g_variant_get(result, "(u)", &reply);
+    g_variant_unref(result);
+    if (reply != 1 /* PRIMARY_OWNER */) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "org.bluez is already owned on %s", mock->bus_address);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void mock_cleanup(MockBluez* mock) {
+    if (mock->conn) {
+        if (mock->device_subtree_id) g_dbus_connection_unregister_subtree(mock->conn, mock->device_subtree_id);
+        if (mock->adapter_subtree_id) g_dbus_connection_unregister_subtree(mock->conn, mock->adapter_subtree_id);
+        if (mock->object_id) g_dbus_connection_unregister_object(mock->conn, mock->object_id);
+        g_dbus_connection_close_sync(mock->conn, NULL, NULL);
+        g_object_unref(mock->conn);
+        mock->conn = NULL;
+    }
+    if (mock->node_info) {
+        g_dbus_node_info_unref(mock->node_info);
+        mock->node_info = NULL;
+    }
+}
+
+static gpointer mock_thread_main(gpointer data) {
+    MockBluez* mock = (MockBluez*)data;
+    GError* error = NULL;
+
+    g_main_context_push_thread_default(mock->context);
+    gboolean ok = mock_setup(mock, &error);
+
+    g_mutex_lock(&mock->mutex);
+    mock->started = TRUE;
+    mock->start_error = error;
+    g_cond_signal(&mock->cond);
+    g_mutex_unlock(&mock->mutex);
+
+    if (ok) {
+        g_main_loop_run(mock->loop);
+    }
+    mock_cleanup(mock); // Replies still waiting for their delay are dropped with the context
+    g_main_context_pop_thread_default(mock->context);
+    return NULL;
+}
+
+MockBluez* mock_bluez_start(const gchar* bus_address, const MockBluezConfig* config, GError** error) {
+    MockBluez* mock = g_new0(MockBluez, 1);
+
+    mock->bus_address = g_strdup(bus_address);
+    mock->reply_latency_ms = config->reply_latency_ms;
+    mock->n_devices = config->n_devices;
+    mock->added_capacity = config->n_devices;
+    mock->added_sent_us = g_new0(gint64, MAX(mock->added_capacity, 1));
+    mock->context = g_main_context_new();
+    mock->loop = g_main_loop_new(mock->context, FALSE);
+    g_mutex_init(&mock->mutex);
+    g_cond_init(&mock->cond);
+
+    mock->thread = g_thread_new("mock-bluez", mock_thread_main, mock);
+    g_mutex_lock(&mock->mutex);
+    while (!mock->started) {
+        g_cond_wait(&mock->cond, &mock->mutex);
+    }
+    g_mutex_unlock(&mock->mutex);
+
+    if (mock->start_error) {
+        g_propagate_error(error, mock->start_error);
+        mock->start_error = NULL;
+        mock_bluez_stop(mock);
+        return NULL;
+    }
+    return mock;
+}
+
+static gboolean quit_cb(gpointer user_data) {
+    g_main_loop_quit((GMainLoop*)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+void mock_bluez_stop(MockBluez* mock) {
+    if (!mock) return;
+
+    g_main_context_invoke(mock->context, quit_cb, mock->loop);
+    g_thread_join(mock->thread);
+
+    g_main_loop_unref(mock->loop);
+    g_main_context_unref(mock->context);
+    g_mutex_clear(&mock->mutex);
+    g_cond_clear(&mock->cond);
+    g_free(mock->added_sent_us);
+    g_free(mock->bus_address);
+    g_free(mock);
+}
@@ -0,0 +1,51 @@
+#ifndef MOCK_BLUEZ_H_
+#define MOCK_BLUEZ_H_
+
+#include <gio/gio.h>
+
+// A fake org.bluez for benchmarks: one adapter (/org/bluez/hci0) and a
+// configurable number of devices, served from its own connection and thread.
+// It answers GetManagedObjects, Properties.Set and the Adapter1/Device1
+// methods the HAL calls, optionally after a fixed delay, and emits
+// InterfacesAdded and PropertiesChanged floods at a set rate.
+//
+// Device 'index' has the address 10:00:00:XX:XX:XX made of the low 24 bits
+// of the index, so a HAL event can be matched back to the signal behind it.
+
+#define MOCK_BLUEZ_ADAPTER_PATH     "/org/bluez/hci0"
+#define MOCK_BLUEZ_MANUFACTURER_ID  0xffff  // ManufacturerData key carrying the send time
+
+typedef struct _MockBluez MockBluez;
+
+typedef struct {
+    guint n_devices;                // Devices listed by GetManagedObjects from the start
+    guint reply_latency_ms;         // Added before every method reply (0: reply at once)
+} MockBluezConfig;
+
+typedef enum {
+    MOCK_BLUEZ_FLOOD_ADDED,         // InterfacesAdded for new devices (indices continue after the last one)
+    MOCK_BLUEZ_FLOOD_PROPERTIES     // Device1 PropertiesChanged (RSSI + ManufacturerData) round-robin over all devices
+} MockBluezFlood;
+
+// Connects to 'bus_address', owns org.bluez and starts serving. NULL on failure.
+MockBluez* mock_bluez_start(const gchar* bus_address, const MockBluezConfig* config, GError** error);
+void mock_bluez_stop(MockBluez* mock);
+
+// Starts emitting 'count' signals, 'rate' per second (0: as fast as the bus
+// takes them). Returns at once; one flood at a time.
+void mock_bluez_flood(MockBluez* mock, MockBluezFlood kind, guint count, guint rate);
+gboolean mock_bluez_flood_running(MockBluez* mock);
+// Signals emitted by the current (or last) flood.
+guint mock_bluez_flood_sent(MockBluez* mock);
+// g_get_monotonic_time() at which the current (or last) flood started.
+gint64 mock_bluez_flood_started_us(MockBluez* mock);
+
+// g_get_monotonic_time() at which InterfacesAdded was sent for device
+// 'index', or 0 (device listed from the start, or unknown index).
+gint64 mock_bluez_added_sent_us(MockBluez* mock, guint index);
+
+void mock_bluez_device_address(guint index, gchar address[18]);
+// Index of the device with 'address' (6 bytes, display order), or -1.
+gint mock_bluez_device_index(const guint8* address);
+
+#endif // MOCK_BLUEZ_H_
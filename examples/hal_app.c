@@ -1,9 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
 #include "ble_hal.h" // Assuming this path is correct based on your -Iinclude flag
 
 static GMainLoop *main_loop = NULL;
+static volatile sig_atomic_t quit_requested = 0; // Ends the --external-loop poll loop
 
 // Simple global event callback for the sample app
 void sample_global_event_cb(BleHalEvent event_type, BleHalEventData* data, void* user_data) {
@@ -12,19 +17,142 @@ void sample_global_event_cb(BleHalEvent event_type, BleHalEventData* data, void*
         printf("HAL App: BlueZ service is UP.\n");
     } else if (event_type == BLE_HAL_EVENT_BLUEZ_SERVICE_DOWN) {
         printf("HAL App: BlueZ service is DOWN.\n");
+    } else if (event_type == BLE_HAL_EVENT_DEVICE_ADDED || event_type == BLE_HAL_EVENT_DEVICE_REMOVED) {
+        const BleHalDeviceInfo* device = (const BleHalDeviceInfo*)data->data;
+        char address[18];
+        ble_hal_address_to_string(&device->address, address);
+        printf("HAL App: Device %s %s (%s, %u tracked).\n", address,
+               event_type == BLE_HAL_EVENT_DEVICE_ADDED ? "added" : "removed",
+               device->name[0] ? device->name : "unnamed", ble_hal_get_device_count());
+    } else if (event_type == BLE_HAL_EVENT_ADAPTER_CHANGED) {
+        const BleHalAdapterInfo* adapter = (const BleHalAdapterInfo*)data->data;
+        printf("HAL App: Adapter %s powered=%d discovering=%d.\n", adapter->address,
+               adapter->powered, adapter->discovering);
+    } else if (event_type == BLE_HAL_EVENT_ADAPTER_ADDED || event_type == BLE_HAL_EVENT_ADAPTER_REMOVED) {
+        const BleHalAdapterInfo* adapter = (const BleHalAdapterInfo*)data->data;
+        printf("HAL App: Adapter %s (%s) %s, %u adapter(s) tracked.\n", adapter->path, adapter->address,
+               event_type == BLE_HAL_EVENT_ADAPTER_ADDED ? "added" : "removed", ble_hal_get_adapter_count());
+    } else if (event_type == BLE_HAL_EVENT_CONNECTION_LOST) {
+        const BleHalConnectionLost* lost = (const BleHalConnectionLost*)data->data;
+        printf("HAL App: Connection %u to %s lost.\n", lost->ticket, lost->path);
     }
 }
 
+// Batched advertisement callback: one array per flush interval
+void sample_adv_batch_cb(const BleHalAdvUpdate* updates, guint n_updates, void* user_data) {
+    printf("HAL App: Advertisement batch with %u device update(s).\n", n_updates);
+}
+
+static void print_adapter_cb(const BleHalAdapterInfo* adapter, void* user_data) {
+    printf("HAL App:   %s %s: %u device(s)\n", adapter->path, adapter->address,
+           ble_hal_get_adapter_device_count(adapter->path));
+}
+
+static void sample_chain_cb(BleHalStatus status, guint failed_step, const guint* handles, guint n_steps,
+                            void* user_data) {
+    if (status == BLE_HAL_SUCCESS) {
+        printf("HAL App: Default adapter powered and discovering (session %u).\n", handles[1]);
+    } else {
+        printf("HAL App: Startup chain failed at step %u (status %d).\n", failed_step, status);
+    }
+}
+
+// Power on the default adapter, then discover once it reports Powered.
+static void start_chain(void) {
+    BleHalChainStep steps[2] = {
+        { .type = BLE_HAL_STEP_POWER, .power_on = TRUE },
+        { .type = BLE_HAL_STEP_DISCOVERY, .after = 1u << 0 },
+    };
+    ble_hal_run_chain(steps, 2, 0, sample_chain_cb, NULL);
+}
+
+static gboolean use_chain = FALSE;
+static gboolean use_beacon = FALSE;
+static guint beacon_id = 0;
+static guint32 beacon_counter = 0;
+
+static void sample_beacon_cb(BleHalStatus status, void* user_data) {
+    printf("HAL App: Beacon %u %s (status %d).\n", beacon_id,
+           status == BLE_HAL_SUCCESS ? "advertising" : "failed", status);
+}
+
+// Rotates the beacon payload in place; no re-registration and no gap on air.
+static gboolean rotate_beacon(gpointer user_data) {
+    guint8 data[4];
+    beacon_counter++;
+    memcpy(data, &beacon_counter, sizeof(data));
+    BleHalAdvertisingPayload payload = {
+        .company_id = 0xFFFF, .manufacturer_data = data, .manufacturer_data_length = sizeof(data)
+    };
+    return ble_hal_advertising_update(beacon_id, &payload) == BLE_HAL_SUCCESS ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+// Broadcasts a counter as manufacturer data (test company ID 0xFFFF), changed every 100 ms.
+static void start_beacon(void) {
+    guint8 data[4] = {0};
+    BleHalAdvertisingPayload payload = {
+        .company_id = 0xFFFF, .manufacturer_data = data, .manufacturer_data_length = sizeof(data)
+    };
+    if (ble_hal_advertising_start(NULL, NULL, &payload, &beacon_id, sample_beacon_cb, NULL) == BLE_HAL_PENDING) {
+        g_timeout_add(100, rotate_beacon, NULL);
+    }
+}
+
+static gboolean use_gatt_server = FALSE;
+static guint server_char_ids[2];             // Counter (read/notify), sink (write without response)
+static guint32 server_counter = 0;
+
+static void sample_server_write_cb(guint char_id, const guint8* data, gsize length, void* user_data) {
+    printf("HAL App: Central wrote %zu byte(s) to characteristic %u.\n", length, char_id);
+}
+
+static void sample_server_cb(BleHalStatus status, void* user_data) {
+    printf("HAL App: GATT server %s (status %d).\n", status == BLE_HAL_SUCCESS ? "registered" : "failed", status);
+}
+
+// Notifies the counter to every subscribed central; the value is read from the HAL without a round trip.
+static gboolean tick_server(gpointer user_data) {
+    server_counter++;
+    BleHalBuffer buffer = { (const guint8*)&server_counter, sizeof(server_counter) };
+    ble_hal_gatt_server_set_value(server_char_ids[0], buffer.data, buffer.length);
+    ble_hal_gatt_server_notify(server_char_ids[0], &buffer, 1, NULL, NULL); // NOT_FOUND while nobody listens
+    return G_SOURCE_CONTINUE;
+}
+
+static void start_gatt_server(void) {
+    static const BleHalGattCharacteristicDef chars[] = {
+        { "12345678-1234-5678-1234-56789abcdef1", BLE_HAL_GATT_CHR_READ | BLE_HAL_GATT_CHR_NOTIFY },
+        { "12345678-1234-5678-1234-56789abcdef2", BLE_HAL_GATT_CHR_WRITE | BLE_HAL_GATT_CHR_WRITE_WITHOUT_RESPONSE },
+    };
+    static const BleHalGattServiceDef service = { "12345678-1234-5678-1234-56789abcdef0", TRUE, chars, 2 };
+    guint app_id;
+    if (ble_hal_gatt_server_register(NULL, &service, 1, sample_server_write_cb, &app_id, server_char_ids,
+                                     sample_server_cb, NULL) == BLE_HAL_PENDING) {
+        g_timeout_add(100, tick_server, NULL);
+    }
+}
+
+// Readiness callback for ble_hal_init_async()
+void sample_ready_cb(BleHalStatus status, void* user_data) {
+    printf("HAL App: HAL ready (status %d, %u device(s) known).\n", status, ble_hal_get_device_count());
+    ble_hal_foreach_adapter(print_adapter_cb, NULL);
+    if (use_chain && status == BLE_HAL_SUCCESS) start_chain();
+    if (use_beacon && status == BLE_HAL_SUCCESS) start_beacon();
+    if (use_gatt_server && status == BLE_HAL_SUCCESS) start_gatt_server();
+}
+
 void sigint_handler(int signum) {
     printf("\nSample App: SIGINT received, quitting...\n");
+    quit_requested = 1;
     if (main_loop && g_main_loop_is_running(main_loop)) {
         g_main_loop_quit(main_loop);
     }
 }
 
 int main(int argc, char *argv[]) {
-    BleHalConfig hal_config;
+    BleHalConfig hal_config = {0};
     BleHalStatus status;
+    gboolean use_async_init = FALSE;
 
     printf("HAL App: Starting...\n");
 
@@ -41,24 +169,102 @@ int main(int argc, char *argv[]) {
     // Prepare HAL configuration
     hal_config.global_event_cb = sample_global_event_cb;
     hal_config.global_event_user_data = NULL; // No specific user data for this simple example
+    hal_config.adv_batch_cb = sample_adv_batch_cb;
+    hal_config.adv_batch_interval_ms = 250;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--event-thread") == 0) {
+            hal_config.use_event_thread = TRUE; // Process D-Bus traffic on a HAL thread
+        } else if (strcmp(argv[i], "--adapter-threads") == 0) {
+            hal_config.use_adapter_threads = TRUE; // One worker thread per controller
+        } else if (strcmp(argv[i], "--mgmt-scan") == 0) {
+            hal_config.use_mgmt_scan = TRUE;    // Advertising data from the kernel (needs CAP_NET_ADMIN)
+        } else if (strcmp(argv[i], "--device-cache") == 0 && i + 1 < argc) {
+            hal_config.device_cache_path = argv[++i]; // Warm start from, and save to, this file
+        } else if (strcmp(argv[i], "--max-devices") == 0 && i + 1 < argc) {
+            hal_config.max_devices_per_adapter = (guint)atoi(argv[++i]); // Evict the least recently seen beyond this
+            hal_config.device_max_age_ms = 5 * 60 * 1000;
+            hal_config.remove_evicted_devices = TRUE; // Keep bluetoothd's device list bounded too
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            hal_config.log_level = BLE_HAL_LOG_DEBUG; // Per-signal and per-request messages
+        } else if (strcmp(argv[i], "--async") == 0) {
+            use_async_init = TRUE;              // Do not block in ble_hal_init
+        } else if (strcmp(argv[i], "--chain") == 0) {
+            use_chain = TRUE;                   // Power on and discover as one chain
+        } else if (strcmp(argv[i], "--beacon") == 0) {
+            use_beacon = TRUE;                  // Advertise a rotating payload (GMainLoop mode)
+        } else if (strcmp(argv[i], "--gatt-server") == 0) {
+            use_gatt_server = TRUE;             // Serve a notifying counter (GMainLoop mode)
+        } else if (strcmp(argv[i], "--external-loop") == 0) {
+            hal_config.use_external_loop = TRUE; // Drive the HAL from poll() below instead of a GMainLoop
+        }
+    }
+    GMainLoop* hal_loop = hal_config.use_external_loop ? NULL : main_loop;
 
     // Initialize the BLE HAL
     // We pass NULL for the loop parameter to let the HAL create its own internal one for this test.
     // Or, you could pass 'main_loop' if you intend the HAL to use this app's loop directly.
-    status = ble_hal_init(&hal_config, main_loop);
-    if (status != BLE_HAL_SUCCESS) {
+    if (use_async_init) {
+        status = ble_hal_init_async(&hal_config, hal_loop, sample_ready_cb, NULL);
+    } else {
+        status = ble_hal_init(&hal_config, hal_loop);
+    }
+    if (status != BLE_HAL_SUCCESS && status != BLE_HAL_PENDING) {
         fprintf(stderr, "HAL App: Failed to initialize BLE HAL, error: %d\n", status);
         g_main_loop_unref(main_loop);
         return 1;
     }
+    if (use_chain && !use_async_init) start_chain();
+    if (use_beacon && !use_async_init) start_beacon();
+    if (use_gatt_server && !use_async_init) start_gatt_server();
 
-    g_main_loop_run(main_loop);
+    if (hal_config.use_external_loop) {
+        // Any poll/epoll/libuv loop works the same way: wait for the HAL's fd,
+        // then dispatch in bounded slices so other work is not starved.
+        struct pollfd pfd = { .fd = ble_hal_get_fd(), .events = POLLIN };
+        while (!quit_requested) {
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
+            while (ble_hal_dispatch(64, 2000) == BLE_HAL_PENDING && !quit_requested) {
+            }
+        }
+    } else {
+        g_main_loop_run(main_loop);
+    }
 
     printf("HAL App: GMainLoop finished. Deinitializing BLE HAL...\n");
 
     // Deinitialize the BLE HAL
     ble_hal_deinit();
 
+    BleHalPoolStats pools;
+    ble_hal_get_pool_stats(&pools);
+    for (guint i = 0; i < BLE_HAL_POOL_N_CLASSES; i++) {
+        if (pools.classes[i].allocations == 0 && pools.classes[i].fallbacks == 0) continue;
+        printf("HAL App: Pool %4u B: peak %u/%u blocks, %llu allocations, %llu heap fallbacks\n",
+               (guint)pools.classes[i].block_size, pools.classes[i].blocks_peak, pools.classes[i].blocks_total,
+               (unsigned long long)pools.classes[i].allocations, (unsigned long long)pools.classes[i].fallbacks);
+    }
+
+    static const char* const method_names[BLE_HAL_STATS_N_METHODS] = {
+        "GetManagedObjects", "Properties.Set", "StartDiscovery", "StopDiscovery", "SetDiscoveryFilter",
+        "Connect", "Disconnect", "AcquireNotify", "AcquireWrite", "RemoveDevice", "other"
+    };
+    BleHalStats stats;
+    ble_hal_get_stats(&stats);
+    for (guint i = 0; i < BLE_HAL_STATS_N_METHODS; i++) {
+        const BleHalLatencyStats* m = &stats.methods[i];
+        if (m->count == 0) continue;
+        printf("HAL App: %-18s %llu calls, %llu failed, avg %llu us, max %llu us\n", method_names[i],
+               (unsigned long long)m->count, (unsigned long long)m->errors,
+               (unsigned long long)(m->total_us / m->count), (unsigned long long)m->max_us);
+    }
+    printf("HAL App: Peak queue depths: %u commands, %u events, %u waiting and %u in-flight requests\n",
+           stats.commands.peak, stats.events.peak, stats.requests_waiting.peak, stats.requests_in_flight.peak);
+    if (stats.devices_evicted_count || stats.devices_evicted_memory || stats.devices_expired) {
+        printf("HAL App: Evicted devices: %llu over the limit, %llu over the budget, %llu expired\n",
+               (unsigned long long)stats.devices_evicted_count, (unsigned long long)stats.devices_evicted_memory,
+               (unsigned long long)stats.devices_expired);
+    }
+
     // Clean up GMainLoop
     g_main_loop_unref(main_loop);
 
@@ -11,13 +11,23 @@ typedef enum {
     BLE_HAL_ERROR_DBUS,                 // D-Bus related error
     BLE_HAL_ERROR_NOT_INITIALIZED,      // HAL not initialized
     BLE_HAL_ERROR_INVALID_PARAMS,       // Invalid parameters provided
-    BLE_HAL_PENDING                     // Asynchronous operation pending
+    BLE_HAL_PENDING,                    // Asynchronous operation pending
+    BLE_HAL_ERROR_NOT_FOUND,            // Requested object is not known to the HAL
+    BLE_HAL_ERROR_BUSY,                 // Resource in use or full (e.g. characteristic already subscribed)
+    BLE_HAL_ERROR_TIMEOUT,              // Request deadline passed before BlueZ answered
+    BLE_HAL_ERROR_CANCELLED             // Request superseded, or cancelled by deinit / BlueZ vanishing
 } BleHalStatus;
 
 // --- Global HAL Events ---
 typedef enum {
     BLE_HAL_EVENT_BLUEZ_SERVICE_UP,     // BlueZ service is available
-    BLE_HAL_EVENT_BLUEZ_SERVICE_DOWN,   // BlueZ service is not available
+    BLE_HAL_EVENT_BLUEZ_SERVICE_DOWN,   // BlueZ service is not available (tables kept for bluez_restart_grace_ms)
+    BLE_HAL_EVENT_DEVICE_ADDED,         // New device in the device table (data: const BleHalDeviceInfo*)
+    BLE_HAL_EVENT_DEVICE_REMOVED,       // Device left the device table (data: const BleHalDeviceInfo*)
+    BLE_HAL_EVENT_ADAPTER_CHANGED,      // Cached adapter state changed (data: const BleHalAdapterInfo*)
+    BLE_HAL_EVENT_ADAPTER_ADDED,        // New adapter in the adapter table (data: const BleHalAdapterInfo*)
+    BLE_HAL_EVENT_ADAPTER_REMOVED,      // Adapter left the adapter table, after its devices (data: const BleHalAdapterInfo*)
+    BLE_HAL_EVENT_CONNECTION_LOST,      // A scheduled link dropped on its own (data: const BleHalConnectionLost*)
     // Add other global events
 } BleHalEvent;
 
@@ -32,15 +42,260 @@ typedef struct {
     char address[18];       // XX:XX:XX:XX:XX:XX format
     char name[249];         // Adapter's Bluetooth name
     gboolean powered;       // Adapter's power state
-    // Add other fields as needed, e.g., discovering status
+    gboolean discovering;   // A discovery session is active
+    gboolean discoverable;
+    gboolean pairable;
 } BleHalAdapterInfo;
 
+// --- Bluetooth Device Address ---
+typedef struct {
+    guint8 b[6];            // Address bytes in display order (b[0] is the leftmost "XX")
+} BleHalAddress;
+
+typedef enum {
+    BLE_HAL_ADDRESS_TYPE_PUBLIC = 0,
+    BLE_HAL_ADDRESS_TYPE_RANDOM
+} BleHalAddressType;
+
+#define BLE_HAL_RSSI_UNKNOWN        ((gint16)127)   // RSSI not reported by BlueZ
+#define BLE_HAL_TX_POWER_UNKNOWN    ((gint16)127)   // TX power not reported by BlueZ
+
+// --- Device Information ---
+typedef struct {
+    char path[256];                 // D-Bus object path (e.g., /org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX)
+    BleHalAddress address;          // Device address
+    BleHalAddressType address_type; // Public or random address
+    char name[249];                 // Device name (or alias), empty if unknown
+    gint16 rssi;                    // Last RSSI in dBm, BLE_HAL_RSSI_UNKNOWN if none
+    gint16 tx_power;                // Advertised TX power, BLE_HAL_TX_POWER_UNKNOWN if none
+    gint64 last_seen_us;            // g_get_monotonic_time() of the last advertisement, 0 if none
+    gboolean paired;
+    gboolean connected;
+    gboolean trusted;
+    gboolean blocked;
+} BleHalDeviceInfo;
+
+// --- Compact Device Records ---
+// The hot fields of a device without any strings; see ble_hal_foreach_device_record().
+typedef enum {
+    BLE_HAL_DEVICE_PAIRED       = 1 << 0,
+    BLE_HAL_DEVICE_CONNECTED    = 1 << 1,
+    BLE_HAL_DEVICE_TRUSTED      = 1 << 2,
+    BLE_HAL_DEVICE_BLOCKED      = 1 << 3
+} BleHalDeviceFlag;
+
+typedef struct {
+    BleHalAddress address;          // Device address (packed, 6 bytes)
+    guint8 address_type;            // BleHalAddressType
+    guint8 flags;                   // BleHalDeviceFlag bits
+    gint16 rssi;                    // Last RSSI in dBm, BLE_HAL_RSSI_UNKNOWN if none
+    gint16 tx_power;                // Advertised TX power, BLE_HAL_TX_POWER_UNKNOWN if none
+    gint64 last_seen_us;            // g_get_monotonic_time() of the last advertisement, 0 if none
+} BleHalDeviceRecord;
+
+// --- Advertisement Updates ---
+typedef enum {
+    BLE_HAL_ADV_FIELD_RSSI              = 1 << 0,
+    BLE_HAL_ADV_FIELD_TX_POWER          = 1 << 1,
+    BLE_HAL_ADV_FIELD_MANUFACTURER_DATA = 1 << 2,
+    BLE_HAL_ADV_FIELD_SERVICE_DATA      = 1 << 3
+} BleHalAdvField;
+
+// Latest advertisement state of one device, coalesced over a batch interval.
+// Only the fields flagged in 'changed' carry new values.
+typedef struct {
+    BleHalAddress address;          // Device address
+    const char* path;               // Device object path (valid during the callback only)
+    guint32 changed;                // BleHalAdvField bits updated since the last batch
+    gint16 rssi;                    // Latest RSSI (if BLE_HAL_ADV_FIELD_RSSI)
+    gint16 tx_power;                // Latest TX power (if BLE_HAL_ADV_FIELD_TX_POWER)
+    GVariant* manufacturer_data;    // Latest a{qv} (if BLE_HAL_ADV_FIELD_MANUFACTURER_DATA), borrowed
+    GVariant* service_data;         // Latest a{sv} (if BLE_HAL_ADV_FIELD_SERVICE_DATA), borrowed
+    gint64 timestamp_us;            // g_get_monotonic_time() of the most recent update
+} BleHalAdvUpdate;
+
+// Delivers one array per flush. The array and everything it points to are
+// only valid for the duration of the call.
+typedef void (*BleHalAdvBatchCb)(const BleHalAdvUpdate* updates, guint n_updates, void* user_data);
+
+#define BLE_HAL_ADV_BATCH_DEFAULT_INTERVAL_MS   100
+#define BLE_HAL_ADV_BATCH_DEFAULT_MAX_ENTRIES   256
+
+// --- Advertisement Data Views ---
+// ManufacturerData and ServiceData entries read in place from an update's
+// GVariant, without creating child variants or copying bytes. A view is
+// valid as long as the update it came from, i.e. during the batch callback.
+
+typedef struct {
+    guint16 company_id;             // ManufacturerData: company identifier (0 for ServiceData)
+    const char* uuid;               // ServiceData: UUID string as BlueZ sent it (NULL for ManufacturerData)
+    const guint8* data;             // Borrowed
+    gsize length;
+} BleHalAdvData;
+
+// Return FALSE to stop the iteration.
+typedef gboolean (*BleHalAdvDataCb)(const BleHalAdvData* entry, void* user_data);
+
+// --- Signal Interests ---
+// Selects which optional BlueZ signal streams the HAL asks the bus for.
+// ObjectManager InterfacesAdded/Removed are always subscribed.
+typedef enum {
+    BLE_HAL_INTEREST_DEVICE_PROPERTIES  = 1 << 0,   // PropertiesChanged on org.bluez.Device1
+    BLE_HAL_INTEREST_ADAPTER_PROPERTIES = 1 << 1,   // PropertiesChanged on org.bluez.Adapter1
+} BleHalInterest;
+
+#define BLE_HAL_INTEREST_DEFAULT    (BLE_HAL_INTEREST_DEVICE_PROPERTIES | BLE_HAL_INTEREST_ADAPTER_PROPERTIES)
+
+typedef void (*BleHalGlobalEventCb)(BleHalEvent event_type, BleHalEventData* data, void* user_data);
+
+#define BLE_HAL_EVENT_QUEUE_DEFAULT_CAPACITY    1024
+
+#define BLE_HAL_REQUEST_DEFAULT_TIMEOUT_MS      10000
+#define BLE_HAL_REQUEST_DEFAULT_MAX_IN_FLIGHT   4
+
+#define BLE_HAL_POOL_DEFAULT_MAX_BYTES          (1024 * 1024)
+
+#define BLE_HAL_BLUEZ_RESTART_DEFAULT_GRACE_MS  30000
+
+#define BLE_HAL_CONNECT_DEFAULT_MAX_CONNECTIONS 4
+#define BLE_HAL_CONNECT_DEFAULT_MAX_PENDING     1
+#define BLE_HAL_CONNECT_DEFAULT_RETRY_LIMIT     3
+#define BLE_HAL_CONNECT_DEFAULT_RETRY_BASE_MS   250
+
+// --- Logging ---
+// HAL messages go into a lock-free in-memory ring and are written out by a
+// log thread, so logging never blocks D-Bus or advertisement processing.
+// A full ring drops messages and reports how many were lost.
+typedef enum {
+    BLE_HAL_LOG_DEFAULT = 0,    // See BleHalConfig.log_level and ble_hal_set_log_level()
+    BLE_HAL_LOG_NONE,
+    BLE_HAL_LOG_ERROR,
+    BLE_HAL_LOG_WARN,
+    BLE_HAL_LOG_INFO,
+    BLE_HAL_LOG_DEBUG           // Per-signal and per-request detail
+} BleHalLogLevel;
+
+// Most verbose level compiled in; messages above it are removed at build time
+// (e.g. -DBLE_HAL_LOG_MAX_LEVEL=BLE_HAL_LOG_INFO).
+#ifndef BLE_HAL_LOG_MAX_LEVEL
+#define BLE_HAL_LOG_MAX_LEVEL       BLE_HAL_LOG_DEBUG
+#endif
+
+// Receives each message (without prefix or newline) on the log thread, in
+// order. 'timestamp_us' is g_get_monotonic_time() at the call site.
+typedef void (*BleHalLogSink)(BleHalLogLevel level, gint64 timestamp_us, const char* message, void* user_data);
+
+#define BLE_HAL_LOG_DEFAULT_RING_CAPACITY       256
+
 // --- Configuration ---
 typedef struct {
     // Callback for global HAL events (e.g., BlueZ service status)
-    void (*global_event_cb)(BleHalEvent event_type, BleHalEventData* data, void* user_data);
+    BleHalGlobalEventCb global_event_cb;
     void* global_event_user_data;   // User data for global_event_cb
-    // Other config options (e.g., log level)
+
+    // Batched advertisement delivery (RSSI/ManufacturerData/ServiceData/TxPower).
+    // Updates are coalesced per device and flushed every adv_batch_interval_ms,
+    // or earlier once adv_batch_max_entries devices are pending. 0 selects the default.
+    BleHalAdvBatchCb adv_batch_cb;  // NULL disables batching
+    void* adv_batch_user_data;      // User data for adv_batch_cb
+    guint adv_batch_interval_ms;    // Flush interval (default BLE_HAL_ADV_BATCH_DEFAULT_INTERVAL_MS)
+    guint adv_batch_max_entries;    // Flush threshold (default BLE_HAL_ADV_BATCH_DEFAULT_MAX_ENTRIES)
+
+    guint32 interests;              // BleHalInterest bits (0 selects BLE_HAL_INTEREST_DEFAULT)
+
+    // Advertisement pre-filter, applied on the adapter contexts before a
+    // value is batched. With a list given, ManufacturerData is only passed on
+    // if it has an entry for one of the company IDs, and ServiceData only if
+    // it has one for one of the service UUIDs (16-bit, 32-bit or full
+    // strings); RSSI and TxPower updates are unaffected. Lists are copied.
+    const guint16* adv_company_ids;
+    guint n_adv_company_ids;
+    const char* const* adv_service_uuids; // NULL-terminated, NULL for no UUID filter
+
+    // Event-thread mode: the HAL processes D-Bus traffic on its own GMainContext
+    // and thread. All callbacks above are still invoked on the application's
+    // loop, fed through a bounded queue of event_queue_capacity entries.
+    gboolean use_event_thread;
+    guint event_queue_capacity;     // 0 selects BLE_HAL_EVENT_QUEUE_DEFAULT_CAPACITY
+
+    // External-loop mode: the HAL runs on a private GMainContext instead of a
+    // GMainLoop. The application watches ble_hal_get_fd() with its own poll,
+    // epoll, libuv, ... loop and calls ble_hal_dispatch() when it is readable;
+    // all callbacks run inside ble_hal_dispatch(). Pass a NULL loop to ble_hal_init().
+    // Combines with use_event_thread, which moves the D-Bus work off that thread.
+    gboolean use_external_loop;
+
+    // Gives every adapter its own GMainContext and worker thread for its device
+    // table and advertisement batching, so each controller is processed in
+    // parallel. Implies use_event_thread.
+    gboolean use_adapter_threads;
+
+    // Reads advertising reports straight from the kernel's Bluetooth management
+    // socket instead of Device1 PropertiesChanged. They feed the same device
+    // tables and adv_batch_cb; control operations stay on D-Bus. Needs
+    // CAP_NET_ADMIN; if the socket cannot be opened the D-Bus path is used.
+    gboolean use_mgmt_scan;
+
+    // D-Bus requests (property writes, method calls) go through one pipeline.
+    // Each has a deadline covering queueing and the call itself, and at most
+    // max_requests_in_flight run per adapter; the rest wait in order. 0 selects the default.
+    guint request_timeout_ms;       // Default BLE_HAL_REQUEST_DEFAULT_TIMEOUT_MS
+    guint max_requests_in_flight;   // Default BLE_HAL_REQUEST_DEFAULT_MAX_IN_FLIGHT
+
+    // Byte budget of each block pool size class (see ble_hal_get_pool_stats()).
+    // Allocations beyond it fall back to the heap. 0 selects BLE_HAL_POOL_DEFAULT_MAX_BYTES.
+    gsize pool_max_bytes;
+
+    // When bluetoothd leaves the bus the adapter and device tables are kept
+    // for this long. If it comes back in time, its object tree is diffed
+    // against them and only real changes are reported (adapters or devices
+    // added, removed or changed); otherwise everything is removed as usual.
+    // 0 selects BLE_HAL_BLUEZ_RESTART_DEFAULT_GRACE_MS.
+    guint bluez_restart_grace_ms;
+
+    // Warm-start device cache file (NULL disables it). When set, ble_hal_init()
+    // maps the file and fills the adapter and device tables from it, so the
+    // getters answer before BlueZ has been scanned; no events are sent for the
+    // cached entries. The first object scan reconciles them like a BlueZ
+    // restart (see bluez_restart_grace_ms). ble_hal_deinit() saves the tables back.
+    const char* device_cache_path;
+
+    // Device table limits, per adapter; 0 disables each. Once a table holds
+    // more than max_devices_per_adapter devices, or its records and names
+    // take more than device_memory_budget_bytes, the least recently seen
+    // devices are evicted until it is 1/8 below the limit. Devices not seen
+    // for device_max_age_ms are evicted as well (checked every quarter of
+    // it, at least every second and at most every minute). A device's age
+    // counts from its last advertisement, or from when it was first tracked.
+    // Paired, trusted, blocked and connected devices are never evicted.
+    // Evictions are reported as BLE_HAL_EVENT_DEVICE_REMOVED and counted in
+    // BleHalStats. With remove_evicted_devices the HAL also calls
+    // Adapter1.RemoveDevice, so bluetoothd drops the object (and its
+    // GetManagedObjects entry) too; a device that advertises again comes back.
+    guint max_devices_per_adapter;
+    gsize device_memory_budget_bytes;
+    guint device_max_age_ms;
+    gboolean remove_evicted_devices;
+
+    // Connection scheduler (ble_hal_schedule_connect()). Per adapter, at most
+    // max_connections_per_adapter scheduled links are up or being set up, of
+    // which at most max_pending_connects_per_adapter are Connect calls in
+    // progress. Aborted attempts are retried up to connect_retry_limit times,
+    // waiting connect_retry_base_ms, then twice as long each time. Connect
+    // calls count against the adapter's max_requests_in_flight, so keep
+    // max_pending_connects_per_adapter below it.
+    // 0 selects the BLE_HAL_CONNECT_DEFAULT_* value.
+    guint max_connections_per_adapter;
+    guint max_pending_connects_per_adapter;
+    guint connect_retry_limit;
+    guint connect_retry_base_ms;
+
+    // Logging (see BleHalLogLevel). Without a sink, messages go to stdout,
+    // and errors and warnings to stderr.
+    BleHalLogLevel log_level;       // BLE_HAL_LOG_DEFAULT keeps ble_hal_set_log_level()'s (initially INFO)
+    BleHalLogSink log_sink;         // NULL selects stdout/stderr
+    void* log_sink_user_data;
+    guint log_ring_capacity;        // Messages; 0 selects BLE_HAL_LOG_DEFAULT_RING_CAPACITY
 } BleHalConfig;
 
 
@@ -48,13 +303,32 @@ typedef void (*BleHalResultCb)(BleHalStatus error, void* user_data);
 
 /**
  * @brief Initializes the BLE HAL.
+ * Zero-initialize the BleHalConfig before filling it so unused options keep their defaults.
  * Connects to D-Bus, monitors BlueZ service.
  * @param config HAL configuration.
  * @param loop Optional GMainLoop for integration. If NULL, HAL may create its own.
+ *             Callbacks are delivered on this loop's context (the default context if NULL).
  * @return BleHalStatus indicating success/failure.
  */
 BleHalStatus ble_hal_init(const BleHalConfig* config, GMainLoop* loop);
 
+/**
+ * @brief Starts the BLE HAL without blocking the caller.
+ * The system bus connection and the org.bluez name watch are opened in
+ * parallel; signal subscriptions and the initial object scan follow as soon
+ * as BlueZ's owner is known, without waiting for each other's replies.
+ * @param config HAL configuration (as for ble_hal_init()).
+ * @param loop Optional GMainLoop for integration (as for ble_hal_init()).
+ * @param ready_cb Called once on the loop's context: BLE_HAL_SUCCESS when the
+ *                 initial object scan finished or BlueZ was found not to be
+ *                 running, BLE_HAL_ERROR_DBUS if the bus or the scan failed.
+ *                 After a bus failure the HAL is inert; call ble_hal_deinit().
+ * @param user_data User data for ready_cb.
+ * @return BLE_HAL_PENDING if startup is in progress, or an error code.
+ */
+BleHalStatus ble_hal_init_async(const BleHalConfig* config, GMainLoop* loop,
+                                BleHalResultCb ready_cb, void* user_data);
+
 /**
  * @brief Deinitializes the BLE HAL.
  * Closes D-Bus connection and cleans up resources.
@@ -67,9 +341,826 @@ void ble_hal_deinit(void);
  * @param adapter_path The D-Bus object path of the adapter (e.g., "/org/bluez/hci0").
  * @param power_on TRUE to power on, FALSE to power off.
  * @param cb Callback function to be invoked with the result of the operation.
+ *           Runs on the calling thread's thread-default GMainContext (the
+ *           global default context if none was pushed).
+ *           A call still queued when another one for the same adapter
+ *           arrives is merged into it: with the same value both get its
+ *           result, otherwise the older one completes with BLE_HAL_ERROR_CANCELLED.
+ *           BLE_HAL_ERROR_TIMEOUT reports a missed deadline (request_timeout_ms).
  * @param user_data User data to be passed to the callback.
  * @return BleHalStatus BLE_HAL_PENDING if the operation was initiated, or an error code.
+ * @note Safe to call from any thread; the command is queued to the HAL context.
  */
 BleHalStatus ble_hal_set_adapter_power(const char* adapter_path, gboolean power_on, BleHalResultCb cb, void* user_data);
 
+/**
+ * @brief Changes the set of BlueZ signal streams the HAL subscribes to.
+ * Match rules are added and removed on the bus so unwanted signals are
+ * filtered by dbus-daemon instead of waking the HAL.
+ *
+ * @param interests Bitwise OR of BleHalInterest values.
+ * @return BLE_HAL_SUCCESS or BLE_HAL_ERROR_NOT_INITIALIZED.
+ * @note Safe to call from any thread; the change is applied on the HAL context.
+ */
+BleHalStatus ble_hal_set_interests(guint32 interests);
+
+// --- Advertisement Data ---
+
+/**
+ * @brief Calls 'cb' for each ManufacturerData entry of 'update' (if
+ * BLE_HAL_ADV_FIELD_MANUFACTURER_DATA is set) until it returns FALSE.
+ * @return Number of entries visited.
+ * @note Allocation-free; views are valid while 'update' is.
+ */
+guint ble_hal_adv_foreach_manufacturer_data(const BleHalAdvUpdate* update, BleHalAdvDataCb cb, void* user_data);
+// As above for ServiceData (BLE_HAL_ADV_FIELD_SERVICE_DATA).
+guint ble_hal_adv_foreach_service_data(const BleHalAdvUpdate* update, BleHalAdvDataCb cb, void* user_data);
+
+/**
+ * @brief Finds the ManufacturerData entry for 'company_id'.
+ * @return TRUE and fills 'out' if present.
+ */
+gboolean ble_hal_adv_get_manufacturer_data(const BleHalAdvUpdate* update, guint16 company_id, BleHalAdvData* out);
+// Finds the ServiceData entry for 'uuid' (16-bit, 32-bit or full UUID string, any case).
+gboolean ble_hal_adv_get_service_data(const BleHalAdvUpdate* update, const char* uuid, BleHalAdvData* out);
+
+// --- Memory Pools ---
+// Operation contexts, queued event records and their payload copies come from
+// fixed-size block pools. Each size class carves blocks from slabs up to its
+// byte budget and recycles them; slabs are kept for the life of the process.
+
+#define BLE_HAL_POOL_N_CLASSES      6       // 32, 64, 128, 256, 512 and 1024-byte blocks
+
+typedef struct {
+    gsize block_size;               // Usable bytes per block
+    guint blocks_total;             // Blocks carved from slabs so far
+    guint blocks_in_use;
+    guint blocks_peak;              // Highest blocks_in_use seen
+    guint64 allocations;            // Served from the pool
+    guint64 fallbacks;              // Sent to the heap because the class was at its budget
+} BleHalPoolClassStats;
+
+typedef struct {
+    BleHalPoolClassStats classes[BLE_HAL_POOL_N_CLASSES];   // Smallest block size first
+    guint64 oversize_allocations;   // Larger than the biggest class; always from the heap
+} BleHalPoolStats;
+
+/**
+ * @brief Copies the current pool usage counters.
+ * @param out Receives the counters.
+ * @note Safe to call from any thread, also before ble_hal_init().
+ */
+void ble_hal_get_pool_stats(BleHalPoolStats* out);
+
+// --- Device Cache ---
+
+/**
+ * @brief Writes the adapter and device tables to a warm-start cache file
+ * (see BleHalConfig.device_cache_path). The file is replaced atomically.
+ * @param path File to write, or NULL for the configured device_cache_path.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR if the file could not be written,
+ *         BLE_HAL_ERROR_NOT_INITIALIZED or BLE_HAL_ERROR_INVALID_PARAMS.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_save_device_cache(const char* path);
+
+// --- Runtime Statistics ---
+// Counters are updated with relaxed atomic adds on the paths they measure and
+// are always on. A snapshot is not taken atomically as a whole: fields read
+// while traffic flows may be a few samples apart.
+
+// Latency buckets: buckets[0] counts samples under 1 us, buckets[i] samples
+// from 2^(i-1) up to 2^i us; the last bucket also takes everything longer.
+#define BLE_HAL_STATS_N_BUCKETS     24
+
+typedef struct {
+    guint64 count;
+    guint64 errors;                 // D-Bus calls that failed or timed out
+    guint64 total_us;
+    guint64 max_us;
+    guint64 buckets[BLE_HAL_STATS_N_BUCKETS];
+} BleHalLatencyStats;
+
+// D-Bus methods the HAL calls on BlueZ.
+typedef enum {
+    BLE_HAL_STATS_METHOD_GET_MANAGED_OBJECTS = 0,
+    BLE_HAL_STATS_METHOD_SET_PROPERTY,      // Properties.Set (e.g. Adapter1.Powered)
+    BLE_HAL_STATS_METHOD_START_DISCOVERY,
+    BLE_HAL_STATS_METHOD_STOP_DISCOVERY,
+    BLE_HAL_STATS_METHOD_SET_DISCOVERY_FILTER,
+    BLE_HAL_STATS_METHOD_CONNECT,
+    BLE_HAL_STATS_METHOD_DISCONNECT,
+    BLE_HAL_STATS_METHOD_ACQUIRE_NOTIFY,
+    BLE_HAL_STATS_METHOD_ACQUIRE_WRITE,
+    BLE_HAL_STATS_METHOD_REMOVE_DEVICE,     // Evicted devices (BleHalConfig.remove_evicted_devices)
+    BLE_HAL_STATS_METHOD_OTHER,
+    BLE_HAL_STATS_N_METHODS
+} BleHalStatsMethod;
+
+// Inputs the HAL context handles.
+typedef enum {
+    BLE_HAL_STATS_SIGNAL_INTERFACES_ADDED = 0,
+    BLE_HAL_STATS_SIGNAL_INTERFACES_REMOVED,
+    BLE_HAL_STATS_SIGNAL_ADAPTER_PROPERTIES,    // Adapter1 PropertiesChanged
+    BLE_HAL_STATS_SIGNAL_DEVICE_PROPERTIES,     // Device1 PropertiesChanged
+    BLE_HAL_STATS_SIGNAL_MGMT_DEVICE_FOUND,     // Kernel advertising report (use_mgmt_scan)
+    BLE_HAL_STATS_N_SIGNALS
+} BleHalStatsSignal;
+
+typedef struct {
+    guint current;
+    guint peak;                     // Highest value since init or ble_hal_reset_stats()
+} BleHalQueueDepth;
+
+typedef struct {
+    BleHalLatencyStats methods[BLE_HAL_STATS_N_METHODS];    // Call sent to reply received
+    BleHalLatencyStats signals[BLE_HAL_STATS_N_SIGNALS];    // Time in the HAL-context handler
+    BleHalQueueDepth commands;              // Commands waiting in the HAL and adapter queues
+    BleHalQueueDepth events;                // Events waiting for the application context
+    BleHalQueueDepth requests_waiting;      // D-Bus calls queued in the request pipeline
+    BleHalQueueDepth requests_in_flight;    // D-Bus calls sent and not answered yet
+    guint events_dropped;                   // Advertisement batches dropped on a full ring, or at deinit
+    guint64 devices_evicted_count;          // Over BleHalConfig.max_devices_per_adapter
+    guint64 devices_evicted_memory;         // Over BleHalConfig.device_memory_budget_bytes
+    guint64 devices_expired;                // Older than BleHalConfig.device_max_age_ms
+    guint adapters;
+    guint devices;                          // Across all adapters' device tables
+    gsize device_table_bytes;               // Allocated by all device tables
+    BleHalPoolStats pools;
+} BleHalStats;
+
+/**
+ * @brief Copies the current counters, queue depths and table sizes.
+ * @param out Receives the snapshot.
+ * @note Safe to call from any thread, also before ble_hal_init() (counters only).
+ */
+void ble_hal_get_stats(BleHalStats* out);
+
+/**
+ * @brief Zeroes the latency and eviction counters and the queue depth peaks.
+ * @note Safe to call from any thread.
+ */
+void ble_hal_reset_stats(void);
+
+/**
+ * @brief Changes which messages are logged from now on.
+ * @param level BLE_HAL_LOG_NONE silences the HAL; BLE_HAL_LOG_DEFAULT selects BLE_HAL_LOG_INFO.
+ * @note Safe to call from any thread, also before ble_hal_init().
+ */
+void ble_hal_set_log_level(BleHalLogLevel level);
+BleHalLogLevel ble_hal_get_log_level(void);
+
+// --- External Event Loop ---
+// Only available with BleHalConfig.use_external_loop.
+
+/**
+ * @brief Returns the fd to watch for readability, or -1 when the HAL is not
+ * in external-loop mode. The fd stays the same until ble_hal_deinit().
+ */
+int ble_hal_get_fd(void);
+
+/**
+ * @brief Runs the HAL's pending work and callbacks without blocking.
+ * Call it when ble_hal_get_fd() is readable; the fd is rearmed for the next
+ * timer or D-Bus message before it returns.
+ * @param max_iterations Stop after this many dispatch rounds (0: no limit).
+ * @param budget_us Stop once this much time has passed (0: no limit). A
+ *                  round in progress is not interrupted.
+ * @return BLE_HAL_SUCCESS if nothing is due any more, BLE_HAL_PENDING if a
+ *         limit was hit with work left (the fd stays readable),
+ *         BLE_HAL_ERROR_NOT_INITIALIZED outside external-loop mode, or
+ *         BLE_HAL_ERROR_BUSY if another thread is dispatching.
+ * @note Call it, and ble_hal_deinit(), from one thread.
+ */
+BleHalStatus ble_hal_dispatch(guint max_iterations, guint budget_us);
+
+// --- Adapter State ---
+// Every org.bluez.Adapter1 is tracked. The adapter cache is filled by the
+// object scan and kept current from Adapter1 PropertiesChanged signals
+// (BLE_HAL_INTEREST_ADAPTER_PROPERTIES), so these getters never touch the bus.
+// They are safe to call from any thread.
+
+typedef void (*BleHalAdapterForeachCb)(const BleHalAdapterInfo* adapter, void* user_data);
+
+/**
+ * @brief Copies the cached state of the default adapter (the first one tracked).
+ * @param out Receives the adapter state.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND if no adapter is known,
+ *         BLE_HAL_ERROR_NOT_INITIALIZED or BLE_HAL_ERROR_INVALID_PARAMS.
+ */
+BleHalStatus ble_hal_get_adapter_info(BleHalAdapterInfo* out);
+
+/**
+ * @brief Copies the cached state of the adapter at 'adapter_path' (e.g. "/org/bluez/hci1").
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ */
+BleHalStatus ble_hal_get_adapter_info_by_path(const char* adapter_path, BleHalAdapterInfo* out);
+
+/**
+ * @brief Returns the number of adapters currently tracked.
+ */
+guint ble_hal_get_adapter_count(void);
+
+/**
+ * @brief Calls 'cb' once for every tracked adapter, in discovery order.
+ * The BleHalAdapterInfo pointer is only valid for the duration of each call,
+ * and 'cb' must not call back into the HAL.
+ * @return Number of adapters visited.
+ */
+guint ble_hal_foreach_adapter(BleHalAdapterForeachCb cb, void* user_data);
+
+// --- Discovery ---
+// BlueZ keeps one discovery filter per D-Bus client and adapter, so the HAL
+// merges the filters of all open sessions on an adapter into the one it sets.
+// Filtering happens in bluetoothd: devices that match no session cause no
+// signal at all. Discovery runs while at least one session is open.
+
+typedef enum {
+    BLE_HAL_DISCOVERY_TRANSPORT_AUTO = 0,   // LE and BR/EDR interleaved
+    BLE_HAL_DISCOVERY_TRANSPORT_LE,
+    BLE_HAL_DISCOVERY_TRANSPORT_BREDR
+} BleHalDiscoveryTransport;
+
+// A filter of all zeroes matches every device.
+typedef struct {
+    BleHalDiscoveryTransport transport;
+    gint16 rssi;                    // Minimum RSSI in dBm, 0 for no threshold
+    guint16 pathloss;               // Maximum pathloss in dB, 0 for none (not together with rssi)
+    const char* const* uuids;       // NULL-terminated service UUIDs, NULL or empty for any
+    gboolean duplicate_data;        // TRUE: report repeated advertising data; FALSE: bluetoothd drops it
+    const char* pattern;            // Address or name prefix, NULL for any
+} BleHalDiscoveryFilter;
+
+/**
+ * @brief Opens a discovery session on an adapter and starts discovery if it
+ * is not running yet. The merged filter is updated when the session's
+ * filter loosens or narrows it:
+ *  - transport: AUTO unless every session asks for the same one;
+ *  - rssi / pathloss: the most permissive value, or none if any session has none;
+ *  - uuids: the union, or any if a session accepts any;
+ *  - duplicate_data: TRUE if any session wants duplicates;
+ *  - pattern: kept only if every session uses the same one.
+ * Sessions therefore see at least the devices their filter matches.
+ *
+ * @param adapter_path Adapter object path, or NULL for the default adapter.
+ * @param filter Devices of interest, or NULL for all.
+ * @param session_id Receives the session handle for ble_hal_stop_discovery().
+ * @param cb Called with the result; runs on the calling thread's
+ *           thread-default GMainContext. On failure the session is closed,
+ *           except for BLE_HAL_ERROR_CANCELLED: BlueZ left the bus and
+ *           discovery restarts for the open sessions when it returns.
+ * @param user_data User data for the callback.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND if there is no default
+ *         adapter, or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_start_discovery(const char* adapter_path, const BleHalDiscoveryFilter* filter,
+                                     guint* session_id, BleHalResultCb cb, void* user_data);
+
+/**
+ * @brief Closes a discovery session. Discovery stops with the last session on
+ * the adapter; otherwise the merged filter is recomputed without it.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND for an unknown session,
+ *         or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_stop_discovery(guint session_id, BleHalResultCb cb, void* user_data);
+
+// --- Connection Scheduler ---
+// Connect / use / release cycles over many peripherals. Scheduled connections
+// wait in priority classes; within a class, flows (e.g. one per application
+// module) take turns so none can crowd out the others. A connection goes to
+// the adapter with the fewest scheduled links among those that know the
+// device, within the per-adapter limits in BleHalConfig.
+
+typedef enum {
+    BLE_HAL_CONNECT_PRIORITY_HIGH = 0,  // Served before any waiting lower class
+    BLE_HAL_CONNECT_PRIORITY_NORMAL,
+    BLE_HAL_CONNECT_PRIORITY_LOW
+} BleHalConnectPriority;
+
+#define BLE_HAL_CONNECT_N_PRIORITIES    3
+
+// Payload of BLE_HAL_EVENT_CONNECTION_LOST. The adapter slot is free again
+// and the ticket has ended; releasing it is no longer needed.
+typedef struct {
+    guint ticket;
+    char path[256];         // Device object path the link used
+} BleHalConnectionLost;
+
+/**
+ * @brief Queues a connection to the device with 'address' (Device1.Connect).
+ * Attempts that bluetoothd aborts with "le-connection-abort-by-local" are
+ * retried with exponential backoff. The link holds its adapter slot until
+ * ble_hal_release_connection(), or until it drops on its own (the device's
+ * Connected property turns false), which is reported as
+ * BLE_HAL_EVENT_CONNECTION_LOST.
+ *
+ * @param priority Class to wait in.
+ * @param flow Caller-chosen queue within the class; flows are served round robin.
+ * @param ticket Receives the handle for ble_hal_release_connection().
+ * @param cb Called once: BLE_HAL_SUCCESS when connected, otherwise the reason
+ *           (BLE_HAL_ERROR_NOT_FOUND if no adapter knows the device,
+ *           BLE_HAL_ERROR_CANCELLED if released first). Runs on the calling
+ *           thread's thread-default GMainContext.
+ * @return BLE_HAL_PENDING or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_schedule_connect(const BleHalAddress* address, BleHalConnectPriority priority, guint flow,
+                                      guint* ticket, BleHalResultCb cb, void* user_data);
+
+/**
+ * @brief Ends a scheduled connection: drops it if still waiting, otherwise
+ * disconnects (Device1.Disconnect) and frees the adapter slot once done.
+ * Links that were lost end by themselves (BLE_HAL_EVENT_CONNECTION_LOST).
+ * @return BLE_HAL_SUCCESS (applied on the HAL context; unknown tickets are
+ *         ignored) or BLE_HAL_ERROR_NOT_INITIALIZED.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_release_connection(guint ticket);
+
+/**
+ * @brief Formats the object path of the device a scheduled connection uses
+ * (which depends on the adapter chosen) into 'out'.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND if the ticket has no
+ *         adapter yet or is unknown, BLE_HAL_ERROR_INVALID_PARAMS if 'size'
+ *         is too small, or BLE_HAL_ERROR_NOT_INITIALIZED.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_get_connection_path(guint ticket, char* out, gsize size);
+
+// --- Operation Chains ---
+// A startup sequence (power on, discover, connect, ...) described as steps
+// with prerequisites rather than nested callbacks. Each step is started as
+// soon as the steps it depends on are done, so independent calls go out
+// together. Power and discovery steps are done once the adapter reports the
+// new state (Adapter1 PropertiesChanged), not merely when BlueZ replies.
+// A step on a powered-off adapter should depend on the adapter's power step.
+
+typedef enum {
+    BLE_HAL_STEP_POWER = 0,         // Adapter1.Powered; skipped if already in that state
+    BLE_HAL_STEP_DISCOVERY,         // ble_hal_start_discovery(); done once the adapter is discovering
+    BLE_HAL_STEP_CONNECT            // ble_hal_schedule_connect(); done once connected
+} BleHalStepType;
+
+#define BLE_HAL_CHAIN_MAX_STEPS                     32
+#define BLE_HAL_CHAIN_DEFAULT_CONFIRM_TIMEOUT_MS    5000
+
+typedef struct {
+    BleHalStepType type;
+    guint32 after;                  // Bit i set: wait for step i (an earlier step) to be done
+    const char* adapter_path;       // POWER, DISCOVERY: NULL for the default adapter
+    gboolean power_on;              // POWER
+    const BleHalDiscoveryFilter* filter; // DISCOVERY: NULL for all devices
+    BleHalAddress address;          // CONNECT
+    BleHalConnectPriority priority; // CONNECT
+    guint flow;                     // CONNECT
+} BleHalChainStep;
+
+/**
+ * @param status BLE_HAL_SUCCESS once every step is done, otherwise the
+ *               failing step's error (BLE_HAL_ERROR_TIMEOUT if the adapter
+ *               did not confirm a state in time).
+ * @param failed_step Index of the step that failed (0 on success).
+ * @param handles On success, per step: the discovery session id
+ *                (DISCOVERY), the connection ticket (CONNECT) or 0; they are
+ *                the caller's to close. NULL on failure.
+ */
+typedef void (*BleHalChainCb)(BleHalStatus status, guint failed_step, const guint* handles, guint n_steps,
+                              void* user_data);
+
+/**
+ * @brief Runs a chain of steps. The steps and the strings they point to are
+ * copied. On failure no further step is started and the discovery sessions
+ * and connections the chain opened are closed again; power changes stay.
+ *
+ * @param steps Up to BLE_HAL_CHAIN_MAX_STEPS steps.
+ * @param confirm_timeout_ms How long a power or discovery step waits for the
+ *                           adapter to report its state after the call
+ *                           succeeded; 0 selects BLE_HAL_CHAIN_DEFAULT_CONFIRM_TIMEOUT_MS.
+ * @param cb Called once; runs on the calling thread's thread-default GMainContext.
+ * @return BLE_HAL_PENDING or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_run_chain(const BleHalChainStep* steps, guint n_steps, guint confirm_timeout_ms,
+                               BleHalChainCb cb, void* user_data);
+
+// --- LE Advertising ---
+// Each instance is one advertising set on the controller, registered with
+// bluetoothd once. Payload updates are signalled as property changes on the
+// registered object, which bluetoothd applies in place: no re-registration
+// and no gap on air, so payloads can rotate at a high rate. An adapter runs
+// as many instances as its controller supports (LEAdvertisingManager1
+// SupportedInstances).
+
+typedef enum {
+    BLE_HAL_ADVERTISING_BROADCAST = 0,  // Non-connectable
+    BLE_HAL_ADVERTISING_PERIPHERAL      // Connectable
+} BleHalAdvertisingType;
+
+// All zeroes: broadcast at bluetoothd's default interval.
+typedef struct {
+    BleHalAdvertisingType type;
+    guint min_interval_ms;          // 0 for the default (needs bluetoothd's experimental features otherwise)
+    guint max_interval_ms;          // 0 for the default
+} BleHalAdvertisingParams;
+
+// The advertised fields; zeroed fields are left out. bluetoothd rejects a
+// registration, and skips an update, whose data does not fit the
+// controller's advertising PDU.
+typedef struct {
+    const char* const* service_uuids;   // NULL-terminated, or NULL
+    guint16 company_id;                 // Manufacturer data, if manufacturer_data_length > 0
+    const guint8* manufacturer_data;
+    gsize manufacturer_data_length;
+    const char* service_data_uuid;      // Service data, if not NULL
+    const guint8* service_data;
+    gsize service_data_length;
+    const char* local_name;             // NULL or empty for none
+    gboolean include_tx_power;
+} BleHalAdvertisingPayload;
+
+/**
+ * @brief Starts advertising 'payload' as a new instance on an adapter.
+ * Everything the parameters point to is copied.
+ *
+ * @param adapter_path Adapter object path, or NULL for the default adapter.
+ * @param params Type and interval, or NULL for the defaults.
+ * @param payload Initial data, or NULL for none.
+ * @param instance_id Receives the handle for ble_hal_advertising_update() and
+ *                    ble_hal_advertising_stop(); updates may be posted at once.
+ * @param cb Called once registered; runs on the calling thread's
+ *           thread-default GMainContext. BLE_HAL_ERROR_BUSY if the controller
+ *           has no free instance. On failure the instance is gone, except for
+ *           BLE_HAL_ERROR_CANCELLED: BlueZ left the bus and the instance is
+ *           registered again when it returns.
+ * @param user_data User data for the callback.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND if there is no default
+ *         adapter, or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_advertising_start(const char* adapter_path, const BleHalAdvertisingParams* params,
+                                       const BleHalAdvertisingPayload* payload, guint* instance_id,
+                                       BleHalResultCb cb, void* user_data);
+
+/**
+ * @brief Replaces the advertised data of an instance. Only the fields that
+ * differ from the current data are signalled; updates posted before the HAL
+ * thread applies them are merged into the newest one.
+ * @return BLE_HAL_SUCCESS (applied on the HAL context), BLE_HAL_ERROR_NOT_FOUND
+ *         for an unknown or stopping instance, BLE_HAL_ERROR_INVALID_PARAMS,
+ *         or BLE_HAL_ERROR_NOT_INITIALIZED.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_advertising_update(guint instance_id, const BleHalAdvertisingPayload* payload);
+
+/**
+ * @brief Stops an instance and frees its controller slot (UnregisterAdvertisement).
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND for an unknown instance,
+ *         or an error code (cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_advertising_stop(guint instance_id, BleHalResultCb cb, void* user_data);
+
+// --- Device Table ---
+
+typedef void (*BleHalDeviceForeachCb)(const BleHalDeviceInfo* device, void* user_data);
+
+/**
+ * @brief Parses a "XX:XX:XX:XX:XX:XX" string into a BleHalAddress.
+ * @return TRUE on success, FALSE if the string is not a valid address.
+ */
+gboolean ble_hal_address_from_string(const char* str, BleHalAddress* out);
+
+/**
+ * @brief Formats a BleHalAddress as "XX:XX:XX:XX:XX:XX" into 'out' (at least 18 bytes).
+ */
+void ble_hal_address_to_string(const BleHalAddress* address, char* out);
+
+// Each adapter has its own device table. The functions below without an
+// adapter path cover the devices of all adapters.
+
+/**
+ * @brief Returns the number of devices currently held in the HAL's device tables.
+ */
+guint ble_hal_get_device_count(void);
+
+/**
+ * @brief Returns the number of devices seen by the adapter at 'adapter_path' (0 if unknown).
+ */
+guint ble_hal_get_adapter_device_count(const char* adapter_path);
+
+/**
+ * @brief Looks up a device by address in the HAL's device tables (no D-Bus traffic).
+ * A device seen by several adapters is returned from the first adapter tracked.
+ *
+ * @param address Device address.
+ * @param out Filled with a snapshot of the device on success.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ */
+BleHalStatus ble_hal_get_device_by_address(const BleHalAddress* address, BleHalDeviceInfo* out);
+
+/**
+ * @brief Looks up a device by its D-Bus object path in the HAL's device table.
+ *
+ * @param object_path Device object path (e.g., "/org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX").
+ * @param out Filled with a snapshot of the device on success.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ */
+BleHalStatus ble_hal_get_device_by_path(const char* object_path, BleHalDeviceInfo* out);
+
+/**
+ * @brief Calls 'cb' once for every device in the device table.
+ * The BleHalDeviceInfo pointer is only valid for the duration of each call,
+ * and 'cb' must not call back into the HAL.
+ * @return Number of devices visited.
+ */
+guint ble_hal_foreach_device(BleHalDeviceForeachCb cb, void* user_data);
+
+/**
+ * @brief Like ble_hal_foreach_device(), restricted to the adapter at 'adapter_path'.
+ * @return Number of devices visited (0 if the adapter is unknown).
+ */
+guint ble_hal_foreach_adapter_device(const char* adapter_path, BleHalDeviceForeachCb cb, void* user_data);
+
+typedef void (*BleHalDeviceRecordCb)(const BleHalDeviceRecord* record, void* user_data);
+
+/**
+ * @brief Calls 'cb' with the compact record of every device, without
+ * formatting names or object paths. Cheaper than ble_hal_foreach_device()
+ * for large device populations; fetch the strings of the devices that
+ * matter with ble_hal_get_device_name() and ble_hal_get_device_path().
+ * The same rules apply to 'cb' as for ble_hal_foreach_device().
+ *
+ * @param adapter_path Restricts the walk to one adapter, or NULL for all.
+ * @return Number of devices visited.
+ */
+guint ble_hal_foreach_device_record(const char* adapter_path, BleHalDeviceRecordCb cb, void* user_data);
+
+/**
+ * @brief Copies the name (or alias) of the device with 'address' into 'out'.
+ * An empty string means BlueZ has not reported a name yet.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ */
+BleHalStatus ble_hal_get_device_name(const BleHalAddress* address, char* out, gsize size);
+
+/**
+ * @brief Formats the D-Bus object path of the device with 'address' into 'out'.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, BLE_HAL_ERROR_INVALID_PARAMS
+ *         if 'size' is too small, or an error code.
+ */
+BleHalStatus ble_hal_get_device_path(const BleHalAddress* address, char* out, gsize size);
+
+// --- GATT Client ---
+
+/**
+ * @brief Receives the value of every notification or indication of a
+ * subscribed characteristic. 'data' points into a buffer the HAL reuses for
+ * the next packet, so it is only valid during the call.
+ * A call with data == NULL and length == 0 means the subscription ended on
+ * its own (link lost or released by BlueZ); no further calls follow.
+ */
+typedef void (*BleHalGattNotifyCb)(const guint8* data, gsize length, void* user_data);
+
+/**
+ * @brief Subscribes to a characteristic through GattCharacteristic1.AcquireNotify.
+ * BlueZ hands back a socket and every notification is read from it directly,
+ * with no D-Bus message or GVariant per packet.
+ *
+ * @param char_path Characteristic object path (e.g. ".../dev_XX_XX_XX_XX_XX_XX/service0010/char0011").
+ * @param notify_cb Called on the application's context for every packet.
+ * @param result_cb Called once the subscription is active or has failed; runs
+ *                  on the calling thread's thread-default GMainContext.
+ * @param user_data User data for both callbacks.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_BUSY if 'char_path' is already
+ *         subscribed, or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_start_notify(const char* char_path, BleHalGattNotifyCb notify_cb,
+                                       BleHalResultCb result_cb, void* user_data);
+
+/**
+ * @brief Ends a subscription made with ble_hal_gatt_start_notify(). Closing
+ * the socket releases the notification in BlueZ. notify_cb is not called
+ * again once this returns on the application's context (from another thread,
+ * a call already in progress may still finish).
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_stop_notify(const char* char_path);
+
+// One piece of a scatter/gather write; the HAL does not copy 'data'.
+typedef struct {
+    const guint8* data;
+    gsize length;
+} BleHalBuffer;
+
+// Bytes a write stream accepts before ble_hal_gatt_write() returns BLE_HAL_ERROR_BUSY.
+#define BLE_HAL_GATT_WRITE_MAX_QUEUED   (64 * 1024)
+
+/**
+ * @brief Opens a write stream to a characteristic through
+ * GattCharacteristic1.AcquireWrite. Every packet written to the returned
+ * socket becomes one Write Without Response, with no D-Bus call per write.
+ * Batches may be queued with ble_hal_gatt_write() before the stream is open;
+ * they are sent once it is.
+ *
+ * @param char_path Characteristic object path.
+ * @param result_cb Called once the stream is open or has failed; runs on the
+ *                  calling thread's thread-default GMainContext.
+ * @param user_data User data for result_cb.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_BUSY if a stream to 'char_path' is
+ *         already open, or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_open_write(const char* char_path, BleHalResultCb result_cb, void* user_data);
+
+/**
+ * @brief Queues one batch on a write stream. The buffers are sent as a single
+ * byte stream cut into packets of the MTU BlueZ reported, each packet gathered
+ * straight from the caller's buffers. Batches are sent in the order queued.
+ *
+ * @param buffers Array of 'n_buffers' pieces. The array is copied; the data
+ *                it points to must stay valid until done_cb runs.
+ * @param done_cb Called once per batch, with BLE_HAL_SUCCESS after its last
+ *                packet was written or BLE_HAL_ERROR if the stream closed
+ *                first; runs on the calling thread's thread-default GMainContext.
+ * @param user_data User data for done_cb.
+ * @return BLE_HAL_PENDING, or without calling done_cb: BLE_HAL_ERROR_BUSY if
+ *         the stream already holds BLE_HAL_GATT_WRITE_MAX_QUEUED bytes (retry
+ *         after a batch completes), BLE_HAL_ERROR_NOT_FOUND if no stream is
+ *         open to 'char_path', or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_write(const char* char_path, const BleHalBuffer* buffers, guint n_buffers,
+                                BleHalResultCb done_cb, void* user_data);
+
+/**
+ * @brief Closes a write stream opened with ble_hal_gatt_open_write(). Batches
+ * not yet written complete with BLE_HAL_ERROR.
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_close_write(const char* char_path);
+
+// --- GATT Server ---
+// Local services for centrals to use, registered with the adapter's
+// GattManager1 as one application. Reads are answered by the HAL from the
+// value last set, without a round trip to the application. Notifications
+// and writes without response travel over sockets bluetoothd acquires
+// (AcquireNotify / AcquireWrite), with no D-Bus message per value; for
+// notifications bluetoothd fans each value out to every subscribed central.
+
+// Characteristic flags (GattCharacteristic1.Flags)
+#define BLE_HAL_GATT_CHR_READ                   (1u << 0)
+#define BLE_HAL_GATT_CHR_WRITE                  (1u << 1)
+#define BLE_HAL_GATT_CHR_WRITE_WITHOUT_RESPONSE (1u << 2)
+#define BLE_HAL_GATT_CHR_NOTIFY                 (1u << 3)
+#define BLE_HAL_GATT_CHR_INDICATE               (1u << 4)
+
+typedef struct {
+    const char* uuid;
+    guint32 flags;                  // BLE_HAL_GATT_CHR_* bits, at least one
+} BleHalGattCharacteristicDef;
+
+typedef struct {
+    const char* uuid;
+    gboolean primary;
+    const BleHalGattCharacteristicDef* characteristics;
+    guint n_characteristics;
+} BleHalGattServiceDef;
+
+/**
+ * @brief Receives every value a central writes to a characteristic, with or
+ * without response. 'data' is only valid during the call.
+ */
+typedef void (*BleHalGattServerWriteCb)(guint char_id, const guint8* data, gsize length, void* user_data);
+
+// Bytes a characteristic accepts before ble_hal_gatt_server_notify() returns BLE_HAL_ERROR_BUSY.
+#define BLE_HAL_GATT_SERVER_NOTIFY_MAX_QUEUED   (64 * 1024)
+
+/**
+ * @brief Exports services and registers them with an adapter. The
+ * definitions are copied.
+ *
+ * @param adapter_path Adapter object path, or NULL for the default adapter.
+ * @param services Array of 'n_services' definitions.
+ * @param write_cb Called on the application's context for every write, or NULL.
+ * @param app_id Receives the handle for ble_hal_gatt_server_unregister().
+ * @param char_ids Receives one id per characteristic, in definition order
+ *                 across all services, or NULL. Ids stay valid until the
+ *                 application is unregistered.
+ * @param result_cb Called once bluetoothd accepted the services; runs on the
+ *                  calling thread's thread-default GMainContext. On failure
+ *                  the application is gone, except for BLE_HAL_ERROR_CANCELLED:
+ *                  BlueZ left the bus and it is registered again when it returns.
+ * @param user_data User data for write_cb and result_cb.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND if there is no default
+ *         adapter, or an error code (result_cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_server_register(const char* adapter_path, const BleHalGattServiceDef* services,
+                                          guint n_services, BleHalGattServerWriteCb write_cb, guint* app_id,
+                                          guint* char_ids, BleHalResultCb result_cb, void* user_data);
+
+/**
+ * @brief Unregisters an application and closes its sockets. Notifications
+ * not yet sent complete with BLE_HAL_ERROR.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND for an unknown application,
+ *         or an error code (result_cb is called with it too).
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_server_unregister(guint app_id, BleHalResultCb result_cb, void* user_data);
+
+/**
+ * @brief Sets the value centrals read from a characteristic (copied).
+ * @return BLE_HAL_SUCCESS, BLE_HAL_ERROR_NOT_FOUND, or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_server_set_value(guint char_id, const guint8* data, gsize length);
+
+/**
+ * @brief Queues one batch of notifications (or indications) on a
+ * characteristic. Like ble_hal_gatt_write(), the buffers are sent as one byte
+ * stream cut into values of the largest size the ATT MTU allows.
+ *
+ * @param done_cb Called once per batch, with BLE_HAL_SUCCESS after its last
+ *                value went to bluetoothd or BLE_HAL_ERROR if the last central
+ *                unsubscribed first; runs on the calling thread's
+ *                thread-default GMainContext.
+ * @return BLE_HAL_PENDING, or without calling done_cb: BLE_HAL_ERROR_BUSY if
+ *         BLE_HAL_GATT_SERVER_NOTIFY_MAX_QUEUED bytes are queued already,
+ *         BLE_HAL_ERROR_NOT_FOUND if no central is subscribed (or the id is
+ *         unknown), or an error code.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_gatt_server_notify(guint char_id, const BleHalBuffer* buffers, guint n_buffers,
+                                        BleHalResultCb done_cb, void* user_data);
+
+// --- L2CAP Channels ---
+// LE connection-oriented channels (L2CAP CoC) opened straight on a kernel
+// socket. Data never goes through D-Bus; the HAL's device table supplies the
+// address, and the channel is a GSource on the application's context.
+
+typedef struct BleHalL2capChannel BleHalL2capChannel;
+
+/**
+ * @brief Receives every SDU read from a channel. 'data' points into a buffer
+ * the HAL reuses, so it is only valid during the call. A call with
+ * data == NULL and length == 0 means the channel was closed by the peer or the
+ * link dropped; no further calls follow, but the handle stays valid until
+ * ble_hal_l2cap_close().
+ */
+typedef void (*BleHalL2capDataCb)(BleHalL2capChannel* channel, const guint8* data, gsize length, void* user_data);
+
+// Bytes a channel accepts before ble_hal_l2cap_write() returns BLE_HAL_ERROR_BUSY.
+#define BLE_HAL_L2CAP_MAX_QUEUED    (256 * 1024)
+
+/**
+ * @brief Opens an LE L2CAP channel to a device in the HAL's device table.
+ * The connect is non-blocking; writes may be queued right away and are sent
+ * once the channel is up.
+ *
+ * @param device_path Device object path (e.g., "/org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX").
+ *                    The socket is bound to the device's adapter.
+ * @param psm LE PSM of the peer's service.
+ * @param data_cb Called on the application's context for every SDU received.
+ * @param connect_cb Called once the channel is connected or has failed; runs
+ *                   on the calling thread's thread-default GMainContext.
+ * @param user_data User data for both callbacks.
+ * @param channel Receives the handle on BLE_HAL_PENDING; release it with
+ *                ble_hal_l2cap_close() whatever the outcome.
+ * @return BLE_HAL_PENDING, BLE_HAL_ERROR_NOT_FOUND if the device or its
+ *         adapter is not tracked, or an error code.
+ * @note Safe to call from any thread. Open channels do not depend on the
+ *       D-Bus connection.
+ */
+BleHalStatus ble_hal_l2cap_connect(const char* device_path, guint16 psm, BleHalL2capDataCb data_cb,
+                                   BleHalResultCb connect_cb, void* user_data, BleHalL2capChannel** channel);
+
+/**
+ * @brief Queues one batch on a channel. Works like ble_hal_gatt_write(): the
+ * buffers are sent as SDUs of the channel's send MTU, gathered straight from
+ * the caller's memory, and done_cb reports the whole batch.
+ * @return BLE_HAL_PENDING, or without calling done_cb: BLE_HAL_ERROR_BUSY if
+ *         BLE_HAL_L2CAP_MAX_QUEUED bytes are already waiting, BLE_HAL_ERROR
+ *         if the channel has closed, or BLE_HAL_ERROR_INVALID_PARAMS.
+ * @note Safe to call from any thread.
+ */
+BleHalStatus ble_hal_l2cap_write(BleHalL2capChannel* channel, const BleHalBuffer* buffers, guint n_buffers,
+                                 BleHalResultCb done_cb, void* user_data);
+
+/**
+ * @brief Returns the channel's send MTU (the largest SDU), or 0 while it is not connected.
+ */
+guint16 ble_hal_l2cap_get_mtu(BleHalL2capChannel* channel);
+
+/**
+ * @brief Closes the channel and releases the handle. A pending connect and
+ * batches not yet sent complete with BLE_HAL_ERROR.
+ * @note Safe to call from any thread; data_cb is not called again once this
+ *       returns on the application's context.
+ */
+void ble_hal_l2cap_close(BleHalL2capChannel* channel);
+
 #endif // BLE_HAL_H_
@@ -1,23 +1,57 @@
 #include <stdio.h>
 #include <string.h>
-#include "ble_hal.h"
+#include "ble_hal_internal.h"
 
 // --- Static Global Variables ---
 static GDBusConnection* dbus_conn = NULL;       // D-Bus system bus connection
 static GMainLoop* app_provided_loop = NULL;     // App-provided GMainLoop
 static GMainLoop* internal_loop = NULL;         // HAL-created GMainLoop
 static guint bluez_name_watch_id = 0;           // Watch ID for BlueZ service name
-static guint object_manager_signal_watch_id = 0; // For InterfacesAdded/Removed
-static BleHalAdapterInfo active_adapter;         // Store info about the selected/active adapter
-static gboolean active_adapter_found = FALSE;
+static HalSubscriptionManager* subscriptions = NULL; // Match rules for BlueZ signals
+static guint32 signal_interests = 0;            // BleHalInterest bits currently requested
+static GPtrArray* adapters = NULL;              // HalAdapter*, in discovery order ([0] is the default adapter)
+// Guards the membership of 'adapters'; changed on the HAL context, read by the public getters.
+static GRWLock adapters_lock;
 
 static BleHalConfig hal_global_config;          // Stored HAL configuration
 static gboolean hal_initialized = FALSE;        // HAL initialization state
 
+// Asynchronous startup (ble_hal_init_async)
+static BleHalResultCb init_ready_cb = NULL;     // Pending readiness callback (cleared once reported)
+static void* init_ready_user_data = NULL;
+static GCancellable* init_cancellable = NULL;   // Cancels the bus lookup on early deinit
+static gboolean bluez_state_pending = FALSE;    // Name watch reported before the bus connection was ready
+static gchar* pending_bluez_owner = NULL;       // Owner from that report (NULL: BlueZ absent)
+static volatile gint scan_jobs_pending = 0;     // Initial-scan stages still running (HAL context + adapters)
+// Advertising reports from the kernel (use_mgmt_scan); set up before any adapter exists.
+static HalMgmtSource* mgmt_source = NULL;
+// Runs while BlueZ is away; the adapter snapshot is dropped when it fires.
+static GSource* restart_grace_source = NULL;
+static gchar* device_cache_path = NULL;         // Copy of BleHalConfig.device_cache_path
+
+typedef struct {
+    HalCommand base;
+    guint32 interests;
+} SetInterestsCommand;
+
+// Work handed from the HAL context to an adapter's context (see hal_adapter_post()).
+typedef struct {
+    HalCommand base;
+    HalAdapter* adapter;
+    gchar* object_path;             // Device path (owned), NULL if unused
+    GVariant* properties;           // a{sv} to apply (owned), NULL if unused
+    GPtrArray* scan_paths;          // Initial scan: device paths (owned), NULL otherwise
+    GPtrArray* scan_properties;     // Initial scan: the matching Device1 a{sv}s (owned)
+    gboolean notify;                // Retirement: report the removals to the application
+} AdapterWork;
+
+// One mgmt advertising report handed to the device's adapter context.
 typedef struct {
-    BleHalResultCb app_callback;
-    void* app_user_data;
-} SetPowerAsyncData;
+    HalCommand base;
+    HalAdapter* adapter;
+    HalMgmtReport report;           // 'eir' points at 'eir_data'
+    guint8 eir_data[];
+} MgmtReportWork;
 
 void generic_result_cb(BleHalStatus error_code, void* user_data) {
     const char* operation_description = (const char*)user_data; // Cast user_data to its expected type
@@ -27,97 +61,239 @@ void generic_result_cb(BleHalStatus error_code, void* user_data) {
     }
 
     if (error_code == BLE_HAL_SUCCESS) {
-        printf("HAL_APP: Operation '%s' completed successfully.\n", operation_description);
+        HAL_LOG_DEBUG("Operation '%s' completed successfully.", operation_description);
     } else {
-        fprintf(stderr, "HAL_APP: Operation '%s' failed with error code: %d\n", operation_description, error_code);
+        HAL_LOG_ERROR("Operation '%s' failed with error code: %d", operation_description, error_code);
     }
 }
 
-static void on_object_manager_signal(GDBusConnection *connection,
-                                     const gchar *sender_name,
-                                     const gchar *object_path,
-                                     const gchar *interface_name,
-                                     const gchar *signal_name,
-                                     GVariant *parameters,
-                                     gpointer user_data);
-
-static void process_adapter_interface(const gchar* object_path, GVariant* interface_properties);
+static void on_interfaces_added(GDBusConnection *connection,
+                                const gchar *sender_name,
+                                const gchar *object_path,
+                                const gchar *interface_name,
+                                const gchar *signal_name,
+                                GVariant *parameters,
+                                gpointer user_data);
+static void on_interfaces_removed(GDBusConnection *connection,
+                                  const gchar *sender_name,
+                                  const gchar *object_path,
+                                  const gchar *interface_name,
+                                  const gchar *signal_name,
+                                  GVariant *parameters,
+                                  gpointer user_data);
+static void on_device_properties_changed(GDBusConnection *connection,
+                                         const gchar *sender_name,
+                                         const gchar *object_path,
+                                         const gchar *interface_name,
+                                         const gchar *signal_name,
+                                         GVariant *parameters,
+                                         gpointer user_data);
+static void on_adapter_properties_changed(GDBusConnection *connection,
+                                          const gchar *sender_name,
+                                          const gchar *object_path,
+                                          const gchar *interface_name,
+                                          const gchar *signal_name,
+                                          GVariant *parameters,
+                                          gpointer user_data);
+
+static HalAdapter* find_adapter(const gchar* adapter_path);
+static HalAdapter* find_device_adapter(const gchar* object_path);
+static void add_adapter(const gchar* object_path, GVariant* interface_properties);
+static void remove_adapter(HalAdapter* adapter, gboolean notify);
+static void remove_all_adapters(gboolean notify);
+static void post_adapter_work(HalAdapter* adapter, HalCommandFunc execute,
+                              const gchar* object_path, GVariant* properties);
+static void adapter_property_cb(HalPropId prop, GVariant* prop_value, void* user_data);
+static void adapter_added_execute(HalCommand* command);
+static void adapter_changed_execute(HalCommand* command);
+static void adapter_retire_execute(HalCommand* command);
+static void device_added_execute(HalCommand* command);
+static void device_changed_execute(HalCommand* command);
+static void device_removed_execute(HalCommand* command);
+static void devices_scanned_execute(HalCommand* command);
+static void mgmt_report_execute(HalCommand* command);
+static void deliver_adv_batch(const BleHalAdvUpdate* updates, guint n_updates, void* user_data);
+static gboolean on_device_expiry(gpointer user_data);
 
 static void initial_object_scan(void);
+static void report_ready(BleHalStatus status);
 
 // D-Bus name watcher callback forward declarations
 static void on_bluez_appeared(GDBusConnection *connection, const gchar *name, const gchar *name_owner, gpointer user_data);
 static void on_bluez_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data);
 
+// --- Signal Subscriptions ---
+
+// BlueZ's ObjectManager lives at "/"; these two are always installed.
+static const HalSignalRule rule_interfaces_added = {
+    "org.freedesktop.DBus.ObjectManager", "InterfacesAdded", "/", NULL, NULL, 0, on_interfaces_added
+};
+static const HalSignalRule rule_interfaces_removed = {
+    "org.freedesktop.DBus.ObjectManager", "InterfacesRemoved", "/", NULL, NULL, 0, on_interfaces_removed
+};
+// PropertiesChanged carries the changed interface in arg0, so each interest is one rule.
+static const HalSignalRule rule_device_properties = {
+    "org.freedesktop.DBus.Properties", "PropertiesChanged", NULL, "/org/bluez", "org.bluez.Device1", 0,
+    on_device_properties_changed
+};
+
+static const HalSignalRule rule_adapter_properties = {
+    "org.freedesktop.DBus.Properties", "PropertiesChanged", NULL, "/org/bluez", "org.bluez.Adapter1", 0,
+    on_adapter_properties_changed
+};
+
+/**
+ * @brief Installs exactly the match rules needed for 'interests'.
+ */
+static void apply_signal_interests(guint32 interests) {
+    const HalSignalRule* rules[8];
+    guint n = 0;
+
+    rules[n++] = &rule_interfaces_added;
+    rules[n++] = &rule_interfaces_removed;
+    if (interests & BLE_HAL_INTEREST_DEVICE_PROPERTIES) rules[n++] = &rule_device_properties;
+    if (interests & BLE_HAL_INTEREST_ADAPTER_PROPERTIES) rules[n++] = &rule_adapter_properties;
+
+    hal_subscriptions_sync(subscriptions, rules, n, NULL);
+}
+
 // --- D-Bus Name Watcher Callbacks ---
 
 /**
- * @brief Handles D-Bus ObjectManager signals (InterfacesAdded/Removed) from org.bluez.
+ * @brief Handles ObjectManager.InterfacesAdded from org.bluez.
  * Used for dynamic discovery of adapters and other BlueZ objects.
  */
-static void on_object_manager_signal(GDBusConnection *connection,
-                                     const gchar *sender_name,
-                                     const gchar *object_path_param,    // Path of the ObjectManager emitting the signal (usually "/")
-                                     const gchar *interface_name_signal,
-                                     const gchar *signal_name,          // "InterfacesAdded" or "InterfacesRemoved"
-                                     GVariant *parameters,
-                                     gpointer user_data) {
-    // Only process signals from org.bluez
-    if (g_strcmp0(sender_name, "org.bluez") != 0) {
-        return;
-    }
-
+static void on_interfaces_added(GDBusConnection *connection,
+                                const gchar *sender_name,
+                                const gchar *object_path_param,    // Path of the ObjectManager emitting the signal ("/")
+                                const gchar *interface_name_signal,
+                                const gchar *signal_name,
+                                GVariant *parameters,
+                                gpointer user_data) {
+    // Sender, member and path were already matched by the bus and by GDBus.
     // The actual object path is within the 'parameters' GVariant.
-    if (g_strcmp0(signal_name, "InterfacesAdded") == 0) {
-        const gchar *actual_object_path;
-        GVariant *interfaces_and_properties; // Dict of interfaces and their properties for the added object
-
-        g_variant_get(parameters, "(&oa{sa{sv}})", &actual_object_path, &interfaces_and_properties);
-        printf("HAL: InterfacesAdded for object %s\n", actual_object_path);
-
-        GVariantIter iter;
-        const gchar *interface_name; // e.g., org.bluez.Adapter1
-        GVariant *properties;
-
-        g_variant_iter_init(&iter, interfaces_and_properties);
-        while (g_variant_iter_next(&iter, "{&s@a{sv}}", &interface_name, &properties)) {
-            if (g_strcmp0(interface_name, "org.bluez.Adapter1") == 0) {
-                if (!active_adapter_found) { // Use the first adapter discovered
-                     process_adapter_interface(actual_object_path, properties);
+    gint64 started_us = g_get_monotonic_time();
+    const gchar *actual_object_path;
+    GVariant *interfaces_and_properties; // Dict of interfaces and their properties for the added object
+
+    g_variant_get(parameters, "(&o@a{sa{sv}})", &actual_object_path, &interfaces_and_properties);
+    HAL_LOG_DEBUG("InterfacesAdded for object %s", actual_object_path);
+
+    GVariantIter iter;
+    const gchar *interface_name; // e.g., org.bluez.Adapter1
+    GVariant *properties;
+
+    g_variant_iter_init(&iter, interfaces_and_properties);
+    while (g_variant_iter_next(&iter, "{&s@a{sv}}", &interface_name, &properties)) {
+        switch (hal_interface_lookup(interface_name)) {
+            case HAL_IFACE_ADAPTER1:
+                add_adapter(actual_object_path, properties);
+                break;
+            case HAL_IFACE_DEVICE1: {
+                HalAdapter* adapter = find_device_adapter(actual_object_path);
+                if (adapter) {
+                    post_adapter_work(adapter, device_added_execute, actual_object_path, properties);
                 } else {
-                    printf("HAL: Ignoring newly added adapter %s (one already active).\n", actual_object_path);
+                    HAL_LOG_DEBUG("Device %s has no tracked adapter, not tracking.", actual_object_path);
                 }
+                break;
             }
-            // TODO: Handle "org.bluez.Device1" here for device discovery later.
-            g_variant_unref(properties);
+            default:
+                break;
         }
-        g_variant_unref(interfaces_and_properties);
-
-    } else if (g_strcmp0(signal_name, "InterfacesRemoved") == 0) {
-        const gchar *actual_object_path;
-        GVariant *interfaces_array; // Array of interface name strings that were removed
-
-        g_variant_get(parameters, "(&oas)", &actual_object_path, &interfaces_array);
-        printf("HAL: InterfacesRemoved for object %s\n", actual_object_path);
-
-        // Check if the removed object was our active adapter
-        if (active_adapter_found && g_strcmp0(actual_object_path, active_adapter.path) == 0) {
-            GVariantIter iter;
-            const gchar *removed_interface_name;
-            g_variant_iter_init(&iter, interfaces_array);
-            while (g_variant_iter_next(&iter, "&s", &removed_interface_name)) {
-                if (g_strcmp0(removed_interface_name, "org.bluez.Adapter1") == 0) {
-                    printf("HAL: Active adapter %s was removed.\n", active_adapter.path);
-                    active_adapter_found = FALSE;
-                    memset(&active_adapter, 0, sizeof(BleHalAdapterInfo));
-                    // TODO: Notify application or try to find another adapter.
-                    break;
+        g_variant_unref(properties);
+    }
+    g_variant_unref(interfaces_and_properties);
+    hal_stats_record_signal(BLE_HAL_STATS_SIGNAL_INTERFACES_ADDED, started_us);
+}
+
+/**
+ * @brief Handles ObjectManager.InterfacesRemoved from org.bluez.
+ */
+static void on_interfaces_removed(GDBusConnection *connection,
+                                  const gchar *sender_name,
+                                  const gchar *object_path_param,
+                                  const gchar *interface_name_signal,
+                                  const gchar *signal_name,
+                                  GVariant *parameters,
+                                  gpointer user_data) {
+    gint64 started_us = g_get_monotonic_time();
+    const gchar *actual_object_path;
+    GVariant *interfaces_array; // Array of interface name strings that were removed
+
+    g_variant_get(parameters, "(&o@as)", &actual_object_path, &interfaces_array);
+    HAL_LOG_DEBUG("InterfacesRemoved for object %s", actual_object_path);
+
+    GVariantIter iter;
+    const gchar *removed_interface_name;
+    g_variant_iter_init(&iter, interfaces_array);
+    while (g_variant_iter_next(&iter, "&s", &removed_interface_name)) {
+        HalAdapter* adapter;
+        switch (hal_interface_lookup(removed_interface_name)) {
+            case HAL_IFACE_ADAPTER1:
+                adapter = find_adapter(actual_object_path);
+                if (adapter) {
+                    HAL_LOG_INFO("Adapter %s was removed.", actual_object_path);
+                    remove_adapter(adapter, TRUE);
                 }
-            }
-            g_variant_unref(interfaces_array);
+                break;
+            case HAL_IFACE_DEVICE1:
+                adapter = find_device_adapter(actual_object_path);
+                if (adapter) {
+                    post_adapter_work(adapter, device_removed_execute, actual_object_path, NULL);
+                }
+                break;
+            default:
+                break;
         }
-        // TODO: Handle removal of other object types (devices, etc.) if tracking them.
     }
+    g_variant_unref(interfaces_array);
+    hal_stats_record_signal(BLE_HAL_STATS_SIGNAL_INTERFACES_REMOVED, started_us);
+}
+
+/**
+ * @brief Handles PropertiesChanged for org.bluez.Device1 (arg0 is matched by the rule).
+ * Hands the change to the device's adapter, which keeps its device table
+ * current and feeds advertisement properties into its batching stage.
+ */
+static void on_device_properties_changed(GDBusConnection *connection,
+                                         const gchar *sender_name,
+                                         const gchar *object_path,     // Device whose properties changed
+                                         const gchar *interface_name_signal,
+                                         const gchar *signal_name,
+                                         GVariant *parameters,
+                                         gpointer user_data) {
+    gint64 started_us = g_get_monotonic_time();
+    HalAdapter* adapter = find_device_adapter(object_path);
+
+    if (adapter) {
+        GVariant *changed_properties = g_variant_get_child_value(parameters, 1); // a{sv}
+        post_adapter_work(adapter, device_changed_execute, object_path, changed_properties);
+        g_variant_unref(changed_properties);
+    }
+    hal_stats_record_signal(BLE_HAL_STATS_SIGNAL_DEVICE_PROPERTIES, started_us);
+}
+
+/**
+ * @brief Handles PropertiesChanged for org.bluez.Adapter1 (arg0 is matched by the rule).
+ * Hands the change to the adapter, which keeps its cached state current.
+ */
+static void on_adapter_properties_changed(GDBusConnection *connection,
+                                          const gchar *sender_name,
+                                          const gchar *object_path,     // Adapter whose properties changed
+                                          const gchar *interface_name_signal,
+                                          const gchar *signal_name,
+                                          GVariant *parameters,
+                                          gpointer user_data) {
+    gint64 started_us = g_get_monotonic_time();
+    HalAdapter* adapter = find_adapter(object_path);
+
+    if (adapter) {
+        GVariant *changed_properties = g_variant_get_child_value(parameters, 1); // a{sv}
+        post_adapter_work(adapter, adapter_changed_execute, NULL, changed_properties);
+        g_variant_unref(changed_properties);
+    }
+    hal_stats_record_signal(BLE_HAL_STATS_SIGNAL_ADAPTER_PROPERTIES, started_us);
 }
 
 /**
@@ -128,51 +304,48 @@ static void on_bluez_appeared(GDBusConnection *connection, // This 'connection'
                               const gchar *name,
                               const gchar *name_owner,
                               gpointer user_data) {
-    printf("HAL: BlueZ service (%s owner: %s) appeared.\n", name, name_owner);
+    HAL_LOG_INFO("BlueZ service (%s owner: %s) appeared.", name, name_owner);
 
-    if (object_manager_signal_watch_id > 0) {
-        // Already subscribed, perhaps BlueZ restarted. Clean up old just in case.
-        // Ensure dbus_conn is valid if you're using the global one here.
-        if (dbus_conn) {
-             g_dbus_connection_signal_unsubscribe(dbus_conn, object_manager_signal_watch_id);
-        }
-        object_manager_signal_watch_id = 0;
-    }
-
-    // Reset adapter state on BlueZ appearance
-    active_adapter_found = FALSE;
-    memset(&active_adapter, 0, sizeof(BleHalAdapterInfo));
-    printf("HAL: Active adapter state reset.\n"); // Added a log for clarity
-
-    if (dbus_conn) { // Ensure dbus_conn is not NULL
-        object_manager_signal_watch_id = g_dbus_connection_signal_subscribe(
-            dbus_conn,                                  // The D-Bus connection
-            "org.bluez",                                // Sender name to watch
-            "org.freedesktop.DBus.ObjectManager",       // Interface name
-            NULL,                                       // Member (signal name, NULL for all signals from this interface)
-            "/",                                        // Object path (subscribe to root for all BlueZ objects)
-            NULL,                                       // Arg0 filter (NULL for any)
-            G_DBUS_SIGNAL_FLAGS_NONE,
-            on_object_manager_signal,                   // Your callback function for these signals
-            NULL,                                       // User data for the callback
-            NULL);                                      // User data free function
-
-        if (object_manager_signal_watch_id == 0) {
-            fprintf(stderr, "HAL Error: Failed to subscribe to ObjectManager signals.\n");
-        } else {
-            printf("HAL: Subscribed to ObjectManager signals (watch ID: %u).\n", object_manager_signal_watch_id);
-            // Perform an initial scan for existing objects ONLY IF subscription was successful
-            initial_object_scan();
-        }
+    if (!dbus_conn) {
+        // Async startup: the bus connection is still pending. attach_bus_connection() replays this.
+        g_free(pending_bluez_owner);
+        pending_bluez_owner = g_strdup(name_owner);
+        bluez_state_pending = TRUE;
+        return;
+    }
+
+    // Adapters kept from a previous owner are diffed against the scan below.
+    hal_source_clear(&restart_grace_source);
+
+    if (subscriptions) {
+        // (Re)bind all match rules to the new owner. If BlueZ restarted, the
+        // rules for the previous owner are removed first.
+        hal_subscriptions_set_sender(subscriptions, name_owner);
+        HAL_LOG_INFO("Installed %u signal match rule(s) for %s.",
+                     hal_subscriptions_count_installed(subscriptions), name_owner);
+
+        // The AddMatch calls were queued first, so no change after this scan is missed.
+        initial_object_scan();
+        hal_discovery_resume(); // Sessions opened before, or kept across a restart
+        hal_advertising_resume();
+        hal_gatt_server_resume();
     } else {
-        fprintf(stderr, "HAL Error: dbus_conn is NULL in on_bluez_appeared, cannot subscribe to signals.\n");
+        HAL_LOG_ERROR("No subscription manager in on_bluez_appeared, cannot subscribe to signals.");
     }
 
     // Notify the application that the BlueZ service is up
-    if (hal_global_config.global_event_cb) {
-        BleHalEventData event_data = {0};
-        hal_global_config.global_event_cb(BLE_HAL_EVENT_BLUEZ_SERVICE_UP, &event_data, hal_global_config.global_event_user_data);
-    }
+    hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                           BLE_HAL_EVENT_BLUEZ_SERVICE_UP, NULL, 0);
+}
+
+/**
+ * @brief BlueZ stayed away too long: its adapters and devices are gone for good.
+ */
+static gboolean on_restart_grace_expired(gpointer user_data) {
+    hal_source_clear(&restart_grace_source);
+    HAL_LOG_WARN("BlueZ did not return; dropping its adapters.");
+    remove_all_adapters(TRUE);
+    return G_SOURCE_REMOVE;
 }
 
 /**
@@ -181,129 +354,825 @@ static void on_bluez_appeared(GDBusConnection *connection, // This 'connection'
 static void on_bluez_vanished(GDBusConnection *connection,
                               const gchar *name,
                               gpointer user_data) {
-    printf("HAL: BlueZ service (%s) vanished.\n", name);
+    HAL_LOG_INFO("BlueZ service (%s) vanished.", name);
+
+    if (!dbus_conn) {
+        // Async startup: the bus connection is still pending (or failing, which reports itself).
+        g_free(pending_bluez_owner);
+        pending_bluez_owner = NULL;
+        bluez_state_pending = TRUE;
+        return;
+    }
 
-    // Unsubscribe from ObjectManager signals if we were subscribed
-    if (object_manager_signal_watch_id > 0 && dbus_conn) { // Ensure dbus_conn is still valid for unsubscription
-        g_dbus_connection_signal_unsubscribe(dbus_conn, object_manager_signal_watch_id);
-        object_manager_signal_watch_id = 0; // Reset the watch ID
-        printf("HAL: Unsubscribed from ObjectManager signals.\n");
+    // Remove the match rules bound to the old owner
+    if (subscriptions) {
+        hal_subscriptions_set_sender(subscriptions, NULL);
+        HAL_LOG_INFO("Removed BlueZ signal match rules.");
     }
 
-    // Clear active adapter information
-    if (active_adapter_found) {
-        active_adapter_found = FALSE;
-        memset(&active_adapter, 0, sizeof(BleHalAdapterInfo)); // Clear the struct
-        printf("HAL: Cleared active adapter info.\n");
+    // Calls to the old owner can no longer succeed; its discovery and registrations ended with it
+    hal_requests_cancel_all(BLE_HAL_ERROR_CANCELLED);
+    hal_discovery_bluez_lost();
+    hal_advertising_bluez_lost();
+    hal_gatt_server_bluez_lost();
+
+    // Keep the adapter and device tables for a while: if BlueZ comes back, the
+    // next object scan is diffed against them instead of rebuilding everything.
+    if (adapters && adapters->len > 0 && !restart_grace_source) {
+        guint grace_ms = hal_global_config.bluez_restart_grace_ms ? hal_global_config.bluez_restart_grace_ms
+                                                                  : BLE_HAL_BLUEZ_RESTART_DEFAULT_GRACE_MS;
+        restart_grace_source = hal_timeout_source_add(grace_ms, on_restart_grace_expired, NULL);
+        HAL_LOG_INFO("Keeping %u adapter(s) for %u ms in case BlueZ restarts.", adapters->len, grace_ms);
     }
 
     // Notify the application
-    if (hal_global_config.global_event_cb) {
-        BleHalEventData event_data = {0};
-        hal_global_config.global_event_cb(BLE_HAL_EVENT_BLUEZ_SERVICE_DOWN, &event_data, hal_global_config.global_event_user_data);
+    hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                           BLE_HAL_EVENT_BLUEZ_SERVICE_DOWN, NULL, 0);
+
+    // BlueZ not running at startup is a known state too.
+    report_ready(BLE_HAL_SUCCESS);
+}
+
+// --- Adapter Table (HAL context) ---
+
+// The HAL context is the only writer of 'adapters', so lookups from it need no lock.
+static HalAdapter* find_adapter(const gchar* adapter_path) {
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        if (strcmp(adapter->path, adapter_path) == 0) return adapter;
+    }
+    return NULL;
+}
+
+static HalAdapter* find_device_adapter(const gchar* object_path) {
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        if (hal_adapter_owns_path(adapter, object_path)) return adapter;
+    }
+    return NULL;
+}
+
+static void adapter_work_finalize(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    hal_pool_free(work->object_path);
+    if (work->properties) g_variant_unref(work->properties);
+    if (work->scan_paths) g_ptr_array_unref(work->scan_paths);
+    if (work->scan_properties) g_ptr_array_unref(work->scan_properties);
+}
+
+static AdapterWork* adapter_work_new(HalAdapter* adapter, HalCommandFunc execute) {
+    AdapterWork* work = hal_command_new(sizeof(AdapterWork), execute, adapter_work_finalize, NULL, NULL);
+    work->adapter = adapter;
+    return work;
+}
+
+static void post_adapter_work(HalAdapter* adapter, HalCommandFunc execute,
+                              const gchar* object_path, GVariant* properties) {
+    AdapterWork* work = adapter_work_new(adapter, execute);
+    work->object_path = hal_pool_strdup(object_path);
+    work->properties = properties ? g_variant_ref(properties) : NULL;
+    hal_adapter_post(adapter, &work->base);
+}
+
+static void set_adapter_flag(HalAdapterState* state, guint8 flag, gboolean on) {
+    if (on) {
+        state->flags |= flag;
+    } else {
+        state->flags &= ~flag;
+    }
+}
+
+/**
+ * @brief Decodes one org.bluez.Adapter1 property into a HalAdapterState.
+ */
+static void adapter_property_cb(HalPropId prop, GVariant* prop_value, void* user_data) {
+    HalAdapterState* state = (HalAdapterState*)user_data;
+
+    switch (prop) {
+        case HAL_PROP_ADAPTER1_ADDRESS:
+            set_adapter_flag(state, HAL_ADAPTER_FLAG_HAS_ADDRESS,
+                             ble_hal_address_from_string(g_variant_get_string(prop_value, NULL), &state->address));
+            break;
+        case HAL_PROP_ADAPTER1_NAME:
+            g_free(state->name);
+            state->name = g_variant_dup_string(prop_value, NULL);
+            break;
+        case HAL_PROP_ADAPTER1_POWERED:
+            set_adapter_flag(state, HAL_ADAPTER_FLAG_POWERED, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_ADAPTER1_DISCOVERING:
+            set_adapter_flag(state, HAL_ADAPTER_FLAG_DISCOVERING, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_ADAPTER1_DISCOVERABLE:
+            set_adapter_flag(state, HAL_ADAPTER_FLAG_DISCOVERABLE, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_ADAPTER1_PAIRABLE:
+            set_adapter_flag(state, HAL_ADAPTER_FLAG_PAIRABLE, g_variant_get_boolean(prop_value));
+            break;
+        default:
+            break; // Add more properties as needed from org.bluez.Adapter1
     }
 }
 
 /**
- * @brief Processes properties for a discovered org.bluez.Adapter1 interface.
+ * @brief Creates the record for the adapter at 'path', taking 'state'. It is
+ * not tracked until start_adapter().
  */
-static void process_adapter_interface(const gchar* object_path, GVariant* properties) {
-    if (active_adapter_found) {
-        // For simplicity, we'll just use the first adapter found.
-        // More sophisticated logic could allow selecting or managing multiple.
-        printf("HAL: Already have an active adapter (%s), ignoring new one: %s\n", active_adapter.path, object_path);
+static HalAdapter* new_adapter(const gchar* path, HalAdapterState* state) {
+    HalAdapter* adapter = hal_adapter_new(path, hal_global_config.use_adapter_threads);
+    adapter->state = *state;
+    memset(state, 0, sizeof(*state));
+    if (hal_global_config.adv_batch_cb) {
+        adapter->batch = hal_adv_batch_new(adapter->devices, adapter->context,
+                                           hal_global_config.adv_batch_interval_ms,
+                                           hal_global_config.adv_batch_max_entries,
+                                           deliver_adv_batch,
+                                           NULL);
+    }
+    if (hal_global_config.device_max_age_ms) {
+        guint interval_ms = CLAMP(hal_global_config.device_max_age_ms / 4, 1000, 60000);
+        adapter->expiry_source = hal_timeout_source_attach(adapter->context, interval_ms, on_device_expiry, adapter);
+    }
+    return adapter;
+}
+
+/**
+ * @brief Starts the adapter's context and adds it to the tracked adapters.
+ * Frees it on failure.
+ */
+static gboolean start_adapter(HalAdapter* adapter) {
+    if (!hal_adapter_start(adapter)) {
+        hal_adapter_free(adapter);
+        return FALSE;
+    }
+
+    g_rw_lock_writer_lock(&adapters_lock);
+    g_ptr_array_add(adapters, adapter);
+    g_rw_lock_writer_unlock(&adapters_lock);
+    return TRUE;
+}
+
+/**
+ * @brief Starts tracking the org.bluez.Adapter1 at 'object_path'.
+ */
+static void add_adapter(const gchar* object_path, GVariant* properties) {
+    if (find_adapter(object_path)) {
+        return; // Already tracked (seen by both InterfacesAdded and the scan)
+    }
+
+    HAL_LOG_DEBUG("Found potential adapter at %s", object_path);
+    HalAdapterState state = {0};
+    hal_props_foreach(HAL_IFACE_ADAPTER1, properties, adapter_property_cb, &state);
+
+    // Basic check if we got essential info
+    if (!(state.flags & HAL_ADAPTER_FLAG_HAS_ADDRESS)) {
+        HAL_LOG_WARN("Adapter at %s did not have an address, not using.", object_path);
+        hal_adapter_state_clear(&state);
         return;
     }
 
-    printf("HAL: Found potential adapter at %s\n", object_path);
-    BleHalAdapterInfo new_adapter_info = {0};
-    strncpy(new_adapter_info.path, object_path, sizeof(new_adapter_info.path) - 1);
+    HalAdapter* adapter = new_adapter(object_path, &state);
+    BleHalAdapterInfo info;
+    hal_adapter_to_info(adapter, &info);
+    if (!start_adapter(adapter)) {
+        return;
+    }
 
-    GVariantIter iter;
-    const gchar *prop_name;
-    GVariant *prop_value;
-
-    g_variant_iter_init(&iter, properties);
-    while (g_variant_iter_next(&iter, "{&sv}", &prop_name, &prop_value)) {
-        if (g_strcmp0(prop_name, "Address") == 0 && g_variant_is_of_type(prop_value, G_VARIANT_TYPE_STRING)) {
-            strncpy(new_adapter_info.address, g_variant_get_string(prop_value, NULL), sizeof(new_adapter_info.address) - 1);
-        } else if (g_strcmp0(prop_name, "Name") == 0 && g_variant_is_of_type(prop_value, G_VARIANT_TYPE_STRING)) {
-            strncpy(new_adapter_info.name, g_variant_get_string(prop_value, NULL), sizeof(new_adapter_info.name) - 1);
-        } else if (g_strcmp0(prop_name, "Powered") == 0 && g_variant_is_of_type(prop_value, G_VARIANT_TYPE_BOOLEAN)) {
-            new_adapter_info.powered = g_variant_get_boolean(prop_value);
+    HAL_LOG_INFO("Tracking adapter %s, Address: %s, Name: %s, Powered: %s (%u adapter(s))",
+                 info.path, info.address, info.name, info.powered ? "on" : "off", adapters->len);
+    post_adapter_work(adapter, adapter_added_execute, NULL, NULL);
+
+    // Issued from here so the result is reported on the HAL context, which outlives the adapter.
+    if (!info.powered) {
+        HAL_LOG_INFO("Adapter %s is not powered on. Attempting to power on...", info.address);
+        ble_hal_set_adapter_power(info.path, TRUE, generic_result_cb, "SetPowerOn");
+    }
+}
+
+/**
+ * @brief Takes one adapter from the warm-start cache. Loaded records stay
+ * private to 'user_data' until their device tables are filled.
+ */
+static HalAdapter* adopt_cached_adapter(const gchar* path, HalAdapterState* state, void* user_data) {
+    GPtrArray* loaded = (GPtrArray*)user_data;
+
+    gboolean duplicate = FALSE;
+    for (guint i = 0; i < loaded->len && !duplicate; i++) {
+        duplicate = g_strcmp0(((HalAdapter*)g_ptr_array_index(loaded, i))->path, path) == 0;
+    }
+    if (duplicate || !(state->flags & HAL_ADAPTER_FLAG_HAS_ADDRESS)) {
+        hal_adapter_state_clear(state);
+        return NULL;
+    }
+
+    HalAdapter* adapter = new_adapter(path, state);
+    g_ptr_array_add(loaded, adapter);
+    return adapter;
+}
+
+/**
+ * @brief Fills the adapter table from the warm-start cache. Nothing is
+ * reported; the first object scan diffs BlueZ's tree against these records
+ * as it does after a BlueZ restart, and if BlueZ is absent they expire with
+ * the restart grace period.
+ */
+static void load_device_cache(void) {
+    GPtrArray* loaded = g_ptr_array_new();
+
+    if (hal_cache_load(device_cache_path, adopt_cached_adapter, loaded)) {
+        for (guint i = 0; i < loaded->len; i++) {
+            start_adapter(g_ptr_array_index(loaded, i));
         }
-        // Add more properties as needed from org.bluez.Adapter1
-        g_variant_unref(prop_value);
     }
+    g_ptr_array_free(loaded, TRUE);
+}
 
-    // Basic check if we got essential info
-    if (strlen(new_adapter_info.address) > 0) {
-        active_adapter = new_adapter_info;
-        active_adapter_found = TRUE;
-        printf("HAL: Configured active adapter: %s, Address: %s, Name: %s, Powered: %s\n",
-               active_adapter.path, active_adapter.address, active_adapter.name,
-               active_adapter.powered ? "on" : "off");
-
-        // TODO: Notify application about adapter readiness or proceed with next steps
-        // (e.g., if auto-scan on adapter ready is a feature)
-
-        // If the adapter is not powered, the application might need to be notified,
-        // or the HAL could attempt to power it on if that's desired functionality.
-        // Example: ble_hal_power_on_adapter(active_adapter.path); (to be implemented)
-        if (active_adapter_found && !active_adapter.powered) {
-            printf("HAL App: Adapter %s is not powered on. Attempting to power on...\n", active_adapter.address);
-            ble_hal_set_adapter_power(active_adapter.path, TRUE, generic_result_cb, "SetPowerOn");
+/**
+ * @brief Stops tracking 'adapter'. Its devices are dropped on its own context,
+ * so the application sees them go before the adapter itself.
+ */
+static void remove_adapter(HalAdapter* adapter, gboolean notify) {
+    g_rw_lock_writer_lock(&adapters_lock);
+    g_ptr_array_remove(adapters, adapter);
+    g_rw_lock_writer_unlock(&adapters_lock);
+    hal_chain_adapters_changed(); // Steps waiting on it fail
+
+    AdapterWork* work = adapter_work_new(adapter, adapter_retire_execute);
+    work->notify = notify;
+    hal_adapter_post(adapter, &work->base);
+    hal_adapter_free(adapter); // Waits for the retirement to run
+}
+
+static void remove_all_adapters(gboolean notify) {
+    if (!adapters || adapters->len == 0) return;
+
+    guint count = adapters->len;
+    while (adapters->len > 0) {
+        remove_adapter(g_ptr_array_index(adapters, adapters->len - 1), notify);
+    }
+    HAL_LOG_INFO("Cleared %u tracked adapter(s).", count);
+}
+
+// --- Adapter Work (adapter context) ---
+
+static void adapter_added_execute(HalCommand* command) {
+    HalAdapter* adapter = ((AdapterWork*)command)->adapter;
+
+    // Only this context writes adapter->state, so it can be read here unlocked.
+    BleHalAdapterInfo info;
+    hal_adapter_to_info(adapter, &info);
+    hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                           BLE_HAL_EVENT_ADAPTER_ADDED, &info, sizeof(info));
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void adapter_changed_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    HalAdapter* adapter = work->adapter;
+
+    HalAdapterState updated = adapter->state;
+    updated.name = g_strdup(adapter->state.name);
+    hal_props_foreach(HAL_IFACE_ADAPTER1, work->properties, adapter_property_cb, &updated);
+
+    if (hal_adapter_state_equal(&updated, &adapter->state)) {
+        hal_adapter_state_clear(&updated);
+    } else {
+        g_rw_lock_writer_lock(&adapter->lock);
+        HalAdapterState previous = adapter->state;
+        adapter->state = updated;
+        g_rw_lock_writer_unlock(&adapter->lock);
+        guint8 changed = previous.flags ^ updated.flags;
+        hal_adapter_state_clear(&previous);
+
+        BleHalAdapterInfo info;
+        hal_adapter_to_info(adapter, &info);
+        HAL_LOG_DEBUG("Adapter %s updated (Powered: %s, Discovering: %s).", info.path,
+                      info.powered ? "on" : "off", info.discovering ? "yes" : "no");
+        if (changed & (HAL_ADAPTER_FLAG_POWERED | HAL_ADAPTER_FLAG_DISCOVERING)) {
+            hal_chain_adapters_changed(); // Chain steps may wait for this state
         }
+        hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                               BLE_HAL_EVENT_ADAPTER_CHANGED, &info, sizeof(info));
+    }
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void emit_device_event(BleHalEvent event_type, const BleHalDeviceInfo* info) {
+    hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                           event_type, info, sizeof(*info));
+}
+
+static void set_device_flag(HalDevice* device, guint32 flag, gboolean on) {
+    if (on) {
+        device->flags |= flag;
     } else {
-        printf("HAL: Adapter at %s did not have an address, not using.\n", object_path);
+        device->flags &= ~flag;
     }
 }
 
 /**
- * @brief Callback for GetManagedObjects D-Bus method.
+ * @brief Applies one org.bluez.Device1 property to a device table record.
+ * The value's type was checked by the property dispatcher.
  */
-static void on_get_managed_objects_reply(GObject *source_object, GAsyncResult *res, gpointer user_data) {
-    GError *error = NULL;
-    GVariant *result_tuple = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+static void apply_device_property(HalDeviceTable* table, HalDevice* device, HalPropId prop, GVariant* prop_value) {
+    switch (prop) {
+        case HAL_PROP_DEVICE1_ADDRESS_TYPE:
+            device->address_type = g_strcmp0(g_variant_get_string(prop_value, NULL), "random") == 0
+                                       ? BLE_HAL_ADDRESS_TYPE_RANDOM : BLE_HAL_ADDRESS_TYPE_PUBLIC;
+            break;
+        case HAL_PROP_DEVICE1_ALIAS:
+            // Prefer the advertised Name; Alias is only a fallback until a Name shows up.
+            if (hal_device_table_get_name(table, device)) break;
+            /* fall through */
+        case HAL_PROP_DEVICE1_NAME:
+            hal_device_table_take_name(table, device, g_variant_dup_string(prop_value, NULL));
+            break;
+        case HAL_PROP_DEVICE1_RSSI:
+            device->rssi = g_variant_get_int16(prop_value);
+            device->flags |= HAL_DEVICE_FLAG_HAS_RSSI;
+            break;
+        case HAL_PROP_DEVICE1_TX_POWER:
+            device->tx_power = g_variant_get_int16(prop_value);
+            device->flags |= HAL_DEVICE_FLAG_HAS_TX_POWER;
+            break;
+        case HAL_PROP_DEVICE1_PAIRED:
+            set_device_flag(device, HAL_DEVICE_FLAG_PAIRED, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_DEVICE1_CONNECTED:
+            if ((device->flags & HAL_DEVICE_FLAG_CONNECTED) && !g_variant_get_boolean(prop_value)) {
+                gchar path[256];
+                hal_device_table_format_path(table, device, path, sizeof(path));
+                hal_connect_link_lost(path); // Frees a scheduled link's slot
+            }
+            set_device_flag(device, HAL_DEVICE_FLAG_CONNECTED, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_DEVICE1_TRUSTED:
+            set_device_flag(device, HAL_DEVICE_FLAG_TRUSTED, g_variant_get_boolean(prop_value));
+            break;
+        case HAL_PROP_DEVICE1_BLOCKED:
+            set_device_flag(device, HAL_DEVICE_FLAG_BLOCKED, g_variant_get_boolean(prop_value));
+            break;
+        default:
+            break; // Add more properties as needed from org.bluez.Device1
+    }
+}
 
-    if (error) {
-        fprintf(stderr, "HAL Error: GetManagedObjects failed: %s\n", error->message);
-        g_error_free(error);
+typedef struct {
+    HalAdapter* adapter;
+    HalDevice* device;
+    gboolean skip_adv;              // Advertisement fields arrive from the mgmt socket instead
+    gint64 now_us;                  // Stamped into last_seen_us by advertisement fields
+} DevicePropertyTarget;
+
+static gboolean is_adv_property(HalPropId prop) {
+    return prop == HAL_PROP_DEVICE1_RSSI || prop == HAL_PROP_DEVICE1_TX_POWER ||
+           prop == HAL_PROP_DEVICE1_MANUFACTURER_DATA || prop == HAL_PROP_DEVICE1_SERVICE_DATA;
+}
+
+/**
+ * @brief Property dispatcher callback for Device1: updates the record and
+ * feeds advertisement fields into the adapter's batching stage.
+ */
+static void device_property_cb(HalPropId prop, GVariant* prop_value, void* user_data) {
+    DevicePropertyTarget* target = (DevicePropertyTarget*)user_data;
+    if (is_adv_property(prop)) {
+        if (target->skip_adv) return;
+        target->device->last_seen_us = target->now_us;
+        if (!hal_adv_filter_accepts(prop, prop_value)) return; // Never batched or decoded further
+    }
+    apply_device_property(target->adapter->devices, target->device, prop, prop_value);
+    hal_adv_batch_add(target->adapter->batch, target->device, prop, prop_value);
+}
+
+// Devices the user set up or is using are never evicted.
+#define EVICTION_PROTECTED_FLAGS \
+    (HAL_DEVICE_FLAG_PAIRED | HAL_DEVICE_FLAG_CONNECTED | HAL_DEVICE_FLAG_TRUSTED | HAL_DEVICE_FLAG_BLOCKED)
+
+// Collects a removed device's info (user_data: { adapter, GArray of BleHalDeviceInfo }).
+static void collect_swept_device_cb(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    HalAdapter* adapter = (HalAdapter*)((gpointer*)user_data)[0];
+    GArray* infos = (GArray*)((gpointer*)user_data)[1];
+    BleHalDeviceInfo info;
+
+    hal_device_to_info(table, device, &info);
+    g_array_append_val(infos, info);
+    hal_adv_batch_forget(adapter->batch, device);
+}
+
+/**
+ * @brief Evicts the least recently seen devices once the adapter's table is
+ * over BleHalConfig's device limit or memory budget, sparing the record keyed
+ * 'inserted_key' whose insert got it there. Call with the adapter lock held
+ * for writing; returns the evicted devices for finish_evictions(), or NULL if
+ * the table is within its limits.
+ */
+static GArray* enforce_device_limits(HalAdapter* adapter, guint64 inserted_key) {
+    HalDeviceTable* table = adapter->devices;
+    guint max_count = hal_global_config.max_devices_per_adapter;
+    gsize max_bytes = hal_global_config.device_memory_budget_bytes;
+    gboolean over_count = max_count && hal_device_table_count(table) > max_count;
+    gboolean over_budget = max_bytes && hal_device_table_used_bytes(table) > max_bytes;
+
+    if (!over_count && !over_budget) return NULL;
+
+    GArray* evicted = g_array_new(FALSE, FALSE, sizeof(BleHalDeviceInfo));
+    gpointer evict_data[2] = { adapter, evicted };
+    // Evicting below the limit leaves room, so the next passes are a while away.
+    if (over_count) {
+        hal_stats_counter_add(HAL_STATS_COUNTER_EVICTED_COUNT,
+                              hal_device_table_evict(table, max_count - max_count / 8, 0, EVICTION_PROTECTED_FLAGS,
+                                                     inserted_key, collect_swept_device_cb, evict_data));
+    }
+    if (max_bytes && hal_device_table_used_bytes(table) > max_bytes) {
+        hal_stats_counter_add(HAL_STATS_COUNTER_EVICTED_MEMORY,
+                              hal_device_table_evict(table, 0, max_bytes - max_bytes / 8, EVICTION_PROTECTED_FLAGS,
+                                                     inserted_key, collect_swept_device_cb, evict_data));
+    }
+    HAL_LOG_DEBUG("Evicted %u device(s) of %s (%u left).", evicted->len, adapter->path,
+                  hal_device_table_count(table));
+    return evicted;
+}
+
+/**
+ * @brief Reports evicted devices to the application and, if configured, has
+ * BlueZ drop them as well. Call without the adapter lock held.
+ */
+static void finish_evictions(HalAdapter* adapter, GArray* evicted) {
+    if (!evicted) return;
+
+    for (guint i = 0; i < evicted->len; i++) {
+        const BleHalDeviceInfo* info = &g_array_index(evicted, BleHalDeviceInfo, i);
+        emit_device_event(BLE_HAL_EVENT_DEVICE_REMOVED, info);
+        if (hal_global_config.remove_evicted_devices) {
+            // Its InterfacesRemoved finds no record left to remove.
+            hal_request_submit(hal_request_new(sizeof(HalRequest), adapter->path, "org.bluez.Adapter1",
+                                               "RemoveDevice", g_variant_new("(o)", info->path),
+                                               NULL, 0, NULL, NULL));
+        }
+    }
+    g_array_free(evicted, TRUE);
+}
+
+/**
+ * @brief Processes properties for a discovered org.bluez.Device1 interface
+ * and inserts (or refreshes) the device in its adapter's device table.
+ */
+static void update_device(HalAdapter* adapter, const gchar* object_path, GVariant* properties, guint32 mark) {
+    const gchar* address_str = NULL;
+    BleHalAddress address;
+    guint64 path_key;
+
+    if (!g_variant_lookup(properties, "Address", "&s", &address_str) ||
+        !ble_hal_address_from_string(address_str, &address)) {
+        HAL_LOG_DEBUG("Device at %s did not have a valid address, not tracking.", object_path);
         return;
     }
+    // Records keep no path of their own; it is rebuilt from the address.
+    if (!hal_device_table_path_to_key(adapter->devices, object_path, &path_key) ||
+        path_key != hal_address_pack(&address)) {
+        HAL_LOG_DEBUG("Device at %s does not match its address %s, not tracking.", object_path, address_str);
+        return;
+    }
+
+    gboolean created = FALSE;
+    BleHalDeviceInfo info;
+    GArray* evicted = NULL;
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    DevicePropertyTarget target = {
+        adapter,
+        hal_device_table_insert(adapter->devices, path_key, &created),
+        FALSE,
+        g_get_monotonic_time()
+    };
+    if (!target.device) {
+        g_rw_lock_writer_unlock(&adapter->lock);
+        return;
+    }
+
+    hal_props_foreach(HAL_IFACE_DEVICE1, properties, device_property_cb, &target);
+    target.device->flags |= mark;
+    if (created) {
+        hal_device_to_info(adapter->devices, target.device, &info); // Last use of target.device
+        evicted = enforce_device_limits(adapter, path_key);
+    }
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    // Callbacks run without the lock held so they may call the device getters.
+    if (created) {
+        emit_device_event(BLE_HAL_EVENT_DEVICE_ADDED, &info);
+    }
+    finish_evictions(adapter, evicted);
+    hal_adv_batch_flush_if_full(adapter->batch);
+}
+
+static void device_added_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    update_device(work->adapter, work->object_path, work->properties, 0);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void device_changed_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    HalAdapter* adapter = work->adapter;
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    DevicePropertyTarget target = {
+        adapter, hal_device_table_lookup_path(adapter->devices, work->object_path), mgmt_source != NULL,
+        g_get_monotonic_time()
+    };
+    if (target.device) {
+        hal_props_foreach(HAL_IFACE_DEVICE1, work->properties, device_property_cb, &target);
+    }
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    hal_adv_batch_flush_if_full(adapter->batch);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief Removes the device at 'object_path' from its adapter's device table, if tracked.
+ */
+static void device_removed_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    HalAdapter* adapter = work->adapter;
+    BleHalDeviceInfo info;
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    HalDevice* device = hal_device_table_lookup_path(adapter->devices, work->object_path);
+    if (device) {
+        hal_device_to_info(adapter->devices, device, &info);
+        hal_adv_batch_forget(adapter->batch, device);
+        hal_device_table_remove(adapter->devices, device);
+    }
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    if (device) {
+        HAL_LOG_DEBUG("Device %s was removed.", work->object_path);
+        emit_device_event(BLE_HAL_EVENT_DEVICE_REMOVED, &info);
+    }
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief Applies an object scan to the adapter's device table. Listed devices
+ * are added or refreshed; records the scan did not list are left over from a
+ * previous BlueZ instance and are removed.
+ */
+static void devices_scanned_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    HalAdapter* adapter = work->adapter;
+
+    for (guint i = 0; i < work->scan_paths->len; i++) {
+        update_device(adapter, g_ptr_array_index(work->scan_paths, i),
+                      g_ptr_array_index(work->scan_properties, i), HAL_DEVICE_FLAG_SCANNED);
+    }
+
+    GArray* removed = g_array_new(FALSE, FALSE, sizeof(BleHalDeviceInfo));
+    gpointer sweep_data[2] = { adapter, removed };
+    g_rw_lock_writer_lock(&adapter->lock);
+    hal_device_table_sweep(adapter->devices, HAL_DEVICE_FLAG_SCANNED, collect_swept_device_cb, sweep_data);
+    g_rw_lock_writer_unlock(&adapter->lock);
+    for (guint i = 0; i < removed->len; i++) {
+        emit_device_event(BLE_HAL_EVENT_DEVICE_REMOVED, &g_array_index(removed, BleHalDeviceInfo, i));
+    }
+
+    HAL_LOG_INFO("Adapter %s holds %u device(s) after object scan (%u stale removed).", adapter->path,
+                 hal_device_table_count(adapter->devices), removed->len);
+    g_array_free(removed, TRUE);
+
+    // The last stage to finish reports readiness, after every device event it emitted.
+    if (g_atomic_int_dec_and_test(&scan_jobs_pending)) {
+        report_ready(BLE_HAL_SUCCESS);
+    }
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief Applies one mgmt advertising report, creating the device record if
+ * BlueZ has not announced it yet.
+ */
+static void mgmt_report_execute(HalCommand* command) {
+    MgmtReportWork* work = (MgmtReportWork*)command;
+    HalAdapter* adapter = work->adapter;
+    guint64 addr_key = hal_address_pack(&work->report.address);
+    gboolean created = FALSE;
+    BleHalDeviceInfo info;
+    GArray* evicted = NULL;
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    // The Device1 object BlueZ creates later has the same address, so its InterfacesAdded lands on this record.
+    DevicePropertyTarget target = {
+        adapter, hal_device_table_insert(adapter->devices, addr_key, &created), FALSE, g_get_monotonic_time()
+    };
+    if (target.device) {
+        target.device->address_type = work->report.address_type;
+        hal_mgmt_report_foreach(&work->report, device_property_cb, &target);
+        if (created) {
+            hal_device_to_info(adapter->devices, target.device, &info);
+            evicted = enforce_device_limits(adapter, addr_key);
+        }
+    }
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    if (created) {
+        emit_device_event(BLE_HAL_EVENT_DEVICE_ADDED, &info);
+    }
+    finish_evictions(adapter, evicted);
+    hal_adv_batch_flush_if_full(adapter->batch);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief mgmt socket callback (HAL context): routes the report to its adapter.
+ */
+static void on_mgmt_report(const HalMgmtReport* report, void* user_data) {
+    gint64 started_us = g_get_monotonic_time();
+    gchar adapter_path[32];
+
+    g_snprintf(adapter_path, sizeof(adapter_path), "/org/bluez/hci%u", report->index);
+    HalAdapter* adapter = find_adapter(adapter_path);
+    if (adapter) { // Otherwise not (yet) announced by BlueZ
+        MgmtReportWork* work = hal_command_new(sizeof(MgmtReportWork) + report->eir_len, mgmt_report_execute,
+                                               NULL, NULL, NULL);
+        work->adapter = adapter;
+        work->report = *report;
+        memcpy(work->eir_data, report->eir, report->eir_len);
+        work->report.eir = work->eir_data;
+        hal_adapter_post(adapter, &work->base);
+    }
+    hal_stats_record_signal(BLE_HAL_STATS_SIGNAL_MGMT_DEVICE_FOUND, started_us);
+}
+
+static void collect_device_info_cb(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    GArray* infos = (GArray*)user_data;
+    BleHalDeviceInfo info;
+    hal_device_to_info(table, device, &info);
+    g_array_append_val(infos, info);
+}
+
+/**
+ * @brief Last work item of a removed adapter: drops its devices and, if
+ * 'notify' is set, reports them and then the adapter itself to the application.
+ */
+static void adapter_retire_execute(HalCommand* command) {
+    AdapterWork* work = (AdapterWork*)command;
+    HalAdapter* adapter = work->adapter;
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    guint count = hal_device_table_count(adapter->devices);
+    GArray* removed = g_array_sized_new(FALSE, FALSE, sizeof(BleHalDeviceInfo), count);
+    if (work->notify) {
+        hal_device_table_foreach(adapter->devices, collect_device_info_cb, removed);
+    }
+    hal_adv_batch_reset(adapter->batch);
+    hal_device_table_clear(adapter->devices);
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    if (count > 0) {
+        HAL_LOG_INFO("Cleared %u tracked device(s) of %s.", count, adapter->path);
+    }
+    for (guint i = 0; i < removed->len; i++) {
+        emit_device_event(BLE_HAL_EVENT_DEVICE_REMOVED, &g_array_index(removed, BleHalDeviceInfo, i));
+    }
+    g_array_free(removed, TRUE);
+
+    if (work->notify) {
+        BleHalAdapterInfo info;
+        hal_adapter_to_info(adapter, &info);
+        hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                               BLE_HAL_EVENT_ADAPTER_REMOVED, &info, sizeof(info));
+    }
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief Age eviction timer (adapter context): drops devices not seen for
+ * BleHalConfig.device_max_age_ms.
+ */
+static gboolean on_device_expiry(gpointer user_data) {
+    HalAdapter* adapter = (HalAdapter*)user_data;
+    gint64 cutoff_us = g_get_monotonic_time() - (gint64)hal_global_config.device_max_age_ms * 1000;
+    GArray* evicted = g_array_new(FALSE, FALSE, sizeof(BleHalDeviceInfo));
+    gpointer evict_data[2] = { adapter, evicted };
+
+    g_rw_lock_writer_lock(&adapter->lock);
+    guint expired = hal_device_table_expire(adapter->devices, cutoff_us, EVICTION_PROTECTED_FLAGS,
+                                            collect_swept_device_cb, evict_data);
+    g_rw_lock_writer_unlock(&adapter->lock);
+
+    if (expired > 0) {
+        hal_stats_counter_add(HAL_STATS_COUNTER_EXPIRED, expired);
+        HAL_LOG_DEBUG("Expired %u device(s) of %s.", expired, adapter->path);
+    }
+    finish_evictions(adapter, evicted);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Batch flush hook: hands the coalesced updates to the event layer.
+ */
+static void deliver_adv_batch(const BleHalAdvUpdate* updates, guint n_updates, void* user_data) {
+    hal_events_emit_adv_batch(hal_global_config.adv_batch_cb, hal_global_config.adv_batch_user_data,
+                              updates, n_updates);
+}
+
+// --- Initial Object Scan ---
+
+/**
+ * @brief Reply of the GetManagedObjects request (HAL context).
+ */
+static BleHalStatus on_get_managed_objects_reply(HalRequest* request, GVariant* result_tuple, GUnixFDList* fd_list,
+                                                 BleHalStatus status) {
+    if (status == BLE_HAL_ERROR_CANCELLED) {
+        return status; // BlueZ vanished; on_bluez_vanished() reports readiness
+    }
+    if (status != BLE_HAL_SUCCESS) {
+        report_ready(status);
+        return status;
+    }
+
+    // One stage for this function plus one per adapter batch posted below.
+    g_atomic_int_set(&scan_jobs_pending, 1);
+    guint n_devices = 0;
 
     if (result_tuple) {
-        GVariant *dict_entries = g_variant_get_child_value(result_tuple, 0); // Get the a{oa{sa{sv}}}
-        GVariantIter iter_obj_paths;
-        const gchar *object_path;
-        GVariant *ifaces_and_props_dict; // This is a{sa{sv}}
-
-        g_variant_iter_init(&iter_obj_paths, dict_entries);
-        printf("HAL: Processing GetManagedObjects reply...\n");
-        while (g_variant_iter_next(&iter_obj_paths, "{&o@a{sa{sv}}}", &object_path, &ifaces_and_props_dict)) {
-            GVariantIter iter_ifaces;
-            const gchar *iface_name;
-            GVariant *props_dict; // This is a{sv}
-
-            g_variant_iter_init(&iter_ifaces, ifaces_and_props_dict);
-            while (g_variant_iter_next(&iter_ifaces, "{&s@a{sv}}", &iface_name, &props_dict)) {
-                if (g_strcmp0(iface_name, "org.bluez.Adapter1") == 0) { //
-                    if (!active_adapter_found) { // Process first one found
-                        process_adapter_interface(object_path, props_dict);
-                    }
+        HAL_LOG_DEBUG("Processing GetManagedObjects reply...");
+        // Only the interfaces in HAL_INTERFACES are kept; everything else is skipped in place.
+        HalManagedObjects *objects = hal_managed_objects_parse(result_tuple);
+        guint n = hal_managed_objects_count(objects);
+
+        // Adapters first, so every device can be routed to its adapter. Adapters
+        // kept from a previous BlueZ instance are refreshed (reported only if
+        // their state differs) and dropped if no longer listed.
+        GPtrArray* listed = g_ptr_array_new();
+        for (guint i = 0; i < n; i++) {
+            if (hal_managed_objects_interface_id(objects, i) != HAL_IFACE_ADAPTER1) continue;
+
+            const gchar* path = hal_managed_objects_path(objects, i);
+            GVariant* properties = hal_managed_objects_properties(objects, i);
+            HalAdapter* adapter = find_adapter(path);
+            if (adapter) {
+                gboolean powered = TRUE;
+                post_adapter_work(adapter, adapter_changed_execute, NULL, properties);
+                // As for a new adapter, an unpowered one is switched on.
+                if (g_variant_lookup(properties, "Powered", "b", &powered) && !powered) {
+                    ble_hal_set_adapter_power(path, TRUE, generic_result_cb, "SetPowerOn");
                 }
-                // Here you could also process org.bluez.Device1 if needed at this stage
-                g_variant_unref(props_dict);
+            } else {
+                add_adapter(path, properties);
+                adapter = find_adapter(path);
+            }
+            if (adapter) g_ptr_array_add(listed, adapter);
+        }
+        for (guint a = adapters->len; a > 0; a--) {
+            HalAdapter* adapter = g_ptr_array_index(adapters, a - 1);
+            if (!g_ptr_array_find(listed, adapter, NULL)) {
+                HAL_LOG_INFO("Adapter %s is gone after the restart.", adapter->path);
+                remove_adapter(adapter, TRUE);
+            }
+        }
+        g_ptr_array_free(listed, TRUE);
+
+        // Devices are grouped into one batch per adapter, applied on the adapter's context.
+        // Every adapter gets one, even if empty, so stale records are swept everywhere.
+        AdapterWork** batches = g_new0(AdapterWork*, adapters->len);
+        for (guint a = 0; a < adapters->len; a++) {
+            batches[a] = adapter_work_new(g_ptr_array_index(adapters, a), devices_scanned_execute);
+            batches[a]->scan_paths = g_ptr_array_new_with_free_func(g_free);
+            batches[a]->scan_properties = g_ptr_array_new_with_free_func((GDestroyNotify)g_variant_unref);
+        }
+        for (guint i = 0; i < n; i++) {
+            if (hal_managed_objects_interface_id(objects, i) != HAL_IFACE_DEVICE1) continue;
+
+            const gchar* path = hal_managed_objects_path(objects, i);
+            guint a = 0;
+            while (a < adapters->len && !hal_adapter_owns_path(g_ptr_array_index(adapters, a), path)) a++;
+            if (a == adapters->len) {
+                HAL_LOG_DEBUG("Device %s has no tracked adapter, not tracking.", path);
+                continue;
             }
-            g_variant_unref(ifaces_and_props_dict);
+
+            g_ptr_array_add(batches[a]->scan_paths, g_strdup(path));
+            g_ptr_array_add(batches[a]->scan_properties, g_variant_ref(hal_managed_objects_properties(objects, i)));
+            n_devices++;
+        }
+        g_atomic_int_add(&scan_jobs_pending, (gint)adapters->len);
+        for (guint a = 0; a < adapters->len; a++) {
+            hal_adapter_post(g_ptr_array_index(adapters, a), &batches[a]->base);
         }
-        g_variant_unref(dict_entries);
-        g_variant_unref(result_tuple);
+        g_free(batches);
+        hal_managed_objects_free(objects);
     }
 
-    if (!active_adapter_found) {
-        printf("HAL: No Bluetooth adapter found after initial scan of managed objects.\n");
+    if (adapters->len == 0) {
+        HAL_LOG_WARN("No Bluetooth adapter found after initial scan of managed objects.");
     }
+    HAL_LOG_INFO("Initial scan found %u adapter(s) and %u device(s).", adapters->len, n_devices);
+    if (g_atomic_int_dec_and_test(&scan_jobs_pending)) {
+        report_ready(BLE_HAL_SUCCESS);
+    }
+    return BLE_HAL_SUCCESS;
 }
 
 /**
@@ -312,99 +1181,221 @@ static void on_get_managed_objects_reply(GObject *source_object, GAsyncResult *r
 static void initial_object_scan(void) {
     if (!dbus_conn) return;
 
-    printf("HAL: Performing initial scan for BlueZ managed objects.\n");
-    g_dbus_connection_call(dbus_conn,
-                           "org.bluez",                             // Bus name
-                           "/",                                     // Object path for ObjectManager
-                           "org.freedesktop.DBus.ObjectManager",    // Interface
-                           "GetManagedObjects",                     // Method
-                           NULL,                                    // Parameters
-                           G_VARIANT_TYPE("(a{oa{sa{sv}}})"),      // Reply type
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,                                      // Timeout
-                           NULL,                                    // GCancellable
-                           on_get_managed_objects_reply,            // Callback
-                           NULL);                                   // User data
+    HAL_LOG_INFO("Performing initial scan for BlueZ managed objects.");
+    // Through the pipeline, so a stuck bluetoothd fails the scan at its
+    // deadline and a BlueZ restart cancels it.
+    HalRequest* request = hal_request_new(sizeof(HalRequest), "/", "org.freedesktop.DBus.ObjectManager",
+                                          "GetManagedObjects", NULL, G_VARIANT_TYPE("(a{oa{sa{sv}}})"), 0,
+                                          NULL, NULL);
+    request->on_reply = on_get_managed_objects_reply;
+    hal_request_submit(request);
 }
 
-// --- Public API Functions ---
+// --- Initialization ---
 
-BleHalStatus ble_hal_init(const BleHalConfig* config, GMainLoop* loop) {
-    GError *error = NULL;
+/**
+ * @brief One-shot readiness report for ble_hal_init_async().
+ */
+static void report_ready(BleHalStatus status) {
+    // May race between the HAL context and an adapter finishing its scan batch.
+    BleHalResultCb cb = g_atomic_pointer_get(&init_ready_cb);
+    if (!cb || !g_atomic_pointer_compare_and_exchange(&init_ready_cb, cb, NULL)) return;
+    hal_events_emit_result(cb, init_ready_user_data, status);
+}
 
-    if (hal_initialized) {
-        printf("HAL: Already initialized.\n");
-        return BLE_HAL_SUCCESS;
+/**
+ * @brief Adopts the system bus connection and configures the signal rules.
+ * The rules are installed once the BlueZ owner is known.
+ */
+static void attach_bus_connection(GDBusConnection* conn) {
+    dbus_conn = conn;
+    HAL_LOG_INFO("D-Bus connection acquired.");
+
+    subscriptions = hal_subscriptions_new(dbus_conn);
+    apply_signal_interests(signal_interests);
+
+    // Replay a BlueZ appearance/vanishing that the name watch reported first.
+    if (bluez_state_pending) {
+        bluez_state_pending = FALSE;
+        if (pending_bluez_owner) {
+            on_bluez_appeared(dbus_conn, "org.bluez", pending_bluez_owner, NULL);
+            g_free(pending_bluez_owner);
+            pending_bluez_owner = NULL;
+        } else {
+            on_bluez_vanished(dbus_conn, "org.bluez", NULL);
+        }
     }
+}
 
-    if (!config) {
-        printf("HAL Error: Null configuration.\n");
-        return BLE_HAL_ERROR_INVALID_PARAMS;
+static void on_bus_get_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+    GError *error = NULL;
+    GDBusConnection *conn = g_bus_get_finish(res, &error);
+
+    if (!conn) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error); // ble_hal_deinit() ran first; HAL state is already gone
+            return;
+        }
+        HAL_LOG_ERROR("D-Bus connection failed: %s", error->message);
+        g_error_free(error);
+        report_ready(BLE_HAL_ERROR_DBUS);
+        return;
     }
+    attach_bus_connection(conn);
+}
+
+/**
+ * @brief Sets up everything that does not need the bus: config, event
+ * delivery, adapter table, loops and the command queue.
+ */
+static BleHalStatus hal_setup(const BleHalConfig* config, GMainLoop* loop) {
     hal_global_config = *config; // Store config
 
-    printf("HAL: Initializing...\n");
+    hal_log_init(hal_global_config.log_level, hal_global_config.log_sink, hal_global_config.log_sink_user_data,
+                 hal_global_config.log_ring_capacity);
+    HAL_LOG_INFO("Initializing...");
 
-    dbus_conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error); // Connect to system D-Bus
-    if (error) {
-        fprintf(stderr, "HAL Error: D-Bus connection failed: %s\n", error->message);
-        g_error_free(error);
-        return BLE_HAL_ERROR_DBUS;
+    // Queues from a previous run are gone; latency counters carry over.
+    hal_stats_reset_gauges();
+
+    GMainContext* application_context = loop ? g_main_loop_get_context(loop) : NULL;
+    if (hal_global_config.use_external_loop) {
+        if (loop) {
+            HAL_LOG_ERROR("use_external_loop needs a NULL GMainLoop.");
+            return BLE_HAL_ERROR_INVALID_PARAMS;
+        }
+        application_context = hal_loop_init();
+        if (!application_context) return BLE_HAL_ERROR;
     }
-    if (!dbus_conn) {
-        fprintf(stderr, "HAL Error: D-Bus connection failed (null conn, no GError).\n");
-        return BLE_HAL_ERROR_DBUS;
+    // Adapter worker threads hand their events over like the HAL thread does.
+    if (!hal_events_init(application_context,
+                         hal_global_config.use_event_thread || hal_global_config.use_adapter_threads,
+                         hal_global_config.event_queue_capacity)) {
+        return BLE_HAL_ERROR;
     }
-    printf("HAL: D-Bus connection acquired.\n");
+
+    signal_interests = hal_global_config.interests ? hal_global_config.interests : BLE_HAL_INTEREST_DEFAULT;
+    hal_pool_set_max_bytes(hal_global_config.pool_max_bytes);
+    hal_adv_filter_init(hal_global_config.adv_company_ids, hal_global_config.n_adv_company_ids,
+                        hal_global_config.adv_service_uuids);
+
+    g_rw_lock_writer_lock(&adapters_lock);
+    adapters = g_ptr_array_new();
+    g_rw_lock_writer_unlock(&adapters_lock);
 
     if (loop) {
         app_provided_loop = loop; // Use app's GMainLoop
-        printf("HAL: Using application-provided GMainLoop.\n");
+        HAL_LOG_INFO("Using application-provided GMainLoop.");
+    } else if (hal_global_config.use_external_loop) {
+        HAL_LOG_INFO("Driven by the application's loop through ble_hal_dispatch().");
     } else {
         internal_loop = g_main_loop_new(NULL, FALSE); // Create internal GMainLoop
-        printf("HAL: Created internal GMainLoop (app must manage its execution).\n");
+        HAL_LOG_INFO("Created internal GMainLoop (app must manage its execution).");
+    }
+
+    hal_requests_init(hal_global_config.request_timeout_ms, hal_global_config.max_requests_in_flight);
+    hal_gatt_init();
+    hal_gatt_server_init();
+    hal_discovery_init();
+    hal_advertising_init();
+    hal_connect_init(hal_global_config.max_connections_per_adapter, hal_global_config.max_pending_connects_per_adapter,
+                     hal_global_config.connect_retry_limit, hal_global_config.connect_retry_base_ms);
+
+    if (hal_global_config.use_mgmt_scan) {
+        mgmt_source = hal_mgmt_open(hal_events_get_hal_context(), on_mgmt_report, NULL);
+        if (!mgmt_source) {
+            HAL_LOG_WARN("Falling back to D-Bus for advertising data.");
+        }
+    }
+
+    if (hal_global_config.device_cache_path) {
+        device_cache_path = g_strdup(hal_global_config.device_cache_path);
+        load_device_cache();
     }
 
-    // Watch for BlueZ service on D-Bus
+    // Commands are accepted from here on; queued ones run once the HAL context is iterated.
+    hal_commands_init(hal_events_get_hal_context());
+    return BLE_HAL_SUCCESS;
+}
+
+/**
+ * @brief Starts watching org.bluez. GDBus binds the watch (and everything
+ * started from its callbacks) to the thread-default context, so make that the
+ * HAL context while registering it.
+ */
+static gboolean start_bluez_watch(void) {
+    g_main_context_push_thread_default(hal_events_get_hal_context());
     bluez_name_watch_id = g_bus_watch_name(
         G_BUS_TYPE_SYSTEM, "org.bluez", G_BUS_NAME_WATCHER_FLAGS_NONE,
         on_bluez_appeared, on_bluez_vanished,
         NULL, NULL);
+    g_main_context_pop_thread_default(hal_events_get_hal_context());
 
     if (bluez_name_watch_id == 0) {
-        fprintf(stderr, "HAL Error: Failed to watch BlueZ D-Bus name.\n");
-        g_object_unref(dbus_conn);
-        dbus_conn = NULL;
-        if (internal_loop) {
-            g_main_loop_unref(internal_loop);
-            internal_loop = NULL;
-        }
-        return BLE_HAL_ERROR_DBUS;
+        HAL_LOG_ERROR("Failed to watch BlueZ D-Bus name.");
+        return FALSE;
     }
-    printf("HAL: Watching BlueZ D-Bus service (ID: %u).\n", bluez_name_watch_id);
-
-    hal_initialized = TRUE;
-    printf("HAL: Initialization successful.\n");
-    return BLE_HAL_SUCCESS;
+    HAL_LOG_INFO("Watching BlueZ D-Bus service (ID: %u).", bluez_name_watch_id);
+    return TRUE;
 }
 
-void ble_hal_deinit(void) {
-    if (!hal_initialized) {
-        printf("HAL: Not initialized or already deinitialized.\n");
-        return;
+/**
+ * @brief Releases everything hal_setup() and the bus stages created. Safe on
+ * partially initialized state.
+ */
+static void hal_teardown(void) {
+    // Stop the HAL thread first so nothing below races with D-Bus callbacks.
+    hal_events_stop();
+    hal_commands_shutdown(); // Queued commands complete with BLE_HAL_ERROR_NOT_INITIALIZED
+    hal_chain_shutdown();    // Running chains fail with BLE_HAL_ERROR_NOT_INITIALIZED
+    hal_gatt_shutdown();     // Closes the characteristic sockets
+    hal_discovery_shutdown();
+    hal_connect_shutdown();  // Scheduled connections fail with BLE_HAL_ERROR_NOT_INITIALIZED
+    hal_advertising_shutdown(); // Controller slots are freed while the bus is still up
+    hal_gatt_server_shutdown();
+
+    hal_mgmt_close(mgmt_source); // Nothing posts to the adapters from here on
+    mgmt_source = NULL;
+
+    if (init_cancellable) {
+        g_cancellable_cancel(init_cancellable); // A pending async bus lookup is abandoned
+        g_object_unref(init_cancellable);
+        init_cancellable = NULL;
     }
-    printf("HAL: Deinitializing...\n");
+    init_ready_cb = NULL;
+    init_ready_user_data = NULL;
+    bluez_state_pending = FALSE;
+    g_free(pending_bluez_owner);
+    pending_bluez_owner = NULL;
 
     if (bluez_name_watch_id > 0) {
         g_bus_unwatch_name(bluez_name_watch_id); // Stop watching BlueZ name
         bluez_name_watch_id = 0;
-        printf("HAL: Stopped watching BlueZ D-Bus service.\n");
+        HAL_LOG_INFO("Stopped watching BlueZ D-Bus service.");
+    }
+
+    if (subscriptions) {
+        hal_subscriptions_free(subscriptions); // Removes any installed match rules
+        subscriptions = NULL;
+    }
+
+    // Stops the adapter worker threads; pending advertisement updates are dropped.
+    hal_source_clear(&restart_grace_source);
+    if (adapters) {
+        remove_all_adapters(FALSE);
+        g_rw_lock_writer_lock(&adapters_lock);
+        g_ptr_array_unref(adapters);
+        adapters = NULL;
+        g_rw_lock_writer_unlock(&adapters_lock);
     }
 
+    // Queued and in-flight D-Bus requests complete with BLE_HAL_ERROR_NOT_INITIALIZED.
+    hal_requests_shutdown();
+
     if (dbus_conn) {
         g_object_unref(dbus_conn); // Close D-Bus connection
         dbus_conn = NULL;
-        printf("HAL: D-Bus connection closed.\n");
+        HAL_LOG_INFO("D-Bus connection closed.");
     }
 
     if (internal_loop) { // Clean up internal GMainLoop
@@ -413,84 +1404,509 @@ void ble_hal_deinit(void) {
         }
         g_main_loop_unref(internal_loop);
         internal_loop = NULL;
-        printf("HAL: Internal GMainLoop cleaned up.\n");
+        HAL_LOG_INFO("Internal GMainLoop cleaned up.");
     }
     app_provided_loop = NULL;
 
+    // Every producer thread is gone now; undelivered events are dropped.
+    hal_events_shutdown();
+    hal_loop_shutdown();
+    hal_adv_filter_shutdown();
+    hal_log_shutdown(); // Anything logged from here on is written directly
+
+    g_free(device_cache_path);
+    device_cache_path = NULL;
     memset(&hal_global_config, 0, sizeof(BleHalConfig)); // Reset global config
+}
 
-    hal_initialized = FALSE;
-    printf("HAL: Deinitialization complete.\n");
+GDBusConnection* hal_get_dbus_connection(void) {
+    return dbus_conn;
+}
+
+void hal_emit_global_event(BleHalEvent event_type, const void* payload, gsize payload_size) {
+    hal_events_emit_global(hal_global_config.global_event_cb, hal_global_config.global_event_user_data,
+                           event_type, payload, payload_size);
+}
+
+GPtrArray* hal_find_device_adapters(guint64 addr_key) {
+    GPtrArray* paths = g_ptr_array_new_with_free_func(g_free);
+
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        g_rw_lock_reader_lock(&adapter->lock);
+        gboolean known = hal_device_table_lookup_address(adapter->devices, addr_key) != NULL;
+        g_rw_lock_reader_unlock(&adapter->lock);
+        if (known) g_ptr_array_add(paths, g_strdup(adapter->path));
+    }
+    return paths;
 }
 
-static void on_set_power_reply(GObject *source_object, GAsyncResult *res, gpointer user_data) {
-    SetPowerAsyncData *data = (SetPowerAsyncData *)user_data;
+// --- Public API Functions ---
+
+BleHalStatus ble_hal_init(const BleHalConfig* config, GMainLoop* loop) {
     GError *error = NULL;
-    BleHalStatus hal_err = BLE_HAL_SUCCESS;
 
-    g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (hal_initialized) {
+        HAL_LOG_WARN("Already initialized.");
+        return BLE_HAL_SUCCESS;
+    }
+
+    if (!config) {
+        HAL_LOG_ERROR("Null configuration.");
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    BleHalStatus status = hal_setup(config, loop);
+    if (status != BLE_HAL_SUCCESS) {
+        hal_teardown();
+        return status;
+    }
 
+    GDBusConnection *conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error); // Connect to system D-Bus
     if (error) {
-        fprintf(stderr, "HAL Error: Failed to set 'Powered' property: %s (D-Bus error: %s)\n",
-                error->message, g_dbus_error_get_remote_error(error));
-        // TODO: Map GError to BleHalError more specifically if desired
-        // For example, check g_dbus_error_get_remote_error(error) for BlueZ specific errors.
-        hal_err = BLE_HAL_ERROR_DBUS;
+        HAL_LOG_ERROR("D-Bus connection failed: %s", error->message);
         g_error_free(error);
-    } else {
-        printf("HAL: 'Powered' property set successfully.\n");
-        // Note: The actual state change confirmation usually comes via a PropertiesChanged signal
-        // for the 'Powered' property on org.bluez.Adapter1. Listening to this signal
-        // would be the robust way to confirm the power state has indeed changed.
+        hal_teardown();
+        return BLE_HAL_ERROR_DBUS;
+    }
+    if (!conn) {
+        HAL_LOG_ERROR("D-Bus connection failed (null conn, no GError).");
+        hal_teardown();
+        return BLE_HAL_ERROR_DBUS;
     }
+    attach_bus_connection(conn);
 
-    if (data->app_callback) {
-        data->app_callback(hal_err, data->app_user_data);
+    if (!start_bluez_watch()) {
+        hal_teardown();
+        return BLE_HAL_ERROR_DBUS;
+    }
+
+    if (!hal_events_start()) {
+        hal_teardown();
+        return BLE_HAL_ERROR;
     }
-    g_free(data);
+
+    hal_initialized = TRUE;
+    HAL_LOG_INFO("Initialization successful.");
+    return BLE_HAL_SUCCESS;
 }
 
-BleHalStatus ble_hal_set_adapter_power(const char* adapter_path, gboolean power_on, BleHalResultCb cb, void* user_data) {
-    if (!hal_initialized || !dbus_conn) {
-        fprintf(stderr, "HAL Error: HAL not initialized or D-Bus connection lost.\n");
-        if (cb) cb(BLE_HAL_ERROR_NOT_INITIALIZED, user_data); // Call immediately with error
-        return BLE_HAL_ERROR_NOT_INITIALIZED;
+BleHalStatus ble_hal_init_async(const BleHalConfig* config, GMainLoop* loop,
+                                BleHalResultCb ready_cb, void* user_data) {
+    if (hal_initialized) {
+        HAL_LOG_WARN("Already initialized.");
+        return BLE_HAL_SUCCESS;
     }
 
+    if (!config) {
+        HAL_LOG_ERROR("Null configuration.");
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    BleHalStatus status = hal_setup(config, loop);
+    if (status != BLE_HAL_SUCCESS) {
+        hal_teardown();
+        return status;
+    }
+    init_ready_cb = ready_cb;
+    init_ready_user_data = user_data;
+
+    // The bus lookup and the name watch run in parallel; whichever finishes
+    // second completes the BlueZ hand-off (see attach_bus_connection()).
+    init_cancellable = g_cancellable_new();
+    g_main_context_push_thread_default(hal_events_get_hal_context());
+    g_bus_get(G_BUS_TYPE_SYSTEM, init_cancellable, on_bus_get_ready, NULL);
+    g_main_context_pop_thread_default(hal_events_get_hal_context());
+
+    if (!start_bluez_watch() || !hal_events_start()) {
+        hal_teardown();
+        return BLE_HAL_ERROR;
+    }
+
+    hal_initialized = TRUE;
+    HAL_LOG_INFO("Initialization started.");
+    return BLE_HAL_PENDING;
+}
+
+void ble_hal_deinit(void) {
+    if (!hal_initialized) {
+        HAL_LOG_WARN("Not initialized or already deinitialized.");
+        return;
+    }
+    HAL_LOG_INFO("Deinitializing...");
+
+    // Saved while the tables still hold BlueZ's state; a failed init never gets here.
+    if (device_cache_path) {
+        ble_hal_save_device_cache(NULL);
+    }
+    hal_teardown();
+
+    hal_initialized = FALSE;
+    HAL_LOG_INFO("Deinitialization complete.");
+}
+
+BleHalStatus ble_hal_save_device_cache(const char* path) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!path) path = device_cache_path;
+    if (!path) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    gboolean saved = hal_cache_save(path, adapters);
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return saved ? BLE_HAL_SUCCESS : BLE_HAL_ERROR;
+}
+
+void ble_hal_get_stats(BleHalStats* out) {
+    if (!out) return;
+
+    memset(out, 0, sizeof(*out));
+    hal_stats_snapshot(out);
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        g_rw_lock_reader_lock(&adapter->lock);
+        out->devices += hal_device_table_count(adapter->devices);
+        out->device_table_bytes += hal_device_table_memory_size(adapter->devices);
+        g_rw_lock_reader_unlock(&adapter->lock);
+    }
+    out->adapters = adapters ? adapters->len : 0;
+    g_rw_lock_reader_unlock(&adapters_lock);
+}
+
+static BleHalStatus on_set_power_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                       BleHalStatus status) {
+    if (status == BLE_HAL_SUCCESS) {
+        HAL_LOG_DEBUG("'Powered' property set successfully.");
+        // Note: The actual state change is confirmed by the Adapter1 PropertiesChanged
+        // signal, which updates the adapter cache and emits BLE_HAL_EVENT_ADAPTER_CHANGED.
+    }
+    return status;
+}
+
+BleHalStatus ble_hal_set_adapter_power(const char* adapter_path, gboolean power_on, BleHalResultCb cb, void* user_data) {
     if (!adapter_path) {
-        fprintf(stderr, "HAL Error: Adapter path cannot be NULL for set_adapter_power.\n");
+        HAL_LOG_ERROR("Adapter path cannot be NULL for set_adapter_power.");
         if (cb) cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
         return BLE_HAL_ERROR_INVALID_PARAMS;
     }
 
-    // The 'Powered' property expects a GVariant of type boolean ('b').
-    GVariant *value_variant = g_variant_new_boolean(power_on);
-
-    // The parameters for DBus.Properties.Set are:
-    // interface_name (s), property_name (s), value (v)
-    GVariant *params = g_variant_new("(ssv)",
-                                     "org.bluez.Adapter1", // Interface name
-                                     "Powered",            // Property name
-                                     value_variant);       // The new value (GVariant takes ownership of value_variant)
-
-    SetPowerAsyncData *async_data = g_new(SetPowerAsyncData, 1);
-    async_data->app_callback = cb;
-    async_data->app_user_data = user_data;
-
-    printf("HAL: Attempting to set 'Powered' property to %s for adapter %s\n", power_on ? "ON" : "OFF", adapter_path);
-
-    g_dbus_connection_call(dbus_conn,
-                           "org.bluez",                             // D-Bus service name
-                           adapter_path,                          // Object path of the adapter
-                           "org.freedesktop.DBus.Properties",       // Interface name for property operations
-                           "Set",                                   // Method name
-                           params,                                  // Parameters (GVariant owns its children)
-                           NULL,                                    // Reply type (Set has no specific reply value other than error)
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,                                      // Timeout
-                           NULL,                                    // GCancellable
-                           on_set_power_reply,                      // Callback for the reply
-                           async_data);                             // User data for the callback
-
-    return BLE_HAL_PENDING; // Operation is asynchronous
+    // Properties.Set of Adapter1.Powered; a newer call for the same adapter supersedes a queued one.
+    HalRequest *request = hal_request_new_set_property(adapter_path, "org.bluez.Adapter1", "Powered",
+                                                       g_variant_new_boolean(power_on), cb, user_data);
+    request->on_reply = on_set_power_reply;
+
+    HAL_LOG_DEBUG("Attempting to set 'Powered' property to %s for adapter %s",
+                  power_on ? "ON" : "OFF", adapter_path);
+
+    BleHalStatus status = hal_request_submit(request); // Sent from the HAL context
+    if (status != BLE_HAL_PENDING) {
+        HAL_LOG_ERROR("HAL not initialized or D-Bus connection lost.");
+        if (cb) cb(status, user_data); // Call immediately with error
+    }
+    return status; // BLE_HAL_PENDING: operation is asynchronous
+}
+
+/**
+ * @brief Re-syncs the signal subscriptions. Runs on the HAL context so their
+ * callbacks are dispatched there.
+ */
+static void set_interests_execute(HalCommand* command) {
+    guint32 interests = ((SetInterestsCommand*)command)->interests;
+
+    if (interests != signal_interests) {
+        HAL_LOG_DEBUG("Signal interests changed 0x%x -> 0x%x.", signal_interests, interests);
+        signal_interests = interests;
+        apply_signal_interests(signal_interests); // No-op until the bus connection is attached
+    }
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+BleHalStatus ble_hal_set_interests(guint32 interests) {
+    SetInterestsCommand *command = hal_command_new(sizeof(SetInterestsCommand), set_interests_execute,
+                                                   NULL, NULL, NULL);
+    command->interests = interests;
+
+    BleHalStatus status = hal_command_submit(&command->base);
+    return status == BLE_HAL_PENDING ? BLE_HAL_SUCCESS : status;
+}
+
+// --- Adapter State API ---
+
+static HalAdapter* find_adapter_locked(const char* adapter_path) {
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        if (strcmp(adapter->path, adapter_path) == 0) return adapter;
+    }
+    return NULL;
+}
+
+static BleHalStatus copy_adapter_info(HalAdapter* adapter, BleHalAdapterInfo* out) {
+    if (!adapter) return BLE_HAL_ERROR_NOT_FOUND;
+    g_rw_lock_reader_lock(&adapter->lock);
+    hal_adapter_to_info(adapter, out);
+    g_rw_lock_reader_unlock(&adapter->lock);
+    return BLE_HAL_SUCCESS;
+}
+
+BleHalStatus ble_hal_get_adapter_info(BleHalAdapterInfo* out) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    BleHalStatus status = copy_adapter_info(adapters && adapters->len > 0 ? g_ptr_array_index(adapters, 0) : NULL,
+                                            out);
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return status;
+}
+
+BleHalStatus ble_hal_get_adapter_info_by_path(const char* adapter_path, BleHalAdapterInfo* out) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!adapter_path || !out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    BleHalStatus status = copy_adapter_info(find_adapter_locked(adapter_path), out);
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return status;
+}
+
+guint ble_hal_get_adapter_count(void) {
+    g_rw_lock_reader_lock(&adapters_lock);
+    guint count = adapters ? adapters->len : 0;
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return count;
+}
+
+guint ble_hal_foreach_adapter(BleHalAdapterForeachCb cb, void* user_data) {
+    if (!hal_initialized || !cb) return 0;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    guint count = adapters ? adapters->len : 0;
+    for (guint i = 0; i < count; i++) {
+        BleHalAdapterInfo info;
+        copy_adapter_info(g_ptr_array_index(adapters, i), &info);
+        cb(&info, user_data);
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return count;
+}
+
+// --- Device Table API ---
+
+gboolean ble_hal_address_from_string(const char* str, BleHalAddress* out) {
+    if (!str || !out) return FALSE;
+
+    for (int i = 0; i < 6; i++) {
+        const char* p = str + i * 3;
+        int hi = g_ascii_xdigit_value(p[0]);
+        int lo = (hi >= 0) ? g_ascii_xdigit_value(p[1]) : -1;
+        if (hi < 0 || lo < 0) return FALSE;
+        if (p[2] != (i < 5 ? ':' : '\0')) return FALSE;
+        out->b[i] = (guint8)((hi << 4) | lo);
+    }
+    return TRUE;
+}
+
+void ble_hal_address_to_string(const BleHalAddress* address, char* out) {
+    if (!address || !out) return;
+    g_snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X",
+               address->b[0], address->b[1], address->b[2],
+               address->b[3], address->b[4], address->b[5]);
+}
+
+// Device getters hold the adapters lock (reader) and then one adapter's lock (reader).
+
+guint ble_hal_get_device_count(void) {
+    guint count = 0;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        g_rw_lock_reader_lock(&adapter->lock);
+        count += hal_device_table_count(adapter->devices);
+        g_rw_lock_reader_unlock(&adapter->lock);
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return count;
+}
+
+guint ble_hal_get_adapter_device_count(const char* adapter_path) {
+    guint count = 0;
+
+    if (!adapter_path) return 0;
+    g_rw_lock_reader_lock(&adapters_lock);
+    HalAdapter* adapter = find_adapter_locked(adapter_path);
+    if (adapter) {
+        g_rw_lock_reader_lock(&adapter->lock);
+        count = hal_device_table_count(adapter->devices);
+        g_rw_lock_reader_unlock(&adapter->lock);
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return count;
+}
+
+typedef void (*DeviceVisitFunc)(HalDeviceTable* table, HalDevice* device, void* user_data);
+
+/**
+ * @brief Calls 'func' with the locks held for the first device with 'address'.
+ * @return TRUE if one was found.
+ */
+static gboolean visit_device_by_address(const BleHalAddress* address, DeviceVisitFunc func, void* user_data) {
+    gboolean found = FALSE;
+    guint64 addr_key = hal_address_pack(address);
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    for (guint i = 0; adapters && i < adapters->len && !found; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        g_rw_lock_reader_lock(&adapter->lock);
+        HalDevice* device = hal_device_table_lookup_address(adapter->devices, addr_key);
+        if (device) {
+            func(adapter->devices, device, user_data);
+            found = TRUE;
+        }
+        g_rw_lock_reader_unlock(&adapter->lock);
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return found;
+}
+
+static void copy_device_info(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    hal_device_to_info(table, device, (BleHalDeviceInfo*)user_data);
+}
+
+BleHalStatus ble_hal_get_device_by_address(const BleHalAddress* address, BleHalDeviceInfo* out) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!address || !out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    return visit_device_by_address(address, copy_device_info, out) ? BLE_HAL_SUCCESS : BLE_HAL_ERROR_NOT_FOUND;
+}
+
+BleHalStatus ble_hal_get_device_by_path(const char* object_path, BleHalDeviceInfo* out) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!object_path || !out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    HalDevice* device = NULL;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        if (!hal_adapter_owns_path(adapter, object_path)) continue;
+
+        g_rw_lock_reader_lock(&adapter->lock);
+        device = hal_device_table_lookup_path(adapter->devices, object_path);
+        if (device) {
+            hal_device_to_info(adapter->devices, device, out);
+        }
+        g_rw_lock_reader_unlock(&adapter->lock);
+        break;
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return device ? BLE_HAL_SUCCESS : BLE_HAL_ERROR_NOT_FOUND;
+}
+
+typedef struct {
+    gchar* out;
+    gsize size;
+    gboolean fits;
+} DeviceStringTarget;
+
+static void copy_device_name(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    DeviceStringTarget* target = (DeviceStringTarget*)user_data;
+    const gchar* name = hal_device_table_get_name(table, device);
+    g_strlcpy(target->out, name ? name : "", target->size);
+}
+
+static void copy_device_path(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    DeviceStringTarget* target = (DeviceStringTarget*)user_data;
+    target->fits = target->size >= hal_device_table_path_size(table);
+    if (target->fits) {
+        hal_device_table_format_path(table, device, target->out, target->size);
+    }
+}
+
+BleHalStatus ble_hal_get_device_name(const BleHalAddress* address, char* out, gsize size) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!address || !out || size == 0) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    DeviceStringTarget target = { out, size, TRUE };
+    return visit_device_by_address(address, copy_device_name, &target) ? BLE_HAL_SUCCESS : BLE_HAL_ERROR_NOT_FOUND;
+}
+
+BleHalStatus ble_hal_get_device_path(const BleHalAddress* address, char* out, gsize size) {
+    if (!hal_initialized) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!address || !out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    DeviceStringTarget target = { out, size, TRUE };
+    if (!visit_device_by_address(address, copy_device_path, &target)) return BLE_HAL_ERROR_NOT_FOUND;
+    return target.fits ? BLE_HAL_SUCCESS : BLE_HAL_ERROR_INVALID_PARAMS;
+}
+
+typedef struct {
+    HalDeviceFunc trampoline;       // device_foreach_trampoline or device_record_trampoline
+    gpointer cb;                    // BleHalDeviceForeachCb or BleHalDeviceRecordCb
+    void* user_data;
+} DeviceForeachData;
+
+static void device_foreach_trampoline(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    DeviceForeachData* data = (DeviceForeachData*)user_data;
+    BleHalDeviceInfo info;
+    hal_device_to_info(table, device, &info);
+    ((BleHalDeviceForeachCb)data->cb)(&info, data->user_data);
+}
+
+static void device_record_trampoline(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    DeviceForeachData* data = (DeviceForeachData*)user_data;
+    BleHalDeviceRecord record;
+    hal_device_to_record(device, &record);
+    ((BleHalDeviceRecordCb)data->cb)(&record, data->user_data);
+}
+
+static guint foreach_adapter_device(HalAdapter* adapter, DeviceForeachData* data) {
+    g_rw_lock_reader_lock(&adapter->lock);
+    hal_device_table_foreach(adapter->devices, data->trampoline, data);
+    guint count = hal_device_table_count(adapter->devices);
+    g_rw_lock_reader_unlock(&adapter->lock);
+    return count;
+}
+
+/**
+ * @brief Walks the devices of the adapter at 'adapter_path', or of all adapters if NULL.
+ */
+static guint foreach_device(const char* adapter_path, DeviceForeachData* data) {
+    guint count = 0;
+
+    g_rw_lock_reader_lock(&adapters_lock);
+    if (adapter_path) {
+        HalAdapter* adapter = find_adapter_locked(adapter_path);
+        if (adapter) {
+            count = foreach_adapter_device(adapter, data);
+        }
+    } else {
+        for (guint i = 0; adapters && i < adapters->len; i++) {
+            count += foreach_adapter_device(g_ptr_array_index(adapters, i), data);
+        }
+    }
+    g_rw_lock_reader_unlock(&adapters_lock);
+    return count;
+}
+
+guint ble_hal_foreach_device(BleHalDeviceForeachCb cb, void* user_data) {
+    if (!hal_initialized || !cb) return 0;
+
+    DeviceForeachData data = { device_foreach_trampoline, (gpointer)cb, user_data };
+    return foreach_device(NULL, &data);
+}
+
+guint ble_hal_foreach_adapter_device(const char* adapter_path, BleHalDeviceForeachCb cb, void* user_data) {
+    if (!hal_initialized || !adapter_path || !cb) return 0;
+
+    DeviceForeachData data = { device_foreach_trampoline, (gpointer)cb, user_data };
+    return foreach_device(adapter_path, &data);
+}
+
+guint ble_hal_foreach_device_record(const char* adapter_path, BleHalDeviceRecordCb cb, void* user_data) {
+    if (!hal_initialized || !cb) return 0;
+
+    DeviceForeachData data = { device_record_trampoline, (gpointer)cb, user_data };
+    return foreach_device(adapter_path, &data);
 }
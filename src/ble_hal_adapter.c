@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Adapter records and their worker threads.
+ *
+ * Without a worker thread an adapter simply borrows the HAL context and work
+ * posted to it runs immediately. With one, the adapter owns a GMainContext
+ * driven by its own thread; the HAL context posts work through the adapter's
+ * command queue and the thread emits events through its own event ring, so
+ * adapters never wait on each other.
+ */
+
+typedef struct {
+    HalCommand base;
+    GMainLoop* loop;
+} QuitCommand;
+
+HalAdapter* hal_adapter_new(const gchar* path, gboolean worker_thread) {
+    HalAdapter* adapter = g_new0(HalAdapter, 1);
+    adapter->path = g_strdup(path);
+    adapter->path_len = strlen(path);
+    adapter->devices = hal_device_table_new(path, BLE_HAL_DEVICE_TABLE_INITIAL_CAPACITY);
+    g_rw_lock_init(&adapter->lock);
+
+    if (worker_thread) {
+        gchar* name = g_strdup_printf("ble-hal-adapter %s", path);
+        adapter->context = g_main_context_new();
+        adapter->loop = g_main_loop_new(adapter->context, FALSE);
+        adapter->queue = hal_command_queue_new(adapter->context, name);
+        g_free(name);
+    } else {
+        adapter->context = g_main_context_ref(hal_events_get_hal_context());
+    }
+    return adapter;
+}
+
+static gpointer adapter_thread_main(gpointer data) {
+    HalAdapter* adapter = (HalAdapter*)data;
+
+    g_main_context_push_thread_default(adapter->context);
+    hal_events_attach_producer();
+    g_main_loop_run(adapter->loop);
+    hal_events_detach_producer();
+    g_main_context_pop_thread_default(adapter->context);
+    return NULL;
+}
+
+gboolean hal_adapter_start(HalAdapter* adapter) {
+    if (!adapter->loop || adapter->thread) return TRUE;
+
+    GError* error = NULL;
+    adapter->thread = g_thread_try_new("ble-hal-adapter", adapter_thread_main, adapter, &error);
+    if (!adapter->thread) {
+        HAL_LOG_ERROR("Failed to start worker thread for %s: %s", adapter->path, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void hal_adapter_post(HalAdapter* adapter, HalCommand* command) {
+    if (adapter->thread) {
+        hal_command_queue_push(adapter->queue, command);
+    } else {
+        command->execute(command);
+    }
+}
+
+static void quit_execute(HalCommand* command) {
+    g_main_loop_quit(((QuitCommand*)command)->loop);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+void hal_adapter_free(HalAdapter* adapter) {
+    if (!adapter) return;
+
+    if (adapter->thread) {
+        // Queued behind everything posted so far, so that work still runs.
+        QuitCommand* quit = hal_command_new(sizeof(QuitCommand), quit_execute, NULL, NULL, NULL);
+        quit->loop = adapter->loop;
+        hal_command_queue_push(adapter->queue, &quit->base);
+        g_thread_join(adapter->thread);
+        adapter->thread = NULL;
+    }
+
+    // The worker has exited (or never existed), so nothing below races with it.
+    hal_command_queue_free(adapter->queue);
+    hal_source_clear(&adapter->expiry_source);
+    hal_adv_batch_free(adapter->batch);
+    hal_device_table_free(adapter->devices);
+    if (adapter->loop) g_main_loop_unref(adapter->loop);
+    g_main_context_unref(adapter->context);
+    g_rw_lock_clear(&adapter->lock);
+    hal_adapter_state_clear(&adapter->state);
+    g_free(adapter->path);
+    g_free(adapter);
+}
+
+gboolean hal_adapter_owns_path(const HalAdapter* adapter, const gchar* object_path) {
+    return strncmp(object_path, adapter->path, adapter->path_len) == 0 &&
+           object_path[adapter->path_len] == '/';
+}
+
+void hal_adapter_to_info(const HalAdapter* adapter, BleHalAdapterInfo* info) {
+    const HalAdapterState* state = &adapter->state;
+
+    memset(info, 0, sizeof(*info));
+    g_strlcpy(info->path, adapter->path, sizeof(info->path));
+    if (state->flags & HAL_ADAPTER_FLAG_HAS_ADDRESS) {
+        ble_hal_address_to_string(&state->address, info->address);
+    }
+    if (state->name) {
+        g_strlcpy(info->name, state->name, sizeof(info->name));
+    }
+    info->powered = (state->flags & HAL_ADAPTER_FLAG_POWERED) != 0;
+    info->discovering = (state->flags & HAL_ADAPTER_FLAG_DISCOVERING) != 0;
+    info->discoverable = (state->flags & HAL_ADAPTER_FLAG_DISCOVERABLE) != 0;
+    info->pairable = (state->flags & HAL_ADAPTER_FLAG_PAIRABLE) != 0;
+}
+
+gboolean hal_adapter_state_equal(const HalAdapterState* a, const HalAdapterState* b) {
+    return a->flags == b->flags && memcmp(&a->address, &b->address, sizeof(a->address)) == 0 &&
+           g_strcmp0(a->name, b->name) == 0;
+}
+
+void hal_adapter_state_clear(HalAdapterState* state) {
+    g_free(state->name);
+    memset(state, 0, sizeof(*state));
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Advertisement data views and pre-filter.
+ *
+ * ManufacturerData (a{qv}) and ServiceData (a{sv}) are walked in their
+ * serialized form: each entry's variant must hold an "ay", whose bytes are
+ * handed out where they lie. g_variant_get_data() flattens a value the first
+ * time it is called and caches the result, so repeated walks of one update
+ * cost nothing beyond the walk itself.
+ *
+ * The pre-filter runs on the adapter context for every ManufacturerData and
+ * ServiceData value, before it reaches the batch. Company IDs are looked up
+ * in a 64 Kbit bitmap; service UUIDs are few, so they are compared in turn.
+ * Both are set up at init and read-only afterwards.
+ */
+
+#define HAL_UUID_STRING_LENGTH  36
+#define HAL_UUID_BASE_SUFFIX    "-0000-1000-8000-00805f9b34fb"
+
+static guint8* company_filter = NULL;           // Bit per company ID, NULL: no company filter
+static gchar (*uuid_filter)[HAL_UUID_STRING_LENGTH + 1] = NULL; // Normalized UUIDs, NULL: no UUID filter
+static guint n_uuid_filter = 0;
+
+// --- UUIDs ---
+
+/**
+ * @brief Writes the lowercase 128-bit form of a 16-bit, 32-bit or full UUID
+ * string to 'out'. Returns FALSE if 'uuid' is none of these.
+ */
+static gboolean uuid_normalize(const gchar* uuid, gchar out[HAL_UUID_STRING_LENGTH + 1]) {
+    gsize length = strlen(uuid);
+
+    if (length == 4 || length == 8) {
+        g_snprintf(out, HAL_UUID_STRING_LENGTH + 1, "%s%s%s", length == 4 ? "0000" : "", uuid, HAL_UUID_BASE_SUFFIX);
+    } else if (length == HAL_UUID_STRING_LENGTH) {
+        memcpy(out, uuid, HAL_UUID_STRING_LENGTH + 1);
+    } else {
+        return FALSE;
+    }
+    for (gsize i = 0; i < HAL_UUID_STRING_LENGTH; i++) {
+        gboolean dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash ? out[i] != '-' : !g_ascii_isxdigit(out[i])) return FALSE;
+        out[i] = g_ascii_tolower(out[i]);
+    }
+    return TRUE;
+}
+
+// --- Walking ---
+
+typedef gboolean (*EntryFunc)(const BleHalAdvData* entry, void* user_data);
+
+static gboolean is_bytes_type(const gchar* type, HalGvsView variant) {
+    gsize type_length = (gsize)(variant.data + variant.size - (const guint8*)type);
+    return type_length == 2 && type[0] == 'a' && type[1] == 'y';
+}
+
+/**
+ * @brief Calls 'func' for every "ay" entry of a ManufacturerData or
+ * ServiceData value until it returns FALSE. Entries of any other type are
+ * skipped. Returns the number of entries visited.
+ */
+static guint walk_entries(GVariant* value, HalPropId prop, EntryFunc func, void* user_data) {
+    gboolean manufacturer = prop == HAL_PROP_DEVICE1_MANUFACTURER_DATA;
+    HalGvsView root = { g_variant_get_data(value), g_variant_get_size(value) };
+    HalGvsArray entries;
+    guint visited = 0;
+
+    if (!root.data || !hal_gvs_array_open(root, &entries)) return 0;
+
+    for (gsize i = 0; i < entries.n_elements; i++) {
+        HalGvsView entry, variant, bytes;
+        BleHalAdvData data = {0};
+        const gchar* type;
+
+        if (!hal_gvs_array_element(&entries, i, &entry)) break;
+        if (manufacturer) {
+            // {qv}: the fixed-size key needs no framing offset; the variant starts 8-byte aligned.
+            if (entry.size < 8) break;
+            memcpy(&data.company_id, entry.data, sizeof(data.company_id));
+            variant.data = entry.data + 8;
+            variant.size = entry.size - 8;
+        } else if (!hal_gvs_dict_entry_split(entry, &data.uuid, &variant)) {
+            break;
+        }
+        if (!hal_gvs_variant_split(variant, &type, &bytes) || !is_bytes_type(type, variant)) continue;
+
+        data.data = bytes.data;
+        data.length = bytes.size;
+        visited++;
+        if (!func(&data, user_data)) break;
+    }
+    return visited;
+}
+
+static GVariant* update_value(const BleHalAdvUpdate* update, HalPropId prop) {
+    if (!update) return NULL;
+    if (prop == HAL_PROP_DEVICE1_MANUFACTURER_DATA) {
+        return (update->changed & BLE_HAL_ADV_FIELD_MANUFACTURER_DATA) ? update->manufacturer_data : NULL;
+    }
+    return (update->changed & BLE_HAL_ADV_FIELD_SERVICE_DATA) ? update->service_data : NULL;
+}
+
+typedef struct {
+    BleHalAdvDataCb cb;
+    void* user_data;
+} ForeachTarget;
+
+static gboolean foreach_entry(const BleHalAdvData* entry, void* user_data) {
+    ForeachTarget* target = (ForeachTarget*)user_data;
+    return target->cb(entry, target->user_data);
+}
+
+typedef struct {
+    guint16 company_id;
+    const gchar* uuid;              // Normalized, NULL for a company ID lookup
+    BleHalAdvData* out;
+    gboolean found;
+} FindTarget;
+
+static gboolean find_entry(const BleHalAdvData* entry, void* user_data) {
+    FindTarget* target = (FindTarget*)user_data;
+    gboolean match = target->uuid ? g_ascii_strcasecmp(entry->uuid, target->uuid) == 0
+                                  : entry->company_id == target->company_id;
+    if (match) {
+        *target->out = *entry;
+        target->found = TRUE;
+    }
+    return !match;
+}
+
+// --- Pre-filter ---
+
+static gboolean filter_entry(const BleHalAdvData* entry, void* user_data) {
+    gboolean* accepted = (gboolean*)user_data;
+
+    if (entry->uuid) {
+        for (guint i = 0; i < n_uuid_filter && !*accepted; i++) {
+            *accepted = g_ascii_strcasecmp(entry->uuid, uuid_filter[i]) == 0;
+        }
+    } else {
+        *accepted = (company_filter[entry->company_id >> 3] >> (entry->company_id & 7)) & 1;
+    }
+    return !*accepted;
+}
+
+void hal_adv_filter_init(const guint16* company_ids, guint n_company_ids, const char* const* service_uuids) {
+    hal_adv_filter_shutdown();
+
+    if (company_ids && n_company_ids > 0) {
+        company_filter = g_malloc0(65536 / 8);
+        for (guint i = 0; i < n_company_ids; i++) {
+            company_filter[company_ids[i] >> 3] |= (guint8)(1u << (company_ids[i] & 7));
+        }
+    }
+    if (service_uuids && service_uuids[0]) {
+        guint n = g_strv_length((gchar**)service_uuids);
+        uuid_filter = g_malloc(n * sizeof(*uuid_filter));
+        for (guint i = 0; i < n; i++) {
+            if (uuid_normalize(service_uuids[i], uuid_filter[n_uuid_filter])) {
+                n_uuid_filter++;
+            } else {
+                HAL_LOG_WARN("Ignoring malformed service UUID '%s' in the advertisement filter.", service_uuids[i]);
+            }
+        }
+        if (n_uuid_filter == 0) {
+            g_free(uuid_filter);
+            uuid_filter = NULL;
+        }
+    }
+    if (company_filter || uuid_filter) {
+        HAL_LOG_INFO("Advertisement pre-filter: %u company ID(s), %u service UUID(s).",
+                     company_filter ? n_company_ids : 0, n_uuid_filter);
+    }
+}
+
+void hal_adv_filter_shutdown(void) {
+    g_free(company_filter);
+    company_filter = NULL;
+    g_free(uuid_filter);
+    uuid_filter = NULL;
+    n_uuid_filter = 0;
+}
+
+gboolean hal_adv_filter_accepts(HalPropId prop, GVariant* value) {
+    if (prop == HAL_PROP_DEVICE1_MANUFACTURER_DATA) {
+        if (!company_filter) return TRUE;
+    } else if (prop == HAL_PROP_DEVICE1_SERVICE_DATA) {
+        if (!uuid_filter) return TRUE;
+    } else {
+        return TRUE;
+    }
+
+    gboolean accepted = FALSE;
+    walk_entries(value, prop, filter_entry, &accepted);
+    return accepted;
+}
+
+// --- Public API ---
+
+guint ble_hal_adv_foreach_manufacturer_data(const BleHalAdvUpdate* update, BleHalAdvDataCb cb, void* user_data) {
+    GVariant* value = update_value(update, HAL_PROP_DEVICE1_MANUFACTURER_DATA);
+    ForeachTarget target = { cb, user_data };
+    return value && cb ? walk_entries(value, HAL_PROP_DEVICE1_MANUFACTURER_DATA, foreach_entry, &target) : 0;
+}
+
+guint ble_hal_adv_foreach_service_data(const BleHalAdvUpdate* update, BleHalAdvDataCb cb, void* user_data) {
+    GVariant* value = update_value(update, HAL_PROP_DEVICE1_SERVICE_DATA);
+    ForeachTarget target = { cb, user_data };
+    return value && cb ? walk_entries(value, HAL_PROP_DEVICE1_SERVICE_DATA, foreach_entry, &target) : 0;
+}
+
+gboolean ble_hal_adv_get_manufacturer_data(const BleHalAdvUpdate* update, guint16 company_id, BleHalAdvData* out) {
+    GVariant* value = update_value(update, HAL_PROP_DEVICE1_MANUFACTURER_DATA);
+    FindTarget target = { company_id, NULL, out, FALSE };
+
+    if (!value || !out) return FALSE;
+    walk_entries(value, HAL_PROP_DEVICE1_MANUFACTURER_DATA, find_entry, &target);
+    return target.found;
+}
+
+gboolean ble_hal_adv_get_service_data(const BleHalAdvUpdate* update, const char* uuid, BleHalAdvData* out) {
+    GVariant* value = update_value(update, HAL_PROP_DEVICE1_SERVICE_DATA);
+    gchar normalized[HAL_UUID_STRING_LENGTH + 1];
+    FindTarget target = { 0, normalized, out, FALSE };
+
+    if (!value || !out || !uuid || !uuid_normalize(uuid, normalized)) return FALSE;
+    walk_entries(value, HAL_PROP_DEVICE1_SERVICE_DATA, find_entry, &target);
+    return target.found;
+}
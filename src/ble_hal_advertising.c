@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * LE advertising.
+ *
+ * Every instance exports one org.bluez.LEAdvertisement1 object and registers
+ * it with the adapter's LEAdvertisingManager1 once. Payload changes after
+ * that are PropertiesChanged signals on the object: bluetoothd re-reads the
+ * changed fields and refreshes the data on the controller in place, with no
+ * unregister / register round trips and no gap on air.
+ *
+ * Before registering, the manager's SupportedInstances (advertising sets the
+ * controller still has free) is read, less the registrations of this module
+ * still in flight, so a full controller reports BLE_HAL_ERROR_BUSY instead
+ * of a D-Bus error.
+ *
+ * The instance table is guarded by advertising_lock: instances are created
+ * and their payloads posted on the caller's thread. Everything else (the
+ * served properties, the export and the registration) lives on the HAL
+ * context, which is also where bluetoothd's property reads are answered.
+ * Updates posted faster than the HAL context applies them are coalesced:
+ * only the newest payload is signalled.
+ */
+
+#define ADV_OBJECT_PATH_FORMAT  "/ble_hal/advertisement%u"
+
+typedef enum {
+    ADV_PROP_TYPE,
+    ADV_PROP_SERVICE_UUIDS,
+    ADV_PROP_MANUFACTURER_DATA,
+    ADV_PROP_SERVICE_DATA,
+    ADV_PROP_LOCAL_NAME,
+    ADV_PROP_INCLUDES,
+    ADV_PROP_MIN_INTERVAL,
+    ADV_PROP_MAX_INTERVAL,
+    ADV_N_PROPS
+} HalAdvProp;
+
+// ble_hal_advertising_update() replaces these; the others are fixed at start.
+#define ADV_PAYLOAD_FIRST   ADV_PROP_SERVICE_UUIDS
+#define ADV_PAYLOAD_LAST    ADV_PROP_INCLUDES
+
+static const gchar* const prop_names[ADV_N_PROPS] = {
+    "Type", "ServiceUUIDs", "ManufacturerData", "ServiceData", "LocalName", "Includes",
+    "MinInterval", "MaxInterval"
+};
+
+static const gchar advertisement_xml[] =
+    "<node>"
+    "  <interface name='org.bluez.LEAdvertisement1'>"
+    "    <method name='Release'/>"
+    "    <property name='Type' type='s' access='read'/>"
+    "    <property name='ServiceUUIDs' type='as' access='read'/>"
+    "    <property name='ManufacturerData' type='a{qv}' access='read'/>"
+    "    <property name='ServiceData' type='a{sv}' access='read'/>"
+    "    <property name='LocalName' type='s' access='read'/>"
+    "    <property name='Includes' type='as' access='read'/>"
+    "    <property name='MinInterval' type='u' access='read'/>"
+    "    <property name='MaxInterval' type='u' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+typedef enum {
+    ADV_STATE_UNREGISTERED,         // Not known to bluetoothd (new, released, or BlueZ went away)
+    ADV_STATE_CHECKING,             // Reading SupportedInstances
+    ADV_STATE_REGISTERING,          // RegisterAdvertisement in flight
+    ADV_STATE_REGISTERED
+} HalAdvState;
+
+typedef struct {
+    guint id;
+    gchar* adapter_path;
+    gchar* object_path;
+    // HAL context only
+    HalAdvState state;
+    guint registration_id;          // Object export, 0 while not exported
+    GVariant* props[ADV_N_PROPS];   // What bluetoothd reads; NULL: absent
+    // Guarded by advertising_lock
+    gboolean stopping;              // ble_hal_advertising_stop() was called
+    gboolean pending_set;           // 'pending' holds a payload not applied yet
+    gboolean flush_queued;          // A flush command is on its way
+    GVariant* pending[ADV_N_PROPS];
+} HalAdvertisement;
+
+typedef struct {
+    HalCommand base;
+    guint instance_id;
+} AdvertisingCommand;
+
+typedef struct {
+    HalRequest base;
+    guint instance_id;
+    HalCommand* command;            // Start or stop command the reply completes, or NULL
+} AdvertisingRequest;
+
+static GHashTable* advertisements = NULL;       // GUINT_TO_POINTER(id) -> HalAdvertisement*
+static guint next_instance_id = 1;
+static GMutex advertising_lock;
+static GDBusNodeInfo* advertisement_info = NULL;
+
+static void send_register(HalAdvertisement* adv, HalCommand* command);
+
+// --- Instances ---
+
+static void props_clear(GVariant** props) {
+    for (guint i = 0; i < ADV_N_PROPS; i++) {
+        if (props[i]) g_variant_unref(props[i]);
+        props[i] = NULL;
+    }
+}
+
+static void advertisement_free(gpointer data) {
+    HalAdvertisement* adv = (HalAdvertisement*)data;
+    props_clear(adv->props);
+    props_clear(adv->pending);
+    g_free(adv->adapter_path);
+    g_free(adv->object_path);
+    g_free(adv);
+}
+
+static HalAdvertisement* advertisement_lookup(guint id) {
+    g_mutex_lock(&advertising_lock);
+    HalAdvertisement* adv = advertisements ? g_hash_table_lookup(advertisements, GUINT_TO_POINTER(id)) : NULL;
+    g_mutex_unlock(&advertising_lock);
+    return adv;
+}
+
+static void advertisement_unexport(HalAdvertisement* adv) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    if (adv->registration_id && conn) {
+        g_dbus_connection_unregister_object(conn, adv->registration_id);
+    }
+    adv->registration_id = 0;
+}
+
+/**
+ * @brief Drops an instance from the table, unexports and frees it. HAL context only.
+ */
+static void advertisement_remove(HalAdvertisement* adv) {
+    g_mutex_lock(&advertising_lock);
+    g_hash_table_steal(advertisements, GUINT_TO_POINTER(adv->id));
+    g_mutex_unlock(&advertising_lock);
+    advertisement_unexport(adv);
+    advertisement_free(adv);
+}
+
+static GVariant* bytes_new(const guint8* data, gsize length) {
+    return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, length, sizeof(guint8));
+}
+
+/**
+ * @brief Fills the payload properties of 'props' (ADV_PAYLOAD_FIRST to
+ * ADV_PAYLOAD_LAST, NULL for absent ones) from 'payload', which may be NULL.
+ */
+static void payload_to_props(const BleHalAdvertisingPayload* payload, GVariant** props) {
+    GVariantBuilder builder;
+    static const BleHalAdvertisingPayload empty = {0};
+
+    if (!payload) payload = &empty;
+
+    props[ADV_PROP_SERVICE_UUIDS] = g_variant_ref_sink(
+        g_variant_new_strv(payload->service_uuids, payload->service_uuids ? -1 : 0));
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{qv}"));
+    if (payload->manufacturer_data_length > 0) {
+        g_variant_builder_add(&builder, "{qv}", payload->company_id,
+                              bytes_new(payload->manufacturer_data, payload->manufacturer_data_length));
+    }
+    props[ADV_PROP_MANUFACTURER_DATA] = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    if (payload->service_data_uuid) {
+        g_variant_builder_add(&builder, "{sv}", payload->service_data_uuid,
+                              bytes_new(payload->service_data, payload->service_data_length));
+    }
+    props[ADV_PROP_SERVICE_DATA] = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+    props[ADV_PROP_LOCAL_NAME] = payload->local_name && payload->local_name[0]
+                                 ? g_variant_ref_sink(g_variant_new_string(payload->local_name)) : NULL;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+    if (payload->include_tx_power) {
+        g_variant_builder_add(&builder, "s", "tx-power");
+    }
+    props[ADV_PROP_INCLUDES] = g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+static gboolean payload_is_valid(const BleHalAdvertisingPayload* payload) {
+    if (!payload) return TRUE;
+    if (payload->manufacturer_data_length > 0 && !payload->manufacturer_data) return FALSE;
+    if (payload->service_data_length > 0 && (!payload->service_data || !payload->service_data_uuid)) return FALSE;
+    if (payload->local_name && !g_utf8_validate(payload->local_name, -1, NULL)) return FALSE;
+    return TRUE;
+}
+
+// --- Exported Object ---
+
+static void on_method_call(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                           const gchar* interface_name, const gchar* method_name, GVariant* parameters,
+                           GDBusMethodInvocation* invocation, gpointer user_data) {
+    HalAdvertisement* adv = advertisement_lookup(GPOINTER_TO_UINT(user_data));
+
+    if (strcmp(method_name, "Release") == 0) {
+        if (adv && adv->state == ADV_STATE_REGISTERED) {
+            // Sent when the adapter goes away; registered again if BlueZ restarts.
+            adv->state = ADV_STATE_UNREGISTERED;
+            HAL_LOG_WARN("Advertisement %u released by BlueZ.", adv->id);
+        }
+        g_dbus_method_invocation_return_value(invocation, NULL);
+        return;
+    }
+    g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.UnknownMethod",
+                                               "Unknown method");
+}
+
+static GVariant* on_get_property(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                                 const gchar* interface_name, const gchar* property_name, GError** error,
+                                 gpointer user_data) {
+    HalAdvertisement* adv = advertisement_lookup(GPOINTER_TO_UINT(user_data));
+
+    for (guint i = 0; adv && i < ADV_N_PROPS; i++) {
+        if (strcmp(property_name, prop_names[i]) == 0 && adv->props[i]) {
+            return g_variant_ref(adv->props[i]);
+        }
+    }
+    // GetAll asks with a NULL 'error' and leaves absent properties out.
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No such property '%s'", property_name);
+    return NULL;
+}
+
+static const GDBusInterfaceVTable advertisement_vtable = { on_method_call, on_get_property, NULL };
+
+/**
+ * @brief Exports the object if it is not yet. Method calls and property
+ * reads are dispatched on the HAL context.
+ */
+static gboolean advertisement_export(HalAdvertisement* adv) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    GError* error = NULL;
+
+    if (adv->registration_id) return TRUE;
+    if (!conn) return FALSE;
+
+    g_main_context_push_thread_default(hal_events_get_hal_context());
+    adv->registration_id = g_dbus_connection_register_object(conn, adv->object_path,
+                                                             advertisement_info->interfaces[0],
+                                                             &advertisement_vtable, GUINT_TO_POINTER(adv->id),
+                                                             NULL, &error);
+    g_main_context_pop_thread_default(hal_events_get_hal_context());
+    if (!adv->registration_id) {
+        HAL_LOG_ERROR("Failed to export %s: %s", adv->object_path, error ? error->message : "unknown error");
+        g_clear_error(&error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Moves the newest posted payload into the served properties and
+ * signals the fields that differ. HAL context only.
+ */
+static void advertisement_flush(HalAdvertisement* adv) {
+    GVariant* payload[ADV_N_PROPS] = {0};
+    GVariantBuilder changed, invalidated;
+    guint n_changed = 0;
+
+    g_mutex_lock(&advertising_lock);
+    adv->flush_queued = FALSE;
+    gboolean set = adv->pending_set;
+    if (set) {
+        memcpy(payload, adv->pending, sizeof(payload));
+        memset(adv->pending, 0, sizeof(adv->pending));
+        adv->pending_set = FALSE;
+    }
+    g_mutex_unlock(&advertising_lock);
+    if (!set) return;
+
+    g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_init(&invalidated, G_VARIANT_TYPE_STRING_ARRAY);
+    for (guint i = ADV_PAYLOAD_FIRST; i <= ADV_PAYLOAD_LAST; i++) {
+        GVariant* old = adv->props[i];
+        if (old && payload[i] ? g_variant_equal(old, payload[i]) : old == payload[i]) {
+            if (payload[i]) g_variant_unref(payload[i]);
+            continue;
+        }
+        if (payload[i]) {
+            g_variant_builder_add(&changed, "{sv}", prop_names[i], payload[i]);
+        } else {
+            g_variant_builder_add(&invalidated, "s", prop_names[i]);
+        }
+        if (old) g_variant_unref(old);
+        adv->props[i] = payload[i];
+        n_changed++;
+    }
+
+    GDBusConnection* conn = hal_get_dbus_connection();
+    if (n_changed == 0 || !adv->registration_id || !conn) {
+        g_variant_builder_clear(&changed);
+        g_variant_builder_clear(&invalidated);
+        return; // Read as a whole at the next registration
+    }
+
+    GError* error = NULL;
+    if (!g_dbus_connection_emit_signal(conn, NULL, adv->object_path, "org.freedesktop.DBus.Properties",
+                                       "PropertiesChanged",
+                                       g_variant_new("(sa{sv}as)", "org.bluez.LEAdvertisement1",
+                                                     &changed, &invalidated),
+                                       &error)) {
+        HAL_LOG_ERROR("Failed to signal the payload of advertisement %u: %s", adv->id, error->message);
+        g_clear_error(&error);
+        return;
+    }
+    HAL_LOG_DEBUG("Advertisement %u: %u field(s) changed.", adv->id, n_changed);
+}
+
+// --- Requests ---
+
+static BleHalStatus on_unregister_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                        BleHalStatus status) {
+    AdvertisingRequest* call = (AdvertisingRequest*)request;
+    if (call->command) {
+        // The instance is gone either way; only a refused call is worth reporting.
+        hal_command_complete(call->command, status == BLE_HAL_ERROR_CANCELLED ? BLE_HAL_SUCCESS : status);
+    }
+    return status;
+}
+
+static void send_unregister(const gchar* adapter_path, const gchar* object_path, HalCommand* command) {
+    AdvertisingRequest* call = hal_request_new(sizeof(AdvertisingRequest), adapter_path,
+                                               "org.bluez.LEAdvertisingManager1", "UnregisterAdvertisement",
+                                               g_variant_new("(o)", object_path), NULL, 0, NULL, NULL);
+    call->base.on_reply = on_unregister_reply;
+    call->command = command;
+    if (hal_request_submit(&call->base) != BLE_HAL_PENDING && command) {
+        hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+}
+
+static BleHalStatus on_register_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                      BleHalStatus status) {
+    AdvertisingRequest* call = (AdvertisingRequest*)request;
+    HalAdvertisement* adv = advertisement_lookup(call->instance_id);
+
+    if (!adv) {
+        // Stopped while registering: undo the registration it never saw.
+        if (status == BLE_HAL_SUCCESS) {
+            gchar* object_path = g_strdup_printf(ADV_OBJECT_PATH_FORMAT, call->instance_id);
+            send_unregister(request->object_path, object_path, NULL);
+            g_free(object_path);
+        }
+        if (call->command) hal_command_complete(call->command, BLE_HAL_ERROR_CANCELLED);
+        return status;
+    }
+
+    if (status == BLE_HAL_SUCCESS) {
+        adv->state = ADV_STATE_REGISTERED;
+        HAL_LOG_INFO("Advertisement %u registered on %s.", adv->id, adv->adapter_path);
+    } else if (status == BLE_HAL_ERROR_CANCELLED || !call->command) {
+        adv->state = ADV_STATE_UNREGISTERED; // Registered again when BlueZ (re)appears
+        if (status != BLE_HAL_ERROR_CANCELLED) {
+            HAL_LOG_ERROR("Re-registering advertisement %u failed (%d).", adv->id, status);
+        }
+    } else {
+        advertisement_remove(adv);
+    }
+    if (call->command) hal_command_complete(call->command, status);
+    return status;
+}
+
+static void send_register(HalAdvertisement* adv, HalCommand* command) {
+    if (!advertisement_export(adv)) {
+        advertisement_remove(adv);
+        if (command) hal_command_complete(command, BLE_HAL_ERROR_DBUS);
+        return;
+    }
+
+    AdvertisingRequest* call = hal_request_new(sizeof(AdvertisingRequest), adv->adapter_path,
+                                               "org.bluez.LEAdvertisingManager1", "RegisterAdvertisement",
+                                               g_variant_new("(o@a{sv})", adv->object_path,
+                                                             g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0)),
+                                               NULL, 0, NULL, NULL);
+    call->base.on_reply = on_register_reply;
+    call->instance_id = adv->id;
+    call->command = command;
+    adv->state = ADV_STATE_REGISTERING;
+    if (hal_request_submit(&call->base) != BLE_HAL_PENDING) {
+        adv->state = ADV_STATE_UNREGISTERED;
+        if (command) hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+}
+
+/**
+ * @brief Registrations of this module in flight on 'adapter_path', other
+ * than 'adv'. Not yet counted in SupportedInstances.
+ */
+static guint count_registering(const HalAdvertisement* adv) {
+    GHashTableIter iter;
+    gpointer value;
+    guint n = 0;
+
+    g_mutex_lock(&advertising_lock);
+    g_hash_table_iter_init(&iter, advertisements);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const HalAdvertisement* other = (const HalAdvertisement*)value;
+        if (other != adv && other->state == ADV_STATE_REGISTERING &&
+            strcmp(other->adapter_path, adv->adapter_path) == 0) {
+            n++;
+        }
+    }
+    g_mutex_unlock(&advertising_lock);
+    return n;
+}
+
+static BleHalStatus on_limits_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                    BleHalStatus status) {
+    AdvertisingRequest* call = (AdvertisingRequest*)request;
+    HalAdvertisement* adv = advertisement_lookup(call->instance_id);
+    GVariant* props = NULL;
+    guint8 supported;
+
+    if (!adv) {
+        hal_command_complete(call->command, BLE_HAL_ERROR_CANCELLED); // Stopped meanwhile
+        return status;
+    }
+    if (status == BLE_HAL_ERROR_CANCELLED) {
+        adv->state = ADV_STATE_UNREGISTERED; // hal_advertising_resume() registers it
+        hal_command_complete(call->command, status);
+        return status;
+    }
+    if (status != BLE_HAL_SUCCESS) {
+        advertisement_remove(adv); // Most likely no LEAdvertisingManager1 on the adapter
+        hal_command_complete(call->command, status);
+        return status;
+    }
+
+    g_variant_get(reply, "(@a{sv})", &props);
+    if (g_variant_lookup(props, "SupportedInstances", "y", &supported)) {
+        guint in_flight = count_registering(adv);
+        if (supported <= in_flight) {
+            HAL_LOG_WARN("No free advertising instance on %s (%u free, %u registering).",
+                         adv->adapter_path, supported, in_flight);
+            g_variant_unref(props);
+            advertisement_remove(adv);
+            hal_command_complete(call->command, BLE_HAL_ERROR_BUSY);
+            return status;
+        }
+    }
+    g_variant_unref(props);
+    send_register(adv, call->command);
+    return status;
+}
+
+// --- Commands ---
+
+static void start_execute(HalCommand* command) {
+    HalAdvertisement* adv = advertisement_lookup(((AdvertisingCommand*)command)->instance_id);
+
+    if (!adv) {
+        hal_command_complete(command, BLE_HAL_ERROR_CANCELLED); // Stopped before it ran
+        return;
+    }
+
+    AdvertisingRequest* call = hal_request_new(sizeof(AdvertisingRequest), adv->adapter_path,
+                                               "org.freedesktop.DBus.Properties", "GetAll",
+                                               g_variant_new("(s)", "org.bluez.LEAdvertisingManager1"),
+                                               G_VARIANT_TYPE("(a{sv})"), 0, NULL, NULL);
+    call->base.on_reply = on_limits_reply;
+    call->instance_id = adv->id;
+    call->command = command; // Completed once registered
+    adv->state = ADV_STATE_CHECKING;
+    if (hal_request_submit(&call->base) != BLE_HAL_PENDING) {
+        adv->state = ADV_STATE_UNREGISTERED;
+        hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+}
+
+static void flush_execute(HalCommand* command) {
+    HalAdvertisement* adv = advertisement_lookup(((AdvertisingCommand*)command)->instance_id);
+    if (adv) advertisement_flush(adv);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void stop_execute(HalCommand* command) {
+    HalAdvertisement* adv = advertisement_lookup(((AdvertisingCommand*)command)->instance_id);
+
+    if (!adv) {
+        hal_command_complete(command, BLE_HAL_SUCCESS); // Its start failed meanwhile
+        return;
+    }
+
+    gboolean registered = adv->state == ADV_STATE_REGISTERED;
+    gchar* adapter_path = g_strdup(adv->adapter_path);
+    gchar* object_path = g_strdup(adv->object_path);
+    HAL_LOG_INFO("Advertisement %u stopped on %s.", adv->id, adapter_path);
+    // A registration still in flight is undone when its reply finds the instance gone.
+    advertisement_remove(adv);
+    if (registered) {
+        send_unregister(adapter_path, object_path, command);
+    } else {
+        hal_command_complete(command, BLE_HAL_SUCCESS);
+    }
+    g_free(adapter_path);
+    g_free(object_path);
+}
+
+// --- Internal API ---
+
+void hal_advertising_init(void) {
+    GError* error = NULL;
+
+    advertisement_info = g_dbus_node_info_new_for_xml(advertisement_xml, &error);
+    if (!advertisement_info) {
+        HAL_LOG_ERROR("Bad advertisement introspection data: %s", error->message); // Only if the XML above breaks
+        g_clear_error(&error);
+    }
+    g_mutex_lock(&advertising_lock);
+    advertisements = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, advertisement_free);
+    g_mutex_unlock(&advertising_lock);
+}
+
+void hal_advertising_shutdown(void) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    GHashTableIter iter;
+    gpointer value;
+    guint n_unregistered = 0;
+
+    g_mutex_lock(&advertising_lock);
+    if (advertisements) {
+        g_hash_table_iter_init(&iter, advertisements);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalAdvertisement* adv = (HalAdvertisement*)value;
+            if (conn && adv->state >= ADV_STATE_REGISTERING) {
+                // Nothing waits for the reply: the HAL thread is already stopped.
+                g_dbus_connection_call(conn, "org.bluez", adv->adapter_path, "org.bluez.LEAdvertisingManager1",
+                                       "UnregisterAdvertisement", g_variant_new("(o)", adv->object_path),
+                                       NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+                n_unregistered++;
+            }
+            advertisement_unexport(adv);
+        }
+        g_hash_table_destroy(advertisements);
+        advertisements = NULL;
+    }
+    g_mutex_unlock(&advertising_lock);
+
+    if (n_unregistered > 0) {
+        g_dbus_connection_flush_sync(conn, NULL, NULL); // Out before the connection is dropped
+        HAL_LOG_INFO("Unregistered %u advertisement(s).", n_unregistered);
+    }
+    if (advertisement_info) {
+        g_dbus_node_info_unref(advertisement_info);
+        advertisement_info = NULL;
+    }
+}
+
+void hal_advertising_bluez_lost(void) {
+    GHashTableIter iter;
+    gpointer value;
+
+    g_mutex_lock(&advertising_lock);
+    if (advertisements) {
+        g_hash_table_iter_init(&iter, advertisements);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            ((HalAdvertisement*)value)->state = ADV_STATE_UNREGISTERED;
+        }
+    }
+    g_mutex_unlock(&advertising_lock);
+}
+
+void hal_advertising_resume(void) {
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray* waiting = g_ptr_array_new();
+
+    g_mutex_lock(&advertising_lock);
+    if (advertisements) {
+        g_hash_table_iter_init(&iter, advertisements);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalAdvertisement* adv = (HalAdvertisement*)value;
+            if (adv->state == ADV_STATE_UNREGISTERED && !adv->stopping) g_ptr_array_add(waiting, adv);
+        }
+    }
+    g_mutex_unlock(&advertising_lock);
+
+    for (guint i = 0; i < waiting->len; i++) {
+        HalAdvertisement* adv = g_ptr_array_index(waiting, i);
+        HAL_LOG_INFO("Registering advertisement %u on %s again.", adv->id, adv->adapter_path);
+        send_register(adv, NULL);
+    }
+    g_ptr_array_free(waiting, TRUE);
+}
+
+// --- Public API ---
+
+BleHalStatus ble_hal_advertising_start(const char* adapter_path, const BleHalAdvertisingParams* params,
+                                       const BleHalAdvertisingPayload* payload, guint* instance_id,
+                                       BleHalResultCb cb, void* user_data) {
+    BleHalAdapterInfo info;
+
+    if ((adapter_path && !g_variant_is_object_path(adapter_path)) || !instance_id || !payload_is_valid(payload) ||
+        (params && (params->type > BLE_HAL_ADVERTISING_PERIPHERAL ||
+                    (params->max_interval_ms && params->min_interval_ms > params->max_interval_ms)))) {
+        HAL_LOG_ERROR("Invalid adapter path, parameters, payload or instance pointer for advertising_start.");
+        if (cb) cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    if (!adapter_path) {
+        BleHalStatus status = ble_hal_get_adapter_info(&info);
+        if (status != BLE_HAL_SUCCESS) {
+            if (cb) cb(status, user_data);
+            return status;
+        }
+        adapter_path = info.path;
+    }
+
+    HalAdvertisement* adv = g_new0(HalAdvertisement, 1);
+    adv->adapter_path = g_strdup(adapter_path);
+    adv->state = ADV_STATE_CHECKING; // Owned by the start command; hal_advertising_resume() leaves it alone
+    adv->props[ADV_PROP_TYPE] = g_variant_ref_sink(g_variant_new_string(
+        params && params->type == BLE_HAL_ADVERTISING_PERIPHERAL ? "peripheral" : "broadcast"));
+    if (params && params->min_interval_ms) {
+        adv->props[ADV_PROP_MIN_INTERVAL] = g_variant_ref_sink(g_variant_new_uint32(params->min_interval_ms));
+    }
+    if (params && params->max_interval_ms) {
+        adv->props[ADV_PROP_MAX_INTERVAL] = g_variant_ref_sink(g_variant_new_uint32(params->max_interval_ms));
+    }
+    payload_to_props(payload, adv->props);
+
+    g_mutex_lock(&advertising_lock);
+    if (!advertisements) {
+        g_mutex_unlock(&advertising_lock);
+        advertisement_free(adv);
+        if (cb) cb(BLE_HAL_ERROR_NOT_INITIALIZED, user_data);
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+    adv->id = next_instance_id++;
+    if (next_instance_id == 0) next_instance_id = 1;
+    adv->object_path = g_strdup_printf(ADV_OBJECT_PATH_FORMAT, adv->id);
+    g_hash_table_insert(advertisements, GUINT_TO_POINTER(adv->id), adv);
+    *instance_id = adv->id;
+    g_mutex_unlock(&advertising_lock);
+
+    AdvertisingCommand* start = hal_command_new(sizeof(AdvertisingCommand), start_execute, NULL, cb, user_data);
+    start->instance_id = *instance_id;
+    BleHalStatus status = hal_command_submit(&start->base);
+    if (status != BLE_HAL_PENDING) {
+        g_mutex_lock(&advertising_lock);
+        if (advertisements) g_hash_table_remove(advertisements, GUINT_TO_POINTER(*instance_id));
+        g_mutex_unlock(&advertising_lock);
+        if (cb) cb(status, user_data);
+    }
+    return status;
+}
+
+BleHalStatus ble_hal_advertising_update(guint instance_id, const BleHalAdvertisingPayload* payload) {
+    GVariant* props[ADV_N_PROPS] = {0};
+    AdvertisingCommand* flush = NULL;
+
+    if (!payload_is_valid(payload)) {
+        HAL_LOG_ERROR("Invalid payload for advertising_update.");
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    payload_to_props(payload, props); // Built outside the lock
+
+    g_mutex_lock(&advertising_lock);
+    HalAdvertisement* adv = advertisements ? g_hash_table_lookup(advertisements, GUINT_TO_POINTER(instance_id))
+                                           : NULL;
+    if (!adv || adv->stopping) {
+        BleHalStatus status = advertisements ? BLE_HAL_ERROR_NOT_FOUND : BLE_HAL_ERROR_NOT_INITIALIZED;
+        g_mutex_unlock(&advertising_lock);
+        props_clear(props);
+        return status;
+    }
+    props_clear(adv->pending); // Superseded before it was applied
+    memcpy(adv->pending, props, sizeof(props));
+    adv->pending_set = TRUE;
+    if (!adv->flush_queued) {
+        adv->flush_queued = TRUE;
+        flush = hal_command_new(sizeof(AdvertisingCommand), flush_execute, NULL, NULL, NULL);
+        flush->instance_id = instance_id;
+    }
+    g_mutex_unlock(&advertising_lock);
+
+    if (flush && hal_command_submit(&flush->base) != BLE_HAL_PENDING) {
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+    return BLE_HAL_SUCCESS;
+}
+
+BleHalStatus ble_hal_advertising_stop(guint instance_id, BleHalResultCb cb, void* user_data) {
+    g_mutex_lock(&advertising_lock);
+    HalAdvertisement* adv = advertisements ? g_hash_table_lookup(advertisements, GUINT_TO_POINTER(instance_id))
+                                           : NULL;
+    if (!adv || adv->stopping) {
+        BleHalStatus status = advertisements ? BLE_HAL_ERROR_NOT_FOUND : BLE_HAL_ERROR_NOT_INITIALIZED;
+        g_mutex_unlock(&advertising_lock);
+        if (cb) cb(status, user_data);
+        return status;
+    }
+    adv->stopping = TRUE;
+    g_mutex_unlock(&advertising_lock);
+
+    AdvertisingCommand* stop = hal_command_new(sizeof(AdvertisingCommand), stop_execute, NULL, cb, user_data);
+    stop->instance_id = instance_id;
+    BleHalStatus status = hal_command_submit(&stop->base);
+    if (status != BLE_HAL_PENDING && cb) cb(status, user_data);
+    return status;
+}
@@ -0,0 +1,248 @@
+#include <string.h>
+#include "ble_hal_internal.h"
+
+struct _HalAdvBatch {
+    HalDeviceTable* devices;        // Device table the pending entries refer to
+    GMainContext* context;          // Context the table is written on; flush timers run there
+    BleHalAdvBatchCb cb;
+    void* user_data;
+    guint interval_ms;              // Flush at most this long after the first pending update
+    guint max_entries;              // Flush once this many devices are pending
+    BleHalAdvUpdate* entries;       // Pending updates, one per device ('count' in use)
+    guint count;
+    guint capacity;                 // Allocated length of 'entries'
+    guint32 generation;             // Bumped on every flush; stale HalDevice.batch_slot values are ignored
+    gchar* paths;                   // Device paths of the delivered entries, formatted at flush
+    gsize paths_size;               // Allocated length of 'paths'
+    // The other half of a double buffer: 'entries' and 'paths' swap with these
+    // on every delivered flush, so the batch fills one pair while the
+    // callback reads the other. NULL while that pair is being delivered.
+    BleHalAdvUpdate* spare_entries;
+    guint spare_capacity;
+    gchar* spare_paths;
+    gsize spare_paths_size;
+    GSource* flush_source;          // Pending flush timer on 'context' (NULL if none)
+};
+
+static gboolean on_flush_timeout(gpointer user_data);
+
+HalAdvBatch* hal_adv_batch_new(HalDeviceTable* devices, GMainContext* context,
+                               guint interval_ms, guint max_entries,
+                               BleHalAdvBatchCb cb, void* user_data) {
+    HalAdvBatch* batch = g_new0(HalAdvBatch, 1);
+    batch->devices = devices;
+    batch->context = g_main_context_ref(context);
+    batch->cb = cb;
+    batch->user_data = user_data;
+    batch->interval_ms = interval_ms ? interval_ms : BLE_HAL_ADV_BATCH_DEFAULT_INTERVAL_MS;
+    batch->max_entries = max_entries ? max_entries : BLE_HAL_ADV_BATCH_DEFAULT_MAX_ENTRIES;
+    batch->capacity = batch->max_entries;
+    batch->entries = g_new0(BleHalAdvUpdate, batch->capacity);
+    batch->spare_capacity = batch->max_entries;
+    batch->spare_entries = g_new0(BleHalAdvUpdate, batch->spare_capacity);
+    batch->generation = 1;
+    return batch;
+}
+
+static void entry_release(BleHalAdvUpdate* entry) {
+    if (entry->manufacturer_data) g_variant_unref(entry->manufacturer_data);
+    if (entry->service_data) g_variant_unref(entry->service_data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+void hal_adv_batch_reset(HalAdvBatch* batch) {
+    if (!batch) return;
+    for (guint i = 0; i < batch->count; i++) {
+        entry_release(&batch->entries[i]);
+    }
+    batch->count = 0;
+    batch->generation++;
+    hal_source_clear(&batch->flush_source);
+}
+
+void hal_adv_batch_free(HalAdvBatch* batch) {
+    if (!batch) return;
+    hal_adv_batch_reset(batch);
+    g_main_context_unref(batch->context);
+    g_free(batch->entries);
+    g_free(batch->paths);
+    g_free(batch->spare_entries);
+    g_free(batch->spare_paths);
+    g_free(batch);
+}
+
+/**
+ * @brief Returns the pending entry for 'device', creating one if needed.
+ */
+static BleHalAdvUpdate* entry_for_device(HalAdvBatch* batch, HalDevice* device) {
+    if (device->batch_generation == batch->generation && device->batch_slot < batch->count) {
+        return &batch->entries[device->batch_slot];
+    }
+
+    if (batch->count == batch->capacity) {
+        // Only reachable between an add and the caller's hal_adv_batch_flush_if_full().
+        batch->capacity *= 2;
+        batch->entries = g_renew(BleHalAdvUpdate, batch->entries, batch->capacity);
+    }
+
+    BleHalAdvUpdate* entry = &batch->entries[batch->count];
+    memset(entry, 0, sizeof(*entry));
+    hal_address_unpack(device->addr_key, &entry->address);
+    entry->rssi = BLE_HAL_RSSI_UNKNOWN;
+    entry->tx_power = BLE_HAL_TX_POWER_UNKNOWN;
+    device->batch_slot = batch->count++;
+    device->batch_generation = batch->generation;
+    return entry;
+}
+
+static void replace_variant(GVariant** slot, GVariant* value) {
+    if (*slot) g_variant_unref(*slot);
+    *slot = g_variant_ref(value);
+}
+
+gboolean hal_adv_batch_add(HalAdvBatch* batch, HalDevice* device, HalPropId prop, GVariant* value) {
+    guint32 field;
+
+    if (!batch || !device) return FALSE;
+
+    switch (prop) {
+        case HAL_PROP_DEVICE1_RSSI:              field = BLE_HAL_ADV_FIELD_RSSI; break;
+        case HAL_PROP_DEVICE1_TX_POWER:          field = BLE_HAL_ADV_FIELD_TX_POWER; break;
+        case HAL_PROP_DEVICE1_MANUFACTURER_DATA: field = BLE_HAL_ADV_FIELD_MANUFACTURER_DATA; break;
+        case HAL_PROP_DEVICE1_SERVICE_DATA:      field = BLE_HAL_ADV_FIELD_SERVICE_DATA; break;
+        default:
+            return FALSE; // Not an advertisement property
+    }
+
+    BleHalAdvUpdate* entry = entry_for_device(batch, device);
+    switch (field) {
+        case BLE_HAL_ADV_FIELD_RSSI:
+            entry->rssi = g_variant_get_int16(value);
+            break;
+        case BLE_HAL_ADV_FIELD_TX_POWER:
+            entry->tx_power = g_variant_get_int16(value);
+            break;
+        case BLE_HAL_ADV_FIELD_MANUFACTURER_DATA:
+            replace_variant(&entry->manufacturer_data, value);
+            break;
+        case BLE_HAL_ADV_FIELD_SERVICE_DATA:
+            replace_variant(&entry->service_data, value);
+            break;
+    }
+    entry->changed |= field;
+    entry->timestamp_us = g_get_monotonic_time();
+
+    // Never flush from here: callers may hold the device table lock.
+    if (!batch->flush_source) {
+        batch->flush_source = hal_timeout_source_attach(batch->context, batch->interval_ms,
+                                                        on_flush_timeout, batch);
+    }
+    return TRUE;
+}
+
+void hal_adv_batch_flush_if_full(HalAdvBatch* batch) {
+    if (batch && batch->count >= batch->max_entries) {
+        hal_adv_batch_flush(batch);
+    }
+}
+
+void hal_adv_batch_forget(HalAdvBatch* batch, HalDevice* device) {
+    if (!batch || !device) return;
+    if (device->batch_generation == batch->generation && device->batch_slot < batch->count) {
+        // Leave the slot in place with no fields set; flush skips it.
+        BleHalAdvUpdate* entry = &batch->entries[device->batch_slot];
+        entry_release(entry);
+        device->batch_generation = 0;
+    }
+}
+
+void hal_adv_batch_flush(HalAdvBatch* batch) {
+    if (!batch) return;
+
+    hal_source_clear(&batch->flush_source);
+    if (batch->count == 0) return;
+
+    // Records keep no path, so each delivered entry gets one formatted into 'paths'.
+    gsize stride = hal_device_table_path_size(batch->devices);
+    if (batch->paths_size < batch->count * stride) {
+        g_free(batch->paths);
+        batch->paths_size = batch->count * stride;
+        batch->paths = g_malloc(batch->paths_size);
+    }
+
+    // Compact out forgotten entries and attach the device paths.
+    guint n = 0;
+    for (guint i = 0; i < batch->count; i++) {
+        BleHalAdvUpdate* entry = &batch->entries[i];
+        if (entry->changed == 0) continue;
+        HalDevice* device = hal_device_table_lookup_address(batch->devices, hal_address_pack(&entry->address));
+        if (!device) {
+            entry_release(entry);
+            continue;
+        }
+        gchar* path = batch->paths + n * stride;
+        hal_device_table_format_path(batch->devices, device, path, stride);
+        entry->path = path;
+        if (n != i) {
+            batch->entries[n] = *entry;
+            memset(entry, 0, sizeof(*entry));
+        }
+        n++;
+    }
+
+    // Start a new generation before calling out, so updates made from the
+    // callback open fresh entries instead of touching the array being delivered.
+    guint delivered = n;
+    batch->count = 0;
+    batch->generation++;
+
+    BleHalAdvUpdate* snapshot = batch->entries;
+    if (delivered > 0 && batch->cb) {
+        guint snapshot_capacity = batch->capacity;
+        gchar* paths = batch->paths;
+        gsize paths_size = batch->paths_size;
+        if (batch->spare_entries) {
+            batch->entries = batch->spare_entries;
+            batch->capacity = batch->spare_capacity;
+        } else {
+            // Flushed again from inside the callback: the spare pair is the one being delivered.
+            batch->capacity = batch->max_entries;
+            batch->entries = g_new(BleHalAdvUpdate, batch->capacity);
+        }
+        batch->paths = batch->spare_paths;
+        batch->paths_size = batch->spare_paths_size;
+        batch->spare_entries = NULL;
+        batch->spare_paths = NULL;
+        batch->spare_paths_size = 0;
+
+        batch->cb(snapshot, delivered, batch->user_data);
+        for (guint i = 0; i < delivered; i++) {
+            entry_release(&snapshot[i]);
+        }
+
+        // The delivered pair becomes the spare for the next flush, unless a
+        // nested flush already put one back.
+        if (batch->spare_entries) {
+            g_free(snapshot);
+        } else {
+            batch->spare_entries = snapshot;
+            batch->spare_capacity = snapshot_capacity;
+        }
+        if (batch->spare_paths) {
+            g_free(paths);
+        } else {
+            batch->spare_paths = paths;
+            batch->spare_paths_size = paths_size;
+        }
+    } else {
+        for (guint i = 0; i < delivered; i++) {
+            entry_release(&snapshot[i]);
+        }
+    }
+}
+
+static gboolean on_flush_timeout(gpointer user_data) {
+    HalAdvBatch* batch = (HalAdvBatch*)user_data;
+    hal_adv_batch_flush(batch); // Destroys and clears batch->flush_source
+    return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Warm-start device cache.
+ *
+ * The file holds fixed-size adapter and device records followed by a table
+ * of NUL-terminated strings, all 8-byte aligned, so a mapped file is read in
+ * place without parsing. It is written in host byte order; a file from a
+ * different byte order or format version is ignored. Times are stored as
+ * wall-clock microseconds and turned back into g_get_monotonic_time() values
+ * on load, since the monotonic clock restarts with the system.
+ */
+
+#define HAL_CACHE_MAGIC         "BLEHALDC"
+#define HAL_CACHE_VERSION       1u
+#define HAL_CACHE_BYTE_ORDER    0x01020304u
+#define HAL_CACHE_NO_STRING     G_MAXUINT32
+// Device flags worth keeping across a restart (not batch or scan state).
+#define HAL_CACHE_DEVICE_FLAGS  (HAL_DEVICE_FLAG_PUBLIC_MASK | HAL_DEVICE_FLAG_HAS_RSSI | HAL_DEVICE_FLAG_HAS_TX_POWER)
+
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 byte_order;             // HAL_CACHE_BYTE_ORDER as written
+    guint32 n_adapters;
+    guint32 n_devices;
+    guint32 strings_size;           // Bytes in the string table
+    guint32 reserved;
+    gint64 saved_at_us;             // g_get_real_time() at save
+} HalCacheHeader;
+
+typedef struct {
+    guint32 path;                   // String offset of the object path
+    guint32 name;                   // String offset, or HAL_CACHE_NO_STRING
+    guint32 first_device;           // Index of the adapter's first device record
+    guint32 n_devices;
+    guint8 address[6];
+    guint8 flags;                   // HAL_ADAPTER_FLAG_* bits
+    guint8 reserved;
+} HalCacheAdapter;
+
+typedef struct {
+    gint64 last_seen_us;            // Wall clock of the last advertisement, 0 if none
+    guint32 name;                   // String offset, or HAL_CACHE_NO_STRING
+    gint16 rssi;
+    gint16 tx_power;
+    guint8 address[6];
+    guint8 address_type;
+    guint8 flags;                   // HAL_CACHE_DEVICE_FLAGS bits
+} HalCacheDevice;
+
+G_STATIC_ASSERT(sizeof(HalCacheHeader) == 40);
+G_STATIC_ASSERT(sizeof(HalCacheAdapter) == 24);
+G_STATIC_ASSERT(sizeof(HalCacheDevice) == 24);
+
+// --- Save ---
+
+typedef struct {
+    GArray* devices;                // HalCacheDevice
+    GByteArray* strings;
+    gint64 mono_now;
+    gint64 real_now;
+} CacheWriter;
+
+static guint32 add_string(CacheWriter* writer, const gchar* str) {
+    if (!str) return HAL_CACHE_NO_STRING;
+    guint32 offset = writer->strings->len;
+    g_byte_array_append(writer->strings, (const guint8*)str, strlen(str) + 1);
+    return offset;
+}
+
+static void write_device_cb(HalDeviceTable* table, HalDevice* device, void* user_data) {
+    CacheWriter* writer = (CacheWriter*)user_data;
+    HalCacheDevice record;
+    BleHalAddress address;
+
+    memset(&record, 0, sizeof(record));
+    hal_address_unpack(device->addr_key, &address);
+    memcpy(record.address, address.b, sizeof(record.address));
+    record.address_type = device->address_type;
+    record.flags = (guint8)(device->flags & HAL_CACHE_DEVICE_FLAGS);
+    record.rssi = device->rssi;
+    record.tx_power = device->tx_power;
+    record.last_seen_us = device->last_seen_us ? writer->real_now - (writer->mono_now - device->last_seen_us) : 0;
+    record.name = add_string(writer, hal_device_table_get_name(table, device));
+    g_array_append_val(writer->devices, record);
+}
+
+gboolean hal_cache_save(const gchar* path, GPtrArray* adapters) {
+    CacheWriter writer;
+    HalCacheHeader header;
+    GArray* adapter_records = g_array_new(FALSE, TRUE, sizeof(HalCacheAdapter));
+    GError* error = NULL;
+
+    writer.devices = g_array_new(FALSE, TRUE, sizeof(HalCacheDevice));
+    writer.strings = g_byte_array_new();
+    writer.mono_now = g_get_monotonic_time();
+    writer.real_now = g_get_real_time();
+
+    for (guint i = 0; adapters && i < adapters->len; i++) {
+        HalAdapter* adapter = g_ptr_array_index(adapters, i);
+        HalCacheAdapter record;
+
+        memset(&record, 0, sizeof(record));
+        g_rw_lock_reader_lock(&adapter->lock);
+        record.path = add_string(&writer, adapter->path);
+        record.name = add_string(&writer, adapter->state.name);
+        memcpy(record.address, adapter->state.address.b, sizeof(record.address));
+        record.flags = adapter->state.flags;
+        record.first_device = writer.devices->len;
+        hal_device_table_foreach(adapter->devices, write_device_cb, &writer);
+        record.n_devices = writer.devices->len - record.first_device;
+        g_rw_lock_reader_unlock(&adapter->lock);
+        g_array_append_val(adapter_records, record);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HAL_CACHE_MAGIC, sizeof(header.magic));
+    header.version = HAL_CACHE_VERSION;
+    header.byte_order = HAL_CACHE_BYTE_ORDER;
+    header.n_adapters = adapter_records->len;
+    header.n_devices = writer.devices->len;
+    header.strings_size = writer.strings->len;
+    header.saved_at_us = writer.real_now;
+
+    GByteArray* file = g_byte_array_sized_new(sizeof(header) + adapter_records->len * sizeof(HalCacheAdapter) +
+                                              writer.devices->len * sizeof(HalCacheDevice) + writer.strings->len);
+    g_byte_array_append(file, (const guint8*)&header, sizeof(header));
+    g_byte_array_append(file, (const guint8*)adapter_records->data, adapter_records->len * sizeof(HalCacheAdapter));
+    g_byte_array_append(file, (const guint8*)writer.devices->data, writer.devices->len * sizeof(HalCacheDevice));
+    g_byte_array_append(file, writer.strings->data, writer.strings->len);
+
+    // Written to a temporary file and renamed, so a reader never maps a partial cache.
+    gboolean ok = g_file_set_contents(path, (const gchar*)file->data, file->len, &error);
+    if (ok) {
+        HAL_LOG_INFO("Saved %u adapter(s) and %u device(s) to %s.", header.n_adapters, header.n_devices, path);
+    } else {
+        HAL_LOG_ERROR("Failed to write device cache %s: %s", path, error->message);
+        g_error_free(error);
+    }
+
+    g_byte_array_unref(file);
+    g_byte_array_unref(writer.strings);
+    g_array_unref(writer.devices);
+    g_array_unref(adapter_records);
+    return ok;
+}
+
+// --- Load ---
+
+/**
+ * @brief Returns the string at 'offset', or NULL if it is absent or does not
+ * lie within the string table.
+ */
+static const gchar* cache_string(const gchar* strings, guint32 size, guint32 offset) {
+    if (offset == HAL_CACHE_NO_STRING || offset >= size) return NULL;
+    if (!memchr(strings + offset, '\0', size - offset)) return NULL;
+    return strings + offset;
+}
+
+static void load_devices(HalAdapter* adapter, const HalCacheDevice* records, guint32 n,
+                         const gchar* strings, guint32 strings_size, gint64 real_to_mono) {
+    for (guint32 i = 0; i < n; i++) {
+        const HalCacheDevice* record = &records[i];
+        BleHalAddress address;
+        gboolean created = FALSE;
+
+        memcpy(address.b, record->address, sizeof(address.b));
+        HalDevice* device = hal_device_table_insert(adapter->devices, hal_address_pack(&address), &created);
+        if (!device || !created) continue; // Duplicate record
+
+        device->address_type = record->address_type;
+        device->flags = record->flags & HAL_CACHE_DEVICE_FLAGS;
+        device->rssi = record->rssi;
+        device->tx_power = record->tx_power;
+        if (record->last_seen_us > 0) {
+            gint64 mono = record->last_seen_us + real_to_mono;
+            device->last_seen_us = mono > 0 ? mono : 0; // Before this boot: keep the fields, drop the time
+        }
+        const gchar* name = cache_string(strings, strings_size, record->name);
+        if (name) hal_device_table_take_name(adapter->devices, device, g_strdup(name));
+    }
+}
+
+gboolean hal_cache_load(const gchar* path, HalCacheAdapterFunc func, void* user_data) {
+    GError* error = NULL;
+
+    GMappedFile* mapped = g_mapped_file_new(path, FALSE, &error);
+    if (!mapped) {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            HAL_LOG_ERROR("Failed to map device cache %s: %s", path, error->message);
+        }
+        g_error_free(error);
+        return FALSE;
+    }
+
+    const gchar* data = g_mapped_file_get_contents(mapped);
+    gsize size = g_mapped_file_get_length(mapped);
+    const HalCacheHeader* header = (const HalCacheHeader*)data;
+
+    if (size < sizeof(*header) || memcmp(header->magic, HAL_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != HAL_CACHE_VERSION || header->byte_order != HAL_CACHE_BYTE_ORDER ||
+        size != sizeof(*header) + (gsize)header->n_adapters * sizeof(HalCacheAdapter) +
+                (gsize)header->n_devices * sizeof(HalCacheDevice) + header->strings_size) {
+        HAL_LOG_WARN("Device cache %s has an unknown format, ignoring it.", path);
+        g_mapped_file_unref(mapped);
+        return FALSE;
+    }
+
+    const HalCacheAdapter* adapters = (const HalCacheAdapter*)(header + 1);
+    const HalCacheDevice* devices = (const HalCacheDevice*)(adapters + header->n_adapters);
+    const gchar* strings = (const gchar*)(devices + header->n_devices);
+    gint64 real_to_mono = g_get_monotonic_time() - g_get_real_time();
+    guint n_devices = 0;
+
+    for (guint32 i = 0; i < header->n_adapters; i++) {
+        const HalCacheAdapter* record = &adapters[i];
+        const gchar* adapter_path = cache_string(strings, header->strings_size, record->path);
+        if (!adapter_path || !g_variant_is_object_path(adapter_path) ||
+            record->first_device > header->n_devices ||
+            record->n_devices > header->n_devices - record->first_device) {
+            continue;
+        }
+
+        HalAdapterState state;
+        const gchar* name = cache_string(strings, header->strings_size, record->name);
+        memset(&state, 0, sizeof(state));
+        memcpy(state.address.b, record->address, sizeof(state.address.b));
+        state.flags = record->flags;
+        state.name = g_strdup(name);
+
+        HalAdapter* adapter = func(adapter_path, &state, user_data); // Takes 'state'
+        if (!adapter) continue;
+        load_devices(adapter, devices + record->first_device, record->n_devices,
+                     strings, header->strings_size, real_to_mono);
+        n_devices += record->n_devices;
+    }
+
+    HAL_LOG_INFO("Loaded %u adapter(s) and %u device(s) from %s (saved %" G_GINT64_FORMAT " s ago).",
+                 header->n_adapters, n_devices, path, (g_get_real_time() - header->saved_at_us) / G_USEC_PER_SEC);
+    g_mapped_file_unref(mapped);
+    return TRUE;
+}
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Operation chains.
+ *
+ * A chain is a small dependency graph of steps. Every step whose
+ * prerequisites are done is started at once, so independent calls go out
+ * together and the pipeline sends them in parallel. Power and discovery
+ * steps only count as done once the adapter cache shows the new state (from
+ * Adapter1 PropertiesChanged), not when the call returns, so a dependent
+ * step never races the controller. The adapter contexts report state changes
+ * through hal_chain_adapters_changed().
+ *
+ * Chains live on the HAL context. Each one is referenced by its outcome
+ * report and by every step call still in progress, so late replies after a
+ * failure find it intact.
+ */
+
+typedef enum {
+    STEP_WAITING,                   // Prerequisites not done yet
+    STEP_CALLING,                   // D-Bus call (or scheduled connection) in progress
+    STEP_CONFIRMING,                // Call succeeded; waiting for the adapter to report the state
+    STEP_DONE
+} HalChainStepState;
+
+typedef struct _HalChain HalChain;
+
+typedef struct {
+    HalChain* chain;
+    guint index;
+    BleHalChainStep spec;           // Pointers below replace the caller's
+    BleHalDiscoveryFilter filter;   // Deep copy; spec.filter points here if set
+    gchar* adapter_path;            // Owned; resolved to the default adapter when started
+    HalChainStepState state;
+    guint handle;                   // Discovery session or connection ticket, 0 if none
+    GSource* confirm_source;        // Confirmation deadline while STEP_CONFIRMING
+} HalChainStepRun;
+
+struct _HalChain {
+    volatile gint refs;
+    guint id;
+    HalChainStepRun* steps;
+    guint n_steps;
+    guint32 done;                   // Bit per finished step
+    guint confirm_timeout_ms;
+    BleHalChainCb cb;
+    void* user_data;
+    HalCommand* command;            // Reports the outcome; NULL once reported
+    BleHalStatus status;
+    guint failed_step;
+    guint* handles;                 // Handed to cb on success
+    gboolean advancing;             // Guards chain_advance() against re-entry from inline callbacks
+    gboolean advance_again;
+    gint64 started_us;
+};
+
+typedef struct {
+    HalCommand base;
+    HalChain* chain;
+} ChainCommand;
+
+static GList* chains = NULL;                    // Running HalChain*, HAL context only
+static volatile gint n_chains = 0;              // Length of 'chains', read by adapter contexts
+static volatile gint next_chain_id = 0;
+
+static void chain_advance(HalChain* chain);
+
+// --- Chains ---
+
+static HalChain* chain_ref(HalChain* chain) {
+    g_atomic_int_inc(&chain->refs);
+    return chain;
+}
+
+static void chain_unref(HalChain* chain) {
+    if (!g_atomic_int_dec_and_test(&chain->refs)) return;
+
+    for (guint i = 0; i < chain->n_steps; i++) {
+        HalChainStepRun* step = &chain->steps[i];
+        g_strfreev((gchar**)step->filter.uuids);
+        g_free((gchar*)step->filter.pattern);
+        g_free(step->adapter_path);
+    }
+    g_free(chain->steps);
+    g_free(chain->handles);
+    g_free(chain);
+}
+
+/**
+ * @brief Runs on the caller's context (the command's reply context).
+ */
+static void chain_deliver(BleHalStatus status, void* user_data) {
+    HalChain* chain = (HalChain*)user_data;
+    chain->cb(status, chain->failed_step, status == BLE_HAL_SUCCESS ? chain->handles : NULL,
+              chain->n_steps, chain->user_data);
+    chain_unref(chain);
+}
+
+static void chain_report(HalChain* chain, BleHalStatus status, guint failed_step) {
+    if (!chain->command) return;
+
+    for (guint i = 0; i < chain->n_steps; i++) {
+        hal_source_clear(&chain->steps[i].confirm_source);
+    }
+    chain->status = status;
+    chain->failed_step = failed_step;
+    if (status == BLE_HAL_SUCCESS) {
+        for (guint i = 0; i < chain->n_steps; i++) {
+            chain->handles[i] = chain->steps[i].handle;
+        }
+        HAL_LOG_INFO("Chain %u done: %u step(s) in %" G_GINT64_FORMAT " ms.", chain->id, chain->n_steps,
+                     (g_get_monotonic_time() - chain->started_us) / 1000);
+    } else {
+        HAL_LOG_WARN("Chain %u failed at step %u (status %d).", chain->id, failed_step, status);
+    }
+
+    chains = g_list_remove(chains, chain);
+    g_atomic_int_add(&n_chains, -1);
+    HalCommand* command = chain->command;
+    chain->command = NULL;
+    hal_command_complete(command, status); // The reference it held passes to chain_deliver()
+}
+
+/**
+ * @brief Ends 'chain' with 'status': nothing more is started, and the
+ * discovery sessions and connections it opened are closed again.
+ */
+static void chain_fail(HalChain* chain, guint index, BleHalStatus status) {
+    if (!chain->command) return;
+
+    for (guint i = 0; i < chain->n_steps; i++) {
+        HalChainStepRun* step = &chain->steps[i];
+        if (!step->handle) continue;
+        if (step->spec.type == BLE_HAL_STEP_DISCOVERY) {
+            ble_hal_stop_discovery(step->handle, NULL, NULL);
+        } else if (step->spec.type == BLE_HAL_STEP_CONNECT) {
+            ble_hal_release_connection(step->handle);
+        }
+        step->handle = 0;
+    }
+    chain_report(chain, status, index);
+}
+
+// --- Steps ---
+
+static void step_done(HalChainStepRun* step) {
+    hal_source_clear(&step->confirm_source);
+    step->state = STEP_DONE;
+    step->chain->done |= 1u << step->index;
+}
+
+/**
+ * @brief Checks the adapter cache for the state a power or discovery step
+ * asked for. Returns BLE_HAL_SUCCESS if it is there, BLE_HAL_PENDING if not
+ * yet, or the lookup error (the adapter is gone).
+ */
+static BleHalStatus step_check(HalChainStepRun* step) {
+    BleHalAdapterInfo info;
+    BleHalStatus status = ble_hal_get_adapter_info_by_path(step->adapter_path, &info);
+    if (status != BLE_HAL_SUCCESS) return status;
+
+    gboolean reached = step->spec.type == BLE_HAL_STEP_POWER ? info.powered == step->spec.power_on
+                                                             : info.discovering;
+    return reached ? BLE_HAL_SUCCESS : BLE_HAL_PENDING;
+}
+
+static gboolean on_confirm_timeout(gpointer user_data) {
+    HalChainStepRun* step = (HalChainStepRun*)user_data;
+    HalChain* chain = step->chain;
+
+    hal_source_clear(&step->confirm_source);
+    HAL_LOG_WARN("Chain %u: %s did not report step %u's state in time.", chain->id,
+                 step->adapter_path, step->index);
+    chain_fail(chain, step->index, BLE_HAL_ERROR_TIMEOUT);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Moves a step whose call succeeded to done, or to waiting for the
+ * adapter to confirm it.
+ */
+static void step_confirm(HalChainStepRun* step) {
+    if (step->spec.type == BLE_HAL_STEP_CONNECT) {
+        step_done(step); // Device1.Connect returns once the link is up
+        return;
+    }
+
+    BleHalStatus status = step_check(step);
+    if (status == BLE_HAL_SUCCESS) {
+        step_done(step);
+    } else if (status != BLE_HAL_PENDING) {
+        chain_fail(step->chain, step->index, status);
+    } else if (step->state != STEP_CONFIRMING) {
+        step->state = STEP_CONFIRMING;
+        step->confirm_source = hal_timeout_source_add(step->chain->confirm_timeout_ms, on_confirm_timeout, step);
+    }
+}
+
+static void on_step_result(BleHalStatus status, void* user_data) {
+    HalChainStepRun* step = (HalChainStepRun*)user_data;
+    HalChain* chain = step->chain;
+
+    if (chain->command && step->state == STEP_CALLING) {
+        if (status == BLE_HAL_SUCCESS) {
+            step_confirm(step);
+            chain_advance(chain);
+        } else {
+            chain_fail(chain, step->index, status);
+        }
+    }
+    chain_unref(chain); // Taken when the call was made
+}
+
+static void step_start(HalChainStepRun* step) {
+    HalChain* chain = step->chain;
+
+    if (step->spec.type != BLE_HAL_STEP_CONNECT && !step->adapter_path) {
+        BleHalAdapterInfo info;
+        BleHalStatus status = ble_hal_get_adapter_info(&info);
+        if (status != BLE_HAL_SUCCESS) {
+            chain_fail(chain, step->index, status);
+            return;
+        }
+        step->adapter_path = g_strdup(info.path);
+    }
+
+    if (step->spec.type == BLE_HAL_STEP_POWER && step_check(step) == BLE_HAL_SUCCESS) {
+        step_done(step); // Already in that state: no call needed
+        return;
+    }
+
+    step->state = STEP_CALLING;
+    // Results come back here whichever thread the HAL context runs on.
+    g_main_context_push_thread_default(hal_events_get_hal_context());
+    chain_ref(chain);
+    switch (step->spec.type) {
+        case BLE_HAL_STEP_POWER:
+            ble_hal_set_adapter_power(step->adapter_path, step->spec.power_on, on_step_result, step);
+            break;
+        case BLE_HAL_STEP_DISCOVERY:
+            ble_hal_start_discovery(step->adapter_path, step->spec.filter, &step->handle, on_step_result, step);
+            break;
+        case BLE_HAL_STEP_CONNECT:
+            ble_hal_schedule_connect(&step->spec.address, step->spec.priority, step->spec.flow,
+                                     &step->handle, on_step_result, step);
+            break;
+    }
+    g_main_context_pop_thread_default(hal_events_get_hal_context());
+}
+
+/**
+ * @brief Starts every step whose prerequisites are done and reports the
+ * chain once all steps are. Step results that arrive inline are folded into
+ * the running pass.
+ */
+static void chain_advance(HalChain* chain) {
+    if (chain->advancing) {
+        chain->advance_again = TRUE;
+        return;
+    }
+
+    chain->advancing = TRUE;
+    chain_ref(chain);
+    do {
+        chain->advance_again = FALSE;
+        for (guint i = 0; i < chain->n_steps && chain->command; i++) {
+            HalChainStepRun* step = &chain->steps[i];
+            if (step->state == STEP_WAITING && (step->spec.after & ~chain->done) == 0) {
+                step_start(step);
+                chain->advance_again = TRUE; // A finished step may release later ones
+            }
+        }
+    } while (chain->advance_again && chain->command);
+
+    chain->advancing = FALSE;
+    if (chain->command && chain->done == (chain->n_steps == 32 ? G_MAXUINT32 : (1u << chain->n_steps) - 1)) {
+        chain_report(chain, BLE_HAL_SUCCESS, 0);
+    }
+    chain_unref(chain);
+}
+
+// --- Commands (HAL context) ---
+
+static void chain_start_execute(HalCommand* command) {
+    HalChain* chain = ((ChainCommand*)command)->chain;
+
+    chain->command = command;
+    chain->started_us = g_get_monotonic_time();
+    chains = g_list_prepend(chains, chain);
+    g_atomic_int_inc(&n_chains);
+    HAL_LOG_DEBUG("Chain %u started (%u step(s)).", chain->id, chain->n_steps);
+    chain_advance(chain);
+}
+
+static void rescan_execute(HalCommand* command) {
+    // A chain may finish, and leave 'chains', during the pass.
+    GList* running = g_list_copy(chains);
+    for (GList* item = running; item; item = item->next) {
+        chain_ref(item->data);
+    }
+
+    for (GList* item = running; item; item = item->next) {
+        HalChain* chain = item->data;
+        for (guint i = 0; i < chain->n_steps && chain->command; i++) {
+            if (chain->steps[i].state == STEP_CONFIRMING) {
+                step_confirm(&chain->steps[i]);
+            }
+        }
+        if (chain->command) chain_advance(chain);
+    }
+    g_list_free_full(running, (GDestroyNotify)chain_unref);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+// --- Internal API ---
+
+void hal_chain_adapters_changed(void) {
+    if (g_atomic_int_get(&n_chains) == 0) return; // The usual case
+
+    hal_command_submit(hal_command_new(sizeof(HalCommand), rescan_execute, NULL, NULL, NULL));
+}
+
+void hal_chain_shutdown(void) {
+    while (chains) {
+        chain_report(chains->data, BLE_HAL_ERROR_NOT_INITIALIZED, 0);
+    }
+}
+
+// --- Public API ---
+
+/**
+ * @brief Copies 'spec' into 'step', including the strings it points to.
+ */
+static void step_init(HalChainStepRun* step, HalChain* chain, guint index, const BleHalChainStep* spec) {
+    step->chain = chain;
+    step->index = index;
+    step->spec = *spec;
+    step->adapter_path = g_strdup(spec->adapter_path);
+    step->spec.adapter_path = NULL;
+    if (spec->filter) {
+        step->filter = *spec->filter;
+        step->filter.uuids = (const char* const*)g_strdupv((gchar**)spec->filter->uuids);
+        step->filter.pattern = g_strdup(spec->filter->pattern);
+        step->spec.filter = &step->filter;
+    }
+}
+
+static gboolean step_valid(const BleHalChainStep* spec, guint index) {
+    if (spec->after >> index) return FALSE; // Only earlier steps can be prerequisites
+    switch (spec->type) {
+        case BLE_HAL_STEP_POWER:
+        case BLE_HAL_STEP_DISCOVERY:
+            return !spec->adapter_path || g_variant_is_object_path(spec->adapter_path);
+        case BLE_HAL_STEP_CONNECT:
+            return (guint)spec->priority < BLE_HAL_CONNECT_N_PRIORITIES;
+    }
+    return FALSE;
+}
+
+BleHalStatus ble_hal_run_chain(const BleHalChainStep* steps, guint n_steps, guint confirm_timeout_ms,
+                               BleHalChainCb cb, void* user_data) {
+    if (!steps || n_steps == 0 || n_steps > BLE_HAL_CHAIN_MAX_STEPS || !cb) {
+        HAL_LOG_ERROR("Invalid steps or callback for run_chain.");
+        if (cb) cb(BLE_HAL_ERROR_INVALID_PARAMS, 0, NULL, n_steps, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    for (guint i = 0; i < n_steps; i++) {
+        if (!step_valid(&steps[i], i)) {
+            HAL_LOG_ERROR("Invalid chain step %u.", i);
+            cb(BLE_HAL_ERROR_INVALID_PARAMS, i, NULL, n_steps, user_data);
+            return BLE_HAL_ERROR_INVALID_PARAMS;
+        }
+    }
+
+    HalChain* chain = g_new0(HalChain, 1);
+    chain->refs = 1; // Held by the outcome report
+    chain->id = (guint)g_atomic_int_add(&next_chain_id, 1) + 1;
+    chain->n_steps = n_steps;
+    chain->steps = g_new0(HalChainStepRun, n_steps);
+    chain->handles = g_new0(guint, n_steps);
+    chain->confirm_timeout_ms = confirm_timeout_ms ? confirm_timeout_ms : BLE_HAL_CHAIN_DEFAULT_CONFIRM_TIMEOUT_MS;
+    chain->cb = cb;
+    chain->user_data = user_data;
+    for (guint i = 0; i < n_steps; i++) {
+        step_init(&chain->steps[i], chain, i, &steps[i]);
+    }
+
+    ChainCommand* command = hal_command_new(sizeof(ChainCommand), chain_start_execute, NULL,
+                                            chain_deliver, chain);
+    command->chain = chain;
+    BleHalStatus status = hal_command_submit(&command->base);
+    if (status != BLE_HAL_PENDING) {
+        chain_unref(chain);
+        cb(status, 0, NULL, n_steps, user_data);
+    }
+    return status;
+}
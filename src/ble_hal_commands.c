@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Command queues.
+ *
+ * Public commands may be called from any thread. Each call allocates a
+ * HalCommand and pushes it onto a lock-free multi-producer stack; a GSource on
+ * the queue's context takes the whole stack in one exchange, restores
+ * submission order and executes the batch. Completions are sent to the
+ * GMainContext that was thread-default for the submitting thread.
+ * Commands are allocated from the block pools.
+ *
+ * The HAL context owns the main queue behind hal_command_submit(); adapter
+ * worker threads drain their own queue created with hal_command_queue_new().
+ */
+
+struct _HalCommandQueue {
+    GSource source;
+    HalCommand* volatile head;      // Newest command first (LIFO until drained)
+    volatile gint accepting;        // Cleared by hal_command_queue_free()
+    volatile gint submitters;       // Threads currently inside hal_command_queue_push()
+    GMainContext* context;          // Context the queue is drained on
+};
+
+static HalCommandQueue* main_queue = NULL;     // Behind hal_command_submit(); NULL when not running
+static volatile gint main_submitters = 0;       // Threads that may still be using 'main_queue'
+
+// --- Allocation / Completion ---
+
+gpointer hal_command_new(gsize size, HalCommandFunc execute, HalCommandFunc finalize,
+                         BleHalResultCb cb, void* user_data) {
+    g_assert(size >= sizeof(HalCommand));
+
+    HalCommand* command = hal_pool_alloc0(size);
+    command->execute = execute;
+    command->finalize = finalize;
+    command->cb = cb;
+    command->user_data = user_data;
+    // Internal commands have no completion to deliver.
+    command->reply_context = cb ? hal_reply_context_ref() : NULL;
+    return command;
+}
+
+static void command_free(gpointer data) {
+    HalCommand* command = (HalCommand*)data;
+    if (command->reply_context) g_main_context_unref(command->reply_context);
+    hal_pool_free(command);
+}
+
+static gboolean command_deliver(gpointer data) {
+    HalCommand* command = (HalCommand*)data;
+    command->cb(command->status, command->user_data);
+    return G_SOURCE_REMOVE;
+}
+
+void hal_command_complete(HalCommand* command, BleHalStatus status) {
+    if (command->finalize) {
+        command->finalize(command);
+    }
+    if (!command->cb) {
+        command_free(command);
+        return;
+    }
+    // Runs inline when the reply context is owned by this thread (the usual
+    // case in inline mode), otherwise the command itself carries the result
+    // over to the caller's context.
+    command->status = status;
+    g_main_context_invoke_full(command->reply_context, G_PRIORITY_DEFAULT,
+                               command_deliver, command, command_free);
+}
+
+// --- Queue ---
+
+static HalCommand* queue_take_all(HalCommandQueue* queue) {
+    HalCommand* list;
+    do {
+        list = g_atomic_pointer_get(&queue->head);
+    } while (list && !g_atomic_pointer_compare_and_exchange(&queue->head, list, NULL));
+
+    // Producers push at the head; reverse to execute in submission order.
+    HalCommand* ordered = NULL;
+    while (list) {
+        HalCommand* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    return ordered;
+}
+
+BleHalStatus hal_command_queue_push(HalCommandQueue* queue, HalCommand* command) {
+    g_atomic_int_inc(&queue->submitters);
+    if (!g_atomic_int_get(&queue->accepting)) {
+        g_atomic_int_add(&queue->submitters, -1);
+        if (command->finalize) command->finalize(command);
+        command_free(command);
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+
+    HalCommand* head;
+    hal_stats_gauge_add(HAL_STATS_GAUGE_COMMANDS, 1);
+    do {
+        head = g_atomic_pointer_get(&queue->head);
+        command->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&queue->head, head, command));
+
+    // Only the push that makes the queue non-empty has to wake its context.
+    if (!head) {
+        g_main_context_wakeup(queue->context);
+    }
+    g_atomic_int_add(&queue->submitters, -1);
+    return BLE_HAL_PENDING;
+}
+
+static gboolean command_source_ready(GSource* source, gint* timeout) {
+    if (timeout) *timeout = -1;
+    return g_atomic_pointer_get(&((HalCommandQueue*)source)->head) != NULL;
+}
+
+static gboolean command_source_check(GSource* source) {
+    return g_atomic_pointer_get(&((HalCommandQueue*)source)->head) != NULL;
+}
+
+static gboolean command_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalCommand* command = queue_take_all((HalCommandQueue*)source);
+    while (command) {
+        HalCommand* next = command->next;
+        command->next = NULL;
+        hal_stats_gauge_add(HAL_STATS_GAUGE_COMMANDS, -1);
+        command->execute(command);  // Completes now or once its D-Bus reply arrives
+        command = next;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs command_source_funcs = {
+    command_source_ready,
+    command_source_check,
+    command_source_dispatch,
+    NULL,
+    NULL,
+    NULL
+};
+
+HalCommandQueue* hal_command_queue_new(GMainContext* context, const gchar* name) {
+    HalCommandQueue* queue = (HalCommandQueue*)g_source_new(&command_source_funcs, sizeof(HalCommandQueue));
+    queue->context = g_main_context_ref(context);
+    g_source_set_name(&queue->source, name);
+    g_source_attach(&queue->source, context);
+    g_atomic_int_set(&queue->accepting, 1);
+    return queue;
+}
+
+void hal_command_queue_free(HalCommandQueue* queue) {
+    if (!queue) return;
+
+    // Stop accepting, then wait out submitters that passed the check already.
+    g_atomic_int_set(&queue->accepting, 0);
+    while (g_atomic_int_get(&queue->submitters) > 0) {
+        g_thread_yield();
+    }
+
+    g_source_destroy(&queue->source);
+
+    // Commands that never ran fail with NOT_INITIALIZED.
+    HalCommand* command = queue_take_all(queue);
+    while (command) {
+        HalCommand* next = command->next;
+        hal_stats_gauge_add(HAL_STATS_GAUGE_COMMANDS, -1);
+        hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+        command = next;
+    }
+
+    g_main_context_unref(queue->context);
+    g_source_unref(&queue->source);
+}
+
+// --- Main Queue ---
+
+BleHalStatus hal_command_submit(HalCommand* command) {
+    BleHalStatus status = BLE_HAL_ERROR_NOT_INITIALIZED;
+
+    g_atomic_int_inc(&main_submitters);
+    HalCommandQueue* queue = g_atomic_pointer_get(&main_queue);
+    if (queue) {
+        status = hal_command_queue_push(queue, command);
+    } else {
+        if (command->finalize) command->finalize(command);
+        command_free(command);
+    }
+    g_atomic_int_add(&main_submitters, -1);
+    return status;
+}
+
+void hal_commands_init(GMainContext* hal_context) {
+    g_atomic_pointer_set(&main_queue, hal_command_queue_new(hal_context, "ble-hal-commands"));
+}
+
+void hal_commands_shutdown(void) {
+    HalCommandQueue* queue = g_atomic_pointer_get(&main_queue);
+    if (!queue) return;
+
+    // Unpublish the queue, then wait out submitters that loaded it already.
+    g_atomic_pointer_set(&main_queue, NULL);
+    while (g_atomic_int_get(&main_submitters) > 0) {
+        g_thread_yield();
+    }
+    hal_command_queue_free(queue); // Queued commands complete with BLE_HAL_ERROR_NOT_INITIALIZED
+}
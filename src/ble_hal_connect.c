@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Connection scheduler.
+ *
+ * Every scheduled connection is a job identified by its ticket. Waiting jobs
+ * sit in per-flow queues; each priority class rotates through its flows, and
+ * each pump dispatches one job at a time and then starts again from the
+ * highest class. A job is dispatched when an adapter that knows the device
+ * has a free slot: fewer than 'max_pending' Connect calls in progress and
+ * fewer than 'max_connections' scheduled links in total. A flow whose first
+ * job is blocked still gets a later job dispatched if that one fits on
+ * another adapter.
+ *
+ * Jobs are created and changed on the HAL context only. connect_lock lets
+ * ble_hal_get_connection_path() read them from other threads, and outcomes
+ * are reported after it is released, because an inline callback may call
+ * back into the HAL.
+ */
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_CONNECTING,                 // Device1.Connect in flight
+    JOB_RETRY_WAIT,                 // Backing off after an aborted attempt
+    JOB_CONNECTED,
+    JOB_DISCONNECTING               // Device1.Disconnect in flight
+} HalConnectJobState;
+
+typedef struct {
+    gchar* path;                    // Adapter object path (also the table key)
+    guint connecting;
+    guint links;                    // Jobs holding a slot: connecting, connected or disconnecting
+} HalConnectAdapter;
+
+typedef struct {
+    guint id;
+    BleHalConnectPriority priority;
+    GQueue jobs;                    // HalConnectJob*, oldest first
+} HalConnectFlow;
+
+typedef struct {
+    guint ticket;
+    guint64 addr_key;
+    BleHalConnectPriority priority;
+    guint flow;
+    HalConnectJobState state;
+    guint attempts;                 // Connect calls made so far
+    HalConnectAdapter* adapter;     // While holding a slot
+    gchar* device_path;             // On the last adapter used, NULL before the first attempt
+    HalCommand* command;            // Reports the outcome; NULL once reported
+    GSource* retry_source;
+    gboolean released;              // Released while Connect was in flight
+} HalConnectJob;
+
+typedef struct {
+    HalCommand base;
+    guint ticket;
+    guint64 addr_key;
+    BleHalConnectPriority priority;
+    guint flow;
+} ScheduleCommand;
+
+typedef struct {
+    HalCommand base;
+    guint ticket;
+} ReleaseCommand;
+
+typedef struct {
+    HalRequest base;
+    guint ticket;
+} ConnectRequest;
+
+typedef struct {
+    HalCommand base;
+    gchar* device_path;
+} LinkLostCommand;
+
+static GHashTable* jobs = NULL;             // GUINT_TO_POINTER(ticket) -> HalConnectJob* (owned)
+static GHashTable* slots = NULL;            // adapter path -> HalConnectAdapter* (owned)
+static GHashTable* flows[BLE_HAL_CONNECT_N_PRIORITIES]; // GUINT_TO_POINTER(flow) -> HalConnectFlow* (owned)
+static GQueue rotation[BLE_HAL_CONNECT_N_PRIORITIES];   // HalConnectFlow* with waiting jobs, next first
+static GSList* reports = NULL;              // Commands to complete once the lock is released
+static GMutex connect_lock;
+static volatile gint next_ticket = 0;
+
+static guint max_connections = BLE_HAL_CONNECT_DEFAULT_MAX_CONNECTIONS;
+static guint max_pending = BLE_HAL_CONNECT_DEFAULT_MAX_PENDING;
+static guint retry_limit = BLE_HAL_CONNECT_DEFAULT_RETRY_LIMIT;
+static guint retry_base_ms = BLE_HAL_CONNECT_DEFAULT_RETRY_BASE_MS;
+
+// Longest backoff, however many retries are allowed.
+#define HAL_CONNECT_MAX_BACKOFF_MS  10000
+
+static void scheduler_pump(void);
+
+// --- Jobs ---
+
+/**
+ * @brief Hands the outcome to the caller. Called with connect_lock held; the
+ * callback runs from flush_reports().
+ */
+static void job_report(HalConnectJob* job, BleHalStatus status) {
+    if (!job->command) return;
+    job->command->status = status;
+    reports = g_slist_append(reports, job->command);
+    job->command = NULL;
+}
+
+static void flush_reports(void) {
+    g_mutex_lock(&connect_lock);
+    GSList* pending = reports;
+    reports = NULL;
+    g_mutex_unlock(&connect_lock);
+
+    for (GSList* item = pending; item; item = item->next) {
+        HalCommand* command = item->data;
+        hal_command_complete(command, command->status);
+    }
+    g_slist_free(pending);
+}
+
+static void job_free(gpointer data) {
+    HalConnectJob* job = (HalConnectJob*)data;
+    job_report(job, BLE_HAL_ERROR_CANCELLED);
+    hal_source_clear(&job->retry_source);
+    g_free(job->device_path);
+    g_free(job);
+}
+
+static HalConnectFlow* flow_lookup(BleHalConnectPriority priority, guint id) {
+    HalConnectFlow* flow = g_hash_table_lookup(flows[priority], GUINT_TO_POINTER(id));
+    if (!flow) {
+        flow = g_new0(HalConnectFlow, 1);
+        flow->id = id;
+        flow->priority = priority;
+        g_queue_init(&flow->jobs);
+        g_hash_table_insert(flows[priority], GUINT_TO_POINTER(id), flow);
+        g_queue_push_tail(&rotation[priority], flow);
+    }
+    return flow;
+}
+
+/**
+ * @brief Drops 'flow' once it has no waiting jobs left.
+ */
+static void flow_release_if_empty(HalConnectFlow* flow) {
+    if (!g_queue_is_empty(&flow->jobs)) return;
+    g_queue_remove(&rotation[flow->priority], flow);
+    g_hash_table_remove(flows[flow->priority], GUINT_TO_POINTER(flow->id)); // Frees 'flow'
+}
+
+static void job_enqueue(HalConnectJob* job, gboolean at_head) {
+    HalConnectFlow* flow = flow_lookup(job->priority, job->flow);
+    job->state = JOB_QUEUED;
+    if (at_head) g_queue_push_head(&flow->jobs, job);
+    else g_queue_push_tail(&flow->jobs, job);
+}
+
+static void job_dequeue(HalConnectJob* job) {
+    HalConnectFlow* flow = g_hash_table_lookup(flows[job->priority], GUINT_TO_POINTER(job->flow));
+    if (!flow) return;
+    g_queue_remove(&flow->jobs, job);
+    flow_release_if_empty(flow);
+}
+
+static void slot_release(HalConnectJob* job) {
+    if (!job->adapter) return;
+    if (job->state == JOB_CONNECTING) job->adapter->connecting--;
+    job->adapter->links--;
+    job->adapter = NULL;
+}
+
+static HalConnectAdapter* slots_lookup(const gchar* path) {
+    HalConnectAdapter* adapter = g_hash_table_lookup(slots, path);
+    if (!adapter) {
+        adapter = g_new0(HalConnectAdapter, 1);
+        adapter->path = g_strdup(path);
+        g_hash_table_insert(slots, adapter->path, adapter);
+    }
+    return adapter;
+}
+
+static void slots_free(gpointer data) {
+    HalConnectAdapter* adapter = (HalConnectAdapter*)data;
+    g_free(adapter->path);
+    g_free(adapter);
+}
+
+// --- Calls ---
+
+static gboolean is_retryable(const GError* error) {
+    return error && strstr(error->message, "le-connection-abort-by-local") != NULL;
+}
+
+static gboolean on_retry(gpointer user_data) {
+    g_mutex_lock(&connect_lock);
+    HalConnectJob* job = jobs ? g_hash_table_lookup(jobs, user_data) : NULL;
+    if (job) {
+        hal_source_clear(&job->retry_source);
+        job_enqueue(job, TRUE); // Keeps its place ahead of later jobs in the flow
+        scheduler_pump();
+    }
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+    return G_SOURCE_REMOVE;
+}
+
+static BleHalStatus on_disconnect_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                        BleHalStatus status) {
+    guint ticket = ((ConnectRequest*)request)->ticket;
+
+    g_mutex_lock(&connect_lock);
+    HalConnectJob* job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(ticket)) : NULL;
+    if (job) {
+        slot_release(job); // Freed whatever the outcome: the link is not ours any more
+        g_hash_table_remove(jobs, GUINT_TO_POINTER(ticket));
+        scheduler_pump();
+    }
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+    return status;
+}
+
+/**
+ * @brief Sends Device1.Disconnect for a connected job. Called with connect_lock held.
+ */
+static void job_disconnect(HalConnectJob* job) {
+    job->state = JOB_DISCONNECTING;
+    ConnectRequest* request = hal_request_new(sizeof(ConnectRequest), job->device_path, "org.bluez.Device1",
+                                              "Disconnect", NULL, NULL, 0, NULL, NULL);
+    request->base.on_reply = on_disconnect_reply;
+    request->ticket = job->ticket;
+    if (hal_request_submit(&request->base) != BLE_HAL_PENDING) {
+        slot_release(job);
+        g_hash_table_remove(jobs, GUINT_TO_POINTER(job->ticket));
+    }
+}
+
+static BleHalStatus on_connect_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                     BleHalStatus status) {
+    guint ticket = ((ConnectRequest*)request)->ticket;
+
+    g_mutex_lock(&connect_lock);
+    HalConnectJob* job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(ticket)) : NULL;
+    if (!job) {
+        g_mutex_unlock(&connect_lock);
+        return status;
+    }
+
+    if (status == BLE_HAL_SUCCESS) {
+        job->adapter->connecting--;
+        job->state = JOB_CONNECTED;
+        if (job->released) {
+            job_report(job, BLE_HAL_ERROR_CANCELLED);
+            job_disconnect(job);
+        } else {
+            HAL_LOG_INFO("Connected %s (ticket %u, attempt %u).", job->device_path, ticket, job->attempts);
+            job_report(job, BLE_HAL_SUCCESS);
+        }
+    } else if (!job->released && job->attempts <= retry_limit && is_retryable(request->error)) {
+        slot_release(job);
+        guint delay_ms = MIN(retry_base_ms << MIN(job->attempts - 1, 16u), HAL_CONNECT_MAX_BACKOFF_MS);
+        delay_ms += g_random_int_range(0, (gint32)delay_ms / 4 + 1); // Keeps retries of one burst apart
+        job->state = JOB_RETRY_WAIT;
+        job->retry_source = hal_timeout_source_add(delay_ms, on_retry, GUINT_TO_POINTER(ticket));
+        HAL_LOG_WARN("Connect to %s aborted, retrying in %u ms.", job->device_path, delay_ms);
+    } else {
+        slot_release(job);
+        job_report(job, job->released ? BLE_HAL_ERROR_CANCELLED : status);
+        g_hash_table_remove(jobs, GUINT_TO_POINTER(ticket));
+    }
+    scheduler_pump();
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+    return status;
+}
+
+/**
+ * @brief Starts a Connect call for 'job' on 'adapter'. Called with connect_lock held.
+ */
+static void job_connect(HalConnectJob* job, HalConnectAdapter* adapter) {
+    BleHalAddress address;
+    gchar address_str[18];
+
+    hal_address_unpack(job->addr_key, &address);
+    ble_hal_address_to_string(&address, address_str);
+    g_strdelimit(address_str, ":", '_');
+    g_free(job->device_path);
+    job->device_path = g_strdup_printf("%s/dev_%s", adapter->path, address_str);
+
+    job->state = JOB_CONNECTING;
+    job->adapter = adapter;
+    job->attempts++;
+    adapter->connecting++;
+    adapter->links++;
+
+    ConnectRequest* request = hal_request_new(sizeof(ConnectRequest), job->device_path, "org.bluez.Device1",
+                                              "Connect", NULL, NULL, 0, NULL, NULL);
+    request->base.on_reply = on_connect_reply;
+    request->ticket = job->ticket;
+    // Queued behind this pump on the HAL context, so the reply never runs inside it.
+    if (hal_request_submit(&request->base) != BLE_HAL_PENDING) {
+        slot_release(job);
+        job_report(job, BLE_HAL_ERROR_NOT_INITIALIZED);
+        g_hash_table_remove(jobs, GUINT_TO_POINTER(job->ticket));
+    }
+}
+
+// --- Scheduling ---
+
+static gboolean adapter_has_room(const HalConnectAdapter* adapter) {
+    return adapter->connecting < max_pending && adapter->links < max_connections;
+}
+
+/**
+ * @brief Dispatches the first job of 'flow' that fits on an adapter. Jobs
+ * whose device no adapter knows fail on the way. Called with connect_lock held.
+ */
+static gboolean flow_dispatch(HalConnectFlow* flow) {
+    GList* link = flow->jobs.head;
+
+    while (link) {
+        HalConnectJob* job = link->data;
+        GList* next = link->next;
+        GPtrArray* paths = hal_find_device_adapters(job->addr_key);
+
+        if (paths->len == 0) {
+            g_queue_delete_link(&flow->jobs, link);
+            job_report(job, BLE_HAL_ERROR_NOT_FOUND);
+            g_hash_table_remove(jobs, GUINT_TO_POINTER(job->ticket));
+            g_ptr_array_unref(paths);
+            link = next;
+            continue;
+        }
+
+        HalConnectAdapter* best = NULL;
+        for (guint i = 0; i < paths->len; i++) {
+            HalConnectAdapter* adapter = slots_lookup(g_ptr_array_index(paths, i));
+            if (adapter_has_room(adapter) && (!best || adapter->links < best->links)) {
+                best = adapter;
+            }
+        }
+        g_ptr_array_unref(paths);
+
+        if (best) {
+            g_queue_delete_link(&flow->jobs, link);
+            job_connect(job, best);
+            return TRUE;
+        }
+        link = next;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Dispatches waiting jobs while any fits: one per turn, highest class
+ * first, flows of a class in rotation. Called with connect_lock held.
+ */
+static void scheduler_pump(void) {
+    gboolean dispatched = TRUE;
+
+    while (dispatched) {
+        dispatched = FALSE;
+        for (guint p = 0; p < BLE_HAL_CONNECT_N_PRIORITIES && !dispatched; p++) {
+            guint n = g_queue_get_length(&rotation[p]);
+            for (guint i = 0; i < n && !dispatched; i++) {
+                HalConnectFlow* flow = g_queue_pop_head(&rotation[p]);
+                g_queue_push_tail(&rotation[p], flow); // Its turn is used either way
+                dispatched = flow_dispatch(flow);
+                flow_release_if_empty(flow);
+            }
+        }
+    }
+}
+
+static void schedule_execute(HalCommand* command) {
+    ScheduleCommand* schedule = (ScheduleCommand*)command;
+
+    g_mutex_lock(&connect_lock);
+    if (!jobs) {
+        g_mutex_unlock(&connect_lock);
+        hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+        return;
+    }
+    HalConnectJob* job = g_new0(HalConnectJob, 1);
+    job->ticket = schedule->ticket;
+    job->addr_key = schedule->addr_key;
+    job->priority = schedule->priority;
+    job->flow = schedule->flow;
+    job->command = command; // Completed when connected or given up
+    g_hash_table_insert(jobs, GUINT_TO_POINTER(job->ticket), job);
+    job_enqueue(job, FALSE);
+    scheduler_pump();
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+}
+
+static void release_execute(HalCommand* command) {
+    guint ticket = ((ReleaseCommand*)command)->ticket;
+
+    g_mutex_lock(&connect_lock);
+    HalConnectJob* job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(ticket)) : NULL;
+    if (job) {
+        switch (job->state) {
+            case JOB_QUEUED:
+                job_dequeue(job);
+                g_hash_table_remove(jobs, GUINT_TO_POINTER(ticket)); // Reports BLE_HAL_ERROR_CANCELLED
+                break;
+            case JOB_RETRY_WAIT:
+                g_hash_table_remove(jobs, GUINT_TO_POINTER(ticket));
+                break;
+            case JOB_CONNECTING:
+                job->released = TRUE; // Disconnected once the call returns
+                break;
+            case JOB_CONNECTED:
+                job_disconnect(job);
+                break;
+            case JOB_DISCONNECTING:
+                break;
+        }
+        scheduler_pump();
+    }
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void link_lost_execute(HalCommand* command) {
+    const gchar* device_path = ((LinkLostCommand*)command)->device_path;
+    GArray* lost = g_array_new(FALSE, FALSE, sizeof(BleHalConnectionLost));
+    GHashTableIter iter;
+    gpointer value;
+
+    g_mutex_lock(&connect_lock);
+    if (jobs) {
+        g_hash_table_iter_init(&iter, jobs);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalConnectJob* job = (HalConnectJob*)value;
+            // Connecting jobs learn from their reply, disconnecting ones free their slot anyway.
+            if (job->state != JOB_CONNECTED || g_strcmp0(job->device_path, device_path) != 0) continue;
+
+            BleHalConnectionLost info = { job->ticket, "" };
+            g_strlcpy(info.path, device_path, sizeof(info.path));
+            g_array_append_val(lost, info);
+            HAL_LOG_INFO("Link to %s lost (ticket %u).", device_path, job->ticket);
+            slot_release(job);
+            g_hash_table_iter_remove(&iter); // Its outcome was reported when it connected
+        }
+        if (lost->len > 0) scheduler_pump();
+    }
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+
+    for (guint i = 0; i < lost->len; i++) {
+        hal_emit_global_event(BLE_HAL_EVENT_CONNECTION_LOST, &g_array_index(lost, BleHalConnectionLost, i),
+                              sizeof(BleHalConnectionLost));
+    }
+    g_array_free(lost, TRUE);
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+static void link_lost_finalize(HalCommand* command) {
+    g_free(((LinkLostCommand*)command)->device_path);
+}
+
+// --- Internal API ---
+
+void hal_connect_init(guint connections, guint pending, guint retries, guint base_ms) {
+    g_mutex_lock(&connect_lock);
+    max_connections = connections ? connections : BLE_HAL_CONNECT_DEFAULT_MAX_CONNECTIONS;
+    max_pending = pending ? pending : BLE_HAL_CONNECT_DEFAULT_MAX_PENDING;
+    retry_limit = retries ? retries : BLE_HAL_CONNECT_DEFAULT_RETRY_LIMIT;
+    retry_base_ms = base_ms ? base_ms : BLE_HAL_CONNECT_DEFAULT_RETRY_BASE_MS;
+    jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, job_free);
+    slots = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, slots_free);
+    for (guint p = 0; p < BLE_HAL_CONNECT_N_PRIORITIES; p++) {
+        flows[p] = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        g_queue_init(&rotation[p]);
+    }
+    g_mutex_unlock(&connect_lock);
+}
+
+void hal_connect_shutdown(void) {
+    g_mutex_lock(&connect_lock);
+    if (!jobs) {
+        g_mutex_unlock(&connect_lock);
+        return;
+    }
+    for (guint p = 0; p < BLE_HAL_CONNECT_N_PRIORITIES; p++) {
+        g_queue_clear(&rotation[p]);
+        g_hash_table_destroy(flows[p]);
+        flows[p] = NULL;
+    }
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, jobs);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        job_report((HalConnectJob*)value, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+    g_hash_table_destroy(jobs);
+    g_hash_table_destroy(slots);
+    jobs = NULL;
+    slots = NULL;
+    g_mutex_unlock(&connect_lock);
+    flush_reports();
+}
+
+void hal_connect_link_lost(const gchar* device_path) {
+    LinkLostCommand* command = hal_command_new(sizeof(LinkLostCommand), link_lost_execute, link_lost_finalize,
+                                               NULL, NULL);
+    command->device_path = g_strdup(device_path);
+    hal_command_submit(&command->base);
+}
+
+// --- Public API ---
+
+BleHalStatus ble_hal_schedule_connect(const BleHalAddress* address, BleHalConnectPriority priority, guint flow,
+                                      guint* ticket, BleHalResultCb cb, void* user_data) {
+    if (!address || !ticket || (guint)priority >= BLE_HAL_CONNECT_N_PRIORITIES) {
+        HAL_LOG_ERROR("Invalid address, priority or ticket pointer for schedule_connect.");
+        if (cb) cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    ScheduleCommand* command = hal_command_new(sizeof(ScheduleCommand), schedule_execute, NULL, cb, user_data);
+    command->ticket = (guint)g_atomic_int_add(&next_ticket, 1) + 1;
+    command->addr_key = hal_address_pack(address);
+    command->priority = priority;
+    command->flow = flow;
+    *ticket = command->ticket;
+
+    BleHalStatus status = hal_command_submit(&command->base);
+    if (status != BLE_HAL_PENDING && cb) cb(status, user_data);
+    return status;
+}
+
+BleHalStatus ble_hal_release_connection(guint ticket) {
+    ReleaseCommand* command = hal_command_new(sizeof(ReleaseCommand), release_execute, NULL, NULL, NULL);
+    command->ticket = ticket;
+
+    BleHalStatus status = hal_command_submit(&command->base);
+    return status == BLE_HAL_PENDING ? BLE_HAL_SUCCESS : status;
+}
+
+BleHalStatus ble_hal_get_connection_path(guint ticket, char* out, gsize size) {
+    if (!out) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    BleHalStatus status = BLE_HAL_SUCCESS;
+    g_mutex_lock(&connect_lock);
+    HalConnectJob* job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(ticket)) : NULL;
+    if (!jobs) {
+        status = BLE_HAL_ERROR_NOT_INITIALIZED;
+    } else if (!job || !job->device_path) {
+        status = BLE_HAL_ERROR_NOT_FOUND;
+    } else if (g_strlcpy(out, job->device_path, size) >= size) {
+        status = BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    g_mutex_unlock(&connect_lock);
+    return status;
+}
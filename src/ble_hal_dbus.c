@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Signal subscription manager.
+ *
+ * Every rule is installed twice: once on the bus with an explicit AddMatch,
+ * so dbus-daemon drops unwanted traffic before it reaches us (this is how we
+ * get path_namespace, which g_dbus_connection_signal_subscribe cannot
+ * express), and once locally with G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE so GDBus
+ * routes the message to the rule's own callback.
+ */
+
+typedef struct {
+    const HalSignalRule* rule;  // Static rule description (not owned)
+    gpointer user_data;         // Passed to rule->callback
+    gchar* match;               // Match rule string sent with AddMatch (NULL if not installed)
+    guint subscription_id;      // Local GDBus subscription (0 if not installed)
+} HalSubscription;
+
+struct _HalSubscriptionManager {
+    GDBusConnection* conn;
+    gchar* sender;              // Unique name the rules are bound to (NULL = not installed)
+    GPtrArray* subscriptions;   // HalSubscription*
+};
+
+static gchar* build_match_rule(const HalSignalRule* rule, const gchar* sender) {
+    GString* match = g_string_new("type='signal'");
+
+    g_string_append_printf(match, ",sender='%s'", sender);
+    if (rule->interface) g_string_append_printf(match, ",interface='%s'", rule->interface);
+    if (rule->member) g_string_append_printf(match, ",member='%s'", rule->member);
+    if (rule->path) g_string_append_printf(match, ",path='%s'", rule->path);
+    if (rule->path_namespace) g_string_append_printf(match, ",path_namespace='%s'", rule->path_namespace);
+    if (rule->arg0) {
+        const gchar* key = "arg0";
+        if (rule->arg0_flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE) {
+            key = "arg0namespace";
+        } else if (rule->arg0_flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH) {
+            key = "arg0path";
+        }
+        g_string_append_printf(match, ",%s='%s'", key, rule->arg0);
+    }
+    return g_string_free(match, FALSE);
+}
+
+static BleHalStatus on_match_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                   BleHalStatus status) {
+    if (status != BLE_HAL_SUCCESS) {
+        const gchar* match = NULL;
+        g_variant_get(request->parameters, "(&s)", &match);
+        HAL_LOG_ERROR("Match rule update failed for \"%s\".", match);
+    }
+    return status;
+}
+
+/**
+ * @brief Sends AddMatch or RemoveMatch through the request pipeline, so the
+ * call has a deadline and hal_requests_cancel_all() reaches it.
+ */
+static void send_match_call(GDBusConnection* conn, const gchar* method, const gchar* match) {
+    HalRequest* request = hal_request_new(sizeof(HalRequest), "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                          method,   // "AddMatch" or "RemoveMatch"
+                                          g_variant_new("(s)", match), NULL, 0, NULL, NULL);
+    request->destination = "org.freedesktop.DBus";
+    request->unthrottled = TRUE; // Out before any BlueZ call queued after it
+    request->on_reply = on_match_reply;
+
+    if (hal_request_submit(request) == BLE_HAL_PENDING) return;
+
+    // The pipeline is already down (ble_hal_deinit()): send the call directly,
+    // with the default request timeout, and do not wait for the reply.
+    g_dbus_connection_call(conn, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                           method, g_variant_new("(s)", match), NULL, G_DBUS_CALL_FLAGS_NONE,
+                           BLE_HAL_REQUEST_DEFAULT_TIMEOUT_MS, NULL, NULL, NULL);
+}
+
+static void subscription_install(HalSubscriptionManager* mgr, HalSubscription* sub) {
+    const HalSignalRule* rule = sub->rule;
+
+    if (sub->subscription_id || !mgr->sender || !mgr->conn) return;
+
+    sub->subscription_id = g_dbus_connection_signal_subscribe(
+        mgr->conn,
+        mgr->sender,
+        rule->interface,
+        rule->member,
+        rule->path,             // Exact path, or NULL (path_namespace is enforced by the bus rule)
+        rule->arg0,
+        rule->arg0_flags | G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+        rule->callback,
+        sub->user_data,
+        NULL);
+    if (sub->subscription_id == 0) {
+        HAL_LOG_ERROR("Failed to subscribe to %s.%s.", rule->interface, rule->member);
+        return;
+    }
+
+    sub->match = build_match_rule(rule, mgr->sender);
+    send_match_call(mgr->conn, "AddMatch", sub->match);
+}
+
+static void subscription_uninstall(HalSubscriptionManager* mgr, HalSubscription* sub) {
+    if (sub->subscription_id && mgr->conn) {
+        g_dbus_connection_signal_unsubscribe(mgr->conn, sub->subscription_id);
+    }
+    sub->subscription_id = 0;
+
+    if (sub->match) {
+        // A rule bound to a vanished unique name never matches again, but the bus
+        // keeps it until we remove it, so always clean up while connected.
+        if (mgr->conn && !g_dbus_connection_is_closed(mgr->conn)) {
+            send_match_call(mgr->conn, "RemoveMatch", sub->match);
+        }
+        g_free(sub->match);
+        sub->match = NULL;
+    }
+}
+
+static void subscription_free(gpointer data) {
+    g_free(data);
+}
+
+HalSubscriptionManager* hal_subscriptions_new(GDBusConnection* conn) {
+    HalSubscriptionManager* mgr = g_new0(HalSubscriptionManager, 1);
+    mgr->conn = g_object_ref(conn);
+    mgr->subscriptions = g_ptr_array_new_with_free_func(subscription_free);
+    return mgr;
+}
+
+void hal_subscriptions_free(HalSubscriptionManager* mgr) {
+    if (!mgr) return;
+    for (guint i = 0; i < mgr->subscriptions->len; i++) {
+        subscription_uninstall(mgr, g_ptr_array_index(mgr->subscriptions, i));
+    }
+    g_ptr_array_unref(mgr->subscriptions);
+    g_free(mgr->sender);
+    g_object_unref(mgr->conn);
+    g_free(mgr);
+}
+
+void hal_subscriptions_set_sender(HalSubscriptionManager* mgr, const gchar* sender) {
+    if (!mgr || g_strcmp0(mgr->sender, sender) == 0) return;
+
+    for (guint i = 0; i < mgr->subscriptions->len; i++) {
+        subscription_uninstall(mgr, g_ptr_array_index(mgr->subscriptions, i));
+    }
+    g_free(mgr->sender);
+    mgr->sender = g_strdup(sender);
+    for (guint i = 0; i < mgr->subscriptions->len; i++) {
+        subscription_install(mgr, g_ptr_array_index(mgr->subscriptions, i));
+    }
+}
+
+void hal_subscriptions_sync(HalSubscriptionManager* mgr, const HalSignalRule* const* rules, guint n_rules, gpointer user_data) {
+    if (!mgr) return;
+
+    // Drop subscriptions whose rule is no longer wanted.
+    for (guint i = mgr->subscriptions->len; i > 0; i--) {
+        HalSubscription* sub = g_ptr_array_index(mgr->subscriptions, i - 1);
+        gboolean wanted = FALSE;
+        for (guint r = 0; r < n_rules && !wanted; r++) {
+            wanted = (rules[r] == sub->rule);
+        }
+        if (!wanted) {
+            subscription_uninstall(mgr, sub);
+            g_ptr_array_remove_index(mgr->subscriptions, i - 1);
+        }
+    }
+
+    // Add the rules we do not have yet.
+    for (guint r = 0; r < n_rules; r++) {
+        gboolean present = FALSE;
+        for (guint i = 0; i < mgr->subscriptions->len && !present; i++) {
+            present = (((HalSubscription*)g_ptr_array_index(mgr->subscriptions, i))->rule == rules[r]);
+        }
+        if (!present) {
+            HalSubscription* sub = g_new0(HalSubscription, 1);
+            sub->rule = rules[r];
+            sub->user_data = user_data;
+            g_ptr_array_add(mgr->subscriptions, sub);
+            subscription_install(mgr, sub);
+        }
+    }
+}
+
+guint hal_subscriptions_count_installed(const HalSubscriptionManager* mgr) {
+    guint n = 0;
+    if (!mgr) return 0;
+    for (guint i = 0; i < mgr->subscriptions->len; i++) {
+        if (((HalSubscription*)g_ptr_array_index(mgr->subscriptions, i))->subscription_id) n++;
+    }
+    return n;
+}
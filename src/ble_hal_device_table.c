@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+// Index slots hold (record index + 1); 0 marks an empty slot.
+#define HAL_INDEX_EMPTY 0u
+#define HAL_DEVICE_TABLE_MIN_CAPACITY 64u
+
+// BlueZ names every device object "<adapter path>/dev_XX_XX_XX_XX_XX_XX",
+// so paths are derived from the address instead of stored.
+#define HAL_DEVICE_PATH_SUFFIX      "/dev_"
+#define HAL_DEVICE_PATH_SUFFIX_LEN  22
+
+// What one record in use costs: hot and cold parts plus its share of the
+// index, which is kept between 3/8 and 3/4 full (about two slots per record).
+#define HAL_DEVICE_RECORD_BYTES (sizeof(HalDevice) + sizeof(HalDeviceDetails) + 2 * sizeof(guint32))
+
+struct _HalDeviceTable {
+    HalDevice* records;         // Dense hot records, 'count' entries in use
+    HalDeviceDetails* details;  // Cold fields, same index as 'records'
+    guint count;
+    guint records_capacity;
+    guint32* addr_index;        // Open-addressing index keyed by packed address
+    guint index_mask;           // Index capacity - 1 (capacity is a power of two)
+    gchar* adapter_path;        // Prefix of every device path (owned)
+    gsize adapter_path_len;
+    gsize name_bytes;           // Heap bytes of all names, terminators included
+};
+
+// --- Hashing ---
+
+static inline guint32 hash_address(guint64 key) {
+    // Fibonacci hashing; the high bits of the product are well mixed.
+    return (guint32)((key * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static inline guint32 record_addr_hash(const HalDeviceTable* table, guint32 slot_value) {
+    return hash_address(table->records[slot_value - 1].addr_key);
+}
+
+// --- Index Maintenance ---
+
+static void index_put(guint32* index, guint mask, guint32 hash, guint32 slot_value) {
+    guint i = hash & mask;
+    while (index[i] != HAL_INDEX_EMPTY) {
+        i = (i + 1) & mask;
+    }
+    index[i] = slot_value;
+}
+
+/**
+ * @brief Removes slot 'i' from a linear-probing index using backward-shift
+ * deletion, so lookups never need tombstones.
+ */
+static void index_delete_slot(HalDeviceTable* table, guint32* index, guint i) {
+    guint mask = table->index_mask;
+    guint j = i;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        if (index[j] == HAL_INDEX_EMPTY) {
+            break;
+        }
+        guint home = record_addr_hash(table, index[j]) & mask;
+        // Move index[j] into the hole at i unless its home lies cyclically in (i, j].
+        gboolean home_between = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!home_between) {
+            index[i] = index[j];
+            i = j;
+        }
+    }
+    index[i] = HAL_INDEX_EMPTY;
+}
+
+static guint index_find_value(const HalDeviceTable* table, const guint32* index, guint32 hash, guint32 slot_value) {
+    guint i = hash & table->index_mask;
+    while (index[i] != slot_value) {
+        i = (i + 1) & table->index_mask;
+    }
+    return i;
+}
+
+static void index_rebuild(HalDeviceTable* table, guint new_capacity) {
+    g_free(table->addr_index);
+    table->addr_index = g_new0(guint32, new_capacity);
+    table->index_mask = new_capacity - 1;
+
+    for (guint r = 0; r < table->count; r++) {
+        index_put(table->addr_index, table->index_mask, hash_address(table->records[r].addr_key), r + 1);
+    }
+}
+
+static guint round_up_pow2(guint v) {
+    guint p = HAL_DEVICE_TABLE_MIN_CAPACITY;
+    while (p < v) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// --- Public (internal) API ---
+
+HalDeviceTable* hal_device_table_new(const gchar* adapter_path, guint initial_capacity) {
+    HalDeviceTable* table = g_new0(HalDeviceTable, 1);
+    // Keep the index at most 75% full for the expected population.
+    guint index_capacity = round_up_pow2(initial_capacity + initial_capacity / 3 + 1);
+
+    table->adapter_path = g_strdup(adapter_path);
+    table->adapter_path_len = strlen(adapter_path);
+    table->records_capacity = MAX(initial_capacity, 16u);
+    table->records = g_new0(HalDevice, table->records_capacity);
+    table->details = g_new0(HalDeviceDetails, table->records_capacity);
+    index_rebuild(table, index_capacity);
+    return table;
+}
+
+static gsize name_size(const gchar* name) {
+    return name ? strlen(name) + 1 : 0;
+}
+
+static void details_release(HalDeviceTable* table, HalDeviceDetails* details) {
+    table->name_bytes -= name_size(details->name);
+    g_free(details->name);
+    details->name = NULL;
+}
+
+void hal_device_table_clear(HalDeviceTable* table) {
+    if (!table) return;
+    for (guint r = 0; r < table->count; r++) {
+        details_release(table, &table->details[r]);
+    }
+    table->count = 0;
+    memset(table->addr_index, 0, sizeof(guint32) * (table->index_mask + 1));
+}
+
+void hal_device_table_free(HalDeviceTable* table) {
+    if (!table) return;
+    hal_device_table_clear(table);
+    g_free(table->records);
+    g_free(table->details);
+    g_free(table->addr_index);
+    g_free(table->adapter_path);
+    g_free(table);
+}
+
+guint hal_device_table_count(const HalDeviceTable* table) {
+    return table ? table->count : 0;
+}
+
+HalDevice* hal_device_table_lookup_address(HalDeviceTable* table, guint64 addr_key) {
+    if (!table) return NULL;
+    guint i = hash_address(addr_key) & table->index_mask;
+    guint32 v;
+    while ((v = table->addr_index[i]) != HAL_INDEX_EMPTY) {
+        if (table->records[v - 1].addr_key == addr_key) {
+            return &table->records[v - 1];
+        }
+        i = (i + 1) & table->index_mask;
+    }
+    return NULL;
+}
+
+gboolean hal_device_table_path_to_key(const HalDeviceTable* table, const gchar* path, guint64* addr_key) {
+    if (!table || !path) return FALSE;
+    if (strncmp(path, table->adapter_path, table->adapter_path_len) != 0) return FALSE;
+
+    const gchar* p = path + table->adapter_path_len;
+    if (strlen(p) != HAL_DEVICE_PATH_SUFFIX_LEN ||
+        strncmp(p, HAL_DEVICE_PATH_SUFFIX, sizeof(HAL_DEVICE_PATH_SUFFIX) - 1) != 0) {
+        return FALSE;
+    }
+    p += sizeof(HAL_DEVICE_PATH_SUFFIX) - 1;
+
+    guint64 key = 0;
+    for (int i = 0; i < 6; i++, p += 3) {
+        int hi = g_ascii_xdigit_value(p[0]);
+        int lo = g_ascii_xdigit_value(p[1]);
+        if (hi < 0 || lo < 0 || p[2] != (i < 5 ? '_' : '\0')) return FALSE;
+        key = (key << 8) | (guint64)((hi << 4) | lo);
+    }
+    *addr_key = key;
+    return TRUE;
+}
+
+HalDevice* hal_device_table_lookup_path(HalDeviceTable* table, const gchar* path) {
+    guint64 addr_key;
+    if (!hal_device_table_path_to_key(table, path, &addr_key)) return NULL;
+    return hal_device_table_lookup_address(table, addr_key);
+}
+
+HalDevice* hal_device_table_insert(HalDeviceTable* table, guint64 addr_key, gboolean* created) {
+    if (created) *created = FALSE;
+    if (!table) return NULL;
+
+    HalDevice* existing = hal_device_table_lookup_address(table, addr_key);
+    if (existing) {
+        return existing;
+    }
+
+    // Grow the index before it passes 75% load, and the record array when full.
+    if ((table->count + 1) * 4 > (table->index_mask + 1) * 3) {
+        index_rebuild(table, (table->index_mask + 1) * 2);
+    }
+    if (table->count == table->records_capacity) {
+        table->records_capacity *= 2;
+        table->records = g_renew(HalDevice, table->records, table->records_capacity);
+        table->details = g_renew(HalDeviceDetails, table->details, table->records_capacity);
+    }
+
+    guint32 slot_value = table->count + 1;
+    memset(&table->details[table->count], 0, sizeof(HalDeviceDetails));
+    HalDevice* dev = &table->records[table->count++];
+    memset(dev, 0, sizeof(*dev));
+    dev->addr_key = addr_key;
+    dev->added_s = (guint32)(g_get_monotonic_time() / G_USEC_PER_SEC);
+
+    index_put(table->addr_index, table->index_mask, hash_address(addr_key), slot_value);
+
+    if (created) *created = TRUE;
+    return dev;
+}
+
+gboolean hal_device_table_remove(HalDeviceTable* table, HalDevice* device) {
+    if (!table || !device) return FALSE;
+    guint r = (guint)(device - table->records);
+    if (r >= table->count) return FALSE;
+
+    guint32 slot_value = r + 1;
+    index_delete_slot(table, table->addr_index,
+                      index_find_value(table, table->addr_index, hash_address(device->addr_key), slot_value));
+    details_release(table, &table->details[r]);
+
+    // Keep storage dense: move the last record into the hole and repoint its index slots.
+    guint last = table->count - 1;
+    if (r != last) {
+        HalDevice* moved = &table->records[last];
+        guint32 old_value = last + 1;
+        table->addr_index[index_find_value(table, table->addr_index, hash_address(moved->addr_key), old_value)] = slot_value;
+        table->records[r] = *moved;
+        table->details[r] = table->details[last];
+    }
+    table->count--;
+    return TRUE;
+}
+
+void hal_device_table_foreach(HalDeviceTable* table, HalDeviceFunc func, void* user_data) {
+    if (!table || !func) return;
+    for (guint r = 0; r < table->count; r++) {
+        func(table, &table->records[r], user_data);
+    }
+}
+
+guint hal_device_table_sweep(HalDeviceTable* table, guint32 keep_flag, HalDeviceFunc func, void* user_data) {
+    guint removed = 0;
+
+    if (!table) return 0;
+    // Backwards, so the record moved into a hole has been visited already.
+    for (guint r = table->count; r > 0; r--) {
+        HalDevice* dev = &table->records[r - 1];
+        if (dev->flags & keep_flag) {
+            dev->flags &= ~keep_flag;
+            continue;
+        }
+        if (func) func(table, dev, user_data);
+        hal_device_table_remove(table, dev);
+        removed++;
+    }
+    return removed;
+}
+
+// --- Eviction ---
+
+static inline gint64 record_activity_us(const HalDevice* device) {
+    return device->last_seen_us ? device->last_seen_us : (gint64)device->added_s * G_USEC_PER_SEC;
+}
+
+guint hal_device_table_expire(HalDeviceTable* table, gint64 cutoff_us, guint32 protect_flags,
+                              HalDeviceFunc func, void* user_data) {
+    guint removed = 0;
+
+    if (!table) return 0;
+    // Backwards, as in hal_device_table_sweep().
+    for (guint r = table->count; r > 0; r--) {
+        HalDevice* dev = &table->records[r - 1];
+        if ((dev->flags & protect_flags) || record_activity_us(dev) >= cutoff_us) {
+            continue;
+        }
+        if (func) func(table, dev, user_data);
+        hal_device_table_remove(table, dev);
+        removed++;
+    }
+    return removed;
+}
+
+typedef struct {
+    gint64 activity_us;
+    guint64 addr_key;
+} EvictCandidate;
+
+static int compare_candidates(const void* a, const void* b) {
+    gint64 x = ((const EvictCandidate*)a)->activity_us;
+    gint64 y = ((const EvictCandidate*)b)->activity_us;
+    return (x > y) - (x < y);
+}
+
+static gboolean over_limits(const HalDeviceTable* table, guint max_count, gsize max_bytes) {
+    return (max_count && table->count > max_count) ||
+           (max_bytes && hal_device_table_used_bytes(table) > max_bytes);
+}
+
+guint hal_device_table_evict(HalDeviceTable* table, guint max_count, gsize max_bytes, guint32 protect_flags,
+                             guint64 keep_key, HalDeviceFunc func, void* user_data) {
+    if (!table || !over_limits(table, max_count, max_bytes)) return 0;
+
+    // Only runs once a limit is passed, and callers evict below it, so the
+    // sort is paid for a batch of removals rather than per insert.
+    EvictCandidate* candidates = g_new(EvictCandidate, table->count);
+    guint n_candidates = 0;
+    for (guint r = 0; r < table->count; r++) {
+        if ((table->records[r].flags & protect_flags) || table->records[r].addr_key == keep_key) continue;
+        candidates[n_candidates].activity_us = record_activity_us(&table->records[r]);
+        candidates[n_candidates].addr_key = table->records[r].addr_key;
+        n_candidates++;
+    }
+    qsort(candidates, n_candidates, sizeof(EvictCandidate), compare_candidates);
+
+    guint removed = 0;
+    while (removed < n_candidates && over_limits(table, max_count, max_bytes)) {
+        // Looked up again each time: removals move records around.
+        HalDevice* dev = hal_device_table_lookup_address(table, candidates[removed++].addr_key);
+        if (func) func(table, dev, user_data);
+        hal_device_table_remove(table, dev);
+    }
+    g_free(candidates);
+    return removed;
+}
+
+gsize hal_device_table_used_bytes(const HalDeviceTable* table) {
+    return table ? table->count * HAL_DEVICE_RECORD_BYTES + table->name_bytes : 0;
+}
+
+gsize hal_device_table_memory_size(const HalDeviceTable* table) {
+    if (!table) return 0;
+    return sizeof(*table) + table->adapter_path_len + 1 +
+           table->records_capacity * (sizeof(HalDevice) + sizeof(HalDeviceDetails)) +
+           (table->index_mask + 1) * sizeof(guint32) + table->name_bytes;
+}
+
+// --- Cold Fields / String Forms ---
+
+const gchar* hal_device_table_get_name(const HalDeviceTable* table, const HalDevice* device) {
+    return table->details[device - table->records].name;
+}
+
+void hal_device_table_take_name(HalDeviceTable* table, HalDevice* device, gchar* name) {
+    HalDeviceDetails* details = &table->details[device - table->records];
+    details_release(table, details);
+    details->name = name;
+    table->name_bytes += name_size(name);
+}
+
+gsize hal_device_table_path_size(const HalDeviceTable* table) {
+    return table->adapter_path_len + HAL_DEVICE_PATH_SUFFIX_LEN + 1;
+}
+
+void hal_device_table_format_path(const HalDeviceTable* table, const HalDevice* device, gchar* out, gsize size) {
+    BleHalAddress address;
+    hal_address_unpack(device->addr_key, &address);
+    g_snprintf(out, size, "%s" HAL_DEVICE_PATH_SUFFIX "%02X_%02X_%02X_%02X_%02X_%02X", table->adapter_path,
+               address.b[0], address.b[1], address.b[2], address.b[3], address.b[4], address.b[5]);
+}
+
+void hal_device_to_record(const HalDevice* device, BleHalDeviceRecord* record) {
+    hal_address_unpack(device->addr_key, &record->address);
+    record->address_type = device->address_type;
+    record->flags = (guint8)(device->flags & HAL_DEVICE_FLAG_PUBLIC_MASK);
+    record->rssi = (device->flags & HAL_DEVICE_FLAG_HAS_RSSI) ? device->rssi : BLE_HAL_RSSI_UNKNOWN;
+    record->tx_power = (device->flags & HAL_DEVICE_FLAG_HAS_TX_POWER) ? device->tx_power : BLE_HAL_TX_POWER_UNKNOWN;
+    record->last_seen_us = device->last_seen_us;
+}
+
+void hal_device_to_info(const HalDeviceTable* table, const HalDevice* device, BleHalDeviceInfo* info) {
+    const gchar* name = hal_device_table_get_name(table, device);
+
+    memset(info, 0, sizeof(*info));
+    hal_device_table_format_path(table, device, info->path, sizeof(info->path));
+    hal_address_unpack(device->addr_key, &info->address);
+    info->address_type = (BleHalAddressType)device->address_type;
+    if (name) {
+        g_strlcpy(info->name, name, sizeof(info->name));
+    }
+    info->rssi = (device->flags & HAL_DEVICE_FLAG_HAS_RSSI) ? device->rssi : BLE_HAL_RSSI_UNKNOWN;
+    info->tx_power = (device->flags & HAL_DEVICE_FLAG_HAS_TX_POWER) ? device->tx_power : BLE_HAL_TX_POWER_UNKNOWN;
+    info->last_seen_us = device->last_seen_us;
+    info->paired = (device->flags & HAL_DEVICE_FLAG_PAIRED) != 0;
+    info->connected = (device->flags & HAL_DEVICE_FLAG_CONNECTED) != 0;
+    info->trusted = (device->flags & HAL_DEVICE_FLAG_TRUSTED) != 0;
+    info->blocked = (device->flags & HAL_DEVICE_FLAG_BLOCKED) != 0;
+}
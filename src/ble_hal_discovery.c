@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Discovery sessions.
+ *
+ * bluetoothd keeps a single discovery filter for this D-Bus client on each
+ * adapter, so every open session is recorded here and their filters are
+ * merged into the one that is set. SetDiscoveryFilter is sent only when the
+ * merged filter changes, StartDiscovery when the first session opens and
+ * StopDiscovery when the last one closes. All calls go through the request
+ * pipeline, whose per-adapter lane keeps them in order; the filter calls
+ * share a coalesce key, so only the newest waiting filter is sent.
+ * Sessions opened while StartDiscovery is in flight share its result: their
+ * completions are held until it answers, and if it fails they are closed
+ * along with the session that sent it.
+ *
+ * The session table is guarded by discovery_lock: sessions are opened and
+ * closed on the caller's thread so results reach the caller's context.
+ */
+
+typedef struct {
+    guint id;
+    gchar* adapter_path;
+    BleHalDiscoveryTransport transport;
+    gint16 rssi;
+    guint16 pathloss;
+    gchar** uuids;                  // Lower case, NULL for any
+    gboolean duplicate_data;
+    gchar* pattern;                 // NULL for any
+} HalDiscoverySession;
+
+typedef struct {
+    HalRequest base;
+    guint session_id;               // Session that sent it (0 for a restart), closed if it fails
+    GPtrArray* held;                // HeldOpen* of the sessions opened while it was in flight
+} StartDiscoveryRequest;
+
+typedef struct {
+    HalCommand base;                // Carries the opener's callback; never submitted
+    guint session_id;
+} HeldOpen;
+
+typedef struct {
+    gchar* path;                    // Adapter object path (also the table key)
+    GPtrArray* sessions;            // HalDiscoverySession*, oldest first
+    gboolean running;               // StartDiscovery sent and not failed
+    StartDiscoveryRequest* pending_start; // StartDiscovery sent and not answered yet, or NULL
+    GVariant* filter;               // Last filter sent, NULL if BlueZ's is unknown
+} HalDiscoveryAdapter;
+
+static GHashTable* discovery_adapters = NULL;   // path -> HalDiscoveryAdapter*
+static GHashTable* discovery_sessions = NULL;   // GUINT_TO_POINTER(id) -> HalDiscoverySession*
+static guint next_session_id = 1;
+static GMutex discovery_lock;
+
+static const gchar* const transport_names[] = { "auto", "le", "bredr" };
+
+// --- Sessions ---
+
+static HalDiscoverySession* session_new(const gchar* adapter_path, const BleHalDiscoveryFilter* filter) {
+    HalDiscoverySession* session = g_new0(HalDiscoverySession, 1);
+    session->adapter_path = g_strdup(adapter_path);
+    if (!filter) return session;
+
+    session->transport = filter->transport;
+    session->rssi = filter->rssi;
+    session->pathloss = filter->pathloss;
+    session->duplicate_data = filter->duplicate_data;
+    session->pattern = filter->pattern && filter->pattern[0] ? g_strdup(filter->pattern) : NULL;
+    if (filter->uuids && filter->uuids[0]) {
+        guint n = g_strv_length((gchar**)filter->uuids);
+        session->uuids = g_new0(gchar*, n + 1);
+        for (guint i = 0; i < n; i++) {
+            session->uuids[i] = g_ascii_strdown(filter->uuids[i], -1);
+        }
+    }
+    return session;
+}
+
+static void session_free(gpointer data) {
+    HalDiscoverySession* session = (HalDiscoverySession*)data;
+    g_free(session->adapter_path);
+    g_strfreev(session->uuids);
+    g_free(session->pattern);
+    g_free(session);
+}
+
+static void discovery_adapter_free(gpointer data) {
+    HalDiscoveryAdapter* adapter = (HalDiscoveryAdapter*)data;
+    g_ptr_array_unref(adapter->sessions); // Sessions are owned by discovery_sessions
+    if (adapter->filter) g_variant_unref(adapter->filter);
+    g_free(adapter->path);
+    g_free(adapter);
+}
+
+/**
+ * @brief Merges the filters of every session on 'adapter' into the a{sv}
+ * SetDiscoveryFilter takes. See ble_hal_start_discovery() for the rules.
+ */
+static GVariant* merged_filter(const HalDiscoveryAdapter* adapter) {
+    GVariantBuilder builder;
+    BleHalDiscoveryTransport transport = BLE_HAL_DISCOVERY_TRANSPORT_AUTO;
+    gboolean any_rssi = FALSE, any_pathloss = FALSE, any_uuid = FALSE, same_pattern = TRUE;
+    gboolean duplicate_data = FALSE;
+    gint16 rssi = G_MAXINT16;
+    guint16 pathloss = 0;
+    const gchar* pattern = NULL;
+    GPtrArray* uuids = g_ptr_array_new();
+
+    for (guint i = 0; i < adapter->sessions->len; i++) {
+        const HalDiscoverySession* session = g_ptr_array_index(adapter->sessions, i);
+
+        transport = i == 0 || session->transport == transport ? session->transport : BLE_HAL_DISCOVERY_TRANSPORT_AUTO;
+        if (session->rssi == 0) any_rssi = TRUE;
+        else rssi = MIN(rssi, session->rssi);
+        if (session->pathloss == 0) any_pathloss = TRUE;
+        else pathloss = MAX(pathloss, session->pathloss);
+        duplicate_data |= session->duplicate_data;
+        if (i == 0) pattern = session->pattern;
+        else if (g_strcmp0(pattern, session->pattern) != 0) same_pattern = FALSE;
+
+        if (!session->uuids) {
+            any_uuid = TRUE;
+        }
+        for (gchar** uuid = session->uuids; !any_uuid && *uuid; uuid++) {
+            gboolean known = FALSE;
+            for (guint u = 0; u < uuids->len && !known; u++) {
+                known = strcmp(g_ptr_array_index(uuids, u), *uuid) == 0;
+            }
+            if (!known) g_ptr_array_add(uuids, *uuid);
+        }
+    }
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", "Transport", g_variant_new_string(transport_names[transport]));
+    if (!any_rssi) {
+        g_variant_builder_add(&builder, "{sv}", "RSSI", g_variant_new_int16(rssi));
+    }
+    if (!any_pathloss) {
+        g_variant_builder_add(&builder, "{sv}", "Pathloss", g_variant_new_uint16(pathloss));
+    }
+    if (!any_uuid && uuids->len > 0) {
+        g_variant_builder_add(&builder, "{sv}", "UUIDs",
+                              g_variant_new_strv((const gchar* const*)uuids->pdata, uuids->len));
+    }
+    g_variant_builder_add(&builder, "{sv}", "DuplicateData", g_variant_new_boolean(duplicate_data));
+    if (same_pattern && pattern) {
+        g_variant_builder_add(&builder, "{sv}", "Pattern", g_variant_new_string(pattern));
+    }
+    g_ptr_array_free(uuids, TRUE);
+    return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+// --- Requests ---
+
+static BleHalStatus on_filter_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                    BleHalStatus status) {
+    if (status == BLE_HAL_SUCCESS || status == BLE_HAL_ERROR_CANCELLED) return status;
+
+    HAL_LOG_ERROR("SetDiscoveryFilter failed for %s (%d).", request->object_path, status);
+    g_mutex_lock(&discovery_lock);
+    HalDiscoveryAdapter* adapter = discovery_adapters ? g_hash_table_lookup(discovery_adapters, request->object_path)
+                                                      : NULL;
+    if (adapter && adapter->filter) {
+        g_variant_unref(adapter->filter); // Unknown now; sent again with the next change
+        adapter->filter = NULL;
+    }
+    g_mutex_unlock(&discovery_lock);
+    return status;
+}
+
+/**
+ * @brief Closes session 'id' of 'adapter', if still open. Called with discovery_lock held.
+ */
+static void close_failed_session(HalDiscoveryAdapter* adapter, guint id) {
+    HalDiscoverySession* session = id ? g_hash_table_lookup(discovery_sessions, GUINT_TO_POINTER(id)) : NULL;
+    if (session) {
+        g_ptr_array_remove(adapter->sessions, session);
+        g_hash_table_remove(discovery_sessions, GUINT_TO_POINTER(id));
+        HAL_LOG_INFO("Discovery session %u closed on %s (%u open).", id, adapter->path, adapter->sessions->len);
+    }
+}
+
+/**
+ * @brief Detaches the sessions held on 'start'. Called with discovery_lock held.
+ */
+static GPtrArray* take_held(HalDiscoveryAdapter* adapter, StartDiscoveryRequest* start) {
+    GPtrArray* held = start->held;
+    start->held = NULL;
+    if (adapter && adapter->pending_start == start) {
+        adapter->pending_start = NULL;
+    }
+    return held;
+}
+
+/**
+ * @brief Reports 'status' to the held openers. Called without discovery_lock.
+ */
+static void complete_held(GPtrArray* held, BleHalStatus status) {
+    if (!held) return;
+    for (guint i = 0; i < held->len; i++) {
+        hal_command_complete(g_ptr_array_index(held, i), status);
+    }
+    g_ptr_array_free(held, TRUE);
+}
+
+static BleHalStatus on_start_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                   BleHalStatus status) {
+    StartDiscoveryRequest* start = (StartDiscoveryRequest*)request;
+
+    g_mutex_lock(&discovery_lock);
+    HalDiscoveryAdapter* adapter = discovery_adapters ? g_hash_table_lookup(discovery_adapters, request->object_path)
+                                                      : NULL;
+    gboolean current = adapter && adapter->pending_start == start;
+    GPtrArray* held = take_held(adapter, start);
+
+    if (status == BLE_HAL_SUCCESS) {
+        HAL_LOG_INFO("Discovery started on %s.", request->object_path);
+    } else if (status != BLE_HAL_ERROR_CANCELLED && adapter) {
+        // (On CANCELLED BlueZ went away and hal_discovery_resume() starts it again.)
+        HAL_LOG_ERROR("StartDiscovery failed for %s (%d).", request->object_path, status);
+        if (current) {
+            adapter->running = FALSE; // The next session to open tries again
+        }
+        close_failed_session(adapter, start->session_id);
+        for (guint i = 0; held && i < held->len; i++) {
+            close_failed_session(adapter, ((HeldOpen*)g_ptr_array_index(held, i))->session_id);
+        }
+    }
+    g_mutex_unlock(&discovery_lock);
+
+    complete_held(held, status);
+    return status;
+}
+
+static void start_request_cleanup(HalCommand* command) {
+    StartDiscoveryRequest* start = (StartDiscoveryRequest*)command;
+
+    // Only left here if the request was dropped unanswered.
+    g_mutex_lock(&discovery_lock);
+    HalDiscoveryAdapter* adapter = discovery_adapters ? g_hash_table_lookup(discovery_adapters,
+                                                                            start->base.object_path)
+                                                      : NULL;
+    GPtrArray* held = take_held(adapter, start);
+    g_mutex_unlock(&discovery_lock);
+
+    complete_held(held, BLE_HAL_ERROR_NOT_INITIALIZED);
+}
+
+/**
+ * @brief Creates the StartDiscovery call for 'adapter' and marks discovery
+ * running. Called with discovery_lock held.
+ */
+static StartDiscoveryRequest* start_request_new(HalDiscoveryAdapter* adapter, guint session_id,
+                                                BleHalResultCb cb, void* user_data) {
+    StartDiscoveryRequest* start = hal_request_new(sizeof(StartDiscoveryRequest), adapter->path,
+                                                   "org.bluez.Adapter1", "StartDiscovery",
+                                                   NULL, NULL, 0, cb, user_data);
+    start->base.on_reply = on_start_reply;
+    start->base.cleanup = start_request_cleanup;
+    start->session_id = session_id;
+    start->held = g_ptr_array_new();
+    adapter->running = TRUE;
+    adapter->pending_start = start;
+    return start;
+}
+
+static HalRequest* filter_request_new(const gchar* adapter_path, GVariant* filter) {
+    HalRequest* request = hal_request_new(sizeof(HalRequest), adapter_path, "org.bluez.Adapter1",
+                                          "SetDiscoveryFilter", g_variant_new("(@a{sv})", filter),
+                                          NULL, 0, NULL, NULL);
+    request->coalesce_key = g_strdup_printf("%s org.bluez.Adapter1.SetDiscoveryFilter", adapter_path);
+    request->on_reply = on_filter_reply;
+    return request;
+}
+
+/**
+ * @brief Queues SetDiscoveryFilter if the merged filter of 'adapter' differs
+ * from the last one sent. Called with discovery_lock held.
+ */
+static HalRequest* update_filter(HalDiscoveryAdapter* adapter) {
+    GVariant* filter = merged_filter(adapter);
+
+    if (adapter->filter && g_variant_equal(adapter->filter, filter)) {
+        g_variant_unref(filter);
+        return NULL;
+    }
+    if (adapter->filter) g_variant_unref(adapter->filter);
+    adapter->filter = filter;
+    return filter_request_new(adapter->path, filter);
+}
+
+static void noop_execute(HalCommand* command) {
+    hal_command_complete(command, BLE_HAL_SUCCESS);
+}
+
+/**
+ * @brief Submits the calls a session change produced, in order. 'call' is
+ * the D-Bus call carrying the caller's callback, or NULL to report through
+ * the no-op 'done' instead; with neither, the callback is held on a pending
+ * StartDiscovery. Called without discovery_lock.
+ */
+static BleHalStatus submit_calls(HalRequest* filter, HalRequest* call, HalCommand* done) {
+    if (filter) {
+        hal_request_submit(filter); // If this fails, so does the call after it
+    }
+    if (!call && !done) return BLE_HAL_PENDING;
+    return call ? hal_request_submit(call) : hal_command_submit(done);
+}
+
+// --- Internal API ---
+
+void hal_discovery_init(void) {
+    g_mutex_lock(&discovery_lock);
+    discovery_sessions = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, session_free);
+    discovery_adapters = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, discovery_adapter_free);
+    g_mutex_unlock(&discovery_lock);
+}
+
+void hal_discovery_shutdown(void) {
+    g_mutex_lock(&discovery_lock);
+    if (discovery_adapters) g_hash_table_destroy(discovery_adapters);
+    if (discovery_sessions) g_hash_table_destroy(discovery_sessions);
+    discovery_adapters = NULL;
+    discovery_sessions = NULL;
+    g_mutex_unlock(&discovery_lock);
+}
+
+void hal_discovery_bluez_lost(void) {
+    GHashTableIter iter;
+    gpointer value;
+
+    g_mutex_lock(&discovery_lock);
+    if (discovery_adapters) {
+        g_hash_table_iter_init(&iter, discovery_adapters);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalDiscoveryAdapter* adapter = (HalDiscoveryAdapter*)value;
+            adapter->running = FALSE;
+            if (adapter->filter) g_variant_unref(adapter->filter);
+            adapter->filter = NULL;
+        }
+    }
+    g_mutex_unlock(&discovery_lock);
+}
+
+void hal_discovery_resume(void) {
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray* requests = g_ptr_array_new();
+
+    g_mutex_lock(&discovery_lock);
+    if (discovery_adapters) {
+        g_hash_table_iter_init(&iter, discovery_adapters);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalDiscoveryAdapter* adapter = (HalDiscoveryAdapter*)value;
+            if (adapter->running || adapter->sessions->len == 0) continue;
+
+            HalRequest* filter = update_filter(adapter);
+            if (filter) g_ptr_array_add(requests, filter);
+            g_ptr_array_add(requests, start_request_new(adapter, 0, NULL, NULL));
+            HAL_LOG_INFO("Restarting discovery on %s for %u session(s).", adapter->path, adapter->sessions->len);
+        }
+    }
+    g_mutex_unlock(&discovery_lock);
+
+    for (guint i = 0; i < requests->len; i++) {
+        hal_request_submit(g_ptr_array_index(requests, i));
+    }
+    g_ptr_array_free(requests, TRUE);
+}
+
+// --- Public API ---
+
+BleHalStatus ble_hal_start_discovery(const char* adapter_path, const BleHalDiscoveryFilter* filter,
+                                     guint* session_id, BleHalResultCb cb, void* user_data) {
+    BleHalAdapterInfo info;
+
+    if ((adapter_path && !g_variant_is_object_path(adapter_path)) || !session_id ||
+        (filter && (filter->transport > BLE_HAL_DISCOVERY_TRANSPORT_BREDR || (filter->rssi && filter->pathloss)))) {
+        HAL_LOG_ERROR("Invalid adapter path, filter or session pointer for start_discovery.");
+        if (cb) cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    if (!adapter_path) {
+        BleHalStatus status = ble_hal_get_adapter_info(&info);
+        if (status != BLE_HAL_SUCCESS) {
+            if (cb) cb(status, user_data);
+            return status;
+        }
+        adapter_path = info.path;
+    }
+
+    HalDiscoverySession* session = session_new(adapter_path, filter);
+    HalRequest* filter_request = NULL;
+    HalRequest* call = NULL;
+    HalCommand* done = NULL;
+
+    g_mutex_lock(&discovery_lock);
+    if (!discovery_adapters) {
+        g_mutex_unlock(&discovery_lock);
+        session_free(session);
+        if (cb) cb(BLE_HAL_ERROR_NOT_INITIALIZED, user_data);
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+
+    HalDiscoveryAdapter* adapter = g_hash_table_lookup(discovery_adapters, adapter_path);
+    if (!adapter) {
+        adapter = g_new0(HalDiscoveryAdapter, 1);
+        adapter->path = g_strdup(adapter_path);
+        adapter->sessions = g_ptr_array_new();
+        g_hash_table_insert(discovery_adapters, adapter->path, adapter);
+    }
+    session->id = next_session_id++;
+    if (next_session_id == 0) next_session_id = 1;
+    g_hash_table_insert(discovery_sessions, GUINT_TO_POINTER(session->id), session);
+    g_ptr_array_add(adapter->sessions, session);
+    *session_id = session->id;
+
+    filter_request = update_filter(adapter);
+    if (!adapter->running) {
+        call = &start_request_new(adapter, session->id, cb, user_data)->base;
+    } else if (adapter->pending_start) {
+        // Not known to be running yet: report StartDiscovery's result once it arrives.
+        HeldOpen* held = hal_command_new(sizeof(HeldOpen), noop_execute, NULL, cb, user_data);
+        held->session_id = session->id;
+        g_ptr_array_add(adapter->pending_start->held, held);
+    } else {
+        done = hal_command_new(sizeof(HalCommand), noop_execute, NULL, cb, user_data);
+    }
+    HAL_LOG_INFO("Discovery session %u opened on %s (%u open).", session->id, adapter_path, adapter->sessions->len);
+    g_mutex_unlock(&discovery_lock);
+
+    BleHalStatus status = submit_calls(filter_request, call, done);
+    if (status != BLE_HAL_PENDING && cb) cb(status, user_data);
+    return status;
+}
+
+BleHalStatus ble_hal_stop_discovery(guint session_id, BleHalResultCb cb, void* user_data) {
+    HalRequest* filter_request = NULL;
+    HalRequest* call = NULL;
+    HalCommand* done = NULL;
+
+    g_mutex_lock(&discovery_lock);
+    HalDiscoverySession* session = discovery_sessions ? g_hash_table_lookup(discovery_sessions,
+                                                                            GUINT_TO_POINTER(session_id))
+                                                      : NULL;
+    if (!session) {
+        BleHalStatus status = discovery_sessions ? BLE_HAL_ERROR_NOT_FOUND : BLE_HAL_ERROR_NOT_INITIALIZED;
+        g_mutex_unlock(&discovery_lock);
+        if (cb) cb(status, user_data);
+        return status;
+    }
+
+    HalDiscoveryAdapter* adapter = g_hash_table_lookup(discovery_adapters, session->adapter_path);
+    g_ptr_array_remove(adapter->sessions, session);
+    HAL_LOG_INFO("Discovery session %u closed on %s (%u open).", session_id, adapter->path, adapter->sessions->len);
+
+    if (adapter->sessions->len > 0) {
+        filter_request = update_filter(adapter);
+        done = hal_command_new(sizeof(HalCommand), noop_execute, NULL, cb, user_data);
+    } else if (adapter->running) {
+        call = hal_request_new(sizeof(HalRequest), adapter->path, "org.bluez.Adapter1", "StopDiscovery",
+                               NULL, NULL, 0, cb, user_data);
+        adapter->running = FALSE;
+        adapter->pending_start = NULL; // Sessions opened from here on send their own start
+        if (adapter->filter) g_variant_unref(adapter->filter); // Dropped with the stop; sent again on start
+        adapter->filter = NULL;
+    } else {
+        done = hal_command_new(sizeof(HalCommand), noop_execute, NULL, cb, user_data); // Start failed or BlueZ away
+    }
+    g_hash_table_remove(discovery_sessions, GUINT_TO_POINTER(session_id));
+    g_mutex_unlock(&discovery_lock);
+
+    BleHalStatus status = submit_calls(filter_request, call, done);
+    if (status != BLE_HAL_PENDING && cb) cb(status, user_data);
+    return status;
+}
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Event hand-off between the HAL and the application.
+ *
+ * In the default (inline) mode every HAL callback runs on the application's
+ * context and events are delivered by calling straight into the app.
+ *
+ * In event-thread mode the HAL runs its own GMainContext on a private thread.
+ * Events are copied into bounded single-producer/single-consumer rings and an
+ * eventfd wakes a GSource on the application's context, which drains them and
+ * invokes the callbacks. Every thread that emits events (the HAL thread and
+ * any adapter worker threads) attaches its own ring, so producers never
+ * contend with each other; a thread without a ring falls back to handing each
+ * event over with g_main_context_invoke().
+ */
+
+typedef enum {
+    HAL_QUEUED_GLOBAL,      // BleHalConfig.global_event_cb
+    HAL_QUEUED_RESULT,      // BleHalResultCb completion
+    HAL_QUEUED_ADV_BATCH    // BleHalAdvBatchCb delivery
+} HalQueuedKind;
+
+typedef struct {
+    HalQueuedKind kind;
+    gint code;              // BleHalEvent or BleHalStatus
+    gpointer callback;      // Callback to invoke on the app side
+    void* user_data;
+    gpointer payload;       // Owned copy of the event data (or BleHalAdvUpdate*), may be NULL
+    guint n_items;          // Number of BleHalAdvUpdate entries in 'payload'
+} HalQueuedEvent;
+
+typedef struct {
+    GSource source;
+    gpointer fd_tag;
+} HalEventSource;
+
+// --- State ---
+static gboolean events_threaded = FALSE;
+static GMainContext* app_context = NULL;        // Context app callbacks run on
+static GMainContext* hal_context = NULL;        // Context HAL work runs on (== app_context inline)
+static GMainLoop* hal_loop = NULL;              // Event-thread loop (threaded mode only)
+static GThread* hal_thread = NULL;
+
+// SPSC ring. 'tail' is written only by the producer that claimed it, 'head' only by the app side.
+typedef struct {
+    HalQueuedEvent* slots;
+    volatile gint head;
+    volatile gint tail;
+    gboolean claimed;                           // Owned by a producer thread (guarded by rings_mutex)
+} HalEventRing;
+
+// The HAL thread plus one per adapter worker; further producers use the slow path.
+#define HAL_EVENTS_MAX_PRODUCERS    16
+
+static HalEventRing rings[HAL_EVENTS_MAX_PRODUCERS];
+static volatile gint n_rings = 0;               // rings[0, n_rings) have slots; only ever grows
+static guint ring_mask = 0;                     // Same capacity for every ring
+static GMutex rings_mutex;                      // Serializes claiming and releasing rings
+static GPrivate producer_ring;                  // HalEventRing* attached to the calling thread
+static volatile gint wakeup_pending = 0;        // Set while an eventfd wakeup is outstanding
+static volatile gint shutting_down = 0;
+static volatile gint dropped_events = 0;
+static int wakeup_fd = -1;
+static GSource* app_source = NULL;
+
+// Slow path for a full ring: the producer parks here until the app frees a slot.
+static GMutex ring_full_mutex;
+static GCond ring_full_cond;
+
+// --- Payload Copies ---
+// Copies come from the block pools; BleHalDeviceInfo and BleHalAdapterInfo fit the largest class.
+
+static void free_adv_updates(BleHalAdvUpdate* updates, guint n) {
+    for (guint i = 0; i < n; i++) {
+        if (updates[i].manufacturer_data) g_variant_unref(updates[i].manufacturer_data);
+        if (updates[i].service_data) g_variant_unref(updates[i].service_data);
+        hal_pool_free((gchar*)updates[i].path);
+    }
+    hal_pool_free(updates);
+}
+
+static BleHalAdvUpdate* copy_adv_updates(const BleHalAdvUpdate* updates, guint n) {
+    BleHalAdvUpdate* copy = hal_pool_memdup(updates, sizeof(BleHalAdvUpdate) * n);
+    for (guint i = 0; i < n; i++) {
+        if (copy[i].manufacturer_data) g_variant_ref(copy[i].manufacturer_data);
+        if (copy[i].service_data) g_variant_ref(copy[i].service_data);
+        copy[i].path = hal_pool_strdup(copy[i].path);
+    }
+    return copy;
+}
+
+static void queued_event_release(HalQueuedEvent* ev) {
+    if (ev->kind == HAL_QUEUED_ADV_BATCH) {
+        free_adv_updates(ev->payload, ev->n_items);
+    } else {
+        hal_pool_free(ev->payload);
+    }
+    memset(ev, 0, sizeof(*ev));
+}
+
+static void queued_event_invoke(HalQueuedEvent* ev) {
+    switch (ev->kind) {
+        case HAL_QUEUED_GLOBAL: {
+            BleHalEventData event_data = { .data = ev->payload };
+            ((BleHalGlobalEventCb)ev->callback)((BleHalEvent)ev->code, &event_data, ev->user_data);
+            break;
+        }
+        case HAL_QUEUED_RESULT:
+            ((BleHalResultCb)ev->callback)((BleHalStatus)ev->code, ev->user_data);
+            break;
+        case HAL_QUEUED_ADV_BATCH:
+            ((BleHalAdvBatchCb)ev->callback)(ev->payload, ev->n_items, ev->user_data);
+            break;
+    }
+}
+
+// --- Ring (producer side: HAL thread) ---
+
+static void wake_consumer(void) {
+    if (g_atomic_int_compare_and_exchange(&wakeup_pending, 0, 1)) {
+        guint64 one = 1;
+        ssize_t rc;
+        do {
+            rc = write(wakeup_fd, &one, sizeof(one));
+        } while (rc < 0 && errno == EINTR);
+    }
+}
+
+/**
+ * @brief Appends an event to the calling producer's ring. Returns FALSE if it
+ * was dropped. Advertisement batches are dropped when the ring is full;
+ * everything else waits for the application to make room.
+ */
+static gboolean ring_push(HalEventRing* r, HalQueuedEvent* ev) {
+    gint tail = r->tail;    // Only this thread writes r->tail
+
+    while ((guint)(tail - g_atomic_int_get(&r->head)) > ring_mask) {
+        if (ev->kind == HAL_QUEUED_ADV_BATCH || g_atomic_int_get(&shutting_down)) {
+            g_atomic_int_inc(&dropped_events);
+            queued_event_release(ev);
+            return FALSE;
+        }
+        wake_consumer();
+        g_mutex_lock(&ring_full_mutex);
+        if ((guint)(tail - g_atomic_int_get(&r->head)) > ring_mask) {
+            g_cond_wait_until(&ring_full_cond, &ring_full_mutex,
+                              g_get_monotonic_time() + 50 * G_TIME_SPAN_MILLISECOND);
+        }
+        g_mutex_unlock(&ring_full_mutex);
+    }
+
+    r->slots[(guint)tail & ring_mask] = *ev;
+    hal_stats_gauge_add(HAL_STATS_GAUGE_EVENTS, 1);
+    g_atomic_int_set(&r->tail, tail + 1);      // Publishes the slot (full barrier)
+    wake_consumer();
+    return TRUE;
+}
+
+static gboolean deliver_single(gpointer data) {
+    queued_event_invoke((HalQueuedEvent*)data);
+    return G_SOURCE_REMOVE;
+}
+
+static void free_single(gpointer data) {
+    hal_stats_gauge_add(HAL_STATS_GAUGE_EVENTS, -1);
+    queued_event_release((HalQueuedEvent*)data);
+    hal_pool_free(data);
+}
+
+static void queue_event(HalQueuedEvent* ev) {
+    HalEventRing* r = g_private_get(&producer_ring);
+
+    if (r) {
+        ring_push(r, ev);
+        return;
+    }
+    if (g_atomic_int_get(&shutting_down)) {
+        g_atomic_int_inc(&dropped_events);
+        queued_event_release(ev);
+        return;
+    }
+    hal_stats_gauge_add(HAL_STATS_GAUGE_EVENTS, 1);
+    g_main_context_invoke_full(app_context, G_PRIORITY_DEFAULT, deliver_single,
+                               hal_pool_memdup(ev, sizeof(*ev)), free_single);
+}
+
+// --- Ring (consumer side: application context) ---
+
+static void ring_drain(HalEventRing* r) {
+    gint head = r->head;    // Only the app side writes r->head
+
+    while (head != g_atomic_int_get(&r->tail)) {
+        HalQueuedEvent* slot = &r->slots[(guint)head & ring_mask];
+        HalQueuedEvent ev = *slot;
+        memset(slot, 0, sizeof(*slot));
+        g_atomic_int_set(&r->head, ++head);    // Free the slot before calling out
+        hal_stats_gauge_add(HAL_STATS_GAUGE_EVENTS, -1);
+
+        queued_event_invoke(&ev);
+        queued_event_release(&ev);
+    }
+}
+
+static void drain_all_rings(void) {
+    gint n = g_atomic_int_get(&n_rings);
+    for (gint i = 0; i < n; i++) {
+        ring_drain(&rings[i]);
+    }
+
+    // Let producers parked on a full ring continue.
+    g_mutex_lock(&ring_full_mutex);
+    g_cond_broadcast(&ring_full_cond);
+    g_mutex_unlock(&ring_full_mutex);
+}
+
+static gboolean event_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalEventSource* ev_source = (HalEventSource*)source;
+
+    if (g_source_query_unix_fd(source, ev_source->fd_tag) & G_IO_IN) {
+        guint64 count;
+        // Clear the flag before reading so a push racing with the drain re-arms the fd.
+        g_atomic_int_set(&wakeup_pending, 0);
+        while (read(wakeup_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+        }
+    }
+    drain_all_rings();
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs event_source_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    event_source_dispatch,
+    NULL,                   // finalize
+    NULL,
+    NULL
+};
+
+// --- HAL Thread ---
+
+static gpointer hal_thread_main(gpointer data) {
+    g_main_context_push_thread_default(hal_context);
+    hal_events_attach_producer();
+    g_main_loop_run(hal_loop);
+    hal_events_detach_producer();
+    g_main_context_pop_thread_default(hal_context);
+    return NULL;
+}
+
+// --- Internal API ---
+
+gboolean hal_events_init(GMainContext* application_context, gboolean threaded, guint queue_capacity) {
+    app_context = application_context ? g_main_context_ref(application_context)
+                                      : g_main_context_ref(g_main_context_default());
+    events_threaded = threaded;
+    g_atomic_int_set(&shutting_down, 0);
+    g_atomic_int_set(&dropped_events, 0);
+
+    if (!threaded) {
+        hal_context = g_main_context_ref(app_context);
+        return TRUE;
+    }
+
+    wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd < 0) {
+        HAL_LOG_ERROR("eventfd() failed: %s", g_strerror(errno));
+        g_main_context_unref(app_context);
+        app_context = NULL;
+        events_threaded = FALSE;
+        return FALSE;
+    }
+
+    guint capacity = 16;
+    if (queue_capacity == 0) queue_capacity = BLE_HAL_EVENT_QUEUE_DEFAULT_CAPACITY;
+    while (capacity < queue_capacity) capacity <<= 1;
+    ring_mask = capacity - 1;     // Rings are allocated as producers attach
+    n_rings = 0;
+    wakeup_pending = 0;
+    g_mutex_init(&rings_mutex);
+    g_mutex_init(&ring_full_mutex);
+    g_cond_init(&ring_full_cond);
+
+    app_source = g_source_new(&event_source_funcs, sizeof(HalEventSource));
+    ((HalEventSource*)app_source)->fd_tag = g_source_add_unix_fd(app_source, wakeup_fd, G_IO_IN);
+    g_source_set_name(app_source, "ble-hal-events");
+    g_source_attach(app_source, app_context);
+
+    hal_context = g_main_context_new();
+    hal_loop = g_main_loop_new(hal_context, FALSE);
+    HAL_LOG_INFO("Event thread mode, queue capacity %u.", capacity);
+    return TRUE;
+}
+
+gboolean hal_events_start(void) {
+    if (!events_threaded || hal_thread) return TRUE;
+
+    GError* error = NULL;
+    hal_thread = g_thread_try_new("ble-hal", hal_thread_main, NULL, &error);
+    if (!hal_thread) {
+        HAL_LOG_ERROR("Failed to start HAL thread: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    HAL_LOG_INFO("Event thread started.");
+    return TRUE;
+}
+
+void hal_events_stop(void) {
+    if (!events_threaded) return;
+
+    g_atomic_int_set(&shutting_down, 1);
+    g_mutex_lock(&ring_full_mutex);
+    g_cond_broadcast(&ring_full_cond);
+    g_mutex_unlock(&ring_full_mutex);
+    if (hal_thread) {
+        g_main_loop_quit(hal_loop);
+        g_thread_join(hal_thread);
+        hal_thread = NULL;
+        HAL_LOG_INFO("Event thread stopped.");
+    }
+}
+
+void hal_events_shutdown(void) {
+    if (events_threaded) {
+        hal_events_stop();
+
+        // Undelivered events are dropped.
+        for (gint i = 0; i < n_rings; i++) {
+            HalEventRing* r = &rings[i];
+            while (r->head != r->tail) {
+                queued_event_release(&r->slots[(guint)r->head & ring_mask]);
+                hal_stats_gauge_add(HAL_STATS_GAUGE_EVENTS, -1);
+                r->head++;
+            }
+            g_free(r->slots);
+            memset(r, 0, sizeof(*r));
+        }
+        n_rings = 0;
+        if (app_source) {
+            g_source_destroy(app_source);
+            g_source_unref(app_source);
+            app_source = NULL;
+        }
+        if (wakeup_fd >= 0) {
+            close(wakeup_fd);
+            wakeup_fd = -1;
+        }
+        ring_mask = 0;
+        g_mutex_clear(&rings_mutex);
+        g_mutex_clear(&ring_full_mutex);
+        g_cond_clear(&ring_full_cond);
+        if (hal_loop) {
+            g_main_loop_unref(hal_loop);
+            hal_loop = NULL;
+        }
+    }
+
+    if (hal_context) {
+        g_main_context_unref(hal_context);
+        hal_context = NULL;
+    }
+    if (app_context) {
+        g_main_context_unref(app_context);
+        app_context = NULL;
+    }
+    events_threaded = FALSE;
+}
+
+void hal_events_attach_producer(void) {
+    HalEventRing* r = NULL;
+
+    if (!events_threaded || g_private_get(&producer_ring)) return;
+
+    g_mutex_lock(&rings_mutex);
+    for (gint i = 0; i < n_rings && !r; i++) {
+        if (!rings[i].claimed) r = &rings[i];
+    }
+    if (!r && n_rings < HAL_EVENTS_MAX_PRODUCERS) {
+        r = &rings[n_rings];
+        r->slots = g_new0(HalQueuedEvent, ring_mask + 1);
+        r->head = r->tail = 0;
+        g_atomic_int_set(&n_rings, n_rings + 1); // Publishes the slots to the consumer
+    }
+    if (r) {
+        // A released ring may still hold events; the new producer simply appends.
+        r->claimed = TRUE;
+    }
+    g_mutex_unlock(&rings_mutex);
+
+    if (!r) {
+        HAL_LOG_WARN("No free event ring for this thread; events are handed over individually.");
+        return;
+    }
+    g_private_set(&producer_ring, r);
+}
+
+void hal_events_detach_producer(void) {
+    HalEventRing* r = g_private_get(&producer_ring);
+    if (!r) return;
+
+    g_mutex_lock(&rings_mutex);
+    r->claimed = FALSE;
+    g_mutex_unlock(&rings_mutex);
+    g_private_set(&producer_ring, NULL);
+}
+
+gboolean hal_events_is_threaded(void) {
+    return events_threaded;
+}
+
+GMainContext* hal_events_get_hal_context(void) {
+    return hal_context ? hal_context : g_main_context_default();
+}
+
+GMainContext* hal_events_get_app_context(void) {
+    return app_context ? app_context : g_main_context_default();
+}
+
+guint hal_events_get_dropped_count(void) {
+    return (guint)g_atomic_int_get(&dropped_events);
+}
+
+GSource* hal_timeout_source_add(guint interval_ms, GSourceFunc func, gpointer user_data) {
+    return hal_timeout_source_attach(hal_events_get_hal_context(), interval_ms, func, user_data);
+}
+
+GSource* hal_timeout_source_attach(GMainContext* context, guint interval_ms, GSourceFunc func, gpointer user_data) {
+    GSource* source = g_timeout_source_new(interval_ms);
+    g_source_set_callback(source, func, user_data, NULL);
+    g_source_attach(source, context);
+    return source; // Caller owns the reference; destroy with hal_source_clear()
+}
+
+void hal_source_clear(GSource** source) {
+    if (*source) {
+        g_source_destroy(*source);
+        g_source_unref(*source);
+        *source = NULL;
+    }
+}
+
+void hal_events_emit_global(BleHalGlobalEventCb cb, void* user_data, BleHalEvent event_type,
+                            const void* payload, gsize payload_size) {
+    if (!cb) return;
+
+    if (!events_threaded) {
+        BleHalEventData event_data = { .data = (void*)payload };
+        cb(event_type, &event_data, user_data);
+        return;
+    }
+
+    HalQueuedEvent ev = {
+        .kind = HAL_QUEUED_GLOBAL,
+        .code = event_type,
+        .callback = (gpointer)cb,
+        .user_data = user_data,
+        .payload = payload ? hal_pool_memdup(payload, payload_size) : NULL,
+    };
+    queue_event(&ev);
+}
+
+void hal_events_emit_result(BleHalResultCb cb, void* user_data, BleHalStatus status) {
+    if (!cb) return;
+
+    if (!events_threaded) {
+        cb(status, user_data);
+        return;
+    }
+
+    HalQueuedEvent ev = {
+        .kind = HAL_QUEUED_RESULT,
+        .code = status,
+        .callback = (gpointer)cb,
+        .user_data = user_data,
+    };
+    queue_event(&ev);
+}
+
+void hal_events_emit_adv_batch(BleHalAdvBatchCb cb, void* user_data, const BleHalAdvUpdate* updates, guint n) {
+    if (!cb || n == 0) return;
+
+    if (!events_threaded) {
+        cb(updates, n, user_data);
+        return;
+    }
+
+    HalQueuedEvent ev = {
+        .kind = HAL_QUEUED_ADV_BATCH,
+        .callback = (gpointer)cb,
+        .user_data = user_data,
+        .payload = copy_adv_updates(updates, n),
+        .n_items = n,
+    };
+    queue_event(&ev);
+}
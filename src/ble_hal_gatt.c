@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <gio/gunixfdlist.h>
+#include "ble_hal_internal.h"
+
+/*
+ * GATT client: fd-based notifications and writes.
+ *
+ * GattCharacteristic1.AcquireNotify and AcquireWrite return a SOCK_SEQPACKET
+ * socket that carries one characteristic value per packet. Each socket is a
+ * GSource on the application's context:
+ *
+ *  - notification sockets read every packet into a buffer sized to the MTU
+ *    and hand the callback a pointer into it;
+ *  - write streams send queued batches through a HalPacketQueue, which
+ *    gathers each packet straight from the caller's buffers.
+ *
+ * The D-Bus calls themselves are queued to the HAL context like every other
+ * command.
+ */
+
+// Packets handled per dispatch before other sources get a turn.
+#define HAL_GATT_MAX_PACKETS_PER_DISPATCH   32
+// Used when BlueZ reports no MTU (23 is the minimum ATT MTU).
+#define HAL_GATT_DEFAULT_MTU                23
+
+typedef struct _HalGattSocket HalGattSocket;
+
+// Adds the fd to the source; called with gatt_lock held, before the source is attached.
+typedef void (*HalGattSocketAttachFunc)(HalGattSocket* socket);
+
+// Common header of notification and write sockets; concrete sources embed it first.
+struct _HalGattSocket {
+    GSource source;
+    gpointer fd_tag;
+    int fd;                         // Characteristic socket (-1 until acquired)
+    gchar* char_path;               // Characteristic object path (owned, also the table key)
+    gsize mtu;                      // Packet size BlueZ reported
+    GHashTable** table;             // Table the socket is registered in
+    const gchar* method;            // "AcquireNotify" or "AcquireWrite"
+    HalGattSocketAttachFunc attach;
+};
+
+typedef struct {
+    HalGattSocket socket;
+    guint8* buffer;                 // Reused for every packet, 'mtu' bytes
+    BleHalGattNotifyCb cb;
+    void* user_data;
+} HalNotifySource;
+
+typedef struct {
+    HalGattSocket socket;
+    HalPacketQueue packets;
+} HalWriteStream;
+
+typedef struct {
+    HalRequest base;
+    HalGattSocket* socket;          // Reference held by the request
+} AcquireRequest;
+
+// Sockets by characteristic path. Each value holds a reference to its source
+// and is removed when the socket closes.
+static GHashTable* notify_subscriptions = NULL;
+static GHashTable* write_streams = NULL;
+static GMutex gatt_lock;
+
+// --- Socket Registration ---
+
+static void socket_release(gpointer data) {
+    GSource* source = (GSource*)data;
+    g_source_destroy(source);   // Fine on a source that was never attached
+    g_source_unref(source);
+}
+
+// Call with gatt_lock held.
+static gboolean socket_is_registered(HalGattSocket* socket) {
+    return *socket->table && g_hash_table_lookup(*socket->table, socket->char_path) == socket;
+}
+
+/**
+ * @brief Removes 'socket' from its table unless it was replaced or closed
+ * already. Returns TRUE if it was still registered.
+ */
+static gboolean socket_unregister(HalGattSocket* socket) {
+    gboolean registered = FALSE;
+
+    g_mutex_lock(&gatt_lock);
+    if (socket_is_registered(socket)) {
+        // Keep the table's reference alive until the caller is done with the source.
+        g_source_ref(&socket->source);
+        g_hash_table_remove(*socket->table, socket->char_path);
+        registered = TRUE;
+    }
+    g_mutex_unlock(&gatt_lock);
+
+    if (registered) g_source_unref(&socket->source);
+    return registered;
+}
+
+static void socket_finalize(HalGattSocket* socket) {
+    if (socket->fd >= 0) close(socket->fd);
+    g_free(socket->char_path);
+}
+
+static HalGattSocket* socket_new(GSourceFuncs* funcs, gsize size, const gchar* name, const char* char_path,
+                                 GHashTable** table, const gchar* method, HalGattSocketAttachFunc attach) {
+    HalGattSocket* socket = (HalGattSocket*)g_source_new(funcs, size);
+    g_source_set_name(&socket->source, name);
+    socket->fd = -1;
+    socket->char_path = g_strdup(char_path);
+    socket->table = table;
+    socket->method = method;
+    socket->attach = attach;
+    return socket;
+}
+
+// --- Acquire ---
+
+static void acquire_cleanup(HalCommand* command) {
+    g_source_unref(&((AcquireRequest*)command)->socket->source);
+}
+
+/**
+ * @brief Settles an Acquire call on the HAL context: attaches the socket, or
+ * unregisters it if the call failed.
+ */
+static BleHalStatus on_acquire_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                     BleHalStatus status) {
+    HalGattSocket *socket = ((AcquireRequest*)request)->socket;
+    GError *error = NULL;
+
+    if (status != BLE_HAL_SUCCESS) {
+        socket_unregister(socket);
+        return status;
+    }
+
+    gint32 fd_index;
+    guint16 mtu;
+    g_variant_get(reply, "(hq)", &fd_index, &mtu);
+
+    int fd = fd_list ? g_unix_fd_list_get(fd_list, fd_index, &error) : -1;
+    if (fd < 0) {
+        HAL_LOG_ERROR("%s for %s returned no socket%s%s", socket->method, socket->char_path,
+                      error ? ": " : ".", error ? error->message : "");
+        g_clear_error(&error);
+        socket_unregister(socket);
+        return BLE_HAL_ERROR_DBUS;
+    }
+    g_unix_set_fd_nonblocking(fd, TRUE, NULL);
+
+    // Attach under the lock so a concurrent close either sees the source live or never attached.
+    g_mutex_lock(&gatt_lock);
+    gboolean wanted = socket_is_registered(socket);
+    if (wanted) {
+        socket->fd = fd;
+        socket->mtu = mtu > 0 ? mtu : HAL_GATT_DEFAULT_MTU;
+        socket->attach(socket);
+        g_source_attach(&socket->source, hal_events_get_app_context());
+    }
+    g_mutex_unlock(&gatt_lock);
+
+    if (!wanted) {
+        close(fd); // Closed while the call was in flight; closing releases it in BlueZ
+        return BLE_HAL_ERROR;
+    }
+    HAL_LOG_DEBUG("%s socket ready for %s (MTU %u).", socket->method, socket->char_path, mtu);
+    return BLE_HAL_SUCCESS;
+}
+
+/**
+ * @brief Registers 'socket' (taking its initial reference) and queues the
+ * Acquire call. Immediate failures are also reported to 'result_cb'.
+ */
+static BleHalStatus socket_acquire(HalGattSocket* socket, BleHalResultCb result_cb, void* user_data) {
+    BleHalStatus status = BLE_HAL_PENDING;
+
+    g_mutex_lock(&gatt_lock);
+    if (!*socket->table) {
+        status = BLE_HAL_ERROR_NOT_INITIALIZED;
+    } else if (g_hash_table_contains(*socket->table, socket->char_path)) {
+        status = BLE_HAL_ERROR_BUSY;
+    } else {
+        // The table takes the initial reference; the path key is owned by the source.
+        g_hash_table_insert(*socket->table, socket->char_path, socket);
+    }
+    g_mutex_unlock(&gatt_lock);
+
+    if (status != BLE_HAL_PENDING) {
+        g_source_unref(&socket->source);
+        if (result_cb) result_cb(status, user_data);
+        return status;
+    }
+
+    AcquireRequest* request = hal_request_new(sizeof(AcquireRequest), socket->char_path,
+                                              "org.bluez.GattCharacteristic1", socket->method,
+                                              g_variant_new("(a{sv})", NULL),  // No options
+                                              G_VARIANT_TYPE("(hq)"),          // Socket index, MTU
+                                              0, result_cb, user_data);
+    request->base.on_reply = on_acquire_reply;
+    request->base.cleanup = acquire_cleanup;
+    request->socket = (HalGattSocket*)g_source_ref(&socket->source);
+
+    status = hal_request_submit(&request->base); // Sent from the HAL context
+    if (status != BLE_HAL_PENDING) {
+        HAL_LOG_ERROR("HAL not initialized or D-Bus connection lost.");
+        socket_unregister(socket);
+        if (result_cb) result_cb(status, user_data);
+    }
+    return status;
+}
+
+static BleHalStatus socket_close(GHashTable** table, const char* char_path) {
+    if (!char_path) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    gpointer socket = NULL;
+    g_mutex_lock(&gatt_lock);
+    if (!*table) {
+        g_mutex_unlock(&gatt_lock);
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+    g_hash_table_steal_extended(*table, char_path, NULL, &socket);
+    g_mutex_unlock(&gatt_lock);
+
+    if (!socket) return BLE_HAL_ERROR_NOT_FOUND;
+    socket_release(socket); // Closes the socket once no dispatch holds it
+    return BLE_HAL_SUCCESS;
+}
+
+// --- Notification Source ---
+
+static void notify_source_attach(HalGattSocket* socket) {
+    HalNotifySource* subscription = (HalNotifySource*)socket;
+    subscription->buffer = g_malloc(socket->mtu);
+    socket->fd_tag = g_source_add_unix_fd(&socket->source, socket->fd, G_IO_IN | G_IO_HUP | G_IO_ERR);
+}
+
+static gboolean notify_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalNotifySource* subscription = (HalNotifySource*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, subscription->socket.fd_tag);
+
+    if (revents & G_IO_IN) {
+        for (guint i = 0; i < HAL_GATT_MAX_PACKETS_PER_DISPATCH; i++) {
+            ssize_t n = read(subscription->socket.fd, subscription->buffer, subscription->socket.mtu);
+            if (n > 0) {
+                subscription->cb(subscription->buffer, (gsize)n, subscription->user_data);
+                if (g_source_is_destroyed(source)) return G_SOURCE_REMOVE; // Stopped from the callback
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return G_SOURCE_CONTINUE;
+            revents |= G_IO_HUP; // 0 (peer closed) or a real error
+            break;
+        }
+        if (!(revents & (G_IO_HUP | G_IO_ERR))) return G_SOURCE_CONTINUE;
+    }
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_INFO("Notifications for %s ended.", subscription->socket.char_path);
+        socket_unregister(&subscription->socket);
+        subscription->cb(NULL, 0, subscription->user_data);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void notify_source_finalize(GSource* source) {
+    HalNotifySource* subscription = (HalNotifySource*)source;
+    g_free(subscription->buffer);
+    socket_finalize(&subscription->socket);
+}
+
+static GSourceFuncs notify_source_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    notify_source_dispatch,
+    notify_source_finalize,
+    NULL,
+    NULL
+};
+
+// --- Write Stream ---
+
+static void write_stream_attach(HalGattSocket* socket) {
+    HalWriteStream* stream = (HalWriteStream*)socket;
+    socket->fd_tag = hal_packet_queue_attach_fd(&stream->packets, socket->fd, G_IO_HUP | G_IO_ERR);
+}
+
+static gboolean write_stream_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalWriteStream* stream = (HalWriteStream*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, stream->socket.fd_tag);
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_INFO("Write stream to %s closed by BlueZ.", stream->socket.char_path);
+    } else {
+        switch (hal_packet_queue_flush(&stream->packets, stream->socket.fd, stream->socket.mtu)) {
+        case HAL_PACKET_QUEUE_DRAINED:
+        case HAL_PACKET_QUEUE_BLOCKED:
+            return G_SOURCE_CONTINUE;
+        case HAL_PACKET_QUEUE_STOPPED:
+            return G_SOURCE_REMOVE; // Closed from done_cb
+        case HAL_PACKET_QUEUE_FAILED:
+            HAL_LOG_ERROR("Write to %s failed: %s", stream->socket.char_path, g_strerror(errno));
+            break;
+        }
+    }
+
+    socket_unregister(&stream->socket);
+    hal_packet_queue_clear(&stream->packets, BLE_HAL_ERROR);
+    return G_SOURCE_REMOVE;
+}
+
+static void write_stream_finalize(GSource* source) {
+    HalWriteStream* stream = (HalWriteStream*)source;
+    hal_packet_queue_finalize(&stream->packets); // Whatever is still queued was not written
+    socket_finalize(&stream->socket);
+}
+
+static GSourceFuncs write_stream_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    write_stream_dispatch,
+    write_stream_finalize,
+    NULL,
+    NULL
+};
+
+// --- Internal API ---
+
+void hal_gatt_init(void) {
+    g_mutex_lock(&gatt_lock);
+    notify_subscriptions = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, socket_release);
+    write_streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, socket_release);
+    g_mutex_unlock(&gatt_lock);
+}
+
+void hal_gatt_shutdown(void) {
+    g_mutex_lock(&gatt_lock);
+    GHashTable* notify = notify_subscriptions;
+    GHashTable* writes = write_streams;
+    notify_subscriptions = NULL;
+    write_streams = NULL;
+    g_mutex_unlock(&gatt_lock);
+
+    // Closes every socket; unfinished write batches complete with BLE_HAL_ERROR.
+    if (notify) g_hash_table_destroy(notify);
+    if (writes) g_hash_table_destroy(writes);
+}
+
+// --- Public API ---
+
+BleHalStatus ble_hal_gatt_start_notify(const char* char_path, BleHalGattNotifyCb notify_cb,
+                                       BleHalResultCb result_cb, void* user_data) {
+    if (!char_path || !notify_cb || !g_variant_is_object_path(char_path)) {
+        HAL_LOG_ERROR("Invalid characteristic path or callback for start_notify.");
+        if (result_cb) result_cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    HalNotifySource* subscription = (HalNotifySource*)socket_new(&notify_source_funcs, sizeof(HalNotifySource),
+                                                                 "ble-hal-notify", char_path, &notify_subscriptions,
+                                                                 "AcquireNotify", notify_source_attach);
+    subscription->cb = notify_cb;
+    subscription->user_data = user_data;
+    return socket_acquire(&subscription->socket, result_cb, user_data);
+}
+
+BleHalStatus ble_hal_gatt_stop_notify(const char* char_path) {
+    BleHalStatus status = socket_close(&notify_subscriptions, char_path);
+    if (status == BLE_HAL_SUCCESS) {
+        HAL_LOG_INFO("Notifications stopped for %s.", char_path);
+    }
+    return status;
+}
+
+BleHalStatus ble_hal_gatt_open_write(const char* char_path, BleHalResultCb result_cb, void* user_data) {
+    if (!char_path || !g_variant_is_object_path(char_path)) {
+        HAL_LOG_ERROR("Invalid characteristic path for open_write.");
+        if (result_cb) result_cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    HalWriteStream* stream = (HalWriteStream*)socket_new(&write_stream_funcs, sizeof(HalWriteStream),
+                                                         "ble-hal-write", char_path, &write_streams,
+                                                         "AcquireWrite", write_stream_attach);
+    hal_packet_queue_init(&stream->packets, &stream->socket.source, BLE_HAL_GATT_WRITE_MAX_QUEUED);
+    return socket_acquire(&stream->socket, result_cb, user_data);
+}
+
+BleHalStatus ble_hal_gatt_write(const char* char_path, const BleHalBuffer* buffers, guint n_buffers,
+                                BleHalResultCb done_cb, void* user_data) {
+    if (!char_path) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    BleHalStatus status;
+    g_mutex_lock(&gatt_lock);
+    HalWriteStream* stream = write_streams ? g_hash_table_lookup(write_streams, char_path) : NULL;
+    if (!write_streams) {
+        status = BLE_HAL_ERROR_NOT_INITIALIZED;
+    } else if (!stream) {
+        status = BLE_HAL_ERROR_NOT_FOUND;
+    } else {
+        // Under gatt_lock, so a concurrent close cannot finalize the stream meanwhile.
+        status = hal_packet_queue_push(&stream->packets, buffers, n_buffers, done_cb, user_data);
+    }
+    g_mutex_unlock(&gatt_lock);
+    return status;
+}
+
+BleHalStatus ble_hal_gatt_close_write(const char* char_path) {
+    BleHalStatus status = socket_close(&write_streams, char_path);
+    if (status == BLE_HAL_SUCCESS) {
+        HAL_LOG_INFO("Write stream to %s closed.", char_path);
+    }
+    return status;
+}
@@ -0,0 +1,979 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <gio/gunixfdlist.h>
+#include "ble_hal_internal.h"
+
+/*
+ * GATT server: local services exported to bluetoothd.
+ *
+ * An application is an object tree with an ObjectManager at its root, one
+ * object per service and one per characteristic below it, registered with
+ * the adapter's GattManager1. Every object of a kind shares the interface
+ * info parsed once at init and one static vtable; only the object record
+ * differs, so exporting hundreds of characteristics costs one hash insert
+ * each.
+ *
+ * Characteristics expose NotifyAcquired and WriteAcquired, so bluetoothd
+ * calls AcquireNotify and AcquireWrite instead of sending a D-Bus message per
+ * value. Each call gets one end of a SOCK_SEQPACKET socketpair:
+ *
+ *  - notifications queued with ble_hal_gatt_server_notify() go out through a
+ *    HalPacketQueue, one packet per value; bluetoothd fans every packet out
+ *    to all subscribed centrals and closes its end after the last one leaves;
+ *  - writes without response arrive one packet per value and are read into
+ *    a buffer sized to the MTU.
+ *
+ * Both sockets are GSources on the application's context. The object tree
+ * and the registration live on the HAL context, where bluetoothd's calls
+ * are answered. The application and characteristic tables are guarded by
+ * gatt_server_lock, so values and notifications can be posted from any
+ * thread.
+ */
+
+#define SERVER_APP_PATH_FORMAT      "/ble_hal/gatt%u"
+// Packets read per dispatch before other sources get a turn.
+#define SERVER_MAX_PACKETS_PER_DISPATCH 32
+// ATT MTU assumed when bluetoothd passes none (the LE minimum).
+#define SERVER_DEFAULT_MTU          23
+// Opcode and handle in front of every notification value.
+#define SERVER_NOTIFY_HEADER        3
+
+static const gchar server_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg type='a{oa{sa{sv}}}' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.GattService1'>"
+    "    <property name='UUID' type='s' access='read'/>"
+    "    <property name='Primary' type='b' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.bluez.GattCharacteristic1'>"
+    "    <method name='ReadValue'>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "      <arg type='ay' direction='out'/>"
+    "    </method>"
+    "    <method name='WriteValue'>"
+    "      <arg type='ay' direction='in'/>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='AcquireWrite'>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "      <arg type='h' direction='out'/>"
+    "      <arg type='q' direction='out'/>"
+    "    </method>"
+    "    <method name='AcquireNotify'>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "      <arg type='h' direction='out'/>"
+    "      <arg type='q' direction='out'/>"
+    "    </method>"
+    "    <property name='UUID' type='s' access='read'/>"
+    "    <property name='Service' type='o' access='read'/>"
+    "    <property name='Flags' type='as' access='read'/>"
+    "    <property name='NotifyAcquired' type='b' access='read'/>"
+    "    <property name='WriteAcquired' type='b' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static const gchar* const service_props[] = { "UUID", "Primary", NULL };
+static const gchar* const char_props[] = { "UUID", "Service", "Flags", "NotifyAcquired", "WriteAcquired", NULL };
+
+typedef enum {
+    SERVER_STATE_UNREGISTERED,      // Not known to bluetoothd (new, or BlueZ went away)
+    SERVER_STATE_REGISTERING,       // RegisterApplication in flight
+    SERVER_STATE_REGISTERED
+} HalServerState;
+
+typedef struct _HalServerApp HalServerApp;
+
+typedef struct {
+    GSource source;
+    gpointer fd_tag;
+    int fd;                         // Our end of the socketpair
+    gsize mtu;                      // Packet size
+    guint char_id;
+    HalPacketQueue packets;         // Notification sockets only
+    guint8* buffer;                 // Write sockets only, 'mtu' bytes
+    BleHalGattServerWriteCb write_cb;
+    void* user_data;
+} HalServerSocket;
+
+typedef struct {
+    gchar* uuid;
+    gboolean primary;
+    gchar* object_path;
+    guint registration_id;          // HAL context only
+} HalServerService;
+
+typedef struct {
+    guint id;                       // Handle given to the application
+    HalServerApp* app;
+    HalServerService* service;
+    gchar* uuid;
+    guint32 flags;                  // BLE_HAL_GATT_CHR_* bits
+    gchar* object_path;
+    guint registration_id;          // HAL context only
+    // Guarded by gatt_server_lock
+    GBytes* value;                  // ReadValue answer
+    HalServerSocket* notify;        // AcquireNotify socket, NULL while nobody is subscribed
+    HalServerSocket* write;         // AcquireWrite socket
+} HalServerChar;
+
+struct _HalServerApp {
+    guint id;
+    gchar* adapter_path;
+    gchar* object_path;
+    guint registration_id;          // ObjectManager at the root, 0 while not exported (HAL context)
+    HalServerState state;           // HAL context only
+    gboolean stopping;              // Guarded by gatt_server_lock
+    HalServerService* services;
+    guint n_services;
+    HalServerChar* chars;
+    guint n_chars;
+    BleHalGattServerWriteCb write_cb;
+    void* user_data;
+};
+
+typedef struct {
+    HalCommand base;
+    guint app_id;
+} ServerCommand;
+
+typedef struct {
+    HalRequest base;
+    guint app_id;
+    HalCommand* command;            // Register or unregister command the reply completes, or NULL
+} ServerRequest;
+
+typedef struct {
+    BleHalGattServerWriteCb cb;
+    void* user_data;
+    guint char_id;
+    gsize length;
+    guint8 data[];
+} ServerWrite;
+
+static GHashTable* server_apps = NULL;          // GUINT_TO_POINTER(id) -> HalServerApp*
+static GHashTable* server_chars = NULL;         // GUINT_TO_POINTER(id) -> HalServerChar* (owned by the app)
+static guint next_app_id = 1;
+static guint next_char_id = 1;
+static GMutex gatt_server_lock;
+static GDBusNodeInfo* server_info = NULL;
+
+// --- Sockets ---
+
+static void server_socket_release(HalServerSocket* socket) {
+    if (!socket) return;
+    g_source_destroy(&socket->source);
+    g_source_unref(&socket->source);
+}
+
+/**
+ * @brief Drops 'socket' from its characteristic unless it was replaced or
+ * the application is gone already. Called from the socket's dispatch.
+ */
+static void server_socket_detach(HalServerSocket* socket) {
+    gboolean detached = FALSE;
+
+    g_mutex_lock(&gatt_server_lock);
+    HalServerChar* chr = server_chars ? g_hash_table_lookup(server_chars, GUINT_TO_POINTER(socket->char_id)) : NULL;
+    if (chr && chr->notify == socket) {
+        chr->notify = NULL;
+        detached = TRUE;
+    } else if (chr && chr->write == socket) {
+        chr->write = NULL;
+        detached = TRUE;
+    }
+    g_mutex_unlock(&gatt_server_lock);
+
+    if (detached) server_socket_release(socket);
+}
+
+static gboolean notify_socket_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalServerSocket* socket = (HalServerSocket*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, socket->fd_tag);
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_INFO("Last central unsubscribed from characteristic %u.", socket->char_id);
+    } else {
+        switch (hal_packet_queue_flush(&socket->packets, socket->fd, socket->mtu)) {
+        case HAL_PACKET_QUEUE_DRAINED:
+        case HAL_PACKET_QUEUE_BLOCKED:
+            return G_SOURCE_CONTINUE;
+        case HAL_PACKET_QUEUE_STOPPED:
+            return G_SOURCE_REMOVE; // Released from done_cb
+        case HAL_PACKET_QUEUE_FAILED:
+            HAL_LOG_ERROR("Notification on characteristic %u failed: %s", socket->char_id, g_strerror(errno));
+            break;
+        }
+    }
+
+    server_socket_detach(socket);
+    hal_packet_queue_clear(&socket->packets, BLE_HAL_ERROR);
+    return G_SOURCE_REMOVE;
+}
+
+static void notify_socket_finalize(GSource* source) {
+    HalServerSocket* socket = (HalServerSocket*)source;
+    hal_packet_queue_finalize(&socket->packets); // Whatever is still queued was not sent
+    close(socket->fd);
+}
+
+static GSourceFuncs notify_socket_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    notify_socket_dispatch,
+    notify_socket_finalize,
+    NULL,
+    NULL
+};
+
+static gboolean write_socket_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalServerSocket* socket = (HalServerSocket*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, socket->fd_tag);
+
+    if (revents & G_IO_IN) {
+        for (guint i = 0; i < SERVER_MAX_PACKETS_PER_DISPATCH; i++) {
+            ssize_t n = read(socket->fd, socket->buffer, socket->mtu);
+            if (n > 0) {
+                if (socket->write_cb) socket->write_cb(socket->char_id, socket->buffer, (gsize)n, socket->user_data);
+                if (g_source_is_destroyed(source)) return G_SOURCE_REMOVE; // Unregistered from the callback
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return G_SOURCE_CONTINUE;
+            revents |= G_IO_HUP; // 0 (peer closed) or a real error
+            break;
+        }
+        if (!(revents & (G_IO_HUP | G_IO_ERR))) return G_SOURCE_CONTINUE;
+    }
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_INFO("Write socket of characteristic %u closed by BlueZ.", socket->char_id);
+        server_socket_detach(socket);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void write_socket_finalize(GSource* source) {
+    HalServerSocket* socket = (HalServerSocket*)source;
+    g_free(socket->buffer);
+    close(socket->fd);
+}
+
+static GSourceFuncs write_socket_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    write_socket_dispatch,
+    write_socket_finalize,
+    NULL,
+    NULL
+};
+
+/**
+ * @brief Answers AcquireNotify or AcquireWrite: hands bluetoothd one end of a
+ * new socketpair and installs a source on the other, replacing the previous
+ * socket of that kind. HAL context only.
+ */
+static void handle_acquire(HalServerApp* app, HalServerChar* chr, gboolean notify, GVariant* parameters,
+                           GDBusMethodInvocation* invocation) {
+    GVariant* options = NULL;
+    guint16 mtu = SERVER_DEFAULT_MTU;
+    GError* error = NULL;
+    int fds[2];
+
+    g_variant_get(parameters, "(@a{sv})", &options);
+    g_variant_lookup(options, "mtu", "q", &mtu);
+    g_variant_unref(options);
+    if (mtu < SERVER_DEFAULT_MTU) mtu = SERVER_DEFAULT_MTU;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        HAL_LOG_ERROR("No socket for characteristic %u: %s", chr->id, g_strerror(errno));
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", g_strerror(errno));
+        return;
+    }
+    GUnixFDList* fd_list = g_unix_fd_list_new();
+    gint index = g_unix_fd_list_append(fd_list, fds[1], &error); // Duplicates the fd
+    close(fds[1]);
+    if (index < 0) {
+        HAL_LOG_ERROR("Cannot pass the socket of characteristic %u: %s", chr->id, error->message);
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", error->message);
+        g_clear_error(&error);
+        g_object_unref(fd_list);
+        close(fds[0]);
+        return;
+    }
+
+    HalServerSocket* socket;
+    if (notify) {
+        socket = (HalServerSocket*)g_source_new(&notify_socket_funcs, sizeof(HalServerSocket));
+        g_source_set_name(&socket->source, "ble-hal-server-notify");
+        socket->mtu = mtu - SERVER_NOTIFY_HEADER;
+        hal_packet_queue_init(&socket->packets, &socket->source, BLE_HAL_GATT_SERVER_NOTIFY_MAX_QUEUED);
+        socket->fd_tag = hal_packet_queue_attach_fd(&socket->packets, fds[0], G_IO_HUP | G_IO_ERR);
+    } else {
+        socket = (HalServerSocket*)g_source_new(&write_socket_funcs, sizeof(HalServerSocket));
+        g_source_set_name(&socket->source, "ble-hal-server-write");
+        socket->mtu = mtu;
+        socket->buffer = g_malloc(mtu);
+        socket->write_cb = app->write_cb;
+        socket->user_data = app->user_data;
+        socket->fd_tag = g_source_add_unix_fd(&socket->source, fds[0], G_IO_IN | G_IO_HUP | G_IO_ERR);
+    }
+    socket->fd = fds[0];
+    socket->char_id = chr->id;
+
+    g_mutex_lock(&gatt_server_lock);
+    HalServerSocket** slot = notify ? &chr->notify : &chr->write;
+    HalServerSocket* replaced = *slot;
+    *slot = socket; // The characteristic takes the initial reference
+    g_source_attach(&socket->source, hal_events_get_app_context());
+    g_mutex_unlock(&gatt_server_lock);
+    server_socket_release(replaced);
+
+    HAL_LOG_DEBUG("%s socket for characteristic %u (MTU %u).", notify ? "AcquireNotify" : "AcquireWrite",
+                  chr->id, mtu);
+    g_dbus_method_invocation_return_value_with_unix_fd_list(invocation, g_variant_new("(hq)", index, mtu), fd_list);
+    g_object_unref(fd_list);
+}
+
+// --- Exported Objects ---
+
+static GVariant* service_property(const HalServerService* service, const gchar* name) {
+    if (strcmp(name, "UUID") == 0) return g_variant_new_string(service->uuid);
+    if (strcmp(name, "Primary") == 0) return g_variant_new_boolean(service->primary);
+    return NULL;
+}
+
+static GVariant* char_property(const HalServerChar* chr, const gchar* name) {
+    static const struct { guint32 flag; const gchar* name; } flag_names[] = {
+        { BLE_HAL_GATT_CHR_READ, "read" },
+        { BLE_HAL_GATT_CHR_WRITE, "write" },
+        { BLE_HAL_GATT_CHR_WRITE_WITHOUT_RESPONSE, "write-without-response" },
+        { BLE_HAL_GATT_CHR_NOTIFY, "notify" },
+        { BLE_HAL_GATT_CHR_INDICATE, "indicate" },
+    };
+
+    if (strcmp(name, "UUID") == 0) return g_variant_new_string(chr->uuid);
+    if (strcmp(name, "Service") == 0) return g_variant_new_object_path(chr->service->object_path);
+    if (strcmp(name, "Flags") == 0) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+        for (guint i = 0; i < G_N_ELEMENTS(flag_names); i++) {
+            if (chr->flags & flag_names[i].flag) g_variant_builder_add(&builder, "s", flag_names[i].name);
+        }
+        return g_variant_builder_end(&builder);
+    }
+
+    // Their presence tells bluetoothd to use the Acquire methods.
+    gboolean acquired;
+    if (strcmp(name, "NotifyAcquired") == 0 && (chr->flags & (BLE_HAL_GATT_CHR_NOTIFY | BLE_HAL_GATT_CHR_INDICATE))) {
+        g_mutex_lock(&gatt_server_lock);
+        acquired = chr->notify != NULL;
+        g_mutex_unlock(&gatt_server_lock);
+        return g_variant_new_boolean(acquired);
+    }
+    if (strcmp(name, "WriteAcquired") == 0 && (chr->flags & BLE_HAL_GATT_CHR_WRITE_WITHOUT_RESPONSE)) {
+        g_mutex_lock(&gatt_server_lock);
+        acquired = chr->write != NULL;
+        g_mutex_unlock(&gatt_server_lock);
+        return g_variant_new_boolean(acquired);
+    }
+    return NULL;
+}
+
+/**
+ * @brief One object of GetManagedObjects: 'props' of 'interface', leaving
+ * out the ones that are absent.
+ */
+static void add_managed_object(GVariantBuilder* objects, const gchar* path, const gchar* interface,
+                               const gchar* const* props, const HalServerService* service, const HalServerChar* chr) {
+    GVariantBuilder values;
+
+    g_variant_builder_init(&values, G_VARIANT_TYPE_VARDICT);
+    for (const gchar* const* name = props; *name; name++) {
+        GVariant* value = service ? service_property(service, *name) : char_property(chr, *name);
+        if (value) g_variant_builder_add(&values, "{sv}", *name, value);
+    }
+    g_variant_builder_open(objects, G_VARIANT_TYPE("{oa{sa{sv}}}"));
+    g_variant_builder_add(objects, "o", path);
+    g_variant_builder_open(objects, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(objects, "{sa{sv}}", interface, &values);
+    g_variant_builder_close(objects);
+    g_variant_builder_close(objects);
+}
+
+static void on_root_method_call(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                                const gchar* interface_name, const gchar* method_name, GVariant* parameters,
+                                GDBusMethodInvocation* invocation, gpointer user_data) {
+    HalServerApp* app = (HalServerApp*)user_data;
+    GVariantBuilder objects;
+
+    // GetManagedObjects is the only method in the introspection data.
+    g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+    for (guint i = 0; i < app->n_services; i++) {
+        const HalServerService* service = &app->services[i];
+        add_managed_object(&objects, service->object_path, "org.bluez.GattService1", service_props, service, NULL);
+    }
+    for (guint i = 0; i < app->n_chars; i++) {
+        const HalServerChar* chr = &app->chars[i];
+        add_managed_object(&objects, chr->object_path, "org.bluez.GattCharacteristic1", char_props, NULL, chr);
+    }
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(a{oa{sa{sv}}})", &objects));
+}
+
+static GVariant* on_service_get_property(GDBusConnection* connection, const gchar* sender,
+                                         const gchar* object_path, const gchar* interface_name,
+                                         const gchar* property_name, GError** error, gpointer user_data) {
+    GVariant* value = service_property((const HalServerService*)user_data, property_name);
+    if (!value) g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No such property '%s'", property_name);
+    return value;
+}
+
+static GVariant* on_char_get_property(GDBusConnection* connection, const gchar* sender,
+                                      const gchar* object_path, const gchar* interface_name,
+                                      const gchar* property_name, GError** error, gpointer user_data) {
+    GVariant* value = char_property((const HalServerChar*)user_data, property_name);
+    if (!value) g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No such property '%s'", property_name);
+    return value;
+}
+
+static gboolean deliver_write(gpointer data) {
+    ServerWrite* write = (ServerWrite*)data;
+    write->cb(write->char_id, write->data, write->length, write->user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_char_method_call(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                                const gchar* interface_name, const gchar* method_name, GVariant* parameters,
+                                GDBusMethodInvocation* invocation, gpointer user_data) {
+    HalServerChar* chr = (HalServerChar*)user_data;
+    HalServerApp* app = chr->app; // Exported objects always belong to a live application
+
+    if (strcmp(method_name, "ReadValue") == 0) {
+        GVariant* options = NULL;
+        guint16 offset = 0;
+        g_variant_get(parameters, "(@a{sv})", &options);
+        g_variant_lookup(options, "offset", "q", &offset);
+        g_variant_unref(options);
+
+        g_mutex_lock(&gatt_server_lock);
+        GBytes* value = chr->value ? g_bytes_ref(chr->value) : NULL;
+        g_mutex_unlock(&gatt_server_lock);
+
+        gsize length = value ? g_bytes_get_size(value) : 0;
+        if (offset > length) {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidOffset",
+                                                       "Offset past the end of the value");
+        } else {
+            const guint8* data = value ? g_bytes_get_data(value, NULL) : NULL;
+            g_dbus_method_invocation_return_value(invocation,
+                g_variant_new("(@ay)", g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data ? data + offset : NULL,
+                                                                 length - offset, sizeof(guint8))));
+        }
+        if (value) g_bytes_unref(value);
+    } else if (strcmp(method_name, "WriteValue") == 0) {
+        GVariant* bytes = g_variant_get_child_value(parameters, 0);
+        gsize length = 0;
+        const guint8* data = g_variant_get_fixed_array(bytes, &length, sizeof(guint8));
+
+        if (app->write_cb) {
+            // Copied: the message is gone once the call is answered.
+            ServerWrite* write = g_malloc(sizeof(ServerWrite) + length);
+            write->cb = app->write_cb;
+            write->user_data = app->user_data;
+            write->char_id = chr->id;
+            write->length = length;
+            if (length > 0) memcpy(write->data, data, length);
+            g_main_context_invoke_full(hal_events_get_app_context(), G_PRIORITY_DEFAULT, deliver_write, write, g_free);
+        }
+        g_variant_unref(bytes);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else {
+        handle_acquire(app, chr, strcmp(method_name, "AcquireNotify") == 0, parameters, invocation);
+    }
+}
+
+static const GDBusInterfaceVTable root_vtable = { on_root_method_call, NULL, NULL };
+static const GDBusInterfaceVTable service_vtable = { NULL, on_service_get_property, NULL };
+static const GDBusInterfaceVTable char_vtable = { on_char_method_call, on_char_get_property, NULL };
+
+static guint export_object(GDBusConnection* conn, const gchar* path, const gchar* interface,
+                           const GDBusInterfaceVTable* vtable, gpointer record) {
+    GError* error = NULL;
+    guint id = g_dbus_connection_register_object(conn, path, g_dbus_node_info_lookup_interface(server_info, interface),
+                                                 vtable, record, NULL, &error);
+    if (!id) {
+        HAL_LOG_ERROR("Failed to export %s: %s", path, error ? error->message : "unknown error");
+        g_clear_error(&error);
+    }
+    return id;
+}
+
+static void unexport_object(GDBusConnection* conn, guint* registration_id) {
+    if (*registration_id && conn) g_dbus_connection_unregister_object(conn, *registration_id);
+    *registration_id = 0;
+}
+
+static void app_unexport(HalServerApp* app) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+
+    for (guint i = 0; i < app->n_chars; i++) {
+        unexport_object(conn, &app->chars[i].registration_id);
+    }
+    for (guint i = 0; i < app->n_services; i++) {
+        unexport_object(conn, &app->services[i].registration_id);
+    }
+    unexport_object(conn, &app->registration_id);
+}
+
+/**
+ * @brief Exports the application's objects if they are not yet. Calls into
+ * them are dispatched on the HAL context.
+ */
+static gboolean app_export(HalServerApp* app) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    gboolean exported = TRUE;
+
+    if (app->registration_id) return TRUE;
+    if (!conn || !server_info) return FALSE;
+
+    g_main_context_push_thread_default(hal_events_get_hal_context());
+    app->registration_id = export_object(conn, app->object_path, "org.freedesktop.DBus.ObjectManager",
+                                         &root_vtable, app);
+    exported = app->registration_id != 0;
+    for (guint i = 0; exported && i < app->n_services; i++) {
+        HalServerService* service = &app->services[i];
+        service->registration_id = export_object(conn, service->object_path, "org.bluez.GattService1",
+                                                 &service_vtable, service);
+        exported = service->registration_id != 0;
+    }
+    for (guint i = 0; exported && i < app->n_chars; i++) {
+        HalServerChar* chr = &app->chars[i];
+        chr->registration_id = export_object(conn, chr->object_path, "org.bluez.GattCharacteristic1",
+                                             &char_vtable, chr);
+        exported = chr->registration_id != 0;
+    }
+    g_main_context_pop_thread_default(hal_events_get_hal_context());
+
+    if (!exported) app_unexport(app);
+    return exported;
+}
+
+// --- Applications ---
+
+static void app_free(HalServerApp* app) {
+    for (guint i = 0; i < app->n_chars; i++) {
+        HalServerChar* chr = &app->chars[i];
+        server_socket_release(chr->notify);
+        server_socket_release(chr->write);
+        if (chr->value) g_bytes_unref(chr->value);
+        g_free(chr->uuid);
+        g_free(chr->object_path);
+    }
+    for (guint i = 0; i < app->n_services; i++) {
+        g_free(app->services[i].uuid);
+        g_free(app->services[i].object_path);
+    }
+    g_free(app->chars);
+    g_free(app->services);
+    g_free(app->adapter_path);
+    g_free(app->object_path);
+    g_free(app);
+}
+
+static HalServerApp* app_lookup(guint id) {
+    g_mutex_lock(&gatt_server_lock);
+    HalServerApp* app = server_apps ? g_hash_table_lookup(server_apps, GUINT_TO_POINTER(id)) : NULL;
+    g_mutex_unlock(&gatt_server_lock);
+    return app;
+}
+
+// Call with gatt_server_lock held.
+static void app_untable(HalServerApp* app) {
+    g_hash_table_steal(server_apps, GUINT_TO_POINTER(app->id));
+    for (guint i = 0; i < app->n_chars; i++) {
+        g_hash_table_remove(server_chars, GUINT_TO_POINTER(app->chars[i].id));
+    }
+}
+
+/**
+ * @brief Drops an application from the tables, closes its sockets,
+ * unexports and frees it. HAL context only.
+ */
+static void app_remove(HalServerApp* app) {
+    g_mutex_lock(&gatt_server_lock);
+    app_untable(app);
+    g_mutex_unlock(&gatt_server_lock);
+    app_unexport(app);
+    app_free(app);
+}
+
+/**
+ * @brief Deep copy of the definitions, with object paths and characteristic
+ * ids. Returns NULL if a definition is incomplete.
+ */
+static HalServerApp* app_new(const BleHalGattServiceDef* services, guint n_services) {
+    guint n_chars = 0;
+
+    for (guint i = 0; i < n_services; i++) {
+        if (!services[i].uuid || (services[i].n_characteristics > 0 && !services[i].characteristics)) return NULL;
+        for (guint j = 0; j < services[i].n_characteristics; j++) {
+            const BleHalGattCharacteristicDef* def = &services[i].characteristics[j];
+            if (!def->uuid || def->flags == 0) return NULL;
+        }
+        n_chars += services[i].n_characteristics;
+    }
+
+    HalServerApp* app = g_new0(HalServerApp, 1);
+    app->services = g_new0(HalServerService, n_services);
+    app->n_services = n_services;
+    app->chars = g_new0(HalServerChar, n_chars);
+    app->n_chars = n_chars;
+    for (guint i = 0, c = 0; i < n_services; i++) {
+        app->services[i].uuid = g_ascii_strdown(services[i].uuid, -1);
+        app->services[i].primary = services[i].primary;
+        for (guint j = 0; j < services[i].n_characteristics; j++, c++) {
+            HalServerChar* chr = &app->chars[c];
+            chr->app = app;
+            chr->service = &app->services[i];
+            chr->uuid = g_ascii_strdown(services[i].characteristics[j].uuid, -1);
+            chr->flags = services[i].characteristics[j].flags;
+        }
+    }
+    return app;
+}
+
+// --- Requests ---
+
+static BleHalStatus on_unregister_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                        BleHalStatus status) {
+    ServerRequest* call = (ServerRequest*)request;
+    if (call->command) {
+        // The application is gone either way; only a refused call is worth reporting.
+        hal_command_complete(call->command, status == BLE_HAL_ERROR_CANCELLED ? BLE_HAL_SUCCESS : status);
+    }
+    return status;
+}
+
+static void send_unregister(const gchar* adapter_path, const gchar* object_path, HalCommand* command) {
+    ServerRequest* call = hal_request_new(sizeof(ServerRequest), adapter_path, "org.bluez.GattManager1",
+                                          "UnregisterApplication", g_variant_new("(o)", object_path),
+                                          NULL, 0, NULL, NULL);
+    call->base.on_reply = on_unregister_reply;
+    call->command = command;
+    if (hal_request_submit(&call->base) != BLE_HAL_PENDING && command) {
+        hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+}
+
+static BleHalStatus on_register_reply(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                      BleHalStatus status) {
+    ServerRequest* call = (ServerRequest*)request;
+    HalServerApp* app = app_lookup(call->app_id);
+
+    if (!app) {
+        // Unregistered while registering: undo the registration it never saw.
+        if (status == BLE_HAL_SUCCESS) {
+            gchar* object_path = g_strdup_printf(SERVER_APP_PATH_FORMAT, call->app_id);
+            send_unregister(request->object_path, object_path, NULL);
+            g_free(object_path);
+        }
+        if (call->command) hal_command_complete(call->command, BLE_HAL_ERROR_CANCELLED);
+        return status;
+    }
+
+    if (status == BLE_HAL_SUCCESS) {
+        app->state = SERVER_STATE_REGISTERED;
+        HAL_LOG_INFO("GATT application %u registered on %s (%u service(s), %u characteristic(s)).",
+                     app->id, app->adapter_path, app->n_services, app->n_chars);
+    } else if (status == BLE_HAL_ERROR_CANCELLED || !call->command) {
+        app->state = SERVER_STATE_UNREGISTERED; // Registered again when BlueZ (re)appears
+        if (status != BLE_HAL_ERROR_CANCELLED) {
+            HAL_LOG_ERROR("Re-registering GATT application %u failed (%d).", app->id, status);
+        }
+    } else {
+        app_remove(app);
+    }
+    if (call->command) hal_command_complete(call->command, status);
+    return status;
+}
+
+static void send_register(HalServerApp* app, HalCommand* command) {
+    if (!app_export(app)) {
+        app_remove(app);
+        if (command) hal_command_complete(command, BLE_HAL_ERROR_DBUS);
+        return;
+    }
+
+    ServerRequest* call = hal_request_new(sizeof(ServerRequest), app->adapter_path, "org.bluez.GattManager1",
+                                          "RegisterApplication",
+                                          g_variant_new("(o@a{sv})", app->object_path,
+                                                        g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0)),
+                                          NULL, 0, NULL, NULL);
+    call->base.on_reply = on_register_reply;
+    call->app_id = app->id;
+    call->command = command;
+    app->state = SERVER_STATE_REGISTERING;
+    if (hal_request_submit(&call->base) != BLE_HAL_PENDING) {
+        app->state = SERVER_STATE_UNREGISTERED;
+        if (command) hal_command_complete(command, BLE_HAL_ERROR_NOT_INITIALIZED);
+    }
+}
+
+// --- Commands ---
+
+static void register_execute(HalCommand* command) {
+    HalServerApp* app = app_lookup(((ServerCommand*)command)->app_id);
+
+    if (!app) {
+        hal_command_complete(command, BLE_HAL_ERROR_CANCELLED); // Unregistered before it ran
+        return;
+    }
+    send_register(app, command); // Completed once bluetoothd has read the objects
+}
+
+static void unregister_execute(HalCommand* command) {
+    HalServerApp* app = app_lookup(((ServerCommand*)command)->app_id);
+
+    if (!app) {
+        hal_command_complete(command, BLE_HAL_SUCCESS); // Its registration failed meanwhile
+        return;
+    }
+
+    gboolean registered = app->state == SERVER_STATE_REGISTERED;
+    gchar* adapter_path = g_strdup(app->adapter_path);
+    gchar* object_path = g_strdup(app->object_path);
+    HAL_LOG_INFO("GATT application %u unregistered from %s.", app->id, adapter_path);
+    // A registration still in flight is undone when its reply finds the application gone.
+    app_remove(app);
+    if (registered) {
+        send_unregister(adapter_path, object_path, command);
+    } else {
+        hal_command_complete(command, BLE_HAL_SUCCESS);
+    }
+    g_free(adapter_path);
+    g_free(object_path);
+}
+
+// --- Internal API ---
+
+void hal_gatt_server_init(void) {
+    GError* error = NULL;
+
+    server_info = g_dbus_node_info_new_for_xml(server_xml, &error);
+    if (!server_info) {
+        HAL_LOG_ERROR("Bad GATT server introspection data: %s", error->message); // Only if the XML above breaks
+        g_clear_error(&error);
+    }
+    g_mutex_lock(&gatt_server_lock);
+    server_apps = g_hash_table_new(g_direct_hash, g_direct_equal);
+    server_chars = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_mutex_unlock(&gatt_server_lock);
+}
+
+void hal_gatt_server_shutdown(void) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    GHashTableIter iter;
+    gpointer value;
+    guint n_unregistered = 0;
+
+    g_mutex_lock(&gatt_server_lock);
+    GHashTable* apps = server_apps;
+    server_apps = NULL;
+    if (server_chars) g_hash_table_destroy(server_chars);
+    server_chars = NULL;
+    g_mutex_unlock(&gatt_server_lock);
+
+    if (apps) {
+        g_hash_table_iter_init(&iter, apps);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalServerApp* app = (HalServerApp*)value;
+            if (conn && app->state != SERVER_STATE_UNREGISTERED) {
+                // Nothing waits for the reply: the HAL thread is already stopped.
+                g_dbus_connection_call(conn, "org.bluez", app->adapter_path, "org.bluez.GattManager1",
+                                       "UnregisterApplication", g_variant_new("(o)", app->object_path),
+                                       NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+                n_unregistered++;
+            }
+            app_unexport(app);
+            app_free(app); // Closes the sockets; queued notifications complete with BLE_HAL_ERROR
+        }
+        g_hash_table_destroy(apps);
+    }
+
+    if (n_unregistered > 0) {
+        g_dbus_connection_flush_sync(conn, NULL, NULL); // Out before the connection is dropped
+        HAL_LOG_INFO("Unregistered %u GATT application(s).", n_unregistered);
+    }
+    if (server_info) {
+        g_dbus_node_info_unref(server_info);
+        server_info = NULL;
+    }
+}
+
+void hal_gatt_server_bluez_lost(void) {
+    GHashTableIter iter;
+    gpointer value;
+
+    g_mutex_lock(&gatt_server_lock);
+    if (server_apps) {
+        g_hash_table_iter_init(&iter, server_apps);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            ((HalServerApp*)value)->state = SERVER_STATE_UNREGISTERED; // Its sockets close on their own
+        }
+    }
+    g_mutex_unlock(&gatt_server_lock);
+}
+
+void hal_gatt_server_resume(void) {
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray* waiting = g_ptr_array_new();
+
+    g_mutex_lock(&gatt_server_lock);
+    if (server_apps) {
+        g_hash_table_iter_init(&iter, server_apps);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            HalServerApp* app = (HalServerApp*)value;
+            if (app->state == SERVER_STATE_UNREGISTERED && !app->stopping) g_ptr_array_add(waiting, app);
+        }
+    }
+    g_mutex_unlock(&gatt_server_lock);
+
+    for (guint i = 0; i < waiting->len; i++) {
+        HalServerApp* app = g_ptr_array_index(waiting, i);
+        HAL_LOG_INFO("Registering GATT application %u on %s again.", app->id, app->adapter_path);
+        send_register(app, NULL);
+    }
+    g_ptr_array_free(waiting, TRUE);
+}
+
+// --- Public API ---
+
+BleHalStatus ble_hal_gatt_server_register(const char* adapter_path, const BleHalGattServiceDef* services,
+                                          guint n_services, BleHalGattServerWriteCb write_cb, guint* app_id,
+                                          guint* char_ids, BleHalResultCb result_cb, void* user_data) {
+    BleHalAdapterInfo info;
+    HalServerApp* app = NULL;
+
+    if ((adapter_path && !g_variant_is_object_path(adapter_path)) || !services || n_services == 0 || !app_id ||
+        !(app = app_new(services, n_services))) {
+        HAL_LOG_ERROR("Invalid adapter path, service definitions or application pointer for gatt_server_register.");
+        if (result_cb) result_cb(BLE_HAL_ERROR_INVALID_PARAMS, user_data);
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    if (!adapter_path) {
+        BleHalStatus status = ble_hal_get_adapter_info(&info);
+        if (status != BLE_HAL_SUCCESS) {
+            app_free(app);
+            if (result_cb) result_cb(status, user_data);
+            return status;
+        }
+        adapter_path = info.path;
+    }
+    app->adapter_path = g_strdup(adapter_path);
+    app->state = SERVER_STATE_REGISTERING; // Owned by the register command; hal_gatt_server_resume() leaves it alone
+    app->write_cb = write_cb;
+    app->user_data = user_data;
+
+    g_mutex_lock(&gatt_server_lock);
+    if (!server_apps) {
+        g_mutex_unlock(&gatt_server_lock);
+        app_free(app);
+        if (result_cb) result_cb(BLE_HAL_ERROR_NOT_INITIALIZED, user_data);
+        return BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+    app->id = next_app_id++;
+    if (next_app_id == 0) next_app_id = 1;
+    app->object_path = g_strdup_printf(SERVER_APP_PATH_FORMAT, app->id);
+    for (guint i = 0; i < app->n_services; i++) {
+        app->services[i].object_path = g_strdup_printf("%s/service%u", app->object_path, i);
+    }
+    // A service's characteristics are contiguous; numbered from 0 within it, as in BlueZ's examples.
+    for (guint i = 0, n = 0; i < app->n_chars; i++, n++) {
+        HalServerChar* chr = &app->chars[i];
+        if (i > 0 && app->chars[i - 1].service != chr->service) n = 0;
+        chr->id = next_char_id++;
+        if (next_char_id == 0) next_char_id = 1;
+        chr->object_path = g_strdup_printf("%s/char%u", chr->service->object_path, n);
+        g_hash_table_insert(server_chars, GUINT_TO_POINTER(chr->id), chr);
+        if (char_ids) char_ids[i] = chr->id;
+    }
+    g_hash_table_insert(server_apps, GUINT_TO_POINTER(app->id), app);
+    *app_id = app->id;
+    g_mutex_unlock(&gatt_server_lock);
+
+    ServerCommand* command = hal_command_new(sizeof(ServerCommand), register_execute, NULL, result_cb, user_data);
+    command->app_id = *app_id;
+    BleHalStatus status = hal_command_submit(&command->base);
+    if (status != BLE_HAL_PENDING) {
+        g_mutex_lock(&gatt_server_lock);
+        if (server_apps) app_untable(app);
+        g_mutex_unlock(&gatt_server_lock);
+        app_free(app);
+        if (result_cb) result_cb(status, user_data);
+    }
+    return status;
+}
+
+BleHalStatus ble_hal_gatt_server_unregister(guint app_id, BleHalResultCb result_cb, void* user_data) {
+    g_mutex_lock(&gatt_server_lock);
+    HalServerApp* app = server_apps ? g_hash_table_lookup(server_apps, GUINT_TO_POINTER(app_id)) : NULL;
+    if (!app || app->stopping) {
+        BleHalStatus status = server_apps ? BLE_HAL_ERROR_NOT_FOUND : BLE_HAL_ERROR_NOT_INITIALIZED;
+        g_mutex_unlock(&gatt_server_lock);
+        if (result_cb) result_cb(status, user_data);
+        return status;
+    }
+    app->stopping = TRUE;
+    g_mutex_unlock(&gatt_server_lock);
+
+    ServerCommand* command = hal_command_new(sizeof(ServerCommand), unregister_execute, NULL, result_cb, user_data);
+    command->app_id = app_id;
+    BleHalStatus status = hal_command_submit(&command->base);
+    if (status != BLE_HAL_PENDING && result_cb) result_cb(status, user_data);
+    return status;
+}
+
+BleHalStatus ble_hal_gatt_server_set_value(guint char_id, const guint8* data, gsize length) {
+    if (length > 0 && !data) return BLE_HAL_ERROR_INVALID_PARAMS;
+
+    GBytes* value = g_bytes_new(data, length); // Copied outside the lock
+    BleHalStatus status = BLE_HAL_SUCCESS;
+    g_mutex_lock(&gatt_server_lock);
+    HalServerChar* chr = server_chars ? g_hash_table_lookup(server_chars, GUINT_TO_POINTER(char_id)) : NULL;
+    if (chr) {
+        GBytes* old = chr->value;
+        chr->value = value;
+        value = old;
+    } else {
+        status = server_chars ? BLE_HAL_ERROR_NOT_FOUND : BLE_HAL_ERROR_NOT_INITIALIZED;
+    }
+    g_mutex_unlock(&gatt_server_lock);
+    if (value) g_bytes_unref(value);
+    return status;
+}
+
+BleHalStatus ble_hal_gatt_server_notify(guint char_id, const BleHalBuffer* buffers, guint n_buffers,
+                                        BleHalResultCb done_cb, void* user_data) {
+    BleHalStatus status;
+
+    g_mutex_lock(&gatt_server_lock);
+    HalServerChar* chr = server_chars ? g_hash_table_lookup(server_chars, GUINT_TO_POINTER(char_id)) : NULL;
+    if (!server_chars) {
+        status = BLE_HAL_ERROR_NOT_INITIALIZED;
+    } else if (!chr || !chr->notify) {
+        status = BLE_HAL_ERROR_NOT_FOUND; // Unknown, or no central subscribed
+    } else {
+        // Under gatt_server_lock, so a concurrent close cannot finalize the socket meanwhile.
+        status = hal_packet_queue_push(&chr->notify->packets, buffers, n_buffers, done_cb, user_data);
+    }
+    g_mutex_unlock(&gatt_server_lock);
+    return status;
+}
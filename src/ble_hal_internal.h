@@ -0,0 +1,669 @@
+#ifndef BLE_HAL_INTERNAL_H_
+#define BLE_HAL_INTERNAL_H_
+
+#include <gio/gunixfdlist.h>
+#include "ble_hal.h"
+
+// Declarations shared between the HAL's translation units.
+// Nothing in here is part of the public API.
+
+// --- Logging ---
+
+extern volatile gint hal_log_level;     // BleHalLogLevel; see ble_hal_set_log_level()
+
+// Messages are given without the "HAL: " prefix and without a trailing newline.
+// Arguments are only evaluated if the level is enabled.
+#define HAL_LOG(level, ...)                                                                 \
+    do {                                                                                    \
+        if ((level) <= BLE_HAL_LOG_MAX_LEVEL &&                                             \
+            (gint)(level) <= __atomic_load_n(&hal_log_level, __ATOMIC_RELAXED)) {           \
+            hal_log_write((level), __VA_ARGS__);                                            \
+        }                                                                                   \
+    } while (0)
+
+#define HAL_LOG_ERROR(...)  HAL_LOG(BLE_HAL_LOG_ERROR, __VA_ARGS__)
+#define HAL_LOG_WARN(...)   HAL_LOG(BLE_HAL_LOG_WARN, __VA_ARGS__)
+#define HAL_LOG_INFO(...)   HAL_LOG(BLE_HAL_LOG_INFO, __VA_ARGS__)
+#define HAL_LOG_DEBUG(...)  HAL_LOG(BLE_HAL_LOG_DEBUG, __VA_ARGS__)
+
+// Safe from any thread; never blocks once hal_log_init() has started the log thread.
+void hal_log_write(BleHalLogLevel level, const gchar* format, ...) G_GNUC_PRINTF(2, 3);
+// Starts the log thread. 'level' BLE_HAL_LOG_DEFAULT keeps the current level.
+void hal_log_init(BleHalLogLevel level, BleHalLogSink sink, void* sink_user_data, guint capacity);
+// Writes out what is still queued and stops the log thread; later messages are written directly.
+void hal_log_shutdown(void);
+
+// --- Address Helpers ---
+
+// Packs a BleHalAddress into the low 48 bits of a guint64 (b[0] in bits 47..40).
+static inline guint64 hal_address_pack(const BleHalAddress* addr) {
+    return ((guint64)addr->b[0] << 40) | ((guint64)addr->b[1] << 32) |
+           ((guint64)addr->b[2] << 24) | ((guint64)addr->b[3] << 16) |
+           ((guint64)addr->b[4] << 8)  |  (guint64)addr->b[5];
+}
+
+static inline void hal_address_unpack(guint64 key, BleHalAddress* addr) {
+    for (int i = 5; i >= 0; i--) {
+        addr->b[i] = (guint8)(key & 0xff);
+        key >>= 8;
+    }
+}
+
+// --- Interface / Property Tables ---
+
+// Every D-Bus interface the HAL understands: X(id, name)
+#define HAL_INTERFACES(X) \
+    X(ADAPTER1, "org.bluez.Adapter1") \
+    X(DEVICE1,  "org.bluez.Device1")
+
+// Every property the HAL decodes: X(interface id, property id, name, GVariant type)
+#define HAL_PROPERTIES(X) \
+    X(ADAPTER1, ADDRESS,           "Address",          "s") \
+    X(ADAPTER1, NAME,              "Name",             "s") \
+    X(ADAPTER1, POWERED,           "Powered",          "b") \
+    X(ADAPTER1, DISCOVERING,       "Discovering",      "b") \
+    X(ADAPTER1, DISCOVERABLE,      "Discoverable",     "b") \
+    X(ADAPTER1, PAIRABLE,          "Pairable",         "b") \
+    X(DEVICE1,  ADDRESS,           "Address",          "s") \
+    X(DEVICE1,  ADDRESS_TYPE,      "AddressType",      "s") \
+    X(DEVICE1,  NAME,              "Name",             "s") \
+    X(DEVICE1,  ALIAS,             "Alias",            "s") \
+    X(DEVICE1,  RSSI,              "RSSI",             "n") \
+    X(DEVICE1,  TX_POWER,          "TxPower",          "n") \
+    X(DEVICE1,  PAIRED,            "Paired",           "b") \
+    X(DEVICE1,  CONNECTED,         "Connected",        "b") \
+    X(DEVICE1,  TRUSTED,           "Trusted",          "b") \
+    X(DEVICE1,  BLOCKED,           "Blocked",          "b") \
+    X(DEVICE1,  MANUFACTURER_DATA, "ManufacturerData", "a{qv}") \
+    X(DEVICE1,  SERVICE_DATA,      "ServiceData",      "a{sv}")
+
+typedef enum {
+#define HAL_X(id, name) HAL_IFACE_##id,
+    HAL_INTERFACES(HAL_X)
+#undef HAL_X
+    HAL_IFACE_COUNT,
+    HAL_IFACE_UNKNOWN = HAL_IFACE_COUNT
+} HalInterfaceId;
+
+typedef enum {
+#define HAL_X(iface, id, name, type) HAL_PROP_##iface##_##id,
+    HAL_PROPERTIES(HAL_X)
+#undef HAL_X
+    HAL_PROP_COUNT,
+    HAL_PROP_UNKNOWN = HAL_PROP_COUNT
+} HalPropId;
+
+HalInterfaceId hal_interface_lookup(const gchar* name);
+const gchar* hal_interface_name(HalInterfaceId iface);
+HalPropId hal_prop_lookup(HalInterfaceId iface, const gchar* name);
+const gchar* hal_prop_name(HalPropId prop);
+// TRUE if 'value' has the type the property's decoder expects.
+gboolean hal_prop_type_matches(HalPropId prop, GVariant* value);
+
+typedef void (*HalPropFunc)(HalPropId prop, GVariant* value, void* user_data);
+// Calls 'func' for every entry of the a{sv} that is a known property of 'iface'
+// with the expected type; everything else is skipped.
+void hal_props_foreach(HalInterfaceId iface, GVariant* properties, HalPropFunc func, void* user_data);
+
+// --- Device Table ---
+
+// Device flag bits (HalDevice.flags). The low bits match BleHalDeviceFlag.
+#define HAL_DEVICE_FLAG_PAIRED      (1u << 0)
+#define HAL_DEVICE_FLAG_CONNECTED   (1u << 1)
+#define HAL_DEVICE_FLAG_TRUSTED     (1u << 2)
+#define HAL_DEVICE_FLAG_BLOCKED     (1u << 3)
+#define HAL_DEVICE_FLAG_PUBLIC_MASK 0x0fu
+#define HAL_DEVICE_FLAG_HAS_RSSI    (1u << 4)
+#define HAL_DEVICE_FLAG_HAS_TX_POWER (1u << 5)
+#define HAL_DEVICE_FLAG_SCANNED     (1u << 6)   // Listed by the running object scan
+
+// Hot part of a device record: everything advertisement processing touches,
+// in 40 bytes. The object path is not stored; it follows from the address.
+typedef struct {
+    guint64 addr_key;       // Packed 48-bit address (primary key)
+    gint64 last_seen_us;    // g_get_monotonic_time() of the last advertisement (0 = none)
+    guint32 flags;          // HAL_DEVICE_FLAG_* bits
+    guint32 batch_slot;     // Index of this device's pending advertisement entry
+    guint32 batch_generation; // Batch generation 'batch_slot' belongs to (0 = none)
+    gint16 rssi;            // Last RSSI in dBm (valid if HAL_DEVICE_FLAG_HAS_RSSI)
+    gint16 tx_power;        // Advertised TX power (valid if HAL_DEVICE_FLAG_HAS_TX_POWER)
+    guint8 address_type;    // BleHalAddressType
+    guint32 added_s;        // Monotonic seconds at insert; ages records that never advertised
+} HalDevice;
+
+// Cold part, kept in a parallel array so it stays out of the hot records' cache lines.
+typedef struct {
+    gchar* name;            // Device name or alias (owned, may be NULL)
+} HalDeviceDetails;
+
+typedef struct _HalDeviceTable HalDeviceTable;
+
+#define BLE_HAL_DEVICE_TABLE_INITIAL_CAPACITY 1024u
+
+typedef void (*HalDeviceFunc)(HalDeviceTable* table, HalDevice* device, void* user_data);
+
+/*
+ * Open-addressing device table for the devices of one adapter. Records are
+ * stored densely and indexed by packed address with linear probing; object
+ * paths are parsed back into addresses. HalDevice pointers stay valid only
+ * until the next insert or remove.
+ */
+HalDeviceTable* hal_device_table_new(const gchar* adapter_path, guint initial_capacity);
+void hal_device_table_free(HalDeviceTable* table);
+void hal_device_table_clear(HalDeviceTable* table);
+guint hal_device_table_count(const HalDeviceTable* table);
+HalDevice* hal_device_table_lookup_address(HalDeviceTable* table, guint64 addr_key);
+HalDevice* hal_device_table_lookup_path(HalDeviceTable* table, const gchar* path);
+HalDevice* hal_device_table_insert(HalDeviceTable* table, guint64 addr_key, gboolean* created);
+gboolean hal_device_table_remove(HalDeviceTable* table, HalDevice* device);
+void hal_device_table_foreach(HalDeviceTable* table, HalDeviceFunc func, void* user_data);
+// Removes every record without 'keep_flag', calling 'func' on each one first,
+// and clears 'keep_flag' on the rest. Returns the number removed.
+guint hal_device_table_sweep(HalDeviceTable* table, guint32 keep_flag, HalDeviceFunc func, void* user_data);
+
+// Eviction. A record's activity is its last_seen_us, or its insert time if it
+// never advertised; records with any of 'protect_flags' are never removed.
+// Both call 'func' on each record before removing it and return the number removed.
+// Removes records last active before 'cutoff_us'.
+guint hal_device_table_expire(HalDeviceTable* table, gint64 cutoff_us, guint32 protect_flags,
+                              HalDeviceFunc func, void* user_data);
+// Removes the least recently active records until at most 'max_count' remain
+// and hal_device_table_used_bytes() is at most 'max_bytes' (0 = no limit).
+// The record keyed 'keep_key' (G_MAXUINT64 = none) is never removed either:
+// insert times have whole-second resolution, so a record just inserted can
+// tie with the oldest ones.
+guint hal_device_table_evict(HalDeviceTable* table, guint max_count, gsize max_bytes, guint32 protect_flags,
+                             guint64 keep_key, HalDeviceFunc func, void* user_data);
+// Bytes the records in use account for (record, details, index share and
+// name); unlike the capacities, this shrinks as records go.
+gsize hal_device_table_used_bytes(const HalDeviceTable* table);
+// Bytes currently allocated by the table.
+gsize hal_device_table_memory_size(const HalDeviceTable* table);
+
+// Parses "<adapter path>/dev_XX_XX_XX_XX_XX_XX" into the device's address key.
+gboolean hal_device_table_path_to_key(const HalDeviceTable* table, const gchar* path, guint64* addr_key);
+
+// Cold fields. The name is NULL until BlueZ reports one; take_name() frees the old one.
+const gchar* hal_device_table_get_name(const HalDeviceTable* table, const HalDevice* device);
+void hal_device_table_take_name(HalDeviceTable* table, HalDevice* device, gchar* name);
+
+// String forms, produced on request. Device paths of one table all have the same length.
+gsize hal_device_table_path_size(const HalDeviceTable* table);
+void hal_device_table_format_path(const HalDeviceTable* table, const HalDevice* device, gchar* out, gsize size);
+
+// Fills a public snapshot from a table record; the record form copies no strings.
+void hal_device_to_record(const HalDevice* device, BleHalDeviceRecord* record);
+void hal_device_to_info(const HalDeviceTable* table, const HalDevice* device, BleHalDeviceInfo* info);
+
+// --- Advertisement Batching ---
+
+typedef struct _HalAdvBatch HalAdvBatch;
+
+/*
+ * Coalesces advertisement property updates per device, keeping only the
+ * latest value of each field, and hands them to 'cb' as one array per flush.
+ * Flushes are driven by a timer on 'context', the context that owns 'devices'.
+ */
+HalAdvBatch* hal_adv_batch_new(HalDeviceTable* devices, GMainContext* context,
+                               guint interval_ms, guint max_entries,
+                               BleHalAdvBatchCb cb, void* user_data);
+void hal_adv_batch_free(HalAdvBatch* batch);
+// Records 'value' if 'prop' is an advertisement property; returns FALSE otherwise.
+// 'value' must already have the property's type (see hal_prop_type_matches()).
+gboolean hal_adv_batch_add(HalAdvBatch* batch, HalDevice* device, HalPropId prop, GVariant* value);
+// Flushes if the pending entry count reached the configured threshold.
+// Call after releasing the device table lock.
+void hal_adv_batch_flush_if_full(HalAdvBatch* batch);
+// Drops any pending update for 'device' (call before removing it from the table).
+void hal_adv_batch_forget(HalAdvBatch* batch, HalDevice* device);
+void hal_adv_batch_flush(HalAdvBatch* batch);
+// Drops every pending update without delivering it.
+void hal_adv_batch_reset(HalAdvBatch* batch);
+
+// --- Serialized GVariant Walking ---
+
+// In-place reads of GVariant's serialization format (g_variant_get_data()),
+// for containers whose elements hold a variant and are thus 8-byte aligned.
+// No child variants are created; views point into the caller's buffer.
+typedef struct {
+    const guint8* data;
+    gsize size;
+} HalGvsView;
+
+typedef struct {
+    HalGvsView view;
+    gsize offset_size;
+    gsize table_start;      // Start of the framing offset table (== end of the last element)
+    gsize n_elements;
+} HalGvsArray;
+
+// Opens an array whose elements are variable-size and 8-byte aligned.
+gboolean hal_gvs_array_open(HalGvsView view, HalGvsArray* out);
+gboolean hal_gvs_array_element(const HalGvsArray* array, gsize index, HalGvsView* out);
+// Splits a {s...} / {o...} dict entry into its nul-terminated key and its (last, 8-byte aligned) value.
+gboolean hal_gvs_dict_entry_split(HalGvsView entry, const gchar** key, HalGvsView* value);
+// Splits a serialized variant into its value and its type string, which runs
+// to the end of 'variant' without a terminating nul.
+gboolean hal_gvs_variant_split(HalGvsView variant, const gchar** type, HalGvsView* value);
+
+// --- Advertisement Pre-filter ---
+
+// Compiles the BleHalConfig filter lists; empty lists disable that half.
+void hal_adv_filter_init(const guint16* company_ids, guint n_company_ids, const char* const* service_uuids);
+void hal_adv_filter_shutdown(void);
+// FALSE if 'value' (ManufacturerData or ServiceData) has no entry the filter
+// asks for; TRUE for every other property. Lock-free; any adapter context.
+gboolean hal_adv_filter_accepts(HalPropId prop, GVariant* value);
+
+// --- GetManagedObjects Parsing ---
+
+typedef struct _HalManagedObjects HalManagedObjects;
+
+// Walks a (a{oa{sa{sv}}}) reply in place and records every (object, interface)
+// pair whose interface is in HAL_INTERFACES, in reply order. Returns NULL if
+// the reply is malformed.
+HalManagedObjects* hal_managed_objects_parse(GVariant* reply);
+void hal_managed_objects_free(HalManagedObjects* objects);
+guint hal_managed_objects_count(const HalManagedObjects* objects);
+// Object path of entry 'index'; valid until hal_managed_objects_free().
+const gchar* hal_managed_objects_path(const HalManagedObjects* objects, guint index);
+HalInterfaceId hal_managed_objects_interface_id(const HalManagedObjects* objects, guint index);
+// The entry's a{sv}, decoded on first access. Borrowed; owned by 'objects'.
+GVariant* hal_managed_objects_properties(HalManagedObjects* objects, guint index);
+
+// --- Block Pools ---
+
+// Blocks from the smallest class that fits 'size', or from the heap; either way
+// released with hal_pool_free(). Safe from any thread.
+gpointer hal_pool_alloc(gsize size);
+gpointer hal_pool_alloc0(gsize size);
+gpointer hal_pool_memdup(gconstpointer data, gsize size);
+gchar* hal_pool_strdup(const gchar* str);
+void hal_pool_free(gpointer block);
+// Byte budget of each class; 0 restores the default. Applies to slabs carved from now on.
+void hal_pool_set_max_bytes(gsize max_bytes);
+
+// --- Event Delivery ---
+
+// Sets up event delivery. 'threaded' selects the private HAL thread; the thread
+// itself only runs after hal_events_start().
+gboolean hal_events_init(GMainContext* application_context, gboolean threaded, guint queue_capacity);
+gboolean hal_events_start(void);
+// Stops the HAL thread (if any); events emitted from here on may be dropped.
+void hal_events_stop(void);
+// Stops the HAL thread (if any), drops undelivered events and releases the contexts.
+// Every other producer thread must have exited before this is called.
+void hal_events_shutdown(void);
+// Gives the calling thread its own event ring (event-thread mode only). Threads
+// that emit events call this when they start and detach before they exit.
+void hal_events_attach_producer(void);
+void hal_events_detach_producer(void);
+gboolean hal_events_is_threaded(void);
+// Context D-Bus callbacks and HAL timers run on.
+GMainContext* hal_events_get_hal_context(void);
+// Context application callbacks run on.
+GMainContext* hal_events_get_app_context(void);
+guint hal_events_get_dropped_count(void);
+
+// Timeout attached to the HAL context (g_timeout_add would use the global default).
+GSource* hal_timeout_source_add(guint interval_ms, GSourceFunc func, gpointer user_data);
+GSource* hal_timeout_source_attach(GMainContext* context, guint interval_ms, GSourceFunc func, gpointer user_data);
+void hal_source_clear(GSource** source);
+
+// Deliver an event to the application (inline, or queued to the app context
+// in event-thread mode). Payloads are copied as needed.
+// 'payload' (payload_size bytes, may be NULL) becomes BleHalEventData.data.
+void hal_events_emit_global(BleHalGlobalEventCb cb, void* user_data, BleHalEvent event_type,
+                            const void* payload, gsize payload_size);
+void hal_events_emit_result(BleHalResultCb cb, void* user_data, BleHalStatus status);
+void hal_events_emit_adv_batch(BleHalAdvBatchCb cb, void* user_data, const BleHalAdvUpdate* updates, guint n);
+
+// --- Command Queue ---
+
+typedef struct _HalCommand HalCommand;
+typedef void (*HalCommandFunc)(HalCommand* command);
+
+// Common header of every queued command; concrete commands embed it first.
+struct _HalCommand {
+    HalCommand* next;               // Queue link (owned by the queue)
+    HalCommandFunc execute;         // Runs on the queue's context; must end in hal_command_complete()
+    HalCommandFunc finalize;        // Frees command-specific fields, or NULL
+    BleHalResultCb cb;
+    void* user_data;
+    GMainContext* reply_context;    // Thread-default context of the submitter (NULL without cb); cb runs there
+    BleHalStatus status;
+};
+
+// Allocates a zeroed command of 'size' bytes (>= sizeof(HalCommand)).
+gpointer hal_command_new(gsize size, HalCommandFunc execute, HalCommandFunc finalize,
+                         BleHalResultCb cb, void* user_data);
+// Safe from any thread. Returns BLE_HAL_PENDING, or BLE_HAL_ERROR_NOT_INITIALIZED
+// (command freed, cb not called) if the HAL is not running.
+BleHalStatus hal_command_submit(HalCommand* command);
+// Finalizes 'command' and sends 'status' to its cb on the reply context.
+void hal_command_complete(HalCommand* command, BleHalStatus status);
+void hal_commands_init(GMainContext* hal_context);
+// Rejects new commands and fails the ones still queued.
+void hal_commands_shutdown(void);
+
+typedef struct _HalCommandQueue HalCommandQueue;
+
+// A queue drained on 'context'; hal_command_submit() uses the one on the HAL context.
+HalCommandQueue* hal_command_queue_new(GMainContext* context, const gchar* name);
+// Safe from any thread until hal_command_queue_free(); same results as hal_command_submit().
+BleHalStatus hal_command_queue_push(HalCommandQueue* queue, HalCommand* command);
+// Fails the commands that have not run yet with BLE_HAL_ERROR_NOT_INITIALIZED.
+void hal_command_queue_free(HalCommandQueue* queue);
+
+// --- Request Pipeline ---
+
+typedef struct _HalRequest HalRequest;
+typedef struct _HalRequestCall HalRequestCall;
+
+// Runs on the HAL context once the request is settled. 'reply' and 'fd_list'
+// are set only if 'status' is BLE_HAL_SUCCESS; returns the status for cb.
+typedef BleHalStatus (*HalRequestReplyFunc)(HalRequest* request, GVariant* reply, GUnixFDList* fd_list,
+                                            BleHalStatus status);
+
+// One D-Bus method call to org.bluez. Concrete requests may embed it first.
+struct _HalRequest {
+    HalCommand base;                // cb receives the final status
+    gchar* object_path;
+    const gchar* interface;         // Static strings
+    const gchar* method;
+    GVariant* parameters;           // Owned
+    const GVariantType* reply_type; // Static, or NULL
+    gchar* coalesce_key;            // Queued requests with equal keys merge; NULL never merges
+    gint64 deadline_us;             // Monotonic time after which the request fails with TIMEOUT
+    HalRequestReplyFunc on_reply;   // NULL: status passes through
+    HalCommandFunc cleanup;         // Frees fields of a concrete request, or NULL
+    const gchar* destination;       // Static bus name; NULL for org.bluez
+    gboolean unthrottled;           // Sent as soon as it is queued, regardless of max_in_flight
+    // Owned by the pipeline
+    HalRequest* joined;             // Identical requests that share this one's result
+    gpointer lane;                  // Adapter lane while queued or in flight
+    GList* link;                    // Position in the lane
+    HalRequestCall* call;           // While in flight
+    gint64 sent_us;                 // Monotonic time the call went out
+    const GError* error;            // During on_reply: why the call failed, or NULL
+};
+
+// Allocates a zeroed request of 'size' bytes (>= sizeof(HalRequest)). 'parameters'
+// is sunk; 0 for 'timeout_ms' selects the configured default.
+gpointer hal_request_new(gsize size, const gchar* object_path, const gchar* interface, const gchar* method,
+                         GVariant* parameters, const GVariantType* reply_type, guint timeout_ms,
+                         BleHalResultCb cb, void* user_data);
+// Properties.Set of 'interface'.'property' on 'object_path'; requests for the same property merge.
+HalRequest* hal_request_new_set_property(const gchar* object_path, const gchar* interface, const gchar* property,
+                                         GVariant* value, BleHalResultCb cb, void* user_data);
+// Same results as hal_command_submit().
+BleHalStatus hal_request_submit(HalRequest* request);
+void hal_requests_init(guint default_timeout_ms, guint max_in_flight);
+// Settles every queued and in-flight request with 'status'. HAL context only.
+void hal_requests_cancel_all(BleHalStatus status);
+// Cancels everything with BLE_HAL_ERROR_NOT_INITIALIZED; the HAL thread must be stopped.
+void hal_requests_shutdown(void);
+
+// --- Adapters ---
+
+// Adapter flag bits (HalAdapterState.flags)
+#define HAL_ADAPTER_FLAG_POWERED        (1u << 0)
+#define HAL_ADAPTER_FLAG_DISCOVERING    (1u << 1)
+#define HAL_ADAPTER_FLAG_DISCOVERABLE   (1u << 2)
+#define HAL_ADAPTER_FLAG_PAIRABLE       (1u << 3)
+#define HAL_ADAPTER_FLAG_HAS_ADDRESS    (1u << 4)
+
+typedef struct {
+    BleHalAddress address;          // Valid if HAL_ADAPTER_FLAG_HAS_ADDRESS
+    guint8 flags;                   // HAL_ADAPTER_FLAG_* bits
+    gchar* name;                    // Adapter name (owned, may be NULL)
+} HalAdapterState;
+
+/*
+ * One tracked org.bluez.Adapter1 and the devices below its object path.
+ * Everything per adapter runs on 'context': the HAL context by default, or
+ * the adapter's own worker thread when BleHalConfig.use_adapter_threads is
+ * set, so several controllers are processed in parallel.
+ */
+typedef struct {
+    gchar* path;                    // Adapter object path (owned)
+    gsize path_len;
+    HalAdapterState state;          // Cached Adapter1 state
+    HalDeviceTable* devices;        // Devices whose object path is below 'path'
+    HalAdvBatch* batch;             // Advertisement batching (NULL if disabled), set up by the owner
+    GSource* expiry_source;         // Age eviction timer on 'context' (NULL if disabled), set up by the owner
+    GRWLock lock;                   // Guards 'state' and 'devices'; writers run on 'context' only
+    GMainContext* context;          // Where the adapter's work runs
+    GMainLoop* loop;                // Worker loop (NULL without a worker thread)
+    GThread* thread;                // Worker thread (NULL without one)
+    HalCommandQueue* queue;         // Work for the worker thread (NULL without one)
+} HalAdapter;
+
+// With 'worker_thread' the adapter gets its own context; the thread itself
+// only runs after hal_adapter_start().
+HalAdapter* hal_adapter_new(const gchar* path, gboolean worker_thread);
+gboolean hal_adapter_start(HalAdapter* adapter);
+// Runs 'command' on the adapter's context: queued to the worker thread, or
+// executed right away without one. Call from the HAL context.
+void hal_adapter_post(HalAdapter* adapter, HalCommand* command);
+// Lets already posted work finish, stops the worker thread and frees the adapter.
+void hal_adapter_free(HalAdapter* adapter);
+// TRUE if 'object_path' is an object below the adapter (e.g. one of its devices).
+gboolean hal_adapter_owns_path(const HalAdapter* adapter, const gchar* object_path);
+// Formats the cached state as the public snapshot.
+void hal_adapter_to_info(const HalAdapter* adapter, BleHalAdapterInfo* info);
+// TRUE if both states hold the same values.
+gboolean hal_adapter_state_equal(const HalAdapterState* a, const HalAdapterState* b);
+void hal_adapter_state_clear(HalAdapterState* state);
+
+// --- Device Cache ---
+
+// Hands over one cached adapter's state (ownership of 'state' moves) and
+// returns the adapter whose device table the cache fills, or NULL to skip it.
+typedef HalAdapter* (*HalCacheAdapterFunc)(const gchar* path, HalAdapterState* state, void* user_data);
+
+// Writes the adapters and their devices to 'path', replacing it atomically.
+// Takes each adapter's reader lock; the caller keeps 'adapters' stable.
+gboolean hal_cache_save(const gchar* path, GPtrArray* adapters);
+// Maps 'path' and feeds its adapters to 'func'. FALSE if there is no usable
+// cache (missing, unreadable, or another format version).
+gboolean hal_cache_load(const gchar* path, HalCacheAdapterFunc func, void* user_data);
+
+// --- Core ---
+
+// System bus connection, NULL until attached. For use on the HAL context.
+GDBusConnection* hal_get_dbus_connection(void);
+// Paths (owned copies) of the tracked adapters whose device table holds
+// 'addr_key', in adapter order. For use on the HAL context.
+GPtrArray* hal_find_device_adapters(guint64 addr_key);
+// Sends a global event to BleHalConfig.global_event_cb. From the HAL or an adapter context.
+void hal_emit_global_event(BleHalEvent event_type, const void* payload, gsize payload_size);
+
+// --- Kernel Management Socket ---
+
+// One MGMT_EV_DEVICE_FOUND report, borrowed for the duration of the callback.
+typedef struct {
+    guint16 index;                  // Controller index (hciN)
+    BleHalAddress address;
+    BleHalAddressType address_type;
+    gint16 rssi;
+    const guint8* eir;              // Advertising data (AD structures)
+    guint16 eir_len;
+} HalMgmtReport;
+
+typedef struct _HalMgmtSource HalMgmtSource;
+
+typedef void (*HalMgmtReportFunc)(const HalMgmtReport* report, void* user_data);
+
+// Opens the mgmt control channel and calls 'func' on 'context' for every
+// advertising report. Returns NULL if the socket cannot be opened.
+HalMgmtSource* hal_mgmt_open(GMainContext* context, HalMgmtReportFunc func, void* user_data);
+void hal_mgmt_close(HalMgmtSource* mgmt);
+// Decodes a report into the Device1 properties D-Bus would have carried
+// (RSSI, TxPower, Name/Alias, ManufacturerData, ServiceData) and calls 'func' for each.
+void hal_mgmt_report_foreach(const HalMgmtReport* report, HalPropFunc func, void* user_data);
+
+// --- Packet Queues ---
+
+// Outgoing batches of a SOCK_SEQPACKET socket (GATT write streams, L2CAP
+// channels). Producers push from any thread; the socket's GSource sends the
+// batches and is the only consumer.
+typedef struct {
+    GMutex lock;                    // Guards the fields below
+    HalCommand* head;               // Oldest unfinished batch, linked through 'next'
+    HalCommand* tail;
+    gsize queued;                   // Bytes in unfinished batches
+    gsize limit;                    // 'queued' above which pushes get BLE_HAL_ERROR_BUSY
+    gboolean closed;                // Set by hal_packet_queue_clear()
+    GSource* source;                // Socket source (not referenced)
+    gpointer fd_tag;                // NULL until hal_packet_queue_attach_fd()
+    GIOCondition events;            // Events polled while no batch is waiting
+    gboolean polling_out;           // G_IO_OUT is added to 'events'
+} HalPacketQueue;
+
+typedef enum {
+    HAL_PACKET_QUEUE_DRAINED,       // Everything sent; POLLOUT is off until the next push
+    HAL_PACKET_QUEUE_BLOCKED,       // Socket full or budget used; resumes on POLLOUT
+    HAL_PACKET_QUEUE_FAILED,        // sendmsg() failed ('errno' is set)
+    HAL_PACKET_QUEUE_STOPPED        // The source was destroyed from a completion
+} HalPacketQueueResult;
+
+void hal_packet_queue_init(HalPacketQueue* queue, GSource* source, gsize limit);
+// Adds 'fd' to the source with 'events', plus G_IO_OUT while batches wait. Returns the tag.
+gpointer hal_packet_queue_attach_fd(HalPacketQueue* queue, int fd, GIOCondition events);
+// Safe from any thread. Returns BLE_HAL_PENDING (done_cb follows, on the calling
+// thread's context), or BLE_HAL_ERROR_BUSY / _INVALID_PARAMS / BLE_HAL_ERROR
+// (after a clear) without calling done_cb.
+BleHalStatus hal_packet_queue_push(HalPacketQueue* queue, const BleHalBuffer* buffers, guint n_buffers,
+                                   BleHalResultCb done_cb, void* user_data);
+// Sends packets of at most 'mtu' bytes to 'fd'. Call from the source's dispatch only.
+HalPacketQueueResult hal_packet_queue_flush(HalPacketQueue* queue, int fd, gsize mtu);
+// Fails the unfinished batches with 'status' and rejects later pushes. From the dispatch or finalize only.
+void hal_packet_queue_clear(HalPacketQueue* queue, BleHalStatus status);
+// Clears with BLE_HAL_ERROR and releases the queue; for the source's finalize.
+void hal_packet_queue_finalize(HalPacketQueue* queue);
+
+// --- GATT Client ---
+
+void hal_gatt_init(void);
+// Ends every subscription without calling back into the application.
+void hal_gatt_shutdown(void);
+
+// --- GATT Server ---
+
+void hal_gatt_server_init(void);
+// Closes the sockets, unexports every application and unregisters it without
+// waiting for BlueZ. The HAL thread must be stopped; call while the bus
+// connection is still up.
+void hal_gatt_server_shutdown(void);
+// BlueZ left the bus: its registrations ended with it. HAL context only.
+void hal_gatt_server_bluez_lost(void);
+// BlueZ (re)appeared: registers the applications that are not stopping again. HAL context only.
+void hal_gatt_server_resume(void);
+
+// --- Discovery Sessions ---
+
+void hal_discovery_init(void);
+// Forgets every session; their pending calls still complete.
+void hal_discovery_shutdown(void);
+// BlueZ left the bus: discovery stopped with it. HAL context only.
+void hal_discovery_bluez_lost(void);
+// BlueZ (re)appeared: restarts discovery on adapters with open sessions. HAL context only.
+void hal_discovery_resume(void);
+
+// --- Operation Chains ---
+
+// An adapter's Powered or Discovering state changed, or an adapter went away.
+// Safe from any thread; a no-op while no chain runs.
+void hal_chain_adapters_changed(void);
+// Fails the running chains with BLE_HAL_ERROR_NOT_INITIALIZED. The HAL thread must be stopped.
+void hal_chain_shutdown(void);
+
+// --- LE Advertising ---
+
+void hal_advertising_init(void);
+// Unexports every instance and unregisters it without waiting for BlueZ.
+// The HAL thread must be stopped; call while the bus connection is still up.
+void hal_advertising_shutdown(void);
+// BlueZ left the bus: its registrations ended with it. HAL context only.
+void hal_advertising_bluez_lost(void);
+// BlueZ (re)appeared: registers the instances that are not stopping again. HAL context only.
+void hal_advertising_resume(void);
+
+// --- External Loop ---
+
+// Creates the private context, epoll fd and timerfd (BleHalConfig.use_external_loop).
+// Returns the context (owned by this module), or NULL on failure.
+GMainContext* hal_loop_init(void);
+// Releases them; safe if hal_loop_init() never ran.
+void hal_loop_shutdown(void);
+// The private context, or NULL when not in external-loop mode. Safe from any thread.
+GMainContext* hal_loop_get_context(void);
+// New reference to the context completions for the calling thread go to: its
+// thread-default context, else the private one in external-loop mode, else
+// the global default.
+GMainContext* hal_reply_context_ref(void);
+
+// --- Connection Scheduler ---
+
+// 0 for any value selects its BLE_HAL_CONNECT_DEFAULT_*.
+void hal_connect_init(guint max_connections, guint max_pending, guint retry_limit, guint retry_base_ms);
+// Fails every scheduled connection with BLE_HAL_ERROR_NOT_INITIALIZED. The HAL thread must be stopped.
+void hal_connect_shutdown(void);
+// The device at 'device_path' reported Connected=false. Any adapter context.
+void hal_connect_link_lost(const gchar* device_path);
+
+// --- Runtime Statistics ---
+
+typedef enum {
+    HAL_STATS_GAUGE_COMMANDS,           // Commands queued on any command queue
+    HAL_STATS_GAUGE_EVENTS,             // Events not yet delivered to the application
+    HAL_STATS_GAUGE_REQUESTS_WAITING,   // Requests waiting for a lane slot
+    HAL_STATS_GAUGE_REQUESTS_IN_FLIGHT, // Requests sent and not yet answered
+    HAL_STATS_N_GAUGES
+} HalStatsGauge;
+
+typedef enum {
+    HAL_STATS_COUNTER_EVICTED_COUNT,    // Devices evicted for the per-adapter device limit
+    HAL_STATS_COUNTER_EVICTED_MEMORY,   // Devices evicted for the memory budget
+    HAL_STATS_COUNTER_EXPIRED,          // Devices evicted for their age
+    HAL_STATS_N_COUNTERS
+} HalStatsCounter;
+
+// All safe from any thread and lock-free.
+BleHalStatsMethod hal_stats_method_lookup(const gchar* interface, const gchar* method);
+void hal_stats_record_method(BleHalStatsMethod method, gint64 elapsed_us, gboolean failed);
+// Records a signal handler that started at 'started_us' (g_get_monotonic_time()) and ends now.
+void hal_stats_record_signal(BleHalStatsSignal signal, gint64 started_us);
+void hal_stats_gauge_add(HalStatsGauge gauge, gint delta);
+void hal_stats_counter_add(HalStatsCounter counter, guint64 value);
+// Zeroes the gauges; called at init, before any queue exists.
+void hal_stats_reset_gauges(void);
+// Fills everything but the adapter and device table figures.
+void hal_stats_snapshot(BleHalStats* out);
+
+// --- Signal Subscriptions ---
+
+// One D-Bus signal match. Rules are static descriptions; the manager binds
+// them to the current org.bluez unique name when installing.
+typedef struct {
+    const gchar* interface;         // Signal interface
+    const gchar* member;            // Signal name
+    const gchar* path;              // Exact object path, or NULL
+    const gchar* path_namespace;    // Bus-side path_namespace filter, or NULL
+    const gchar* arg0;              // arg0 filter, or NULL
+    GDBusSignalFlags arg0_flags;    // 0, G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE or _MATCH_ARG0_PATH
+    GDBusSignalCallback callback;
+} HalSignalRule;
+
+typedef struct _HalSubscriptionManager HalSubscriptionManager;
+
+HalSubscriptionManager* hal_subscriptions_new(GDBusConnection* conn);
+void hal_subscriptions_free(HalSubscriptionManager* mgr);
+// Binds all rules to 'sender' (the unique name owning org.bluez). NULL uninstalls them.
+void hal_subscriptions_set_sender(HalSubscriptionManager* mgr, const gchar* sender);
+// Makes the wanted rule set exactly 'rules', adding and removing bus match rules as needed.
+void hal_subscriptions_sync(HalSubscriptionManager* mgr, const HalSignalRule* const* rules, guint n_rules, gpointer user_data);
+guint hal_subscriptions_count_installed(const HalSubscriptionManager* mgr);
+
+#endif // BLE_HAL_INTERNAL_H_
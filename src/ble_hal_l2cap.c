@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "ble_hal_internal.h"
+
+/*
+ * LE L2CAP connection-oriented channels.
+ *
+ * A channel is a non-blocking AF_BLUETOOTH/SOCK_SEQPACKET socket wrapped in a
+ * GSource on the application's context, the same model as the GATT sockets:
+ * while connecting it polls for POLLOUT, then reads every SDU into a buffer
+ * of the receive MTU and sends queued batches through a HalPacketQueue.
+ * Address and adapter come from the HAL's tables; D-Bus is not involved.
+ */
+
+// From the kernel's <bluetooth/bluetooth.h> and <bluetooth/l2cap.h>;
+// libbluetooth is not a dependency.
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH            31
+#endif
+#define HAL_BTPROTO_L2CAP       0
+#define HAL_SOL_BLUETOOTH       274
+#define HAL_BT_SNDMTU           12
+#define HAL_BT_RCVMTU           13
+#define HAL_BDADDR_LE_PUBLIC    0x01
+#define HAL_BDADDR_LE_RANDOM    0x02
+
+typedef struct {
+    guint8 b[6];                    // Least significant byte first
+} __attribute__((packed)) HalBdaddr;
+
+typedef struct {
+    sa_family_t l2_family;
+    guint16 l2_psm;                 // Little endian
+    HalBdaddr l2_bdaddr;
+    guint16 l2_cid;
+    guint8 l2_bdaddr_type;
+} HalSockaddrL2;
+
+// Used when the kernel does not report an MTU (23 is the LE CoC minimum).
+#define HAL_L2CAP_DEFAULT_MTU               23
+// SDUs read per dispatch before other sources get a turn.
+#define HAL_L2CAP_MAX_READS_PER_DISPATCH    32
+
+struct BleHalL2capChannel {
+    GSource source;
+    gpointer fd_tag;
+    int fd;
+    gboolean connected;             // Dispatch only
+    volatile gint send_mtu;         // 0 until connected
+    gsize recv_mtu;
+    guint8* buffer;                 // Reused for every SDU, 'recv_mtu' bytes
+    HalCommand* connect;            // connect_cb completion, until reported
+    HalPacketQueue packets;
+    gchar* device_path;
+    BleHalL2capDataCb data_cb;
+    void* user_data;
+};
+
+// --- Helpers ---
+
+static void bdaddr_from_address(const BleHalAddress* address, HalBdaddr* out) {
+    for (int i = 0; i < 6; i++) {
+        out->b[i] = address->b[5 - i]; // BleHalAddress is in display order
+    }
+}
+
+static gsize channel_query_mtu(int fd, int option) {
+    guint16 mtu = 0;
+    socklen_t len = sizeof(mtu);
+    if (getsockopt(fd, HAL_SOL_BLUETOOTH, option, &mtu, &len) < 0 || mtu == 0) {
+        return HAL_L2CAP_DEFAULT_MTU;
+    }
+    return mtu;
+}
+
+static void channel_report_connect(BleHalL2capChannel* channel, BleHalStatus status) {
+    HalCommand* connect = channel->connect;
+    channel->connect = NULL;
+    if (connect) hal_command_complete(connect, status);
+}
+
+/**
+ * @brief Opens the socket, binds it to the device's adapter and starts a
+ * non-blocking connect. Returns the fd or -1.
+ */
+static int channel_open_socket(const BleHalDeviceInfo* device, const BleHalAdapterInfo* adapter, guint16 psm) {
+    BleHalAddress adapter_address;
+    HalSockaddrL2 addr;
+
+    if (!ble_hal_address_from_string(adapter->address, &adapter_address)) {
+        HAL_LOG_ERROR("Adapter %s has no usable address.", adapter->path);
+        return -1;
+    }
+
+    int fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, HAL_BTPROTO_L2CAP);
+    if (fd < 0) {
+        HAL_LOG_ERROR("Failed to create L2CAP socket: %s", g_strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.l2_family = AF_BLUETOOTH;
+    addr.l2_bdaddr_type = HAL_BDADDR_LE_PUBLIC;
+    bdaddr_from_address(&adapter_address, &addr.l2_bdaddr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        HAL_LOG_ERROR("Failed to bind L2CAP socket to %s: %s", adapter->address, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.l2_family = AF_BLUETOOTH;
+    addr.l2_psm = GUINT16_TO_LE(psm);
+    addr.l2_bdaddr_type = device->address_type == BLE_HAL_ADDRESS_TYPE_RANDOM ? HAL_BDADDR_LE_RANDOM
+                                                                               : HAL_BDADDR_LE_PUBLIC;
+    bdaddr_from_address(&device->address, &addr.l2_bdaddr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        HAL_LOG_ERROR("L2CAP connect to %s failed: %s", device->path, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// --- Channel Source ---
+
+static gboolean channel_finish_connect(BleHalL2capChannel* channel, GIOCondition revents) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(channel->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    } else if (err == 0 && (revents & (G_IO_HUP | G_IO_ERR))) {
+        err = ECONNRESET;
+    }
+    if (err != 0) {
+        HAL_LOG_ERROR("L2CAP connect to %s failed: %s", channel->device_path, g_strerror(err));
+        hal_packet_queue_clear(&channel->packets, BLE_HAL_ERROR);
+        channel_report_connect(channel, BLE_HAL_ERROR);
+        return FALSE;
+    }
+
+    channel->connected = TRUE;
+    channel->recv_mtu = channel_query_mtu(channel->fd, HAL_BT_RCVMTU);
+    channel->buffer = g_malloc(channel->recv_mtu);
+    g_atomic_int_set(&channel->send_mtu, (gint)channel_query_mtu(channel->fd, HAL_BT_SNDMTU));
+
+    // Swap the connect poll for the data poll; queued batches add POLLOUT back.
+    g_source_remove_unix_fd(&channel->source, channel->fd_tag);
+    channel->fd_tag = hal_packet_queue_attach_fd(&channel->packets, channel->fd, G_IO_IN | G_IO_HUP | G_IO_ERR);
+
+    HAL_LOG_INFO("L2CAP channel to %s connected (MTU %d/%u).", channel->device_path,
+                 g_atomic_int_get(&channel->send_mtu), (guint)channel->recv_mtu);
+    channel_report_connect(channel, BLE_HAL_SUCCESS);
+    return TRUE;
+}
+
+static gboolean channel_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    BleHalL2capChannel* channel = (BleHalL2capChannel*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, channel->fd_tag);
+
+    if (!channel->connected) {
+        if (!channel_finish_connect(channel, revents)) return G_SOURCE_REMOVE;
+        return g_source_is_destroyed(source) ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+    }
+
+    if (revents & G_IO_IN) {
+        for (guint i = 0; i < HAL_L2CAP_MAX_READS_PER_DISPATCH; i++) {
+            ssize_t n = read(channel->fd, channel->buffer, channel->recv_mtu);
+            if (n > 0) {
+                channel->data_cb(channel, channel->buffer, (gsize)n, channel->user_data);
+                if (g_source_is_destroyed(source)) return G_SOURCE_REMOVE; // Closed from the callback
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            revents |= G_IO_HUP; // 0 (peer closed) or a real error
+            break;
+        }
+    }
+
+    if (!(revents & (G_IO_HUP | G_IO_ERR)) && (revents & G_IO_OUT)) {
+        switch (hal_packet_queue_flush(&channel->packets, channel->fd, (gsize)g_atomic_int_get(&channel->send_mtu))) {
+        case HAL_PACKET_QUEUE_DRAINED:
+        case HAL_PACKET_QUEUE_BLOCKED:
+            break;
+        case HAL_PACKET_QUEUE_STOPPED:
+            return G_SOURCE_REMOVE; // Closed from done_cb
+        case HAL_PACKET_QUEUE_FAILED:
+            HAL_LOG_ERROR("L2CAP write to %s failed: %s", channel->device_path, g_strerror(errno));
+            revents |= G_IO_ERR;
+            break;
+        }
+    }
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_INFO("L2CAP channel to %s closed.", channel->device_path);
+        hal_packet_queue_clear(&channel->packets, BLE_HAL_ERROR);
+        channel->data_cb(channel, NULL, 0, channel->user_data);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void channel_finalize(GSource* source) {
+    BleHalL2capChannel* channel = (BleHalL2capChannel*)source;
+    channel_report_connect(channel, BLE_HAL_ERROR);
+    hal_packet_queue_finalize(&channel->packets);
+    if (channel->fd >= 0) close(channel->fd);
+    g_free(channel->buffer);
+    g_free(channel->device_path);
+}
+
+static GSourceFuncs channel_source_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    channel_dispatch,
+    channel_finalize,
+    NULL,
+    NULL
+};
+
+// --- Public API ---
+
+BleHalStatus ble_hal_l2cap_connect(const char* device_path, guint16 psm, BleHalL2capDataCb data_cb,
+                                   BleHalResultCb connect_cb, void* user_data, BleHalL2capChannel** channel) {
+    BleHalDeviceInfo device;
+    BleHalAdapterInfo adapter;
+
+    if (!device_path || !data_cb || !channel || psm == 0) {
+        HAL_LOG_ERROR("Invalid parameters for l2cap_connect.");
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    *channel = NULL;
+
+    BleHalStatus status = ble_hal_get_device_by_path(device_path, &device);
+    if (status != BLE_HAL_SUCCESS) return status;
+
+    gchar* adapter_path = g_path_get_dirname(device_path);
+    status = ble_hal_get_adapter_info_by_path(adapter_path, &adapter);
+    g_free(adapter_path);
+    if (status != BLE_HAL_SUCCESS) return status;
+
+    int fd = channel_open_socket(&device, &adapter, psm);
+    if (fd < 0) return BLE_HAL_ERROR;
+
+    BleHalL2capChannel* created = (BleHalL2capChannel*)g_source_new(&channel_source_funcs,
+                                                                     sizeof(BleHalL2capChannel));
+    g_source_set_name(&created->source, "ble-hal-l2cap");
+    created->fd = fd;
+    created->device_path = g_strdup(device_path);
+    created->data_cb = data_cb;
+    created->user_data = user_data;
+    created->connect = hal_command_new(sizeof(HalCommand), NULL, NULL, connect_cb, user_data);
+    hal_packet_queue_init(&created->packets, &created->source, BLE_HAL_L2CAP_MAX_QUEUED);
+    created->fd_tag = g_source_add_unix_fd(&created->source, fd, G_IO_OUT | G_IO_HUP | G_IO_ERR);
+    g_source_attach(&created->source, hal_events_get_app_context());
+
+    HAL_LOG_INFO("Connecting L2CAP channel to %s (PSM 0x%04x).", device_path, psm);
+    *channel = created;
+    return BLE_HAL_PENDING;
+}
+
+BleHalStatus ble_hal_l2cap_write(BleHalL2capChannel* channel, const BleHalBuffer* buffers, guint n_buffers,
+                                 BleHalResultCb done_cb, void* user_data) {
+    if (!channel) return BLE_HAL_ERROR_INVALID_PARAMS;
+    return hal_packet_queue_push(&channel->packets, buffers, n_buffers, done_cb, user_data);
+}
+
+guint16 ble_hal_l2cap_get_mtu(BleHalL2capChannel* channel) {
+    return channel ? (guint16)g_atomic_int_get(&channel->send_mtu) : 0;
+}
+
+void ble_hal_l2cap_close(BleHalL2capChannel* channel) {
+    if (!channel) return;
+    g_source_destroy(&channel->source);
+    g_source_unref(&channel->source); // Finalized once no dispatch holds it
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Logging.
+ *
+ * HAL_LOG_*() check the level before evaluating their arguments, so a
+ * disabled message costs one relaxed load (and nothing at all above
+ * BLE_HAL_LOG_MAX_LEVEL). Enabled messages are formatted straight into a
+ * slot of a bounded multi-producer ring: a producer claims a slot with one
+ * compare-and-swap on the write position and publishes it through the slot's
+ * sequence number. The log thread drains the ring into the sink and is woken
+ * through an eventfd, so a producer never takes a lock or waits for output.
+ * When the ring is full the message is counted and dropped.
+ *
+ * While the log thread is not running (before init, after deinit) messages
+ * are written out directly on the calling thread.
+ */
+
+#define HAL_LOG_MESSAGE_MAX     232
+
+typedef struct {
+    volatile guint sequence;        // == position: free; == position + 1: holds a message
+    BleHalLogLevel level;
+    gint64 timestamp_us;
+    gchar text[HAL_LOG_MESSAGE_MAX];
+} HalLogSlot;
+
+volatile gint hal_log_level = BLE_HAL_LOG_INFO;
+
+static HalLogSlot* slots = NULL;
+static guint slot_mask = 0;
+static volatile guint write_pos = 0;            // Next position producers claim
+static guint read_pos = 0;                      // Next position the log thread reads
+static volatile gint running = 0;               // Set while producers may use the ring
+static volatile gint writers = 0;               // Producers currently inside hal_log_write()
+static volatile gint dropped = 0;               // Messages lost to a full ring since the last report
+static volatile gint wakeup_pending = 0;
+static volatile gint stopping = 0;
+static int wakeup_fd = -1;
+static GThread* log_thread = NULL;
+static BleHalLogSink sink = NULL;
+static void* sink_user_data = NULL;
+
+static void default_sink(BleHalLogLevel level, gint64 timestamp_us, const char* message, void* user_data) {
+    switch (level) {
+        case BLE_HAL_LOG_ERROR:
+            fprintf(stderr, "HAL Error: %s\n", message);
+            break;
+        case BLE_HAL_LOG_WARN:
+            fprintf(stderr, "HAL Warning: %s\n", message);
+            break;
+        default:
+            printf("HAL: %s\n", message);
+            break;
+    }
+}
+
+static void write_out(BleHalLogLevel level, gint64 timestamp_us, const gchar* message) {
+    if (sink) {
+        sink(level, timestamp_us, message, sink_user_data);
+    } else {
+        default_sink(level, timestamp_us, message, NULL);
+    }
+}
+
+// --- Ring (producer side) ---
+
+static void wake_log_thread(void) {
+    if (g_atomic_int_compare_and_exchange(&wakeup_pending, 0, 1)) {
+        guint64 one = 1;
+        ssize_t rc;
+        do {
+            rc = write(wakeup_fd, &one, sizeof(one));
+        } while (rc < 0 && errno == EINTR);
+    }
+}
+
+/**
+ * @brief Claims the next free slot, or returns NULL if the ring is full.
+ * On success '*pos' is the claimed position.
+ */
+static HalLogSlot* ring_claim(guint* pos) {
+    guint claim = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        HalLogSlot* slot = &slots[claim & slot_mask];
+        gint diff = (gint)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - claim);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&write_pos, &claim, claim + 1, TRUE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = claim;
+                return slot;
+            }
+            // 'claim' was reloaded by the failed exchange
+        } else if (diff < 0) {
+            return NULL; // The reader has not freed this slot yet
+        } else {
+            claim = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void hal_log_write(BleHalLogLevel level, const gchar* format, ...) {
+    gint64 now = g_get_monotonic_time();
+    va_list args;
+
+    g_atomic_int_inc(&writers);
+    if (!g_atomic_int_get(&running)) {
+        g_atomic_int_add(&writers, -1);
+        gchar text[HAL_LOG_MESSAGE_MAX];
+        va_start(args, format);
+        g_vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        write_out(level, now, text);
+        return;
+    }
+
+    guint pos;
+    HalLogSlot* slot = ring_claim(&pos);
+    if (slot) {
+        slot->level = level;
+        slot->timestamp_us = now;
+        va_start(args, format);
+        g_vsnprintf(slot->text, sizeof(slot->text), format, args);
+        va_end(args);
+        __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE); // Publishes the message
+        wake_log_thread();
+    } else {
+        g_atomic_int_inc(&dropped);
+    }
+    g_atomic_int_add(&writers, -1);
+}
+
+// --- Ring (log thread) ---
+
+static void ring_drain(void) {
+    for (;;) {
+        HalLogSlot* slot = &slots[read_pos & slot_mask];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != read_pos + 1) break;
+
+        write_out(slot->level, slot->timestamp_us, slot->text);
+        __atomic_store_n(&slot->sequence, read_pos + slot_mask + 1, __ATOMIC_RELEASE); // Free for the next lap
+        read_pos++;
+    }
+
+    gint lost = g_atomic_int_and(&dropped, 0);
+    if (lost > 0) {
+        gchar text[64];
+        g_snprintf(text, sizeof(text), "%d log message(s) dropped (log ring full).", lost);
+        write_out(BLE_HAL_LOG_WARN, g_get_monotonic_time(), text);
+    }
+}
+
+static gpointer log_thread_main(gpointer data) {
+    struct pollfd pfd = { .fd = wakeup_fd, .events = POLLIN };
+
+    while (!g_atomic_int_get(&stopping)) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
+
+        guint64 count;
+        ssize_t rc = read(wakeup_fd, &count, sizeof(count));
+        (void)rc;
+        g_atomic_int_set(&wakeup_pending, 0); // Before draining, so no publish goes unnoticed
+        ring_drain();
+    }
+    return NULL;
+}
+
+// --- Lifecycle ---
+
+void hal_log_init(BleHalLogLevel level, BleHalLogSink log_sink, void* user_data, guint capacity) {
+    GError* error = NULL;
+
+    if (level != BLE_HAL_LOG_DEFAULT) ble_hal_set_log_level(level);
+    sink = log_sink;
+    sink_user_data = user_data;
+
+    wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd < 0) {
+        HAL_LOG_ERROR("eventfd() failed for the log thread: %s; logging synchronously.", g_strerror(errno));
+        return;
+    }
+
+    guint size = 16;
+    if (capacity == 0) capacity = BLE_HAL_LOG_DEFAULT_RING_CAPACITY;
+    while (size < capacity) size <<= 1;
+    slot_mask = size - 1;
+    slots = g_new0(HalLogSlot, size);
+    for (guint i = 0; i < size; i++) {
+        slots[i].sequence = i;
+    }
+    write_pos = 0;
+    read_pos = 0;
+    wakeup_pending = 0;
+    stopping = 0;
+    g_atomic_int_set(&dropped, 0);
+
+    log_thread = g_thread_try_new("ble-hal-log", log_thread_main, NULL, &error);
+    if (!log_thread) {
+        HAL_LOG_ERROR("Failed to start log thread: %s; logging synchronously.", error->message);
+        g_error_free(error);
+        g_free(slots);
+        slots = NULL;
+        close(wakeup_fd);
+        wakeup_fd = -1;
+        return;
+    }
+    g_atomic_int_set(&running, 1);
+}
+
+void hal_log_shutdown(void) {
+    if (log_thread) {
+        // Stop accepting, then wait out producers that passed the check already.
+        g_atomic_int_set(&running, 0);
+        while (g_atomic_int_get(&writers) > 0) {
+            g_thread_yield();
+        }
+
+        g_atomic_int_set(&stopping, 1);
+        guint64 one = 1;
+        ssize_t rc = write(wakeup_fd, &one, sizeof(one));
+        (void)rc;
+        g_thread_join(log_thread);
+        log_thread = NULL;
+        ring_drain(); // Whatever arrived after the thread's last pass
+
+        g_free(slots);
+        slots = NULL;
+        close(wakeup_fd);
+        wakeup_fd = -1;
+    }
+    sink = NULL;
+    sink_user_data = NULL;
+}
+
+// --- Public API ---
+
+void ble_hal_set_log_level(BleHalLogLevel level) {
+    if (level == BLE_HAL_LOG_DEFAULT || level > BLE_HAL_LOG_DEBUG) level = BLE_HAL_LOG_INFO;
+    __atomic_store_n(&hal_log_level, level, __ATOMIC_RELAXED);
+}
+
+BleHalLogLevel ble_hal_get_log_level(void) {
+    return (BleHalLogLevel)__atomic_load_n(&hal_log_level, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "ble_hal_internal.h"
+
+/*
+ * External event loop integration (BleHalConfig.use_external_loop).
+ *
+ * The HAL runs on a private GMainContext that the application iterates
+ * through ble_hal_dispatch(). To give it one fd to watch, every fd the
+ * context polls is mirrored into an epoll set, and the context's next
+ * timeout arms a timerfd in the same set, so the epoll fd turns readable
+ * whenever there is something to dispatch. The set is brought up to date at
+ * the end of each ble_hal_dispatch(), from the context's last query.
+ * The context is created for ownerless polling (GLib 2.72): between
+ * dispatches nobody owns it, and sources attached from other threads (GDBus
+ * worker replies, g_main_context_invoke_full()) must still signal its wakeup
+ * fd, which is one of the fds in the set.
+ *
+ * Only the thread calling ble_hal_dispatch() touches the state below.
+ */
+
+static GMainContext* loop_context = NULL;      // Private context; NULL unless in external-loop mode
+static int epoll_fd = -1;                       // What ble_hal_get_fd() returns
+static int timer_fd = -1;                       // Armed with the context's next timeout
+static GPollFD* poll_fds = NULL;                // Last query
+static gint n_poll_fds = 0;
+static gint poll_fds_size = 0;
+static GArray* watched = NULL;                  // GPollFD currently in the epoll set (merged per fd)
+
+static guint32 epoll_events(gushort events) {
+    guint32 mask = 0;
+    if (events & G_IO_IN) mask |= EPOLLIN;
+    if (events & G_IO_OUT) mask |= EPOLLOUT;
+    if (events & G_IO_PRI) mask |= EPOLLPRI;
+    return mask;
+}
+
+/**
+ * @brief Runs one prepare/query/check/dispatch cycle without blocking.
+ * Returns TRUE if a source was dispatched; '*timeout' receives the
+ * context's next timeout as queried.
+ */
+static gboolean iterate_once(gint* timeout) {
+    gint max_priority;
+    gint n;
+
+    g_main_context_prepare(loop_context, &max_priority);
+    while ((n = g_main_context_query(loop_context, max_priority, timeout, poll_fds, poll_fds_size)) > poll_fds_size) {
+        g_free(poll_fds);
+        poll_fds_size = n;
+        poll_fds = g_new(GPollFD, poll_fds_size);
+    }
+    n_poll_fds = n;
+
+    // The application's own poll did the waiting; this only collects revents.
+    if (n > 0) g_poll(poll_fds, n, 0);
+    gboolean ready = g_main_context_check(loop_context, max_priority, poll_fds, n);
+    if (ready) {
+        g_main_context_dispatch(loop_context);
+    }
+    return ready;
+}
+
+static void arm_timer(gint timeout_ms) {
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    if (timeout_ms == 0) {
+        spec.it_value.tv_nsec = 1; // Due now: make the fd readable at once
+    } else if (timeout_ms > 0) {
+        spec.it_value.tv_sec = timeout_ms / 1000;
+        spec.it_value.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+    }
+    timerfd_settime(timer_fd, 0, &spec, NULL); // All zero disarms
+}
+
+/**
+ * @brief Makes the epoll set match the fds of the last query.
+ */
+static void sync_epoll_set(void) {
+    GArray* wanted = g_array_sized_new(FALSE, FALSE, sizeof(GPollFD), n_poll_fds);
+
+    for (gint i = 0; i < n_poll_fds; i++) {
+        guint j = 0;
+        while (j < wanted->len && g_array_index(wanted, GPollFD, j).fd != poll_fds[i].fd) j++;
+        if (j < wanted->len) {
+            g_array_index(wanted, GPollFD, j).events |= poll_fds[i].events;
+        } else {
+            GPollFD pfd = { .fd = poll_fds[i].fd, .events = poll_fds[i].events }; // Drop the last g_poll()'s revents
+            g_array_append_val(wanted, pfd);
+        }
+    }
+
+    if (wanted->len == watched->len &&
+        memcmp(wanted->data, watched->data, wanted->len * sizeof(GPollFD)) == 0) {
+        g_array_unref(wanted);
+        return; // The usual case: nothing changed
+    }
+
+    for (guint i = 0; i < watched->len; i++) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, g_array_index(watched, GPollFD, i).fd, NULL);
+    }
+    for (guint i = 0; i < wanted->len; i++) {
+        GPollFD* pfd = &g_array_index(wanted, GPollFD, i);
+        struct epoll_event event = { .events = epoll_events(pfd->events), .data.fd = pfd->fd };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pfd->fd, &event) < 0) {
+            HAL_LOG_ERROR("Failed to watch fd %d for the external loop: %s", pfd->fd, g_strerror(errno));
+        }
+    }
+    g_array_unref(watched);
+    watched = wanted;
+}
+
+// --- Internal API ---
+
+GMainContext* hal_loop_init(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        HAL_LOG_ERROR("Failed to set up the external loop fd: %s", g_strerror(errno));
+        hal_loop_shutdown();
+        return NULL;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = timer_fd };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+    watched = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+
+    GMainContext* context = g_main_context_new_with_flags(G_MAIN_CONTEXT_FLAGS_OWNERLESS_POLLING);
+    g_atomic_pointer_set(&loop_context, context);
+    arm_timer(0); // Nothing is queried yet: let the first dispatch do that
+    HAL_LOG_INFO("External event loop mode (fd %d).", epoll_fd);
+    return context;
+}
+
+void hal_loop_shutdown(void) {
+    GMainContext* context = g_atomic_pointer_get(&loop_context);
+
+    if (context) {
+        g_atomic_pointer_set(&loop_context, NULL);
+        g_main_context_unref(context);
+    }
+    if (watched) {
+        g_array_unref(watched);
+        watched = NULL;
+    }
+    g_free(poll_fds);
+    poll_fds = NULL;
+    n_poll_fds = poll_fds_size = 0;
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+GMainContext* hal_loop_get_context(void) {
+    return g_atomic_pointer_get(&loop_context);
+}
+
+GMainContext* hal_reply_context_ref(void) {
+    GMainContext* context = g_main_context_get_thread_default();
+    if (!context) {
+        // Nobody runs the global default context in external-loop mode.
+        context = hal_loop_get_context();
+    }
+    return g_main_context_ref(context ? context : g_main_context_default());
+}
+
+// --- Public API ---
+
+int ble_hal_get_fd(void) {
+    return hal_loop_get_context() ? epoll_fd : -1;
+}
+
+BleHalStatus ble_hal_dispatch(guint max_iterations, guint budget_us) {
+    GMainContext* context = hal_loop_get_context();
+    if (!context) return BLE_HAL_ERROR_NOT_INITIALIZED;
+    if (!g_main_context_acquire(context)) return BLE_HAL_ERROR_BUSY;
+
+    guint64 expirations;
+    ssize_t rc = read(timer_fd, &expirations, sizeof(expirations)); // Clears readability; EAGAIN if not due
+    (void)rc;
+
+    // Calls and subscriptions made from callbacks bind to the thread-default context.
+    g_main_context_push_thread_default(context);
+    gint64 deadline_us = budget_us ? g_get_monotonic_time() + budget_us : 0;
+    gboolean exhausted = FALSE;
+    gint timeout = -1;
+    guint iterations = 0;
+
+    while (iterate_once(&timeout)) {
+        iterations++;
+        if ((max_iterations && iterations >= max_iterations) ||
+            (deadline_us && g_get_monotonic_time() >= deadline_us)) {
+            exhausted = TRUE;
+            break;
+        }
+    }
+    g_main_context_pop_thread_default(context);
+
+    sync_epoll_set();
+    // Work may be left after a cut-short pass; keep the fd readable until it is done.
+    arm_timer(exhausted ? 0 : timeout);
+    g_main_context_release(context);
+    return exhausted ? BLE_HAL_PENDING : BLE_HAL_SUCCESS;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Advertising reports from the kernel's Bluetooth management interface.
+ *
+ * The mgmt control channel delivers MGMT_EV_DEVICE_FOUND to every trusted
+ * socket while a discovery is running, the same reports bluetoothd turns into
+ * Device1 PropertiesChanged signals. Reading them here skips bluetoothd's
+ * D-Bus encoding and dbus-daemon's routing; discovery itself is still started
+ * and stopped over D-Bus. Receiving the events needs CAP_NET_ADMIN.
+ */
+
+// From the kernel's <bluetooth/hci.h> and <bluetooth/mgmt.h>;
+// libbluetooth is not a dependency.
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH                31
+#endif
+#define HAL_BTPROTO_HCI             1
+#define HAL_HCI_DEV_NONE            0xffff
+#define HAL_HCI_CHANNEL_CONTROL     3
+#define HAL_MGMT_EV_DEVICE_FOUND    0x0012
+#define HAL_MGMT_ADDR_LE_RANDOM     0x02
+
+typedef struct {
+    sa_family_t hci_family;
+    unsigned short hci_dev;
+    unsigned short hci_channel;
+} HalSockaddrHci;
+
+#define HAL_MGMT_HEADER_SIZE        6       // opcode, index, length (little endian)
+#define HAL_MGMT_DEVICE_FOUND_SIZE  14      // bdaddr, type, rssi, flags, eir_len
+// Largest event read; covers extended advertising data.
+#define HAL_MGMT_BUFFER_SIZE        2048
+// Events handled per dispatch before other sources get a turn.
+#define HAL_MGMT_MAX_READS_PER_DISPATCH 64
+
+// AD types decoded into Device1 properties.
+#define HAL_AD_NAME_SHORT           0x08
+#define HAL_AD_NAME_COMPLETE        0x09
+#define HAL_AD_TX_POWER             0x0a
+#define HAL_AD_SERVICE_DATA_16      0x16
+#define HAL_AD_SERVICE_DATA_32      0x20
+#define HAL_AD_SERVICE_DATA_128     0x21
+#define HAL_AD_MANUFACTURER_DATA    0xff
+
+struct _HalMgmtSource {
+    GSource source;
+    gpointer fd_tag;
+    int fd;
+    HalMgmtReportFunc func;
+    void* user_data;
+    guint8 buffer[HAL_MGMT_BUFFER_SIZE];
+};
+
+static guint16 get_le16(const guint8* p) {
+    return (guint16)(p[0] | (p[1] << 8));
+}
+
+/**
+ * @brief Decodes one MGMT_EV_DEVICE_FOUND and hands it to the callback.
+ */
+static void mgmt_handle_device_found(HalMgmtSource* mgmt, guint16 index, const guint8* params, gsize length) {
+    HalMgmtReport report;
+
+    if (length < HAL_MGMT_DEVICE_FOUND_SIZE) return;
+    report.eir_len = get_le16(params + 12);
+    if (length < HAL_MGMT_DEVICE_FOUND_SIZE + (gsize)report.eir_len) return;
+
+    report.index = index;
+    for (int i = 0; i < 6; i++) {
+        report.address.b[i] = params[5 - i]; // bdaddr_t is least significant byte first
+    }
+    report.address_type = params[6] == HAL_MGMT_ADDR_LE_RANDOM ? BLE_HAL_ADDRESS_TYPE_RANDOM
+                                                               : BLE_HAL_ADDRESS_TYPE_PUBLIC;
+    report.rssi = (gint8)params[7];
+    report.eir = params + HAL_MGMT_DEVICE_FOUND_SIZE;
+    mgmt->func(&report, mgmt->user_data);
+}
+
+static gboolean mgmt_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data) {
+    HalMgmtSource* mgmt = (HalMgmtSource*)source;
+    GIOCondition revents = g_source_query_unix_fd(source, mgmt->fd_tag);
+
+    if (revents & (G_IO_HUP | G_IO_ERR)) {
+        HAL_LOG_ERROR("Management socket closed; advertising reports stop.");
+        return G_SOURCE_REMOVE;
+    }
+
+    for (guint i = 0; i < HAL_MGMT_MAX_READS_PER_DISPATCH; i++) {
+        ssize_t n = read(mgmt->fd, mgmt->buffer, sizeof(mgmt->buffer));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                HAL_LOG_ERROR("Management socket read failed: %s", g_strerror(errno));
+            }
+            break;
+        }
+        if (n < HAL_MGMT_HEADER_SIZE) continue;
+
+        guint16 opcode = get_le16(mgmt->buffer);
+        guint16 index = get_le16(mgmt->buffer + 2);
+        guint16 length = get_le16(mgmt->buffer + 4);
+        if (opcode != HAL_MGMT_EV_DEVICE_FOUND || HAL_MGMT_HEADER_SIZE + (gsize)length > (gsize)n) {
+            continue; // Other events, or one truncated by the buffer
+        }
+        mgmt_handle_device_found(mgmt, index, mgmt->buffer + HAL_MGMT_HEADER_SIZE, length);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void mgmt_source_finalize(GSource* source) {
+    HalMgmtSource* mgmt = (HalMgmtSource*)source;
+    if (mgmt->fd >= 0) close(mgmt->fd);
+}
+
+static GSourceFuncs mgmt_source_funcs = {
+    NULL,                   // prepare: woken by the fd only
+    NULL,                   // check
+    mgmt_source_dispatch,
+    mgmt_source_finalize,
+    NULL,
+    NULL
+};
+
+HalMgmtSource* hal_mgmt_open(GMainContext* context, HalMgmtReportFunc func, void* user_data) {
+    HalSockaddrHci addr;
+
+    int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, HAL_BTPROTO_HCI);
+    if (fd < 0) {
+        HAL_LOG_ERROR("Failed to create management socket: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.hci_family = AF_BLUETOOTH;
+    addr.hci_dev = HAL_HCI_DEV_NONE;
+    addr.hci_channel = HAL_HCI_CHANNEL_CONTROL;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        HAL_LOG_ERROR("Failed to bind management socket: %s", g_strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    HalMgmtSource* mgmt = (HalMgmtSource*)g_source_new(&mgmt_source_funcs, sizeof(HalMgmtSource));
+    g_source_set_name(&mgmt->source, "ble-hal-mgmt");
+    mgmt->fd = fd;
+    mgmt->func = func;
+    mgmt->user_data = user_data;
+    mgmt->fd_tag = g_source_add_unix_fd(&mgmt->source, fd, G_IO_IN | G_IO_HUP | G_IO_ERR);
+    g_source_attach(&mgmt->source, context);
+    HAL_LOG_INFO("Reading advertising reports from the management socket.");
+    return mgmt;
+}
+
+void hal_mgmt_close(HalMgmtSource* mgmt) {
+    if (!mgmt) return;
+    g_source_destroy(&mgmt->source);
+    g_source_unref(&mgmt->source);
+}
+
+// --- Advertising Data ---
+
+/**
+ * @brief Formats a little-endian 16, 32 or 128-bit UUID the way BlueZ names
+ * ServiceData keys.
+ */
+static void format_uuid(const guint8* uuid, gsize size, gchar out[37]) {
+    if (size == 16) {
+        g_snprintf(out, 37, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                   uuid[15], uuid[14], uuid[13], uuid[12], uuid[11], uuid[10], uuid[9], uuid[8],
+                   uuid[7], uuid[6], uuid[5], uuid[4], uuid[3], uuid[2], uuid[1], uuid[0]);
+    } else {
+        guint32 value = size == 4 ? (guint32)(uuid[0] | (uuid[1] << 8) | (uuid[2] << 16) | ((guint32)uuid[3] << 24))
+                                  : get_le16(uuid);
+        g_snprintf(out, 37, "%08x-0000-1000-8000-00805f9b34fb", value);
+    }
+}
+
+static void emit_property(HalPropFunc func, void* user_data, HalPropId prop, GVariant* value) {
+    g_variant_ref_sink(value);
+    func(prop, value, user_data);
+    g_variant_unref(value);
+}
+
+void hal_mgmt_report_foreach(const HalMgmtReport* report, HalPropFunc func, void* user_data) {
+    GVariantBuilder manufacturer;
+    GVariantBuilder service;
+    gboolean has_manufacturer = FALSE;
+    gboolean has_service = FALSE;
+    gsize pos = 0;
+
+    emit_property(func, user_data, HAL_PROP_DEVICE1_RSSI, g_variant_new_int16(report->rssi));
+
+    while (pos < report->eir_len) {
+        guint8 field_len = report->eir[pos];
+        if (field_len == 0 || pos + 1 + field_len > report->eir_len) break; // End of data, or malformed
+        guint8 type = report->eir[pos + 1];
+        const guint8* data = report->eir + pos + 2;
+        gsize data_len = field_len - 1;
+        pos += 1 + field_len;
+
+        switch (type) {
+            case HAL_AD_NAME_SHORT:
+            case HAL_AD_NAME_COMPLETE:
+                if (g_utf8_validate((const gchar*)data, data_len, NULL)) {
+                    emit_property(func, user_data,
+                                  type == HAL_AD_NAME_COMPLETE ? HAL_PROP_DEVICE1_NAME : HAL_PROP_DEVICE1_ALIAS,
+                                  g_variant_new_take_string(g_strndup((const gchar*)data, data_len)));
+                }
+                break;
+            case HAL_AD_TX_POWER:
+                if (data_len >= 1) {
+                    emit_property(func, user_data, HAL_PROP_DEVICE1_TX_POWER, g_variant_new_int16((gint8)data[0]));
+                }
+                break;
+            case HAL_AD_MANUFACTURER_DATA:
+                if (data_len < 2) break;
+                if (!has_manufacturer) {
+                    g_variant_builder_init(&manufacturer, G_VARIANT_TYPE("a{qv}"));
+                    has_manufacturer = TRUE;
+                }
+                g_variant_builder_add(&manufacturer, "{qv}", get_le16(data),
+                                      g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data + 2, data_len - 2, 1));
+                break;
+            case HAL_AD_SERVICE_DATA_16:
+            case HAL_AD_SERVICE_DATA_32:
+            case HAL_AD_SERVICE_DATA_128: {
+                gsize uuid_len = type == HAL_AD_SERVICE_DATA_16 ? 2 : type == HAL_AD_SERVICE_DATA_32 ? 4 : 16;
+                gchar uuid[37];
+                if (data_len < uuid_len) break;
+                if (!has_service) {
+                    g_variant_builder_init(&service, G_VARIANT_TYPE("a{sv}"));
+                    has_service = TRUE;
+                }
+                format_uuid(data, uuid_len, uuid);
+                g_variant_builder_add(&service, "{sv}", uuid,
+                                      g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data + uuid_len,
+                                                                data_len - uuid_len, 1));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (has_manufacturer) {
+        emit_property(func, user_data, HAL_PROP_DEVICE1_MANUFACTURER_DATA, g_variant_builder_end(&manufacturer));
+    }
+    if (has_service) {
+        emit_property(func, user_data, HAL_PROP_DEVICE1_SERVICE_DATA, g_variant_builder_end(&service));
+    }
+}
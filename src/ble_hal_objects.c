@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Selective GetManagedObjects parser.
+ *
+ * The reply (a{oa{sa{sv}}}) is flattened once with g_variant_get_data() and
+ * then walked in place using the GVariant serialization format: variable-size
+ * arrays end in a table of little-endian framing offsets, and a dict entry
+ * stores the end of its key in one framing offset after the value. Object
+ * paths and interface names are read straight from the buffer; interfaces that
+ * are not in HAL_INTERFACES are skipped without creating child variants.
+ * For the ones we keep only the location of their a{sv} is recorded; it is
+ * wrapped in a GVariant the first time it is asked for.
+ *
+ * The serialized format helpers are shared with the advertisement data views.
+ */
+
+// Alignment of every container involved ({oa{sa{sv}}}, {sa{sv}}, a{sv}, a{qv}):
+// the variant inside makes them all 8-byte aligned.
+#define HAL_GVS_ALIGN_MASK 7u
+
+typedef struct {
+    const gchar* object_path;   // Points into the reply buffer
+    HalInterfaceId interface_id;
+    HalGvsView properties;      // Serialized a{sv}
+    GVariant* decoded;          // Created on first access (NULL until then)
+} HalManagedInterface;
+
+struct _HalManagedObjects {
+    GVariant* reply;            // Keeps the buffer the views point into alive
+    GArray* entries;            // HalManagedInterface
+};
+
+// --- Serialized Format Helpers ---
+
+static gsize gvs_offset_size(gsize container_size) {
+    if (container_size <= G_MAXUINT8) return 1;
+    if (container_size <= G_MAXUINT16) return 2;
+    if (container_size <= G_MAXUINT32) return 4;
+    return 8;
+}
+
+static gsize gvs_read_offset(const guint8* p, gsize offset_size) {
+    gsize value = 0;
+    for (gsize i = 0; i < offset_size; i++) {
+        value |= (gsize)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static gsize gvs_align(gsize offset) {
+    return (offset + HAL_GVS_ALIGN_MASK) & ~(gsize)HAL_GVS_ALIGN_MASK;
+}
+
+gboolean hal_gvs_array_open(HalGvsView view, HalGvsArray* out) {
+    memset(out, 0, sizeof(*out));
+    out->view = view;
+    if (view.size == 0) return TRUE; // Empty array
+
+    out->offset_size = gvs_offset_size(view.size);
+    if (view.size < out->offset_size) return FALSE;
+
+    out->table_start = gvs_read_offset(view.data + view.size - out->offset_size, out->offset_size);
+    if (out->table_start > view.size || (view.size - out->table_start) % out->offset_size != 0) {
+        return FALSE;
+    }
+    out->n_elements = (view.size - out->table_start) / out->offset_size;
+    return TRUE;
+}
+
+gboolean hal_gvs_array_element(const HalGvsArray* array, gsize index, HalGvsView* out) {
+    const guint8* table = array->view.data + array->table_start;
+    gsize start = index == 0 ? 0 : gvs_align(gvs_read_offset(table + (index - 1) * array->offset_size,
+                                                             array->offset_size));
+    gsize end = gvs_read_offset(table + index * array->offset_size, array->offset_size);
+
+    if (start > end || end > array->table_start) return FALSE;
+    out->data = array->view.data + start;
+    out->size = end - start;
+    return TRUE;
+}
+
+gboolean hal_gvs_dict_entry_split(HalGvsView entry, const gchar** key, HalGvsView* value) {
+    gsize offset_size = gvs_offset_size(entry.size);
+    if (entry.size < offset_size) return FALSE;
+
+    gsize value_end = entry.size - offset_size;
+    gsize key_end = gvs_read_offset(entry.data + value_end, offset_size);
+    if (key_end == 0 || key_end > value_end || entry.data[key_end - 1] != '\0') return FALSE;
+
+    gsize value_start = gvs_align(key_end);
+    if (value_start > value_end) return FALSE;
+
+    *key = (const gchar*)entry.data;
+    value->data = entry.data + value_start;
+    value->size = value_end - value_start;
+    return TRUE;
+}
+
+gboolean hal_gvs_variant_split(HalGvsView variant, const gchar** type, HalGvsView* value) {
+    // The type string follows the value and the last nul byte.
+    gsize sep = variant.size;
+    while (sep > 0 && variant.data[sep - 1] != '\0') sep--;
+    if (sep == 0 || sep == variant.size) return FALSE;
+
+    // The type string is not nul-terminated in the buffer; callers compare it by length.
+    *type = (const gchar*)variant.data + sep;
+    value->data = variant.data;
+    value->size = sep - 1;
+    return TRUE;
+}
+
+// --- Parser ---
+
+HalManagedObjects* hal_managed_objects_parse(GVariant* reply) {
+    if (!reply || !g_variant_is_of_type(reply, G_VARIANT_TYPE("(a{oa{sa{sv}}})"))) return NULL;
+
+    HalManagedObjects* objects = g_new0(HalManagedObjects, 1);
+    objects->reply = g_variant_ref(reply);
+    objects->entries = g_array_new(FALSE, FALSE, sizeof(HalManagedInterface));
+
+    // A one-member tuple whose member is variable-size has no framing offsets,
+    // so the tuple's data is the array's data.
+    HalGvsView root = { g_variant_get_data(reply), g_variant_get_size(reply) };
+    HalGvsArray objs;
+    if (!hal_gvs_array_open(root, &objs)) goto malformed;
+
+    for (gsize i = 0; i < objs.n_elements; i++) {
+        HalGvsView object_entry, ifaces_view;
+        const gchar* object_path;
+        HalGvsArray ifaces;
+
+        if (!hal_gvs_array_element(&objs, i, &object_entry) ||
+            !hal_gvs_dict_entry_split(object_entry, &object_path, &ifaces_view) ||
+            !hal_gvs_array_open(ifaces_view, &ifaces)) {
+            goto malformed;
+        }
+
+        for (gsize j = 0; j < ifaces.n_elements; j++) {
+            HalGvsView iface_entry;
+            HalManagedInterface item = {0};
+            const gchar* iface_name;
+
+            if (!hal_gvs_array_element(&ifaces, j, &iface_entry) ||
+                !hal_gvs_dict_entry_split(iface_entry, &iface_name, &item.properties)) {
+                goto malformed;
+            }
+
+            item.interface_id = hal_interface_lookup(iface_name);
+            if (item.interface_id == HAL_IFACE_UNKNOWN) continue; // Skipped without decoding anything
+
+            item.object_path = object_path;
+            g_array_append_val(objects->entries, item);
+        }
+    }
+    return objects;
+
+malformed:
+    HAL_LOG_ERROR("Malformed GetManagedObjects reply.");
+    hal_managed_objects_free(objects);
+    return NULL;
+}
+
+void hal_managed_objects_free(HalManagedObjects* objects) {
+    if (!objects) return;
+    for (guint i = 0; i < objects->entries->len; i++) {
+        HalManagedInterface* item = &g_array_index(objects->entries, HalManagedInterface, i);
+        if (item->decoded) g_variant_unref(item->decoded);
+    }
+    g_array_free(objects->entries, TRUE);
+    g_variant_unref(objects->reply);
+    g_free(objects);
+}
+
+guint hal_managed_objects_count(const HalManagedObjects* objects) {
+    return objects ? objects->entries->len : 0;
+}
+
+const gchar* hal_managed_objects_path(const HalManagedObjects* objects, guint index) {
+    return g_array_index(objects->entries, HalManagedInterface, index).object_path;
+}
+
+HalInterfaceId hal_managed_objects_interface_id(const HalManagedObjects* objects, guint index) {
+    return g_array_index(objects->entries, HalManagedInterface, index).interface_id;
+}
+
+GVariant* hal_managed_objects_properties(HalManagedObjects* objects, guint index) {
+    HalManagedInterface* item = &g_array_index(objects->entries, HalManagedInterface, index);
+
+    if (!item->decoded) {
+        // Untrusted: GLib validates the slice lazily as it is read.
+        item->decoded = g_variant_new_from_data(G_VARIANT_TYPE_VARDICT,
+                                                item->properties.data, item->properties.size,
+                                                FALSE,
+                                                (GDestroyNotify)g_variant_unref,
+                                                g_variant_ref(objects->reply));
+        g_variant_ref_sink(item->decoded);
+    }
+    return item->decoded;
+}
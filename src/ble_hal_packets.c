@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Packet queues.
+ *
+ * A batch is one caller's list of buffers, sent as a byte stream cut into
+ * packets of the socket's MTU. Each packet is gathered with sendmsg()
+ * straight from the caller's memory, so nothing is copied on the way out.
+ * The queue only polls for POLLOUT while a batch is waiting: a full socket
+ * simply pauses the flush, and 'limit' bounds what producers may queue.
+ *
+ * Batches are HalCommands that are never executed; hal_command_complete()
+ * delivers their completion to the producer's context.
+ */
+
+// Packets sent per flush before other sources get a turn.
+#define HAL_PACKET_MAX_PER_FLUSH    32
+// Pieces gathered into one packet; longer runs of tiny buffers send short packets.
+#define HAL_PACKET_MAX_IOV          16
+
+typedef struct {
+    HalCommand base;                // 'next' links the queue
+    BleHalBuffer* vectors;          // Copy of the caller's array, empty pieces dropped
+    guint n_vectors;
+    guint index;                    // First piece not fully sent
+    gsize offset;                   // Bytes of vectors[index] already sent
+    gsize length;                   // Bytes in the whole batch
+} PacketBatch;
+
+static void batch_finalize(HalCommand* command) {
+    hal_pool_free(((PacketBatch*)command)->vectors);
+}
+
+/**
+ * @brief Sends the next packet of 'batch': up to 'mtu' bytes gathered from
+ * its remaining pieces. Returns the sendmsg() result.
+ */
+static ssize_t batch_send(PacketBatch* batch, int fd, gsize mtu) {
+    struct iovec iov[HAL_PACKET_MAX_IOV];
+    struct msghdr msg;
+    gsize packet = 0;
+    gsize offset = batch->offset;
+    guint n_iov = 0;
+
+    for (guint i = batch->index; i < batch->n_vectors && n_iov < HAL_PACKET_MAX_IOV && packet < mtu; i++) {
+        gsize take = MIN(batch->vectors[i].length - offset, mtu - packet);
+        iov[n_iov].iov_base = (guint8*)batch->vectors[i].data + offset;
+        iov[n_iov].iov_len = take;
+        n_iov++;
+        packet += take;
+        offset = 0;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_iov;
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL); // EPIPE instead of SIGPIPE
+    if (sent <= 0) return sent;
+
+    // A SEQPACKET send is all or nothing, but advance by what was reported.
+    gsize left = (gsize)sent;
+    while (left > 0) {
+        gsize available = batch->vectors[batch->index].length - batch->offset;
+        if (left < available) {
+            batch->offset += left;
+            left = 0;
+        } else {
+            left -= available;
+            batch->index++;
+            batch->offset = 0;
+        }
+    }
+    return sent;
+}
+
+void hal_packet_queue_init(HalPacketQueue* queue, GSource* source, gsize limit) {
+    memset(queue, 0, sizeof(*queue));
+    g_mutex_init(&queue->lock);
+    queue->source = source;
+    queue->limit = limit;
+}
+
+gpointer hal_packet_queue_attach_fd(HalPacketQueue* queue, int fd, GIOCondition events) {
+    g_mutex_lock(&queue->lock);
+    queue->events = events;
+    queue->polling_out = queue->head != NULL; // Batches pushed before the socket was ready
+    queue->fd_tag = g_source_add_unix_fd(queue->source, fd, events | (queue->polling_out ? G_IO_OUT : 0));
+    g_mutex_unlock(&queue->lock);
+    return queue->fd_tag;
+}
+
+BleHalStatus hal_packet_queue_push(HalPacketQueue* queue, const BleHalBuffer* buffers, guint n_buffers,
+                                   BleHalResultCb done_cb, void* user_data) {
+    gsize length = 0;
+    guint n_vectors = 0;
+
+    if (!buffers && n_buffers > 0) {
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+    for (guint i = 0; i < n_buffers; i++) {
+        if (buffers[i].length == 0) continue;
+        if (!buffers[i].data) return BLE_HAL_ERROR_INVALID_PARAMS;
+        length += buffers[i].length;
+        n_vectors++;
+    }
+    if (length == 0) {
+        return BLE_HAL_ERROR_INVALID_PARAMS;
+    }
+
+    PacketBatch* batch = hal_command_new(sizeof(PacketBatch), NULL, batch_finalize, done_cb, user_data);
+    batch->vectors = hal_pool_alloc(sizeof(BleHalBuffer) * n_vectors);
+    for (guint i = 0; i < n_buffers; i++) {
+        if (buffers[i].length == 0) continue;
+        batch->vectors[batch->n_vectors++] = buffers[i];
+    }
+    batch->length = length;
+
+    BleHalStatus status = BLE_HAL_PENDING;
+    g_mutex_lock(&queue->lock);
+    if (queue->closed) {
+        status = BLE_HAL_ERROR;
+    } else if (queue->head && queue->queued + length > queue->limit) {
+        // An empty queue takes any batch, so one larger than the limit still goes through.
+        status = BLE_HAL_ERROR_BUSY;
+    } else {
+        if (queue->tail) {
+            queue->tail->next = &batch->base;
+        } else {
+            queue->head = &batch->base;
+        }
+        queue->tail = &batch->base;
+        queue->queued += length;
+        if (queue->fd_tag && !queue->polling_out) {
+            g_source_modify_unix_fd(queue->source, queue->fd_tag, queue->events | G_IO_OUT);
+            queue->polling_out = TRUE;
+        }
+    }
+    g_mutex_unlock(&queue->lock);
+
+    if (status != BLE_HAL_PENDING) {
+        batch->base.cb = NULL; // Rejected batches are dropped without a completion
+        hal_command_complete(&batch->base, status);
+    }
+    return status;
+}
+
+HalPacketQueueResult hal_packet_queue_flush(HalPacketQueue* queue, int fd, gsize mtu) {
+    for (guint i = 0; i < HAL_PACKET_MAX_PER_FLUSH; i++) {
+        g_mutex_lock(&queue->lock);
+        PacketBatch* batch = (PacketBatch*)queue->head;
+        if (!batch) {
+            if (queue->polling_out) {
+                g_source_modify_unix_fd(queue->source, queue->fd_tag, queue->events);
+                queue->polling_out = FALSE;
+            }
+            g_mutex_unlock(&queue->lock);
+            return HAL_PACKET_QUEUE_DRAINED;
+        }
+        g_mutex_unlock(&queue->lock);
+
+        // Only the dispatch removes batches, so 'batch' stays valid without the lock.
+        if (batch_send(batch, fd, mtu) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return HAL_PACKET_QUEUE_BLOCKED;
+            return HAL_PACKET_QUEUE_FAILED;
+        }
+        if (batch->index < batch->n_vectors) continue;
+
+        g_mutex_lock(&queue->lock);
+        queue->head = batch->base.next;
+        if (!queue->head) queue->tail = NULL;
+        queue->queued -= batch->length;
+        g_mutex_unlock(&queue->lock);
+
+        batch->base.next = NULL;
+        hal_command_complete(&batch->base, BLE_HAL_SUCCESS);
+        if (g_source_is_destroyed(queue->source)) return HAL_PACKET_QUEUE_STOPPED; // Closed from done_cb
+    }
+    return HAL_PACKET_QUEUE_BLOCKED;
+}
+
+void hal_packet_queue_clear(HalPacketQueue* queue, BleHalStatus status) {
+    g_mutex_lock(&queue->lock);
+    HalCommand* batch = queue->head;
+    queue->head = queue->tail = NULL;
+    queue->queued = 0;
+    queue->closed = TRUE;
+    g_mutex_unlock(&queue->lock);
+
+    while (batch) {
+        HalCommand* next = batch->next;
+        batch->next = NULL;
+        hal_command_complete(batch, status);
+        batch = next;
+    }
+}
+
+void hal_packet_queue_finalize(HalPacketQueue* queue) {
+    hal_packet_queue_clear(queue, BLE_HAL_ERROR);
+    g_mutex_clear(&queue->lock);
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Block pools.
+ *
+ * Commands, requests and event records are short-lived and come in a handful
+ * of sizes, so each goes to the smallest power-of-two class that fits it.
+ * A class carves HAL_POOL_SLAB_BLOCKS blocks at a time from one heap slab and
+ * keeps freed blocks on a free list; slabs are never returned, which keeps
+ * blocks valid for completions still in flight across ble_hal_deinit() and
+ * bounds how much the heap fragments. Once a class has used its byte budget,
+ * further blocks come from g_malloc() and are counted as fallbacks.
+ *
+ * Every block is preceded by a header naming its class (NULL for heap
+ * blocks), so hal_pool_free() needs no size.
+ */
+
+#define HAL_POOL_MIN_BLOCK      32
+// Blocks carved per slab.
+#define HAL_POOL_SLAB_BLOCKS    32
+
+typedef struct _HalPoolClass HalPoolClass;
+
+// Keeps the payload as aligned as g_malloc() would.
+typedef union {
+    HalPoolClass* owner;            // NULL for heap blocks
+    guint8 align[16];
+} HalPoolHeader;
+
+typedef struct _HalPoolFree HalPoolFree;
+struct _HalPoolFree {
+    HalPoolFree* next;
+};
+
+struct _HalPoolClass {
+    GMutex lock;
+    HalPoolFree* free_list;
+    BleHalPoolClassStats stats;     // block_size set once below
+};
+
+static HalPoolClass pool_classes[BLE_HAL_POOL_N_CLASSES];
+static gsize pool_max_bytes = BLE_HAL_POOL_DEFAULT_MAX_BYTES;
+static volatile gint oversize_allocations = 0;
+
+static HalPoolClass* pool_class_for(gsize size) {
+    static gsize classes_ready = 0;
+
+    if (g_once_init_enter(&classes_ready)) {
+        for (guint i = 0; i < BLE_HAL_POOL_N_CLASSES; i++) {
+            g_mutex_init(&pool_classes[i].lock);
+            pool_classes[i].stats.block_size = (gsize)HAL_POOL_MIN_BLOCK << i;
+        }
+        g_once_init_leave(&classes_ready, 1);
+    }
+
+    for (guint i = 0; i < BLE_HAL_POOL_N_CLASSES; i++) {
+        if (size <= pool_classes[i].stats.block_size) return &pool_classes[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Adds one slab of blocks to the free list, unless that would exceed
+ * the class's budget. Called with the class lock held.
+ */
+static gboolean pool_class_grow(HalPoolClass* pool) {
+    gsize stride = sizeof(HalPoolHeader) + pool->stats.block_size;
+    gsize slab_bytes = stride * HAL_POOL_SLAB_BLOCKS;
+
+    if ((gsize)pool->stats.blocks_total * stride + slab_bytes > pool_max_bytes) {
+        return FALSE;
+    }
+
+    guint8* slab = g_malloc(slab_bytes);
+    for (guint i = 0; i < HAL_POOL_SLAB_BLOCKS; i++) {
+        HalPoolHeader* header = (HalPoolHeader*)(slab + i * stride);
+        HalPoolFree* block = (HalPoolFree*)(header + 1);
+        header->owner = pool;
+        block->next = pool->free_list;
+        pool->free_list = block;
+    }
+    pool->stats.blocks_total += HAL_POOL_SLAB_BLOCKS;
+    return TRUE;
+}
+
+static gpointer heap_block(gsize size) {
+    HalPoolHeader* header = g_malloc(sizeof(HalPoolHeader) + size);
+    header->owner = NULL;
+    return header + 1;
+}
+
+gpointer hal_pool_alloc(gsize size) {
+    HalPoolClass* pool = pool_class_for(size);
+
+    if (!pool) {
+        g_atomic_int_inc(&oversize_allocations);
+        return heap_block(size);
+    }
+
+    g_mutex_lock(&pool->lock);
+    if (!pool->free_list && !pool_class_grow(pool)) {
+        pool->stats.fallbacks++;
+        g_mutex_unlock(&pool->lock);
+        return heap_block(size);
+    }
+    HalPoolFree* block = pool->free_list;
+    pool->free_list = block->next;
+    pool->stats.allocations++;
+    if (++pool->stats.blocks_in_use > pool->stats.blocks_peak) {
+        pool->stats.blocks_peak = pool->stats.blocks_in_use;
+    }
+    g_mutex_unlock(&pool->lock);
+    return block;
+}
+
+gpointer hal_pool_alloc0(gsize size) {
+    gpointer block = hal_pool_alloc(size);
+    memset(block, 0, size);
+    return block;
+}
+
+gpointer hal_pool_memdup(gconstpointer data, gsize size) {
+    gpointer block = hal_pool_alloc(size);
+    memcpy(block, data, size);
+    return block;
+}
+
+gchar* hal_pool_strdup(const gchar* str) {
+    if (!str) return NULL;
+    return hal_pool_memdup(str, strlen(str) + 1);
+}
+
+void hal_pool_free(gpointer block) {
+    if (!block) return;
+
+    HalPoolHeader* header = (HalPoolHeader*)block - 1;
+    HalPoolClass* pool = header->owner;
+    if (!pool) {
+        g_free(header);
+        return;
+    }
+
+    g_mutex_lock(&pool->lock);
+    ((HalPoolFree*)block)->next = pool->free_list;
+    pool->free_list = block;
+    pool->stats.blocks_in_use--;
+    g_mutex_unlock(&pool->lock);
+}
+
+void hal_pool_set_max_bytes(gsize max_bytes) {
+    pool_class_for(0); // Classes must exist before their locks are taken
+    for (guint i = 0; i < BLE_HAL_POOL_N_CLASSES; i++) {
+        g_mutex_lock(&pool_classes[i].lock);
+    }
+    pool_max_bytes = max_bytes ? max_bytes : BLE_HAL_POOL_DEFAULT_MAX_BYTES;
+    for (guint i = BLE_HAL_POOL_N_CLASSES; i > 0; i--) {
+        g_mutex_unlock(&pool_classes[i - 1].lock);
+    }
+}
+
+void ble_hal_get_pool_stats(BleHalPoolStats* out) {
+    if (!out) return;
+
+    pool_class_for(0);
+    for (guint i = 0; i < BLE_HAL_POOL_N_CLASSES; i++) {
+        g_mutex_lock(&pool_classes[i].lock);
+        out->classes[i] = pool_classes[i].stats;
+        g_mutex_unlock(&pool_classes[i].lock);
+    }
+    out->oversize_allocations = (guint)g_atomic_int_get(&oversize_allocations);
+}
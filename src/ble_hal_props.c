@@ -0,0 +1,127 @@
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Interface/property dispatch.
+ *
+ * The HAL_INTERFACES and HAL_PROPERTIES tables in ble_hal_internal.h expand
+ * into the ID enums and into the static descriptor arrays below. On first use
+ * both are indexed in a small open-addressing hash table (FNV-1a over the name,
+ * mixed with the interface ID for properties), so a lookup costs one hash and
+ * usually a single strcmp to confirm the hit. Decoders then switch on the ID.
+ */
+
+typedef struct {
+    const gchar* name;
+} HalInterfaceDesc;
+
+typedef struct {
+    HalInterfaceId iface;
+    const gchar* name;
+    const gchar* type;      // GVariant type string the decoder expects
+} HalPropDesc;
+
+static const HalInterfaceDesc interface_descs[HAL_IFACE_COUNT] = {
+#define HAL_X(id, name) { name },
+    HAL_INTERFACES(HAL_X)
+#undef HAL_X
+};
+
+static const HalPropDesc prop_descs[HAL_PROP_COUNT] = {
+#define HAL_X(iface, id, name, type) { HAL_IFACE_##iface, name, type },
+    HAL_PROPERTIES(HAL_X)
+#undef HAL_X
+};
+
+// Power of two, at least 4x the entry count so probe runs stay short.
+#define HAL_NAME_INDEX_SIZE 128u
+G_STATIC_ASSERT(HAL_NAME_INDEX_SIZE >= 4 * (HAL_IFACE_COUNT + HAL_PROP_COUNT));
+
+// Slots hold (ID + 1); 0 marks an empty slot.
+static guint16 interface_index[HAL_NAME_INDEX_SIZE];
+static guint16 prop_index[HAL_NAME_INDEX_SIZE];
+
+static guint32 name_hash(const gchar* name, guint32 seed) {
+    guint32 h = 2166136261u ^ (seed * 0x9e3779b1u);
+    for (const guchar* p = (const guchar*)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void index_insert(guint16* index, guint32 hash, guint id) {
+    guint32 slot = hash & (HAL_NAME_INDEX_SIZE - 1);
+    while (index[slot] != 0) {
+        slot = (slot + 1) & (HAL_NAME_INDEX_SIZE - 1);
+    }
+    index[slot] = (guint16)(id + 1);
+}
+
+static void ensure_indexes(void) {
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        for (guint i = 0; i < HAL_IFACE_COUNT; i++) {
+            index_insert(interface_index, name_hash(interface_descs[i].name, 0), i);
+        }
+        for (guint i = 0; i < HAL_PROP_COUNT; i++) {
+            index_insert(prop_index, name_hash(prop_descs[i].name, prop_descs[i].iface + 1), i);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+HalInterfaceId hal_interface_lookup(const gchar* name) {
+    if (!name) return HAL_IFACE_UNKNOWN;
+    ensure_indexes();
+
+    guint32 slot = name_hash(name, 0) & (HAL_NAME_INDEX_SIZE - 1);
+    while (interface_index[slot] != 0) {
+        guint id = interface_index[slot] - 1u;
+        if (strcmp(interface_descs[id].name, name) == 0) return (HalInterfaceId)id;
+        slot = (slot + 1) & (HAL_NAME_INDEX_SIZE - 1);
+    }
+    return HAL_IFACE_UNKNOWN;
+}
+
+const gchar* hal_interface_name(HalInterfaceId iface) {
+    return iface < HAL_IFACE_COUNT ? interface_descs[iface].name : NULL;
+}
+
+HalPropId hal_prop_lookup(HalInterfaceId iface, const gchar* name) {
+    if (!name || iface >= HAL_IFACE_COUNT) return HAL_PROP_UNKNOWN;
+    ensure_indexes();
+
+    guint32 slot = name_hash(name, iface + 1) & (HAL_NAME_INDEX_SIZE - 1);
+    while (prop_index[slot] != 0) {
+        guint id = prop_index[slot] - 1u;
+        if (prop_descs[id].iface == iface && strcmp(prop_descs[id].name, name) == 0) return (HalPropId)id;
+        slot = (slot + 1) & (HAL_NAME_INDEX_SIZE - 1);
+    }
+    return HAL_PROP_UNKNOWN;
+}
+
+const gchar* hal_prop_name(HalPropId prop) {
+    return prop < HAL_PROP_COUNT ? prop_descs[prop].name : NULL;
+}
+
+gboolean hal_prop_type_matches(HalPropId prop, GVariant* value) {
+    return prop < HAL_PROP_COUNT &&
+           g_variant_is_of_type(value, (const GVariantType*)prop_descs[prop].type);
+}
+
+void hal_props_foreach(HalInterfaceId iface, GVariant* properties, HalPropFunc func, void* user_data) {
+    GVariantIter iter;
+    const gchar* prop_name;
+    GVariant* prop_value;
+
+    g_variant_iter_init(&iter, properties);
+    while (g_variant_iter_next(&iter, "{&sv}", &prop_name, &prop_value)) {
+        HalPropId prop = hal_prop_lookup(iface, prop_name);
+        if (prop != HAL_PROP_UNKNOWN && hal_prop_type_matches(prop, prop_value)) {
+            func(prop, prop_value, user_data);
+        }
+        g_variant_unref(prop_value);
+    }
+}
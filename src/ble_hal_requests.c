@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Request pipeline.
+ *
+ * Every D-Bus call the HAL makes on an application's behalf is a HalRequest.
+ * Requests are created on any thread, handed to the HAL context through the
+ * command queue and then run through one lane per adapter:
+ *
+ *  - a lane keeps at most 'max_in_flight' calls outstanding; the rest wait
+ *    in submission order;
+ *  - a waiting request with the same coalesce key as a newer one is merged:
+ *    identical parameters share one call, otherwise the older request is
+ *    completed with BLE_HAL_ERROR_CANCELLED and the newer one takes its place;
+ *  - the deadline covers waiting and the call: the D-Bus timeout is whatever
+ *    is left when the call is sent, and a timer fails waiting requests whose
+ *    deadline passed;
+ *  - every call has a GCancellable, so hal_requests_cancel_all() can settle
+ *    the whole pipeline at once;
+ *  - unthrottled requests (match rule updates to the bus daemon) skip the
+ *    in-flight limit, so they go out in submission order with the calls
+ *    queued after them.
+ *
+ * All state below is owned by the HAL context.
+ */
+
+typedef struct {
+    gchar* key;                     // Adapter path ("/org/bluez/hci0"), or the object path
+    GQueue waiting;                 // HalRequest*, oldest first
+    GQueue in_flight;               // HalRequest*
+} RequestLane;
+
+// Outlives its request if the request is settled while the call is in flight.
+struct _HalRequestCall {
+    HalRequest* request;            // NULL once settled elsewhere
+    GCancellable* cancellable;
+};
+
+static GHashTable* lanes = NULL;            // key -> RequestLane*
+static GHashTable* waiting_by_key = NULL;   // coalesce key -> waiting HalRequest*
+static GSource* expiry_source = NULL;       // Fires at the earliest waiting deadline
+static guint default_timeout_ms = BLE_HAL_REQUEST_DEFAULT_TIMEOUT_MS;
+static guint max_in_flight = BLE_HAL_REQUEST_DEFAULT_MAX_IN_FLIGHT;
+
+static void lane_pump(RequestLane* lane);
+static void rearm_expiry(void);
+
+// --- Requests ---
+
+static void request_finalize(HalCommand* command) {
+    HalRequest* request = (HalRequest*)command;
+    if (request->cleanup) request->cleanup(command);
+    hal_pool_free(request->object_path);
+    if (request->parameters) g_variant_unref(request->parameters);
+    g_free(request->coalesce_key);
+}
+
+static void request_execute(HalCommand* command);
+
+gpointer hal_request_new(gsize size, const gchar* object_path, const gchar* interface, const gchar* method,
+                         GVariant* parameters, const GVariantType* reply_type, guint timeout_ms,
+                         BleHalResultCb cb, void* user_data) {
+    g_assert(size >= sizeof(HalRequest));
+
+    HalRequest* request = hal_command_new(size, request_execute, request_finalize, cb, user_data);
+    request->object_path = hal_pool_strdup(object_path);
+    request->interface = interface;
+    request->method = method;
+    request->parameters = parameters ? g_variant_ref_sink(parameters) : NULL;
+    request->reply_type = reply_type;
+    request->deadline_us = g_get_monotonic_time() +
+                           (gint64)(timeout_ms ? timeout_ms : g_atomic_int_get(&default_timeout_ms)) * 1000;
+    return request;
+}
+
+HalRequest* hal_request_new_set_property(const gchar* object_path, const gchar* interface, const gchar* property,
+                                         GVariant* value, BleHalResultCb cb, void* user_data) {
+    HalRequest* request = hal_request_new(sizeof(HalRequest), object_path, "org.freedesktop.DBus.Properties", "Set",
+                                          g_variant_new("(ssv)", interface, property, value), NULL, 0,
+                                          cb, user_data);
+    request->coalesce_key = g_strdup_printf("%s %s.%s", object_path, interface, property);
+    return request;
+}
+
+BleHalStatus hal_request_submit(HalRequest* request) {
+    return hal_command_submit(&request->base);
+}
+
+/**
+ * @brief Delivers the outcome to 'request' and every request joined to it.
+ * The request must already be out of its lane.
+ */
+static void request_settle(HalRequest* request, GVariant* reply, GUnixFDList* fd_list, BleHalStatus status) {
+    HalRequest* joined = request->joined;
+    const GError* error = request->error;
+    request->joined = NULL;
+
+    hal_command_complete(&request->base,
+                         request->on_reply ? request->on_reply(request, reply, fd_list, status) : status);
+
+    while (joined) {
+        HalRequest* next = joined->joined;
+        joined->joined = NULL;
+        joined->error = error;
+        request_settle(joined, reply, fd_list, status);
+        joined = next;
+    }
+}
+
+static BleHalStatus status_from_error(const GError* error) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) return BLE_HAL_ERROR_TIMEOUT;
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) return BLE_HAL_ERROR_CANCELLED;
+    return BLE_HAL_ERROR_DBUS;
+}
+
+// --- Lanes ---
+
+/**
+ * @brief Requests below an adapter share its lane: the key is the first three
+ * path elements ("/org/bluez/hci0"), or the whole path if it is shorter.
+ */
+static gchar* lane_key(const gchar* object_path) {
+    const gchar* end = object_path;
+    for (int slashes = 0; *end; end++) {
+        if (*end == '/' && ++slashes == 4) break;
+    }
+    return g_strndup(object_path, end - object_path);
+}
+
+static RequestLane* lane_lookup(const gchar* object_path, gboolean create) {
+    gchar* key = lane_key(object_path);
+    RequestLane* lane = g_hash_table_lookup(lanes, key);
+    if (!lane && create) {
+        lane = g_new0(RequestLane, 1);
+        lane->key = key;
+        g_queue_init(&lane->waiting);
+        g_queue_init(&lane->in_flight);
+        g_hash_table_insert(lanes, lane->key, lane);
+        return lane;
+    }
+    g_free(key);
+    return lane;
+}
+
+static void lane_free(gpointer data) {
+    RequestLane* lane = (RequestLane*)data;
+    g_free(lane->key);
+    g_free(lane);
+}
+
+static gboolean lane_is_idle_cb(gpointer key, gpointer value, gpointer user_data) {
+    RequestLane* lane = (RequestLane*)value;
+    return g_queue_is_empty(&lane->waiting) && g_queue_is_empty(&lane->in_flight);
+}
+
+static void lane_release_if_idle(RequestLane* lane) {
+    if (g_queue_is_empty(&lane->waiting) && g_queue_is_empty(&lane->in_flight)) {
+        g_hash_table_remove(lanes, lane->key); // Frees 'lane'
+    }
+}
+
+static void lane_unlink_waiting(RequestLane* lane, HalRequest* request) {
+    g_queue_delete_link(&lane->waiting, request->link);
+    hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_WAITING, -1);
+    request->link = NULL;
+    request->lane = NULL;
+    if (request->coalesce_key && g_hash_table_lookup(waiting_by_key, request->coalesce_key) == request) {
+        g_hash_table_remove(waiting_by_key, request->coalesce_key);
+    }
+}
+
+static void on_request_reply(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+    HalRequestCall *call = (HalRequestCall *)user_data;
+    HalRequest *request = call->request;
+    GUnixFDList *fd_list = NULL;
+    GError *error = NULL;
+
+    GVariant *reply = g_dbus_connection_call_with_unix_fd_list_finish(G_DBUS_CONNECTION(source_object),
+                                                                      &fd_list, res, &error);
+    g_object_unref(call->cancellable);
+    hal_pool_free(call);
+
+    if (!request) {
+        // Settled by hal_requests_cancel_all(); only the reply is left to drop.
+        if (reply) g_variant_unref(reply);
+        if (fd_list) g_object_unref(fd_list);
+        g_clear_error(&error);
+        return;
+    }
+
+    RequestLane* lane = (RequestLane*)request->lane;
+    g_queue_delete_link(&lane->in_flight, request->link);
+    request->link = NULL;
+    request->lane = NULL;
+    request->call = NULL;
+    hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_IN_FLIGHT, -1);
+    hal_stats_record_method(hal_stats_method_lookup(request->interface, request->method),
+                            g_get_monotonic_time() - request->sent_us, reply == NULL);
+
+    BleHalStatus status = BLE_HAL_SUCCESS;
+    if (!reply) {
+        status = status_from_error(error);
+        HAL_LOG_ERROR("%s.%s on %s failed: %s", request->interface, request->method,
+                      request->object_path, error->message);
+    }
+    request->error = error;
+    request_settle(request, reply, fd_list, status);
+    g_clear_error(&error);
+    if (reply) g_variant_unref(reply);
+    if (fd_list) g_object_unref(fd_list);
+
+    lane_pump(lane);
+    lane_release_if_idle(lane);
+}
+
+static void request_send(RequestLane* lane, HalRequest* request, gint64 now) {
+    GDBusConnection* conn = hal_get_dbus_connection();
+    if (!conn) {
+        request_settle(request, NULL, NULL, BLE_HAL_ERROR_NOT_INITIALIZED);
+        return;
+    }
+
+    HalRequestCall* call = hal_pool_alloc0(sizeof(HalRequestCall));
+    call->request = request;
+    call->cancellable = g_cancellable_new();
+    request->call = call;
+    request->lane = lane;
+    g_queue_push_tail(&lane->in_flight, request);
+    request->link = lane->in_flight.tail;
+    request->sent_us = now;
+    hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_IN_FLIGHT, 1);
+
+    gint64 remaining_ms = MAX((request->deadline_us - now) / 1000, 1);
+    g_dbus_connection_call_with_unix_fd_list(conn,
+                                             request->destination ? request->destination : "org.bluez",
+                                             request->object_path,
+                                             request->interface,
+                                             request->method,
+                                             request->parameters,   // Kept; GDBus takes its own reference
+                                             request->reply_type,
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             (gint)MIN(remaining_ms, G_MAXINT),
+                                             NULL,
+                                             call->cancellable,
+                                             on_request_reply,
+                                             call);
+}
+
+/**
+ * @brief Sends waiting requests while the lane has room. Requests whose
+ * deadline passed while waiting fail without being sent.
+ */
+static void lane_pump(RequestLane* lane) {
+    while (!g_queue_is_empty(&lane->waiting)) {
+        HalRequest* request = g_queue_peek_head(&lane->waiting);
+        gint64 now = g_get_monotonic_time();
+
+        if (g_queue_get_length(&lane->in_flight) >= max_in_flight && !request->unthrottled) break;
+
+        lane_unlink_waiting(lane, request);
+        if (now >= request->deadline_us) {
+            request_settle(request, NULL, NULL, BLE_HAL_ERROR_TIMEOUT);
+            continue;
+        }
+        request_send(lane, request, now);
+    }
+    rearm_expiry();
+}
+
+// --- Deadlines ---
+
+typedef struct {
+    gint64 now;
+    gint64 earliest;
+    GSList* expired;
+} ExpiryScan;
+
+static void scan_lane_cb(gpointer key, gpointer value, gpointer user_data) {
+    RequestLane* lane = (RequestLane*)value;
+    ExpiryScan* scan = (ExpiryScan*)user_data;
+
+    for (GList* link = lane->waiting.head; link; link = link->next) {
+        HalRequest* request = link->data;
+        if (request->deadline_us <= scan->now) {
+            scan->expired = g_slist_prepend(scan->expired, request);
+        } else if (scan->earliest == 0 || request->deadline_us < scan->earliest) {
+            scan->earliest = request->deadline_us;
+        }
+    }
+}
+
+static gboolean on_expiry(gpointer user_data) {
+    ExpiryScan scan = { g_get_monotonic_time(), 0, NULL };
+
+    g_source_unref(expiry_source);
+    expiry_source = NULL;
+
+    g_hash_table_foreach(lanes, scan_lane_cb, &scan);
+    for (GSList* item = scan.expired; item; item = item->next) {
+        HalRequest* request = item->data;
+        lane_unlink_waiting((RequestLane*)request->lane, request);
+    }
+    for (GSList* item = scan.expired; item; item = item->next) {
+        request_settle(item->data, NULL, NULL, BLE_HAL_ERROR_TIMEOUT);
+    }
+    g_slist_free(scan.expired);
+    g_hash_table_foreach_remove(lanes, lane_is_idle_cb, NULL);
+
+    rearm_expiry();
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Points the expiry timer at the earliest deadline among waiting requests.
+ */
+static void rearm_expiry(void) {
+    ExpiryScan scan = { g_get_monotonic_time(), 0, NULL };
+
+    hal_source_clear(&expiry_source);
+    g_hash_table_foreach(lanes, scan_lane_cb, &scan);
+    if (scan.expired) {
+        g_slist_free(scan.expired);
+        scan.earliest = scan.now; // Already due
+    }
+    if (scan.earliest != 0) {
+        expiry_source = hal_timeout_source_add((guint)((scan.earliest - scan.now + 999) / 1000), on_expiry, NULL);
+    }
+}
+
+// --- Submission ---
+
+/**
+ * @brief Executed on the HAL context: merges 'request' with a waiting one or
+ * appends it to its lane.
+ */
+static void request_execute(HalCommand* command) {
+    HalRequest* request = (HalRequest*)command;
+
+    if (!lanes) {
+        request_settle(request, NULL, NULL, BLE_HAL_ERROR_NOT_INITIALIZED);
+        return;
+    }
+
+    HalRequest* waiting = request->coalesce_key ? g_hash_table_lookup(waiting_by_key, request->coalesce_key) : NULL;
+    if (waiting && g_variant_equal(waiting->parameters, request->parameters)) {
+        // The same call is already queued: share its result.
+        request->joined = waiting->joined;
+        waiting->joined = request;
+        return;
+    }
+
+    RequestLane* lane;
+    if (waiting) {
+        // Superseded: the newer request takes the older one's place.
+        lane = (RequestLane*)waiting->lane;
+        request->lane = lane;
+        request->link = waiting->link;
+        request->link->data = request;
+        waiting->link = NULL;
+        waiting->lane = NULL;
+        g_hash_table_replace(waiting_by_key, request->coalesce_key, request);
+        HAL_LOG_DEBUG("%s superseded by a newer request.", waiting->coalesce_key);
+        request_settle(waiting, NULL, NULL, BLE_HAL_ERROR_CANCELLED);
+    } else {
+        lane = lane_lookup(request->object_path, TRUE);
+        request->lane = lane;
+        g_queue_push_tail(&lane->waiting, request);
+        request->link = lane->waiting.tail;
+        hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_WAITING, 1);
+        if (request->coalesce_key) {
+            g_hash_table_insert(waiting_by_key, request->coalesce_key, request);
+        }
+    }
+    lane_pump(lane);
+}
+
+// --- Lifecycle ---
+
+void hal_requests_init(guint timeout_ms, guint in_flight) {
+    g_atomic_int_set(&default_timeout_ms, timeout_ms ? timeout_ms : BLE_HAL_REQUEST_DEFAULT_TIMEOUT_MS);
+    max_in_flight = in_flight ? in_flight : BLE_HAL_REQUEST_DEFAULT_MAX_IN_FLIGHT;
+    lanes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, lane_free);
+    waiting_by_key = g_hash_table_new(g_str_hash, g_str_equal); // Keys are owned by the requests
+}
+
+static void collect_lane_cb(gpointer key, gpointer value, gpointer user_data) {
+    *(GSList**)user_data = g_slist_prepend(*(GSList**)user_data, value);
+}
+
+void hal_requests_cancel_all(BleHalStatus status) {
+    GSList* all = NULL;
+
+    if (!lanes) return;
+    hal_source_clear(&expiry_source);
+    g_hash_table_foreach(lanes, collect_lane_cb, &all);
+    g_hash_table_steal_all(lanes);
+    g_hash_table_remove_all(waiting_by_key);
+
+    guint settled = 0;
+    for (GSList* item = all; item; item = item->next) {
+        RequestLane* lane = item->data;
+        HalRequest* request;
+
+        while ((request = g_queue_pop_head(&lane->in_flight))) {
+            request->call->request = NULL; // The reply callback only frees the call
+            g_cancellable_cancel(request->call->cancellable);
+            request->call = NULL;
+            request->link = NULL;
+            request->lane = NULL;
+            hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_IN_FLIGHT, -1);
+            request_settle(request, NULL, NULL, status);
+            settled++;
+        }
+        while ((request = g_queue_pop_head(&lane->waiting))) {
+            request->link = NULL;
+            request->lane = NULL;
+            hal_stats_gauge_add(HAL_STATS_GAUGE_REQUESTS_WAITING, -1);
+            request_settle(request, NULL, NULL, status);
+            settled++;
+        }
+        lane_free(lane);
+    }
+    g_slist_free(all);
+
+    if (settled > 0) {
+        HAL_LOG_INFO("Cancelled %u pending D-Bus request(s).", settled);
+    }
+}
+
+void hal_requests_shutdown(void) {
+    hal_requests_cancel_all(BLE_HAL_ERROR_NOT_INITIALIZED);
+
+    if (lanes) {
+        g_hash_table_destroy(lanes);
+        g_hash_table_destroy(waiting_by_key);
+        lanes = NULL;
+        waiting_by_key = NULL;
+    }
+
+    // With a private HAL context nobody else will run the cancelled calls'
+    // callbacks, so let them free their state now. The external loop's
+    // context is not dispatched after deinit either.
+    if (hal_events_is_threaded()) {
+        while (g_main_context_iteration(hal_events_get_hal_context(), FALSE)) {
+        }
+    }
+    GMainContext* external = hal_loop_get_context();
+    if (external) {
+        while (g_main_context_iteration(external, FALSE)) {
+        }
+    }
+}
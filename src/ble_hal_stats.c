@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include "ble_hal_internal.h"
+
+/*
+ * Runtime statistics.
+ *
+ * Every counter is a 64-bit word updated with a relaxed atomic add, so a
+ * sample costs a few uncontended instructions and no lock; maxima and peaks
+ * use a compare-and-swap loop that only runs when the value grows.
+ * Latencies come from g_get_monotonic_time() taken by the caller.
+ */
+
+typedef struct {
+    guint64 count;
+    guint64 errors;
+    guint64 total_us;
+    guint64 max_us;
+    guint64 buckets[BLE_HAL_STATS_N_BUCKETS];
+} HalLatency;
+
+typedef struct {
+    gint64 current;
+    gint64 peak;
+} HalGauge;
+
+static HalLatency method_stats[BLE_HAL_STATS_N_METHODS];
+static HalLatency signal_stats[BLE_HAL_STATS_N_SIGNALS];
+static HalGauge gauges[HAL_STATS_N_GAUGES];
+static guint64 counters[HAL_STATS_N_COUNTERS];
+
+// Methods by name, in BleHalStatsMethod order (OTHER excluded).
+static const struct {
+    const gchar* interface;
+    const gchar* method;
+} method_names[] = {
+    { "org.freedesktop.DBus.ObjectManager", "GetManagedObjects" },
+    { "org.freedesktop.DBus.Properties",    "Set" },
+    { "org.bluez.Adapter1",                 "StartDiscovery" },
+    { "org.bluez.Adapter1",                 "StopDiscovery" },
+    { "org.bluez.Adapter1",                 "SetDiscoveryFilter" },
+    { "org.bluez.Device1",                  "Connect" },
+    { "org.bluez.Device1",                  "Disconnect" },
+    { "org.bluez.GattCharacteristic1",      "AcquireNotify" },
+    { "org.bluez.GattCharacteristic1",      "AcquireWrite" },
+    { "org.bluez.Adapter1",                 "RemoveDevice" },
+};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(method_names) == BLE_HAL_STATS_METHOD_OTHER);
+
+static inline void counter_add(guint64* counter, guint64 value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline guint64 counter_get(const guint64* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void counter_max(guint64* counter, guint64 value) {
+    guint64 seen = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(counter, &seen, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void latency_record(HalLatency* stats, gint64 elapsed_us, gboolean failed) {
+    guint64 us = elapsed_us > 0 ? (guint64)elapsed_us : 0;
+    guint bucket = us ? MIN(g_bit_storage(us), BLE_HAL_STATS_N_BUCKETS - 1) : 0;
+
+    counter_add(&stats->count, 1);
+    if (failed) counter_add(&stats->errors, 1);
+    counter_add(&stats->total_us, us);
+    counter_add(&stats->buckets[bucket], 1);
+    counter_max(&stats->max_us, us);
+}
+
+static void latency_copy(const HalLatency* stats, BleHalLatencyStats* out) {
+    out->count = counter_get(&stats->count);
+    out->errors = counter_get(&stats->errors);
+    out->total_us = counter_get(&stats->total_us);
+    out->max_us = counter_get(&stats->max_us);
+    for (guint i = 0; i < BLE_HAL_STATS_N_BUCKETS; i++) {
+        out->buckets[i] = counter_get(&stats->buckets[i]);
+    }
+}
+
+static void latency_reset(HalLatency* stats) {
+    guint64* words = (guint64*)stats;
+    for (gsize i = 0; i < sizeof(*stats) / sizeof(guint64); i++) {
+        __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+// --- Internal API ---
+
+BleHalStatsMethod hal_stats_method_lookup(const gchar* interface, const gchar* method) {
+    for (guint i = 0; i < G_N_ELEMENTS(method_names); i++) {
+        if (strcmp(method_names[i].method, method) == 0 && strcmp(method_names[i].interface, interface) == 0) {
+            return (BleHalStatsMethod)i;
+        }
+    }
+    return BLE_HAL_STATS_METHOD_OTHER;
+}
+
+void hal_stats_record_method(BleHalStatsMethod method, gint64 elapsed_us, gboolean failed) {
+    latency_record(&method_stats[method], elapsed_us, failed);
+}
+
+void hal_stats_record_signal(BleHalStatsSignal signal, gint64 started_us) {
+    latency_record(&signal_stats[signal], g_get_monotonic_time() - started_us, FALSE);
+}
+
+void hal_stats_gauge_add(HalStatsGauge gauge, gint delta) {
+    gint64 value = __atomic_add_fetch(&gauges[gauge].current, delta, __ATOMIC_RELAXED);
+    if (delta > 0) {
+        counter_max((guint64*)&gauges[gauge].peak, (guint64)value);
+    }
+}
+
+void hal_stats_counter_add(HalStatsCounter counter, guint64 value) {
+    counter_add(&counters[counter], value);
+}
+
+void hal_stats_reset_gauges(void) {
+    for (guint i = 0; i < HAL_STATS_N_GAUGES; i++) {
+        __atomic_store_n(&gauges[i].current, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&gauges[i].peak, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void hal_stats_snapshot(BleHalStats* out) {
+    BleHalQueueDepth* depths[HAL_STATS_N_GAUGES] = {
+        &out->commands, &out->events, &out->requests_waiting, &out->requests_in_flight
+    };
+
+    for (guint i = 0; i < BLE_HAL_STATS_N_METHODS; i++) {
+        latency_copy(&method_stats[i], &out->methods[i]);
+    }
+    for (guint i = 0; i < BLE_HAL_STATS_N_SIGNALS; i++) {
+        latency_copy(&signal_stats[i], &out->signals[i]);
+    }
+    for (guint i = 0; i < HAL_STATS_N_GAUGES; i++) {
+        gint64 current = __atomic_load_n(&gauges[i].current, __ATOMIC_RELAXED);
+        depths[i]->current = current > 0 ? (guint)current : 0;
+        depths[i]->peak = (guint)__atomic_load_n(&gauges[i].peak, __ATOMIC_RELAXED);
+    }
+    out->events_dropped = hal_events_get_dropped_count();
+    out->devices_evicted_count = counter_get(&counters[HAL_STATS_COUNTER_EVICTED_COUNT]);
+    out->devices_evicted_memory = counter_get(&counters[HAL_STATS_COUNTER_EVICTED_MEMORY]);
+    out->devices_expired = counter_get(&counters[HAL_STATS_COUNTER_EXPIRED]);
+    ble_hal_get_pool_stats(&out->pools);
+}
+
+// --- Public API ---
+
+void ble_hal_reset_stats(void) {
+    for (guint i = 0; i < BLE_HAL_STATS_N_METHODS; i++) {
+        latency_reset(&method_stats[i]);
+    }
+    for (guint i = 0; i < BLE_HAL_STATS_N_SIGNALS; i++) {
+        latency_reset(&signal_stats[i]);
+    }
+    for (guint i = 0; i < HAL_STATS_N_COUNTERS; i++) {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+    for (guint i = 0; i < HAL_STATS_N_GAUGES; i++) {
+        __atomic_store_n(&gauges[i].peak, __atomic_load_n(&gauges[i].current, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}